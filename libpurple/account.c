@@ -42,6 +42,18 @@ struct _PurpleAccount
 	GObject gparent;
 };
 
+/*
+ * A permit or deny list. Lookups go through a hash set of normalized names;
+ * the GSList handed out by purple_account_privacy_get_permitted() and
+ * purple_account_privacy_get_denied() is only built when asked for.
+ */
+typedef struct
+{
+	GHashTable *names;          /* Normalized name => the same string.    */
+	GSList *view;               /* Sorted list of the names.              */
+	gboolean view_valid;        /* Whether view matches names.            */
+} PurpleAccountPrivacyList;
+
 typedef struct
 {
 	char *username;             /* The username.                          */
@@ -69,16 +81,8 @@ typedef struct
 								/*   to NULL when the account inherits      */
 								/*   proxy settings from global prefs.      */
 
-	/*
-	 * TODO: Instead of linked lists for permit and deny, use a data
-	 * structure that allows fast lookups AND decent performance when
-	 * iterating through all items. Fast lookups should help performance
-	 * for protocols like MSN, where all your buddies exist in your permit
-	 * list therefore the permit list is large. Possibly GTree or
-	 * GHashTable.
-	 */
-	GSList *permit;             /* Permit list.                           */
-	GSList *deny;               /* Deny list.                             */
+	PurpleAccountPrivacyList permit;  /* Permit list.                     */
+	PurpleAccountPrivacyList deny;    /* Deny list.                       */
 	PurpleAccountPrivacyType privacy_type;  /* The permit/deny setting.   */
 
 	GList *status_types;        /* Status types.                          */
@@ -447,6 +451,110 @@ purple_account_get_password_got(PurpleAccount *account,
 	g_free(cbb);
 }
 
+/*
+ * Views that have been replaced are freed from an idle callback rather than
+ * straight away, so that code walking a view while adding or removing
+ * names (and so, through the UI ops, possibly asking for a new view) does
+ * not have the list freed from under it.
+ */
+static GSList *stale_privacy_views = NULL;
+static guint stale_privacy_views_source = 0;
+
+static gboolean
+stale_privacy_views_free_cb(gpointer data)
+{
+	g_slist_free_full(stale_privacy_views, (GDestroyNotify)g_slist_free);
+	stale_privacy_views = NULL;
+	stale_privacy_views_source = 0;
+
+	return FALSE;
+}
+
+static void
+privacy_list_retire_view(PurpleAccountPrivacyList *list)
+{
+	if (list->view == NULL)
+		return;
+
+	stale_privacy_views = g_slist_prepend(stale_privacy_views, list->view);
+	if (stale_privacy_views_source == 0)
+		stale_privacy_views_source =
+			g_idle_add(stale_privacy_views_free_cb, NULL);
+	list->view = NULL;
+}
+
+static void
+privacy_list_init(PurpleAccountPrivacyList *list)
+{
+	list->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	list->view = NULL;
+	list->view_valid = TRUE;
+}
+
+static void
+privacy_list_destroy(PurpleAccountPrivacyList *list)
+{
+	privacy_list_retire_view(list);
+	g_hash_table_destroy(list->names);
+	list->names = NULL;
+}
+
+static gboolean
+privacy_list_contains(PurpleAccountPrivacyList *list, const char *name)
+{
+	return g_hash_table_contains(list->names, name);
+}
+
+/* Takes ownership of name. Returns FALSE if it was already on the list. */
+static gboolean
+privacy_list_add(PurpleAccountPrivacyList *list, char *name)
+{
+	if (g_hash_table_contains(list->names, name)) {
+		g_free(name);
+		return FALSE;
+	}
+
+	g_hash_table_insert(list->names, name, name);
+	list->view_valid = FALSE;
+
+	return TRUE;
+}
+
+/* Returns the caller-owned stored name, or NULL if it was not on the list. */
+static char *
+privacy_list_steal(PurpleAccountPrivacyList *list, const char *name)
+{
+	gpointer stored;
+
+	if (!g_hash_table_lookup_extended(list->names, name, &stored, NULL))
+		return NULL;
+
+	g_hash_table_steal(list->names, stored);
+	list->view_valid = FALSE;
+
+	return stored;
+}
+
+static GSList *
+privacy_list_get_view(PurpleAccountPrivacyList *list)
+{
+	GHashTableIter iter;
+	gpointer name;
+
+	if (list->view_valid)
+		return list->view;
+
+	privacy_list_retire_view(list);
+
+	g_hash_table_iter_init(&iter, list->names);
+	while (g_hash_table_iter_next(&iter, &name, NULL))
+		list->view = g_slist_prepend(list->view, name);
+	list->view = g_slist_sort(list->view, (GCompareFunc)strcmp);
+	list->view_valid = TRUE;
+
+	return list->view;
+}
+
 /*
  * This makes sure your permit list contains all buddies from your
  * buddy list and ONLY buddies from your buddy list.
@@ -455,14 +563,16 @@ static void
 add_all_buddies_to_permit_list(PurpleAccount *account, gboolean local)
 {
 	GSList *list;
+	GList *names;
 	PurpleAccountPrivate *priv = purple_account_get_instance_private(account);
 
 	/* Remove anyone in the permit list who is not in the buddylist */
-	for (list = priv->permit; list != NULL; ) {
-		char *person = list->data;
-		list = list->next;
+	names = g_hash_table_get_keys(priv->permit.names);
+	while (names != NULL) {
+		char *person = names->data;
 		if (!purple_blist_find_buddy(account, person))
 			purple_account_privacy_permit_remove(account, person, local);
+		names = g_list_delete_link(names, names);
 	}
 
 	/* Now make sure everyone in the buddylist is in the permit list */
@@ -472,7 +582,8 @@ add_all_buddies_to_permit_list(PurpleAccount *account, gboolean local)
 		PurpleBuddy *buddy = list->data;
 		const gchar *name = purple_buddy_get_name(buddy);
 
-		if (!g_slist_find_custom(priv->permit, name, (GCompareFunc)g_utf8_collate))
+		if (!privacy_list_contains(&priv->permit,
+				purple_normalize(account, name)))
 			purple_account_privacy_permit_add(account, name, local);
 		list = g_slist_delete_link(list, list);
 	}
@@ -964,6 +1075,8 @@ purple_account_init(PurpleAccount *account)
 	priv->system_log = NULL;
 
 	priv->privacy_type = PURPLE_ACCOUNT_PRIVACY_ALLOW_ALL;
+	privacy_list_init(&priv->permit);
+	privacy_list_init(&priv->deny);
 }
 
 static void
@@ -1071,8 +1184,8 @@ purple_account_finalize(GObject *object)
 	g_hash_table_destroy(priv->settings);
 	g_hash_table_destroy(priv->ui_settings);
 
-	g_slist_free_full(priv->deny, g_free);
-	g_slist_free_full(priv->permit, g_free);
+	privacy_list_destroy(&priv->deny);
+	privacy_list_destroy(&priv->permit);
 
 	G_OBJECT_CLASS(purple_account_parent_class)->finalize(object);
 }
@@ -2294,13 +2407,9 @@ purple_account_privacy_permit_add(PurpleAccount *account, const char *who,
 	priv = purple_account_get_instance_private(account);
 	name = g_strdup(purple_normalize(account, who));
 
-	if (g_slist_find_custom(priv->permit, name, (GCompareFunc)g_strcmp0) != NULL) {
+	if (!privacy_list_add(&priv->permit, name))
 		/* This buddy already exists, so bail out */
-		g_free(name);
 		return FALSE;
-	}
-
-	priv->permit = g_slist_append(priv->permit, name);
 
 	if (!local_only && purple_account_is_connected(account))
 		purple_serv_add_permit(purple_account_get_connection(account), who);
@@ -2323,7 +2432,6 @@ gboolean
 purple_account_privacy_permit_remove(PurpleAccount *account, const char *who,
 						   gboolean local_only)
 {
-	GSList *l;
 	const char *name;
 	PurpleBuddy *buddy;
 	char *del;
@@ -2336,17 +2444,14 @@ purple_account_privacy_permit_remove(PurpleAccount *account, const char *who,
 	priv = purple_account_get_instance_private(account);
 	name = purple_normalize(account, who);
 
-	l = g_slist_find_custom(priv->permit, name, (GCompareFunc)g_strcmp0);
-	if (l == NULL)
+	/* We should not free the stored name just yet. There can be occasions
+	 * where it == who. In such cases, freeing it here can cause crashes
+	 * later when who is used. */
+	del = privacy_list_steal(&priv->permit, name);
+	if (del == NULL)
 		/* We didn't find the buddy we were looking for, so bail out */
 		return FALSE;
 
-	/* We should not free l->data just yet. There can be occasions where
-	 * l->data == who. In such cases, freeing l->data here can cause crashes
-	 * later when who is used. */
-	del = l->data;
-	priv->permit = g_slist_delete_link(priv->permit, l);
-
 	if (!local_only && purple_account_is_connected(account))
 		purple_serv_rem_permit(purple_account_get_connection(account), who);
 
@@ -2379,13 +2484,9 @@ purple_account_privacy_deny_add(PurpleAccount *account, const char *who,
 	priv = purple_account_get_instance_private(account);
 	name = g_strdup(purple_normalize(account, who));
 
-	if (g_slist_find_custom(priv->deny, name, (GCompareFunc)g_strcmp0) != NULL) {
+	if (!privacy_list_add(&priv->deny, name))
 		/* This buddy already exists, so bail out */
-		g_free(name);
 		return FALSE;
-	}
-
-	priv->deny = g_slist_append(priv->deny, name);
 
 	if (!local_only && purple_account_is_connected(account))
 		purple_serv_add_deny(purple_account_get_connection(account), who);
@@ -2407,7 +2508,6 @@ gboolean
 purple_account_privacy_deny_remove(PurpleAccount *account, const char *who,
 						 gboolean local_only)
 {
-	GSList *l;
 	const char *normalized;
 	char *name;
 	PurpleBuddy *buddy;
@@ -2420,15 +2520,12 @@ purple_account_privacy_deny_remove(PurpleAccount *account, const char *who,
 	priv = purple_account_get_instance_private(account);
 	normalized = purple_normalize(account, who);
 
-	l = g_slist_find_custom(priv->deny, normalized, (GCompareFunc)g_strcmp0);
-	if (l == NULL)
+	name = privacy_list_steal(&priv->deny, normalized);
+	if (name == NULL)
 		/* We didn't find the buddy we were looking for, so bail out */
 		return FALSE;
 
-	buddy = purple_blist_find_buddy(account, normalized);
-
-	name = l->data;
-	priv->deny = g_slist_delete_link(priv->deny, l);
+	buddy = purple_blist_find_buddy(account, name);
 
 	if (!local_only && purple_account_is_connected(account))
 		purple_serv_rem_deny(purple_account_get_connection(account), name);
@@ -2451,7 +2548,7 @@ purple_account_privacy_deny_remove(PurpleAccount *account, const char *who,
 void
 purple_account_privacy_allow(PurpleAccount *account, const char *who)
 {
-	GSList *list;
+	GList *list;
 	PurpleAccountPrivacyType type = purple_account_get_privacy_type(account);
 	PurpleAccountPrivate *priv = purple_account_get_instance_private(account);
 
@@ -2467,13 +2564,15 @@ purple_account_privacy_allow(PurpleAccount *account, const char *who)
 		case PURPLE_ACCOUNT_PRIVACY_DENY_ALL:
 			{
 				/* Empty the allow-list. */
-				const char *norm = purple_normalize(account, who);
-				for (list = priv->permit; list != NULL;) {
+				char *norm = g_strdup(purple_normalize(account, who));
+				list = g_hash_table_get_keys(priv->permit.names);
+				while (list != NULL) {
 					char *person = list->data;
-					list = list->next;
 					if (!purple_strequal(norm, person))
 						purple_account_privacy_permit_remove(account, person, FALSE);
+					list = g_list_delete_link(list, list);
 				}
+				g_free(norm);
 				purple_account_privacy_permit_add(account, who, FALSE);
 				purple_account_set_privacy_type(account, PURPLE_ACCOUNT_PRIVACY_ALLOW_USERS);
 			}
@@ -2497,7 +2596,7 @@ purple_account_privacy_allow(PurpleAccount *account, const char *who)
 void
 purple_account_privacy_deny(PurpleAccount *account, const char *who)
 {
-	GSList *list;
+	GList *list;
 	PurpleAccountPrivacyType type = purple_account_get_privacy_type(account);
 	PurpleAccountPrivate *priv = purple_account_get_instance_private(account);
 
@@ -2505,13 +2604,15 @@ purple_account_privacy_deny(PurpleAccount *account, const char *who)
 		case PURPLE_ACCOUNT_PRIVACY_ALLOW_ALL:
 			{
 				/* Empty the deny-list. */
-				const char *norm = purple_normalize(account, who);
-				for (list = priv->deny; list != NULL; ) {
+				char *norm = g_strdup(purple_normalize(account, who));
+				list = g_hash_table_get_keys(priv->deny.names);
+				while (list != NULL) {
 					char *person = list->data;
-					list = list->next;
 					if (!purple_strequal(norm, person))
 						purple_account_privacy_deny_remove(account, person, FALSE);
+					list = g_list_delete_link(list, list);
 				}
+				g_free(norm);
 				purple_account_privacy_deny_add(account, who, FALSE);
 				purple_account_set_privacy_type(account, PURPLE_ACCOUNT_PRIVACY_DENY_USERS);
 			}
@@ -2548,7 +2649,7 @@ purple_account_privacy_get_permitted(PurpleAccount *account)
 	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), NULL);
 
 	priv = purple_account_get_instance_private(account);
-	return priv->permit;
+	return privacy_list_get_view(&priv->permit);
 }
 
 GSList *
@@ -2559,7 +2660,7 @@ purple_account_privacy_get_denied(PurpleAccount *account)
 	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), NULL);
 
 	priv = purple_account_get_instance_private(account);
-	return priv->deny;
+	return privacy_list_get_view(&priv->deny);
 }
 
 gboolean
@@ -2576,11 +2677,11 @@ purple_account_privacy_check(PurpleAccount *account, const char *who)
 
 		case PURPLE_ACCOUNT_PRIVACY_ALLOW_USERS:
 			who = purple_normalize(account, who);
-			return (g_slist_find_custom(priv->permit, who, (GCompareFunc)g_strcmp0) != NULL);
+			return privacy_list_contains(&priv->permit, who);
 
 		case PURPLE_ACCOUNT_PRIVACY_DENY_USERS:
 			who = purple_normalize(account, who);
-			return (g_slist_find_custom(priv->deny, who, (GCompareFunc)g_strcmp0) == NULL);
+			return !privacy_list_contains(&priv->deny, who);
 
 		case PURPLE_ACCOUNT_PRIVACY_ALLOW_BUDDYLIST:
 			return (purple_blist_find_buddy(account, who) != NULL);
@@ -891,7 +891,9 @@ void purple_account_privacy_deny(PurpleAccount *account, const char *who);
  * purple_account_privacy_get_permitted:
  * @account:	The account.
  *
- * Returns the account's permit list.
+ * Returns the account's permit list, sorted by name. The list is a snapshot
+ * that is rebuilt after the permit list changes; do not keep it past the
+ * current main loop iteration.
  *
  * Returns: (transfer none) (element-type utf8): A list of the permitted users
  *
@@ -903,7 +905,9 @@ GSList *purple_account_privacy_get_permitted(PurpleAccount *account);
  * purple_account_privacy_get_denied:
  * @account:	The account.
  *
- * Returns the account's deny list.
+ * Returns the account's deny list, sorted by name. The list is a snapshot
+ * that is rebuilt after the deny list changes; do not keep it past the
+ * current main loop iteration.
  *
  * Returns: (transfer none) (element-type utf8): A list of the denied users
  *
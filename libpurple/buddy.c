@@ -412,8 +412,14 @@ purple_buddy_update_status(PurpleBuddy *buddy, PurpleStatus *old_status)
 		if (purple_counting_node_get_online_count(contact_counter) == 0)
 			purple_counting_node_change_online_count(group_counter, -1);
 	} else {
-		purple_signal_emit(purple_blist_get_handle(),
-		                 "buddy-status-changed", buddy, old_status,
+		static gulong status_changed_signal = 0;
+
+		if (G_UNLIKELY(status_changed_signal == 0)) {
+			status_changed_signal = purple_signal_get_id(
+				purple_blist_get_handle(), "buddy-status-changed");
+		}
+
+		purple_signal_emit_by_id(status_changed_signal, buddy, old_status,
 		                 status);
 	}
 
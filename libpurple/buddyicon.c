@@ -178,6 +178,30 @@ purple_buddy_icon_data_cache(PurpleImage *img)
 	g_free(path);
 }
 
+/*
+ * Lists the cache directory once, so checking that each icon named in the
+ * buddy list or accounts is still there doesn't stat every file.
+ */
+static GHashTable *
+icon_cache_dir_list(void)
+{
+	GHashTable *files;
+	const gchar *name;
+	GDir *dir;
+
+	files = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	dir = g_dir_open(purple_buddy_icons_get_cache_dir(), 0, NULL);
+	if (dir == NULL)
+		return files;
+
+	while ((name = g_dir_read_name(dir)) != NULL)
+		g_hash_table_add(files, g_strdup(name));
+
+	g_dir_close(dir);
+	return files;
+}
+
 static void
 purple_buddy_icon_data_uncache_file(const char *filename)
 {
@@ -617,24 +641,53 @@ read_icon_file(const char *path, guchar **data, size_t *len)
 	return TRUE;
 }
 
+static PurpleBuddyIcon *
+buddy_icon_find_loaded(PurpleAccount *account, const char *username)
+{
+	GHashTable *icon_cache = g_hash_table_lookup(account_cache, account);
+
+	return icon_cache ? g_hash_table_lookup(icon_cache, username) : NULL;
+}
+
+/* Takes ownership of data. */
+static PurpleBuddyIcon *
+buddy_icon_new_from_cache_file(PurpleAccount *account, PurpleBuddy *b,
+                               guchar *data, size_t len)
+{
+	PurpleBuddyIcon *icon;
+	const char *checksum;
+	gboolean caching;
+
+	caching = purple_buddy_icons_is_caching();
+	/* By disabling caching temporarily, we avoid a loop
+	 * and don't have to add special code through several
+	 * functions. */
+	purple_buddy_icons_set_caching(FALSE);
+
+	icon = purple_buddy_icon_create(account, purple_buddy_get_name(b));
+	icon->img = NULL;
+	checksum = purple_blist_node_get_string((PurpleBlistNode *)b,
+	                                        "icon_checksum");
+	purple_buddy_icon_set_data(icon, data, len, checksum);
+
+	purple_buddy_icons_set_caching(caching);
+
+	return icon;
+}
+
 PurpleBuddyIcon *
 purple_buddy_icons_find(PurpleAccount *account, const char *username)
 {
-	GHashTable *icon_cache;
 	PurpleBuddyIcon *icon = NULL;
 
 	g_return_val_if_fail(account  != NULL, NULL);
 	g_return_val_if_fail(username != NULL, NULL);
 
-	icon_cache = g_hash_table_lookup(account_cache, account);
-
-	if ((icon_cache == NULL) || ((icon = g_hash_table_lookup(icon_cache, username)) == NULL))
+	if ((icon = buddy_icon_find_loaded(account, username)) == NULL)
 	{
 		/* The icon is not currently cached in memory--try reading from disk */
 		PurpleBuddy *b = purple_blist_find_buddy(account, username);
 		const char *protocol_icon_file;
-		const char *dirname;
-		gboolean caching;
 		gchar *path;
 		guchar *data;
 		size_t len;
@@ -647,35 +700,146 @@ purple_buddy_icons_find(PurpleAccount *account, const char *username)
 		if (protocol_icon_file == NULL)
 			return NULL;
 
-		dirname = purple_buddy_icons_get_cache_dir();
-
-		caching = purple_buddy_icons_is_caching();
-		/* By disabling caching temporarily, we avoid a loop
-		 * and don't have to add special code through several
-		 * functions. */
-		purple_buddy_icons_set_caching(FALSE);
-
-		path = g_build_filename(dirname, protocol_icon_file, NULL);
+		path = g_build_filename(purple_buddy_icons_get_cache_dir(),
+		                        protocol_icon_file, NULL);
 		if (read_icon_file(path, &data, &len)) {
-			const char *checksum;
-
-			icon = purple_buddy_icon_create(account, username);
-			icon->img = NULL;
-			checksum = purple_blist_node_get_string((PurpleBlistNode *)b,
-			                                        "icon_checksum");
-			purple_buddy_icon_set_data(icon, data, len, checksum);
+			icon = buddy_icon_new_from_cache_file(account, b, data, len);
 		} else {
 			delete_buddy_icon_settings((PurpleBlistNode *)b, "buddy_icon");
 		}
 
 		g_free(path);
-
-		purple_buddy_icons_set_caching(caching);
 	}
 
 	return (icon ? purple_buddy_icon_ref(icon) : NULL);
 }
 
+typedef struct {
+	PurpleAccount *account;
+	gchar *username;
+	gchar *filename;
+} BuddyIconFindData;
+
+static void
+buddy_icon_find_data_free(BuddyIconFindData *find)
+{
+	g_object_unref(find->account);
+	g_free(find->username);
+	g_free(find->filename);
+	g_free(find);
+}
+
+static void
+buddy_icon_find_loaded_cb(GObject *source, GAsyncResult *res, gpointer data)
+{
+	GTask *task = data;
+	BuddyIconFindData *find = g_task_get_task_data(task);
+	PurpleBuddyIcon *icon;
+	PurpleBuddy *b;
+	GError *error = NULL;
+	gchar *contents;
+	gsize len;
+
+	if (!g_file_load_contents_finish(G_FILE(source), res, &contents, &len,
+	                                 NULL, &error)) {
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			purple_debug_error("buddyicon", "Error reading %s: %s\n",
+			                   find->filename, error->message);
+
+			b = purple_blist_find_buddy(find->account, find->username);
+			if (b != NULL && purple_strequal(find->filename,
+					purple_blist_node_get_string((PurpleBlistNode *)b,
+					                             "buddy_icon")))
+				delete_buddy_icon_settings((PurpleBlistNode *)b,
+				                           "buddy_icon");
+		}
+
+		g_task_return_error(task, error);
+		g_object_unref(task);
+		return;
+	}
+
+	/* Someone may have loaded or set it while this was reading. */
+	icon = buddy_icon_find_loaded(find->account, find->username);
+	b = purple_blist_find_buddy(find->account, find->username);
+
+	if (icon != NULL) {
+		g_free(contents);
+		purple_buddy_icon_ref(icon);
+	} else if (b != NULL && purple_strequal(find->filename,
+			purple_blist_node_get_string((PurpleBlistNode *)b, "buddy_icon"))) {
+		icon = buddy_icon_new_from_cache_file(find->account, b,
+		                                      (guchar *)contents, len);
+		purple_buddy_icon_ref(icon);
+	} else {
+		g_free(contents);
+	}
+
+	g_task_return_pointer(task, icon, (GDestroyNotify)purple_buddy_icon_unref);
+	g_object_unref(task);
+}
+
+void
+purple_buddy_icons_find_async(PurpleAccount *account, const char *username,
+                              GCancellable *cancellable,
+                              GAsyncReadyCallback callback, gpointer data)
+{
+	BuddyIconFindData *find;
+	PurpleBuddyIcon *icon;
+	PurpleBuddy *b;
+	const char *protocol_icon_file;
+	gchar *path;
+	GFile *file;
+	GTask *task;
+
+	g_return_if_fail(account  != NULL);
+	g_return_if_fail(username != NULL);
+
+	task = g_task_new(NULL, cancellable, callback, data);
+	g_task_set_source_tag(task, purple_buddy_icons_find_async);
+
+	if ((icon = buddy_icon_find_loaded(account, username)) != NULL) {
+		g_task_return_pointer(task, purple_buddy_icon_ref(icon),
+		                      (GDestroyNotify)purple_buddy_icon_unref);
+		g_object_unref(task);
+		return;
+	}
+
+	b = purple_blist_find_buddy(account, username);
+	protocol_icon_file = b ? purple_blist_node_get_string((PurpleBlistNode *)b,
+	                                                      "buddy_icon")
+	                       : NULL;
+
+	if (protocol_icon_file == NULL) {
+		g_task_return_pointer(task, NULL, NULL);
+		g_object_unref(task);
+		return;
+	}
+
+	find = g_new0(BuddyIconFindData, 1);
+	find->account = g_object_ref(account);
+	find->username = g_strdup(username);
+	find->filename = g_strdup(protocol_icon_file);
+	g_task_set_task_data(task, find,
+	                     (GDestroyNotify)buddy_icon_find_data_free);
+
+	path = g_build_filename(purple_buddy_icons_get_cache_dir(),
+	                        protocol_icon_file, NULL);
+	file = g_file_new_for_path(path);
+	g_file_load_contents_async(file, cancellable, buddy_icon_find_loaded_cb,
+	                           task);
+	g_object_unref(file);
+	g_free(path);
+}
+
+PurpleBuddyIcon *
+purple_buddy_icons_find_finish(GAsyncResult *result, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(result, NULL), NULL);
+
+	return g_task_propagate_pointer(G_TASK(result), error);
+}
+
 PurpleImage *
 purple_buddy_icons_find_account_icon(PurpleAccount *account)
 {
@@ -965,7 +1129,7 @@ delete_buddy_icon_settings(PurpleBlistNode *node, const char *setting_name)
 void
 _purple_buddy_icons_account_loaded_cb()
 {
-	const char *dirname = purple_buddy_icons_get_cache_dir();
+	GHashTable *files = icon_cache_dir_list();
 	GList *cur;
 
 	for (cur = purple_accounts_get_all(); cur != NULL; cur = cur->next)
@@ -975,23 +1139,23 @@ _purple_buddy_icons_account_loaded_cb()
 
 		if (account_icon_file != NULL)
 		{
-			char *path = g_build_filename(dirname, account_icon_file, NULL);
-			if (!g_file_test(path, G_FILE_TEST_EXISTS))
+			if (!g_hash_table_contains(files, account_icon_file))
 			{
 				purple_account_set_string(account, "buddy_icon", NULL);
 			} else {
 				ref_filename(account_icon_file);
 			}
-			g_free(path);
 		}
 	}
+
+	g_hash_table_destroy(files);
 }
 
 void
 _purple_buddy_icons_blist_loaded_cb()
 {
 	PurpleBlistNode *node = purple_blist_get_default_root();
-	const char *dirname = purple_buddy_icons_get_cache_dir();
+	GHashTable *files = icon_cache_dir_list();
 
 	while (node != NULL)
 	{
@@ -1002,8 +1166,7 @@ _purple_buddy_icons_blist_loaded_cb()
 			filename = purple_blist_node_get_string(node, "buddy_icon");
 			if (filename != NULL)
 			{
-				char *path = g_build_filename(dirname, filename, NULL);
-				if (!g_file_test(path, G_FILE_TEST_EXISTS))
+				if (!g_hash_table_contains(files, filename))
 				{
 					purple_blist_node_remove_setting(node,
 					                                 "buddy_icon");
@@ -1012,7 +1175,6 @@ _purple_buddy_icons_blist_loaded_cb()
 				}
 				else
 					ref_filename(filename);
-				g_free(path);
 			}
 		}
 		else if (PURPLE_IS_CONTACT(node) ||
@@ -1024,19 +1186,19 @@ _purple_buddy_icons_blist_loaded_cb()
 			filename = purple_blist_node_get_string(node, "custom_buddy_icon");
 			if (filename != NULL)
 			{
-				char *path = g_build_filename(dirname, filename, NULL);
-				if (!g_file_test(path, G_FILE_TEST_EXISTS))
+				if (!g_hash_table_contains(files, filename))
 				{
 					purple_blist_node_remove_setting(node,
 					                                 "custom_buddy_icon");
 				}
 				else
 					ref_filename(filename);
-				g_free(path);
 			}
 		}
 		node = purple_blist_node_next(node, TRUE);
 	}
+
+	g_hash_table_destroy(files);
 }
 
 void
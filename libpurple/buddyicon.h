@@ -44,6 +44,8 @@ typedef struct _PurpleBuddyIcon PurpleBuddyIcon;
 
 typedef struct _PurpleBuddyIconSpec PurpleBuddyIconSpec;
 
+#include <gio/gio.h>
+
 #include "account.h"
 #include "buddylist.h"
 #include "image.h"
@@ -284,6 +286,41 @@ purple_buddy_icons_get_checksum_for_user(PurpleBuddy *buddy);
 PurpleBuddyIcon *
 purple_buddy_icons_find(PurpleAccount *account, const char *username);
 
+/**
+ * purple_buddy_icons_find_async:
+ * @account:     The account the user is on.
+ * @username:    The username of the user.
+ * @cancellable: (nullable): A #GCancellable, or %NULL.
+ * @callback:    The callback to call when the icon has been found.
+ * @data:        User data to pass to @callback.
+ *
+ * Like purple_buddy_icons_find(), but reads an icon that isn't loaded yet
+ * from the cache without blocking the main loop.  Call
+ * purple_buddy_icons_find_finish() from @callback to get the result.
+ */
+void
+purple_buddy_icons_find_async(PurpleAccount *account, const char *username,
+                              GCancellable *cancellable,
+                              GAsyncReadyCallback callback, gpointer data);
+
+/**
+ * purple_buddy_icons_find_finish:
+ * @result: The #GAsyncResult passed to the callback.
+ * @error:  (nullable): Return location for a #GError, or %NULL.
+ *
+ * Finishes a purple_buddy_icons_find_async() call.
+ *
+ * %NULL is returned without setting @error if the user has no icon, or if
+ * the buddy's icon changed or the buddy was removed while the old one was
+ * being read.  In the latter case what was read is stale and dropped; call
+ * purple_buddy_icons_find_async() again to get the new icon.
+ *
+ * Returns: The icon (with a reference for the caller), or %NULL.  If the
+ *          icon couldn't be read, %NULL is returned and @error is set.
+ */
+PurpleBuddyIcon *
+purple_buddy_icons_find_finish(GAsyncResult *result, GError **error);
+
 /**
  * purple_buddy_icons_find_account_icon:
  * @account: The account
@@ -57,10 +57,68 @@ static GHashTable *buddies_cache = NULL;
  */
 static GHashTable *groups_cache = NULL;
 
+/*
+ * A hash table used for efficient lookups of chats by name.
+ * PurpleAccount* => struct _purple_hchats*.  The per-account index is built
+ * lazily by purple_blist_find_chat().
+ */
+static GHashTable *chats_cache = NULL;
+
 static guint          save_timer = 0;
 static gboolean       blist_loaded = FALSE;
 static gchar *localized_default_group_name = NULL;
 
+/*
+ * Changes to the buddy list are appended to blist.journal as records that
+ * replace a single buddy, chat, or the settings of a contact or group, that
+ * replace or remove a whole group when its members were added, removed or
+ * renamed, or that replace an account's privacy lists.
+ * Every so often the journal is compacted into a full blist.xml snapshot.
+ * Formatting and writing both happen on save_pool's single worker thread,
+ * which only does file I/O; finished jobs are handed back through save_done
+ * and their errors logged on the main thread.
+ *
+ * Each journal record is "<length>\n<record generation='N'>...</record>\n".
+ * Records are only replayed on top of a snapshot of the same generation, so
+ * a journal left over from before a compaction is ignored.  The worker
+ * stamps each record with the generation of the blist.xml it last wrote, so
+ * records queued behind a compaction that fails still match the old file.
+ */
+#define BLIST_JOURNAL_FILE        "blist.journal"
+#define BLIST_JOURNAL_MAX_RECORDS 1000
+
+typedef struct {
+	PurpleXmlNode *snapshot;  /* A full tree to write to blist.xml. */
+	GList *records;           /* Or journal records to append.      */
+	gchar *blist_path;
+	gchar *journal_path;
+
+	/* For a snapshot: its generation, how many journal records it
+	 * replaces, and the dirty sets it cleared, to put back on failure. */
+	guint generation;
+	guint journal_records;
+	GHashTable *dirty_groups;
+	GHashTable *dirty_accounts;
+
+	gboolean written;         /* Set by the worker. */
+	GError *error;            /* Set by the worker. */
+} PurpleBlistSaveJob;
+
+static GThreadPool   *save_pool = NULL;
+static GAsyncQueue   *save_done = NULL;
+static GHashTable    *dirty_groups = NULL;    /* group name => NULL */
+static GHashTable    *dirty_nodes = NULL;     /* PurpleBlistNode* => NULL */
+static GHashTable    *dirty_accounts = NULL;  /* PurpleAccount* => NULL */
+static gboolean       needs_compaction = FALSE;
+static gboolean       compaction_pending = FALSE;
+static guint          journal_records = 0;
+static guint          journal_generation = 0;
+static guint          save_generation = 0;    /* Worker thread only. */
+
+static void purple_blist_journal_flush(void);
+static void purple_blist_real_schedule_save(void);
+static gboolean purple_blist_save_done_cb(gpointer data);
+
 /*********************************************************************
  * Private utility functions                                         *
  *********************************************************************/
@@ -103,7 +161,9 @@ struct _list_account_buddies {
 };
 
 struct _purple_hbuddy {
-	char *name;
+	/* From purple_normalize_intern() in stored keys, or purple_normalize()
+	 * in keys that are only used for a lookup. */
+	const char *name;
 	PurpleAccount *account;
 	PurpleBlistNode *group;
 };
@@ -124,7 +184,6 @@ static guint _purple_blist_hbuddy_equal(struct _purple_hbuddy *hb1, struct _purp
 
 static void _purple_blist_hbuddy_free_key(struct _purple_hbuddy *hb)
 {
-	g_free(hb->name);
 	g_free(hb);
 }
 
@@ -141,6 +200,120 @@ static void
 purple_blist_buddies_cache_remove_account(const PurpleAccount *account)
 {
 	g_hash_table_remove(buddies_cache, account);
+	g_hash_table_remove(chats_cache, account);
+}
+
+struct _purple_hchats {
+	/* The component holding the chat name, from the protocol's chat_info. */
+	char *identifier;
+	/* Normalized chat name (interned, as these are long-lived) => PurpleChat* */
+	GHashTable *chats;
+	/* Whether two chats on this account share a name. */
+	gboolean duplicates;
+};
+
+static void _purple_blist_hchats_free(struct _purple_hchats *hc)
+{
+	g_free(hc->identifier);
+	g_hash_table_destroy(hc->chats);
+	g_free(hc);
+}
+
+/* Returns the interned normalized name a chat is indexed under, or NULL if it
+ * doesn't have one. */
+static const char *
+purple_blist_chats_cache_key(struct _purple_hchats *hc, PurpleChat *chat)
+{
+	const char *name;
+
+	name = g_hash_table_lookup(purple_chat_get_components(chat),
+	                           hc->identifier);
+	if (name == NULL)
+		return NULL;
+
+	return purple_normalize_intern(purple_chat_get_account(chat), name);
+}
+
+static void
+purple_blist_chats_cache_insert(struct _purple_hchats *hc, PurpleChat *chat)
+{
+	const char *key = purple_blist_chats_cache_key(hc, chat);
+
+	if (key == NULL)
+		return;
+
+	/* Keep the first chat in list order, like the old linear search did. */
+	if (g_hash_table_contains(hc->chats, key))
+		hc->duplicates = TRUE;
+	else
+		g_hash_table_insert(hc->chats, (gpointer)key, chat);
+}
+
+static struct _purple_hchats *
+purple_blist_chats_cache_build(PurpleAccount *account, PurpleProtocol *protocol)
+{
+	struct _purple_hchats *hc;
+	PurpleProtocolChatEntry *pce;
+	PurpleBlistNode *gnode, *node;
+	GList *parts;
+
+	parts = purple_protocol_chat_iface_info(protocol,
+			purple_account_get_connection(account));
+	if (parts == NULL)
+		return NULL;
+
+	hc = g_new0(struct _purple_hchats, 1);
+	pce = parts->data;
+	hc->identifier = g_strdup(pce->identifier);
+	hc->chats = g_hash_table_new(g_str_hash, g_str_equal);
+	g_list_free_full(parts, g_free);
+
+	for (gnode = purple_blist_get_default_root(); gnode != NULL;
+	     gnode = gnode->next) {
+		for (node = gnode->child; node != NULL; node = node->next) {
+			if (PURPLE_IS_CHAT(node) &&
+			    purple_chat_get_account(PURPLE_CHAT(node)) == account)
+				purple_blist_chats_cache_insert(hc, PURPLE_CHAT(node));
+		}
+	}
+
+	g_hash_table_insert(chats_cache, account, hc);
+
+	return hc;
+}
+
+static gboolean
+purple_blist_chats_cache_is_chat(gpointer key, gpointer value, gpointer chat)
+{
+	return value == chat;
+}
+
+static void
+purple_blist_chats_cache_remove(PurpleChat *chat)
+{
+	PurpleAccount *account = purple_chat_get_account(chat);
+	struct _purple_hchats *hc;
+	const char *key;
+
+	hc = g_hash_table_lookup(chats_cache, account);
+	if (hc == NULL)
+		return;
+
+	if (hc->duplicates) {
+		/* Another chat may have to take this one's place; rebuild the
+		 * index the next time it is needed. */
+		g_hash_table_remove(chats_cache, account);
+		return;
+	}
+
+	key = purple_blist_chats_cache_key(hc, chat);
+	if (key != NULL && g_hash_table_lookup(hc->chats, key) == chat) {
+		g_hash_table_remove(hc->chats, key);
+	} else {
+		/* The components were changed behind our back. */
+		g_hash_table_foreach_remove(hc->chats,
+				purple_blist_chats_cache_is_chat, chat);
+	}
 }
 
 /*********************************************************************
@@ -225,8 +398,9 @@ buddy_to_xmlnode(PurpleBuddy *buddy)
 	return node;
 }
 
+/* Without @buddies, only the contact's own alias and settings are written. */
 static PurpleXmlNode *
-contact_to_xmlnode(PurpleContact *contact)
+contact_to_xmlnode(PurpleContact *contact, gboolean buddies)
 {
 	PurpleXmlNode *node, *child;
 	PurpleBlistNode *bnode;
@@ -241,7 +415,8 @@ contact_to_xmlnode(PurpleContact *contact)
 	}
 
 	/* Write buddies */
-	for (bnode = PURPLE_BLIST_NODE(contact)->child; bnode != NULL; bnode = bnode->next)
+	for (bnode = buddies ? PURPLE_BLIST_NODE(contact)->child : NULL;
+	     bnode != NULL; bnode = bnode->next)
 	{
 		if (purple_blist_node_is_transient(bnode))
 			continue;
@@ -291,8 +466,9 @@ chat_to_xmlnode(PurpleChat *chat)
 	return node;
 }
 
+/* Without @children, only the group's name and settings are written. */
 static PurpleXmlNode *
-group_to_xmlnode(PurpleGroup *group)
+group_to_xmlnode(PurpleGroup *group, gboolean children)
 {
 	PurpleXmlNode *node, *child;
 	PurpleBlistNode *cnode;
@@ -306,13 +482,14 @@ group_to_xmlnode(PurpleGroup *group)
 			value_to_xmlnode, node);
 
 	/* Write contacts and chats */
-	for (cnode = PURPLE_BLIST_NODE(group)->child; cnode != NULL; cnode = cnode->next)
+	for (cnode = children ? PURPLE_BLIST_NODE(group)->child : NULL;
+	     cnode != NULL; cnode = cnode->next)
 	{
 		if (purple_blist_node_is_transient(cnode))
 			continue;
 		if (PURPLE_IS_CONTACT(cnode))
 		{
-			child = contact_to_xmlnode(PURPLE_CONTACT(cnode));
+			child = contact_to_xmlnode(PURPLE_CONTACT(cnode), TRUE);
 			purple_xmlnode_insert_child(node, child);
 		}
 		else if (PURPLE_IS_CHAT(cnode))
@@ -381,7 +558,7 @@ blist_to_xmlnode(void)
 			continue;
 		if (PURPLE_IS_GROUP(gnode))
 		{
-			grandchild = group_to_xmlnode(PURPLE_GROUP(gnode));
+			grandchild = group_to_xmlnode(PURPLE_GROUP(gnode), TRUE);
 			purple_xmlnode_insert_child(child, grandchild);
 		}
 	}
@@ -398,11 +575,382 @@ blist_to_xmlnode(void)
 }
 
 static void
-purple_blist_sync(void)
+purple_blist_save_job_free(PurpleBlistSaveJob *job)
+{
+	if (job->snapshot != NULL)
+		purple_xmlnode_free(job->snapshot);
+	g_list_free_full(job->records, (GDestroyNotify)purple_xmlnode_free);
+	g_free(job->blist_path);
+	g_free(job->journal_path);
+	if (job->dirty_groups != NULL)
+		g_hash_table_destroy(job->dirty_groups);
+	if (job->dirty_accounts != NULL)
+		g_hash_table_destroy(job->dirty_accounts);
+	g_clear_error(&job->error);
+	g_free(job);
+}
+
+static void
+purple_blist_save_job_set_error(PurpleBlistSaveJob *job, const char *path,
+		int errsv)
+{
+	if (job->error != NULL)
+		return;
+
+	g_set_error(&job->error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+			"%s: %s", path, g_strerror(errsv));
+}
+
+/* Runs on the worker thread, so this must not log or touch the buddy list. */
+static void
+purple_blist_save_job_run(gpointer data, gpointer user_data)
+{
+	PurpleBlistSaveJob *job = data;
+
+	if (job->snapshot != NULL) {
+		char *str = purple_xmlnode_to_formatted_str(job->snapshot, NULL);
+
+		/* Only drop the journal once the snapshot is safely on disk. */
+		if (_purple_util_write_file(job->blist_path, str, -1, &job->error)) {
+			job->written = TRUE;
+			save_generation = job->generation;
+
+			if (g_unlink(job->journal_path) != 0 && errno != ENOENT)
+				purple_blist_save_job_set_error(job, job->journal_path, errno);
+		}
+
+		g_free(str);
+	}
+
+	if (job->records != NULL) {
+		FILE *fp = g_fopen(job->journal_path, "ab");
+		char buf[16];
+		GList *l;
+
+		if (fp == NULL)
+			purple_blist_save_job_set_error(job, job->journal_path, errno);
+
+		g_snprintf(buf, sizeof(buf), "%u", save_generation);
+
+		for (l = job->records; fp != NULL && l != NULL; l = l->next) {
+			int len;
+			char *str;
+
+			purple_xmlnode_set_attrib(l->data, "generation", buf);
+			str = purple_xmlnode_to_str(l->data, &len);
+			fprintf(fp, "%d\n", len);
+			fwrite(str, 1, len, fp);
+			fputc('\n', fp);
+			g_free(str);
+		}
+
+		if (fp != NULL && fclose(fp) != 0)
+			purple_blist_save_job_set_error(job, job->journal_path, errno);
+	}
+
+	g_async_queue_push(save_done, job);
+	g_idle_add(purple_blist_save_done_cb, save_done);
+}
+
+static void
+purple_blist_save_job_push(PurpleBlistSaveJob *job)
+{
+	if (save_pool == NULL) {
+		/* A single thread, so jobs are written in the order queued. */
+		save_pool = g_thread_pool_new(purple_blist_save_job_run, NULL,
+				1, FALSE, NULL);
+	}
+	if (save_done == NULL)
+		save_done = g_async_queue_new();
+
+	job->blist_path = g_build_filename(purple_config_dir(), "blist.xml", NULL);
+	job->journal_path = g_build_filename(purple_config_dir(),
+			BLIST_JOURNAL_FILE, NULL);
+
+	g_thread_pool_push(save_pool, job, NULL);
+}
+
+static void
+purple_blist_dirty_merge(GHashTable *into, GHashTable *from)
+{
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, from);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		g_hash_table_iter_steal(&iter);
+		g_hash_table_add(into, key);
+	}
+}
+
+/* Handles a job the worker has finished.  @retry is FALSE while shutting
+ * down, when no more saves may be scheduled. */
+static void
+purple_blist_save_job_done(PurpleBlistSaveJob *job, gboolean retry)
+{
+	if (job->error != NULL) {
+		purple_debug_error("buddylist", "Error saving the buddy list: %s\n",
+				job->error->message);
+	}
+
+	if (job->snapshot == NULL) {
+		purple_blist_save_job_free(job);
+		return;
+	}
+
+	compaction_pending = FALSE;
+
+	if (job->written) {
+		journal_generation = job->generation;
+		journal_records -= MIN(journal_records, job->journal_records);
+	} else {
+		/* blist.xml still has the old generation.  Journal what the
+		 * snapshot would have saved so it isn't lost, and try to compact
+		 * again later. */
+		purple_blist_dirty_merge(dirty_groups, job->dirty_groups);
+		purple_blist_dirty_merge(dirty_accounts, job->dirty_accounts);
+		needs_compaction = TRUE;
+		purple_blist_journal_flush();
+		if (retry)
+			purple_blist_real_schedule_save();
+	}
+
+	purple_blist_save_job_free(job);
+}
+
+static gboolean
+purple_blist_save_done_cb(gpointer data)
+{
+	PurpleBlistSaveJob *job;
+
+	while ((job = g_async_queue_try_pop(data)) != NULL)
+		purple_blist_save_job_done(job, TRUE);
+
+	return FALSE;
+}
+
+static gint
+purple_blist_group_position(PurpleGroup *group)
+{
+	PurpleBlistNode *gnode;
+	gint position = 0;
+
+	for (gnode = purple_blist_get_default_root(); gnode != NULL;
+	     gnode = gnode->next) {
+		if (gnode == PURPLE_BLIST_NODE(group))
+			return position;
+		if (PURPLE_IS_GROUP(gnode) && !purple_blist_node_is_transient(gnode))
+			position++;
+	}
+
+	return position;
+}
+
+static gint
+journal_record_compare(gconstpointer a, gconstpointer b)
+{
+	const char *pa = purple_xmlnode_get_attrib(a, "position");
+	const char *pb = purple_xmlnode_get_attrib(b, "position");
+
+	/* Removals first, then groups in list order. */
+	return (pa ? atoi(pa) + 1 : 0) - (pb ? atoi(pb) + 1 : 0);
+}
+
+/* The worker thread fills in the record's generation. */
+static PurpleXmlNode *
+journal_record_new(void)
+{
+	return purple_xmlnode_new("record");
+}
+
+/* Returns the group @node is saved under, or NULL if it isn't saved. */
+static PurpleGroup *
+purple_blist_journal_node_group(PurpleBlistNode *node)
+{
+	for (; node != NULL; node = node->parent) {
+		if (purple_blist_node_is_transient(node))
+			return NULL;
+		if (PURPLE_IS_GROUP(node))
+			return PURPLE_GROUP(node);
+	}
+
+	return NULL;
+}
+
+/* Builds a record that replaces just @node, or returns NULL if it can't be
+ * found again on replay. */
+static PurpleXmlNode *
+journal_node_record_new(PurpleBlistNode *node, PurpleGroup *group)
+{
+	PurpleXmlNode *record = journal_record_new(), *child;
+
+	if (group != purple_blist_get_default_group())
+		purple_xmlnode_set_attrib(record, "group", purple_group_get_name(group));
+
+	if (PURPLE_IS_BUDDY(node)) {
+		purple_xmlnode_set_attrib(record, "node", "buddy");
+		child = buddy_to_xmlnode(PURPLE_BUDDY(node));
+	} else if (PURPLE_IS_CHAT(node)) {
+		purple_xmlnode_set_attrib(record, "node", "chat");
+		child = chat_to_xmlnode(PURPLE_CHAT(node));
+	} else if (PURPLE_IS_CONTACT(node)) {
+		PurpleBlistNode *bnode = node->child;
+		PurpleBuddy *buddy;
+		PurpleAccount *account;
+
+		/* A contact is found again through one of its buddies. */
+		while (bnode != NULL && purple_blist_node_is_transient(bnode))
+			bnode = bnode->next;
+		if (bnode == NULL) {
+			purple_xmlnode_free(record);
+			return NULL;
+		}
+
+		buddy = PURPLE_BUDDY(bnode);
+		account = purple_buddy_get_account(buddy);
+		purple_xmlnode_set_attrib(record, "node", "contact");
+		purple_xmlnode_set_attrib(record, "account",
+				purple_account_get_username(account));
+		purple_xmlnode_set_attrib(record, "proto",
+				purple_account_get_protocol_id(account));
+		purple_xmlnode_set_attrib(record, "name", purple_buddy_get_name(buddy));
+		child = contact_to_xmlnode(PURPLE_CONTACT(node), FALSE);
+	} else {
+		purple_xmlnode_set_attrib(record, "node", "group");
+		child = group_to_xmlnode(group, FALSE);
+	}
+
+	purple_xmlnode_insert_child(record, child);
+
+	return record;
+}
+
+static void
+purple_blist_journal_flush(void)
 {
-	PurpleXmlNode *node;
-	char *data;
+	PurpleBlistSaveJob *job;
+	GList *records = NULL, *nodes = NULL, *privacy = NULL;
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, dirty_nodes);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		PurpleGroup *group = purple_blist_journal_node_group(key);
+		PurpleXmlNode *record;
+
+		/* A record for the whole group covers its members. */
+		if (group == NULL || g_hash_table_contains(dirty_groups,
+				purple_group_get_name(group)))
+			continue;
+
+		record = journal_node_record_new(key, group);
+		if (record == NULL) {
+			g_hash_table_add(dirty_groups,
+					g_strdup(purple_group_get_name(group)));
+			continue;
+		}
+
+		nodes = g_list_prepend(nodes, record);
+	}
+	g_hash_table_remove_all(dirty_nodes);
+
+	g_hash_table_iter_init(&iter, dirty_groups);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		PurpleGroup *group = purple_blist_find_group(key);
+		PurpleXmlNode *record = journal_record_new();
+
+		if (group != NULL &&
+				!purple_blist_node_is_transient(PURPLE_BLIST_NODE(group)))
+		{
+			char buf[16];
+
+			g_snprintf(buf, sizeof(buf), "%d",
+					purple_blist_group_position(group));
+			purple_xmlnode_set_attrib(record, "position", buf);
+			purple_xmlnode_insert_child(record, group_to_xmlnode(group, TRUE));
+		} else {
+			PurpleXmlNode *child;
+
+			child = purple_xmlnode_new_child(record, "remove-group");
+			purple_xmlnode_set_attrib(child, "name", key);
+		}
+
+		records = g_list_prepend(records, record);
+	}
+	g_hash_table_remove_all(dirty_groups);
+
+	g_hash_table_iter_init(&iter, dirty_accounts);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		PurpleXmlNode *record;
+
+		/* The account may have been deleted since it was marked. */
+		if (g_list_find(purple_accounts_get_all(), key) == NULL)
+			continue;
 
+		record = journal_record_new();
+		purple_xmlnode_insert_child(record, accountprivacy_to_xmlnode(key));
+		privacy = g_list_prepend(privacy, record);
+	}
+	g_hash_table_remove_all(dirty_accounts);
+
+	records = g_list_concat(g_list_sort(records, journal_record_compare),
+			g_list_concat(nodes, privacy));
+	if (records == NULL)
+		return;
+
+	journal_records += g_list_length(records);
+
+	job = g_new0(PurpleBlistSaveJob, 1);
+	job->records = records;
+	purple_blist_save_job_push(job);
+}
+
+static void
+purple_blist_compact(void)
+{
+	PurpleBlistSaveJob *job;
+	GHashTableIter iter;
+	gpointer key;
+	char buf[16];
+
+	job = g_new0(PurpleBlistSaveJob, 1);
+	job->snapshot = blist_to_xmlnode();
+
+	/* The generation is only bumped once the worker reports that the
+	 * snapshot is on disk; see purple_blist_save_job_done(). */
+	job->generation = journal_generation + 1;
+	g_snprintf(buf, sizeof(buf), "%u", job->generation);
+	purple_xmlnode_set_attrib(job->snapshot, "generation", buf);
+
+	/* The snapshot covers everything marked so far.  Hand the dirty sets
+	 * to the job, so they can be journaled instead if it fails; changed
+	 * nodes are handed over as their groups, as they may be gone by then. */
+	g_hash_table_iter_init(&iter, dirty_nodes);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		PurpleGroup *group = purple_blist_journal_node_group(key);
+
+		if (group != NULL) {
+			g_hash_table_add(dirty_groups,
+					g_strdup(purple_group_get_name(group)));
+		}
+	}
+	g_hash_table_remove_all(dirty_nodes);
+
+	job->journal_records = journal_records;
+	job->dirty_groups = dirty_groups;
+	job->dirty_accounts = dirty_accounts;
+	dirty_groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	dirty_accounts = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	needs_compaction = FALSE;
+	compaction_pending = TRUE;
+
+	purple_blist_save_job_push(job);
+}
+
+static void
+purple_blist_sync(void)
+{
 	if (!blist_loaded)
 	{
 		purple_debug_error("buddylist", "Attempted to save buddy list before it "
@@ -410,11 +958,53 @@ purple_blist_sync(void)
 		return;
 	}
 
-	node = blist_to_xmlnode();
-	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_config_file("blist.xml", data, -1);
-	g_free(data);
-	purple_xmlnode_free(node);
+	if (!compaction_pending &&
+			(needs_compaction || journal_records >= BLIST_JOURNAL_MAX_RECORDS))
+		purple_blist_compact();
+	else
+		purple_blist_journal_flush();
+}
+
+static void
+purple_blist_journal_mark_group(const char *name)
+{
+	if (dirty_groups == NULL || name == NULL)
+		return;
+
+	g_hash_table_add(dirty_groups, g_strdup(name));
+}
+
+/* For members of the group containing @node being added, removed, moved or
+ * renamed, which rewrites the whole group. */
+static void
+purple_blist_journal_mark_structure(PurpleBlistNode *node)
+{
+	/* Nodes that aren't in a group yet are saved once they are added. */
+	while (node != NULL && !PURPLE_IS_GROUP(node))
+		node = node->parent;
+
+	if (node != NULL)
+		purple_blist_journal_mark_group(purple_group_get_name(PURPLE_GROUP(node)));
+}
+
+/* For a change to @node itself, which only rewrites that node. */
+static void
+purple_blist_journal_mark_node(PurpleBlistNode *node)
+{
+	/* Nodes that aren't in a group yet are saved once they are added. */
+	if (dirty_nodes != NULL && purple_blist_journal_node_group(node) != NULL)
+		g_hash_table_add(dirty_nodes, node);
+}
+
+static void
+purple_blist_journal_forget_node(PurpleBlistNode *node)
+{
+	PurpleBlistNode *child;
+
+	g_hash_table_remove(dirty_nodes, node);
+
+	for (child = node->child; child != NULL; child = child->next)
+		purple_blist_journal_forget_node(child);
 }
 
 static gboolean
@@ -435,20 +1025,33 @@ purple_blist_real_schedule_save(void)
 static void
 purple_blist_real_save_account(PurpleBuddyList *list, PurpleAccount *account)
 {
-#if 1
-	purple_blist_real_schedule_save();
-#else
-	if (account != NULL) {
-		/* Save the buddies and privacy data for this account */
-	} else {
-		/* Save all buddies and privacy data */
+	if (dirty_accounts != NULL) {
+		if (account != NULL) {
+			g_hash_table_add(dirty_accounts, account);
+		} else {
+			GList *cur;
+
+			for (cur = purple_accounts_get_all(); cur != NULL; cur = cur->next)
+				g_hash_table_add(dirty_accounts, cur->data);
+		}
 	}
-#endif
+
+	purple_blist_real_schedule_save();
 }
 
 static void
 purple_blist_real_save_node(PurpleBuddyList *list, PurpleBlistNode *node)
 {
+	purple_blist_journal_mark_node(node);
+	purple_blist_real_schedule_save();
+}
+
+static void
+purple_blist_real_remove_node(PurpleBuddyList *list, PurpleBlistNode *node)
+{
+	purple_blist_journal_mark_structure(node);
+	if (dirty_nodes != NULL)
+		purple_blist_journal_forget_node(node);
 	purple_blist_real_schedule_save();
 }
 
@@ -629,17 +1232,382 @@ parse_group(PurpleXmlNode *groupnode)
 	}
 }
 
+static void
+journal_xmlnode_unlink(PurpleXmlNode *node)
+{
+	PurpleXmlNode *parent = node->parent, *prev = NULL, *cur;
+
+	for (cur = parent->child; cur != NULL && cur != node; cur = cur->next)
+		prev = cur;
+
+	g_return_if_fail(cur != NULL);
+
+	if (prev != NULL)
+		prev->next = node->next;
+	else
+		parent->child = node->next;
+
+	if (parent->lastchild == node)
+		parent->lastchild = prev;
+
+	node->parent = NULL;
+	node->next = NULL;
+}
+
+static PurpleXmlNode *
+journal_find_group(PurpleXmlNode *blist, const char *name)
+{
+	PurpleXmlNode *groupnode;
+
+	for (groupnode = purple_xmlnode_get_child(blist, "group"); groupnode != NULL;
+			groupnode = purple_xmlnode_get_next_twin(groupnode)) {
+		const char *gname = purple_xmlnode_get_attrib(groupnode, "name");
+
+		if (name == NULL || gname == NULL) {
+			if (name == gname)
+				return groupnode;
+		} else if (purple_utf8_strcasecmp(gname, name) == 0) {
+			return groupnode;
+		}
+	}
+
+	return NULL;
+}
+
+/* Puts @change in @old's place and frees @old.  With @keep_members, @old's
+ * buddies, contacts and chats are moved over to @change first. */
+static void
+journal_xmlnode_replace(PurpleXmlNode *old, PurpleXmlNode *change,
+		gboolean keep_members)
+{
+	PurpleXmlNode *parent = old->parent, *prev = NULL, *cur, *next;
+
+	for (cur = keep_members ? old->child : NULL; cur != NULL; cur = next) {
+		next = cur->next;
+		cur->next = NULL;
+
+		if (cur->type == PURPLE_XMLNODE_TYPE_TAG &&
+				(purple_strequal(cur->name, "buddy") ||
+				 purple_strequal(cur->name, "contact") ||
+				 purple_strequal(cur->name, "person") ||
+				 purple_strequal(cur->name, "chat")))
+		{
+			purple_xmlnode_insert_child(change, cur);
+		} else {
+			cur->parent = NULL;
+			purple_xmlnode_free(cur);
+		}
+	}
+	if (keep_members)
+		old->child = old->lastchild = NULL;
+
+	for (cur = parent->child; cur != NULL && cur != old; cur = cur->next)
+		prev = cur;
+
+	g_return_if_fail(cur != NULL);
+
+	if (prev != NULL)
+		prev->next = change;
+	else
+		parent->child = change;
+	if (parent->lastchild == old)
+		parent->lastchild = change;
+	change->parent = parent;
+	change->next = old->next;
+
+	old->parent = NULL;
+	old->next = NULL;
+	purple_xmlnode_free(old);
+}
+
+static PurpleXmlNode *
+journal_find_buddy(PurpleXmlNode *groupnode, const char *account,
+		const char *proto, const char *name)
+{
+	PurpleXmlNode *cnode, *bnode;
+
+	for (cnode = groupnode->child; cnode != NULL; cnode = cnode->next) {
+		if (cnode->type != PURPLE_XMLNODE_TYPE_TAG ||
+				!(purple_strequal(cnode->name, "contact") ||
+				  purple_strequal(cnode->name, "person")))
+			continue;
+
+		for (bnode = purple_xmlnode_get_child(cnode, "buddy"); bnode != NULL;
+				bnode = purple_xmlnode_get_next_twin(bnode)) {
+			PurpleXmlNode *namenode = purple_xmlnode_get_child(bnode, "name");
+			char *data;
+			gboolean match;
+
+			if (namenode == NULL ||
+					!purple_strequal(purple_xmlnode_get_attrib(bnode, "account"), account) ||
+					!purple_strequal(purple_xmlnode_get_attrib(bnode, "proto"), proto))
+				continue;
+
+			data = purple_xmlnode_get_data(namenode);
+			match = purple_strequal(data, name);
+			g_free(data);
+
+			if (match)
+				return bnode;
+		}
+	}
+
+	return NULL;
+}
+
+/* Whether two chats are on the same account and have the same components. */
+static gboolean
+journal_chat_matches(PurpleXmlNode *a, PurpleXmlNode *b)
+{
+	GHashTable *components;
+	PurpleXmlNode *x;
+	gboolean match = TRUE;
+
+	if (!purple_strequal(purple_xmlnode_get_attrib(a, "account"),
+	                     purple_xmlnode_get_attrib(b, "account")) ||
+			!purple_strequal(purple_xmlnode_get_attrib(a, "proto"),
+			                 purple_xmlnode_get_attrib(b, "proto")))
+		return FALSE;
+
+	components = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+
+	for (x = purple_xmlnode_get_child(a, "component"); x != NULL;
+			x = purple_xmlnode_get_next_twin(x)) {
+		const char *name = purple_xmlnode_get_attrib(x, "name");
+
+		if (name != NULL) {
+			g_hash_table_insert(components, (gpointer)name,
+					purple_xmlnode_get_data(x));
+		}
+	}
+
+	for (x = purple_xmlnode_get_child(b, "component"); x != NULL && match;
+			x = purple_xmlnode_get_next_twin(x)) {
+		const char *name = purple_xmlnode_get_attrib(x, "name");
+		char *data;
+
+		if (name == NULL)
+			continue;
+
+		data = purple_xmlnode_get_data(x);
+		match = purple_strequal(g_hash_table_lookup(components, name), data);
+		g_hash_table_remove(components, name);
+		g_free(data);
+	}
+
+	match = match && g_hash_table_size(components) == 0;
+	g_hash_table_destroy(components);
+
+	return match;
+}
+
+/* Replays a record that replaces a single buddy, contact, chat or group;
+ * see journal_node_record_new(). */
+static void
+journal_replay_node_record(PurpleXmlNode *blist, PurpleXmlNode *record,
+		PurpleXmlNode *change, const char *kind)
+{
+	PurpleXmlNode *groupnode, *old = NULL;
+
+	groupnode = journal_find_group(blist,
+			purple_xmlnode_get_attrib(record, "group"));
+	if (groupnode == NULL)
+		return;
+
+	if (purple_strequal(kind, "group")) {
+		old = groupnode;
+	} else if (purple_strequal(kind, "contact")) {
+		old = journal_find_buddy(groupnode,
+				purple_xmlnode_get_attrib(record, "account"),
+				purple_xmlnode_get_attrib(record, "proto"),
+				purple_xmlnode_get_attrib(record, "name"));
+		if (old != NULL)
+			old = old->parent;
+	} else if (purple_strequal(kind, "buddy")) {
+		PurpleXmlNode *namenode = purple_xmlnode_get_child(change, "name");
+		char *name = namenode ? purple_xmlnode_get_data(namenode) : NULL;
+
+		old = journal_find_buddy(groupnode,
+				purple_xmlnode_get_attrib(change, "account"),
+				purple_xmlnode_get_attrib(change, "proto"), name);
+		g_free(name);
+	} else if (purple_strequal(kind, "chat")) {
+		for (old = purple_xmlnode_get_child(groupnode, "chat"); old != NULL;
+				old = purple_xmlnode_get_next_twin(old)) {
+			if (journal_chat_matches(old, change))
+				break;
+		}
+	}
+
+	if (old == NULL)
+		return;
+
+	journal_xmlnode_unlink(change);
+	journal_xmlnode_replace(old, change,
+			purple_strequal(kind, "group") || purple_strequal(kind, "contact"));
+}
+
+static void
+journal_replay_record(PurpleXmlNode *purple, PurpleXmlNode *record)
+{
+	PurpleXmlNode *change, *blist, *privacy, *old;
+	const char *kind;
+
+	for (change = record->child; change != NULL; change = change->next) {
+		if (change->type == PURPLE_XMLNODE_TYPE_TAG)
+			break;
+	}
+	if (change == NULL)
+		return;
+
+	blist = purple_xmlnode_get_child(purple, "blist");
+	if (blist == NULL)
+		blist = purple_xmlnode_new_child(purple, "blist");
+	privacy = purple_xmlnode_get_child(purple, "privacy");
+	if (privacy == NULL)
+		privacy = purple_xmlnode_new_child(purple, "privacy");
+
+	kind = purple_xmlnode_get_attrib(record, "node");
+	if (kind != NULL) {
+		journal_replay_node_record(blist, record, change, kind);
+		return;
+	}
+
+	if (purple_strequal(change->name, "group") ||
+			purple_strequal(change->name, "remove-group"))
+	{
+		old = journal_find_group(blist,
+				purple_xmlnode_get_attrib(change, "name"));
+		if (old != NULL) {
+			journal_xmlnode_unlink(old);
+			purple_xmlnode_free(old);
+		}
+	}
+
+	if (purple_strequal(change->name, "group")) {
+		const char *pos = purple_xmlnode_get_attrib(record, "position");
+		gint position = pos ? atoi(pos) : G_MAXINT;
+		PurpleXmlNode *prev = NULL, *cur;
+
+		journal_xmlnode_unlink(change);
+
+		/* Insert before the position'th group, or append. */
+		for (cur = blist->child; cur != NULL; cur = cur->next) {
+			if (cur->type == PURPLE_XMLNODE_TYPE_TAG &&
+					purple_strequal(cur->name, "group") && position-- == 0)
+				break;
+			prev = cur;
+		}
+
+		if (cur == NULL) {
+			purple_xmlnode_insert_child(blist, change);
+		} else {
+			change->parent = blist;
+			change->next = cur;
+			if (prev != NULL)
+				prev->next = change;
+			else
+				blist->child = change;
+		}
+	} else if (purple_strequal(change->name, "account")) {
+		const char *name = purple_xmlnode_get_attrib(change, "name");
+		const char *proto = purple_xmlnode_get_attrib(change, "proto");
+
+		for (old = purple_xmlnode_get_child(privacy, "account"); old != NULL;
+				old = purple_xmlnode_get_next_twin(old)) {
+			if (purple_strequal(purple_xmlnode_get_attrib(old, "name"), name) &&
+					purple_strequal(purple_xmlnode_get_attrib(old, "proto"), proto))
+			{
+				journal_xmlnode_unlink(old);
+				purple_xmlnode_free(old);
+				break;
+			}
+		}
+
+		journal_xmlnode_unlink(change);
+		purple_xmlnode_insert_child(privacy, change);
+	}
+}
+
+/*
+ * Applies blist.journal on top of the snapshot in @purple.  Returns the
+ * number of records replayed.  A torn record at the end of the file, from a
+ * crash mid-write, ends the replay.
+ */
+static guint
+journal_replay(PurpleXmlNode *purple)
+{
+	gchar *path, *contents = NULL, *p, *end;
+	gsize length = 0;
+	guint replayed = 0;
+
+	path = g_build_filename(purple_config_dir(), BLIST_JOURNAL_FILE, NULL);
+	if (!g_file_get_contents(path, &contents, &length, NULL)) {
+		g_free(path);
+		return 0;
+	}
+	g_free(path);
+
+	p = contents;
+	end = contents + length;
+	while (p < end) {
+		PurpleXmlNode *record;
+		const char *generation;
+		gchar *data;
+		guint64 len;
+
+		len = g_ascii_strtoull(p, &data, 10);
+		if (data == p || *data != '\n' || len > (guint64)(end - data - 1))
+			break;
+		data++;
+
+		record = purple_xmlnode_from_str(data, len);
+		if (record == NULL)
+			break;
+
+		generation = purple_xmlnode_get_attrib(record, "generation");
+		if (generation != NULL &&
+				strtoul(generation, NULL, 10) == journal_generation)
+		{
+			journal_replay_record(purple, record);
+			replayed++;
+		}
+		purple_xmlnode_free(record);
+
+		p = data + len;
+		if (p < end && *p == '\n')
+			p++;
+	}
+
+	g_free(contents);
+
+	return replayed;
+}
+
 static void
 load_blist(void)
 {
 	PurpleXmlNode *purple, *blist, *privacy;
+	const char *generation;
 
 	blist_loaded = TRUE;
 
 	purple = purple_util_read_xml_from_config_file("blist.xml", _("buddy list"));
 
-	if (purple == NULL)
-		return;
+	if (purple == NULL) {
+		/* Start from an empty snapshot, but write a real one soon. */
+		purple = purple_xmlnode_new("purple");
+		needs_compaction = TRUE;
+	}
+
+	generation = purple_xmlnode_get_attrib(purple, "generation");
+	journal_generation = generation ? strtoul(generation, NULL, 10) : 0;
+	save_generation = journal_generation;
+
+	if (journal_replay(purple) > 0) {
+		/* Fold the journal back into blist.xml off the main thread. */
+		needs_compaction = TRUE;
+	}
 
 	blist = purple_xmlnode_get_child(purple, "blist");
 	if (blist) {
@@ -702,6 +1670,14 @@ load_blist(void)
 
 	purple_xmlnode_free(purple);
 
+	/* Everything just parsed is already on disk. */
+	g_hash_table_remove_all(dirty_groups);
+	g_hash_table_remove_all(dirty_nodes);
+	g_hash_table_remove_all(dirty_accounts);
+
+	if (needs_compaction)
+		purple_blist_real_schedule_save();
+
 	/* This tells the buddy icon code to do its thing. */
 	_purple_buddy_icons_blist_loaded_cb();
 }
@@ -729,6 +1705,13 @@ purple_blist_boot(void)
 
 	groups_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
+	chats_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					 NULL, (GDestroyNotify)_purple_blist_hchats_free);
+
+	dirty_groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	dirty_nodes = g_hash_table_new(g_direct_hash, g_direct_equal);
+	dirty_accounts = g_hash_table_new(g_direct_hash, g_direct_equal);
+
 	for (account = purple_accounts_get_all(); account != NULL; account = account->next)
 	{
 		purple_blist_buddies_cache_add_account(account->data);
@@ -823,11 +1806,14 @@ void purple_blist_update_buddies_cache(PurpleBuddy *buddy, const char *new_name)
 
 	g_return_if_fail(PURPLE_IS_BUDDY(buddy));
 
+	/* The journal finds buddies by name. */
+	purple_blist_journal_mark_structure(PURPLE_BLIST_NODE(buddy));
+
 	account = purple_buddy_get_account(buddy);
 	name = (gchar *)purple_buddy_get_name(buddy);
 
 	hb = g_new(struct _purple_hbuddy, 1);
-	hb->name = (gchar *)purple_normalize(account, name);
+	hb->name = purple_normalize(account, name);
 	hb->account = account;
 	hb->group = PURPLE_BLIST_NODE(buddy)->parent->parent;
 	g_hash_table_remove(priv->buddies, hb);
@@ -835,21 +1821,40 @@ void purple_blist_update_buddies_cache(PurpleBuddy *buddy, const char *new_name)
 	account_buddies = g_hash_table_lookup(buddies_cache, account);
 	g_hash_table_remove(account_buddies, hb);
 
-	hb->name = g_strdup(purple_normalize(account, new_name));
+	hb->name = purple_normalize_intern(account, new_name);
 	g_hash_table_replace(priv->buddies, hb, buddy);
 
 	hb2 = g_new(struct _purple_hbuddy, 1);
-	hb2->name = g_strdup(hb->name);
+	hb2->name = hb->name;
 	hb2->account = account;
 	hb2->group = PURPLE_BLIST_NODE(buddy)->parent->parent;
 
 	g_hash_table_replace(account_buddies, hb2, buddy);
 }
 
+void purple_blist_update_chats_cache(PurpleChat *chat)
+{
+	g_return_if_fail(PURPLE_IS_CHAT(chat));
+
+	/* The journal finds chats by their components. */
+	purple_blist_journal_mark_structure(PURPLE_BLIST_NODE(chat));
+
+	if (chats_cache == NULL)
+		return;
+
+	/* Edits are rare, so just let the index be rebuilt. */
+	g_hash_table_remove(chats_cache, purple_chat_get_account(chat));
+}
+
 void purple_blist_update_groups_cache(PurpleGroup *group, const char *new_name)
 {
 		gchar* key;
 
+		/* The old name has to be removed from the journal, and the group
+		 * saved whole under the new one. */
+		purple_blist_journal_mark_group(purple_group_get_name(group));
+		purple_blist_journal_mark_group(new_name);
+
 		key = purple_blist_fold_name(purple_group_get_name(group));
 		g_hash_table_remove(groups_cache, key);
 		g_free(key);
@@ -887,10 +1892,18 @@ void purple_blist_add_chat(PurpleChat *chat, PurpleGroup *group, PurpleBlistNode
 	if (cnode == node)
 		return;
 
-	if (cnode->parent) {
+	if (cnode->parent == NULL) {
+		struct _purple_hchats *hc = g_hash_table_lookup(chats_cache,
+				purple_chat_get_account(chat));
+
+		if (hc != NULL)
+			purple_blist_chats_cache_insert(hc, chat);
+	} else {
 		/* This chat was already in the list and is
 		 * being moved.
 		 */
+		purple_blist_journal_mark_structure(cnode);
+
 		group_counter = PURPLE_COUNTING_NODE(cnode->parent);
 		purple_counting_node_change_total_size(group_counter, -1);
 		if (purple_account_is_connected(purple_chat_get_account(chat))) {
@@ -942,6 +1955,8 @@ void purple_blist_add_chat(PurpleChat *chat, PurpleGroup *group, PurpleBlistNode
 		}
 	}
 
+	purple_blist_journal_mark_structure(cnode);
+
 	if (klass) {
 		if (klass->save_node) {
 			klass->save_node(purplebuddylist, cnode);
@@ -1005,6 +2020,8 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 	cnode = PURPLE_BLIST_NODE(c);
 
 	if (bnode->parent) {
+		purple_blist_journal_mark_structure(bnode);
+
 		contact_counter = PURPLE_COUNTING_NODE(bnode->parent);
 		group_counter = PURPLE_COUNTING_NODE(bnode->parent->parent);
 
@@ -1039,7 +2056,7 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 
 		if (bnode->parent->parent != (PurpleBlistNode*)g) {
 			struct _purple_hbuddy hb;
-			hb.name = (gchar *)purple_normalize(account,
+			hb.name = purple_normalize(account,
 					purple_buddy_get_name(buddy));
 			hb.account = account;
 			hb.group = bnode->parent->parent;
@@ -1092,7 +2109,7 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 	purple_counting_node_change_total_size(contact_counter, +1);
 
 	hb = g_new(struct _purple_hbuddy, 1);
-	hb->name = g_strdup(purple_normalize(account, purple_buddy_get_name(buddy)));
+	hb->name = purple_normalize_intern(account, purple_buddy_get_name(buddy));
 	hb->account = account;
 	hb->group = PURPLE_BLIST_NODE(buddy)->parent->parent;
 
@@ -1101,7 +2118,7 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 	account_buddies = g_hash_table_lookup(buddies_cache, account);
 
 	hb2 = g_new(struct _purple_hbuddy, 1);
-	hb2->name = g_strdup(hb->name);
+	hb2->name = hb->name;
 	hb2->account = account;
 	hb2->group = ((PurpleBlistNode*)buddy)->parent->parent;
 
@@ -1109,6 +2126,8 @@ void purple_blist_add_buddy(PurpleBuddy *buddy, PurpleContact *contact, PurpleGr
 
 	purple_contact_invalidate_priority_buddy(purple_buddy_get_contact(buddy));
 
+	purple_blist_journal_mark_structure(bnode);
+
 	if (klass) {
 		if (klass->save_node) {
 			klass->save_node(purplebuddylist,
@@ -1172,7 +2191,7 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 				struct _purple_hbuddy *hb, *hb2;
 
 				hb = g_new(struct _purple_hbuddy, 1);
-				hb->name = g_strdup(purple_normalize(account, purple_buddy_get_name(b)));
+				hb->name = purple_normalize_intern(account, purple_buddy_get_name(b));
 				hb->account = account;
 				hb->group = cnode->parent;
 
@@ -1186,7 +2205,7 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 					g_hash_table_replace(priv->buddies, hb, b);
 
 					hb2 = g_new(struct _purple_hbuddy, 1);
-					hb2->name = g_strdup(hb->name);
+					hb2->name = hb->name;
 					hb2->account = account;
 					hb2->group = gnode;
 
@@ -1199,7 +2218,6 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 
 					/* this buddy already exists in the group, so we're
 					 * gonna delete it instead */
-					g_free(hb->name);
 					g_free(hb);
 					if (purple_account_get_connection(account))
 						purple_account_remove_buddy(account, b, PURPLE_GROUP(cnode->parent));
@@ -1262,6 +2280,8 @@ void purple_blist_add_contact(PurpleContact *contact, PurpleGroup *group, Purple
 		purple_counting_node_change_current_size(group_counter, +1);
 	purple_counting_node_change_total_size(group_counter, +1);
 
+	purple_blist_journal_mark_structure(cnode);
+
 	if (klass && klass->save_node) {
 		if (cnode->child) {
 			klass->save_node(purplebuddylist, cnode);
@@ -1339,6 +2359,8 @@ void purple_blist_add_group(PurpleGroup *group, PurpleBlistNode *node)
 		priv->root = gnode;
 	}
 
+	purple_blist_journal_mark_structure(gnode);
+
 	if (klass && klass->save_node) {
 		klass->save_node(purplebuddylist, gnode);
 		for (node = gnode->child; node; node = node->next) {
@@ -1473,7 +2495,7 @@ void purple_blist_remove_buddy(PurpleBuddy *buddy)
 	}
 
 	/* Remove this buddy from the buddies hash table */
-	hb.name = (gchar *)purple_normalize(account, purple_buddy_get_name(buddy));
+	hb.name = purple_normalize(account, purple_buddy_get_name(buddy));
 	hb.account = account;
 	hb.group = gnode;
 	g_hash_table_remove(priv->buddies, &hb);
@@ -1521,6 +2543,8 @@ void purple_blist_remove_chat(PurpleChat *chat)
 
 	if (gnode != NULL)
 	{
+		purple_blist_chats_cache_remove(chat);
+
 		/* Remove the node from its parent */
 		if (gnode->child == node)
 			gnode->child = node->next;
@@ -1627,7 +2651,7 @@ PurpleBuddy *purple_blist_find_buddy(PurpleAccount *account, const char *name)
 	g_return_val_if_fail((name != NULL) && (*name != '\0'), NULL);
 
 	hb.account = account;
-	hb.name = (gchar *)purple_normalize(account, name);
+	hb.name = purple_normalize(account, name);
 
 	for (group = priv->root; group; group = group->next) {
 		if (!group->child)
@@ -1653,7 +2677,7 @@ PurpleBuddy *purple_blist_find_buddy_in_group(PurpleAccount *account, const char
 	g_return_val_if_fail(PURPLE_IS_ACCOUNT(account), NULL);
 	g_return_val_if_fail((name != NULL) && (*name != '\0'), NULL);
 
-	hb.name = (gchar *)purple_normalize(account, name);
+	hb.name = purple_normalize(account, name);
 	hb.account = account;
 	hb.group = (PurpleBlistNode*)group;
 
@@ -1682,7 +2706,7 @@ GSList *purple_blist_find_buddies(PurpleAccount *account, const char *name)
 	if ((name != NULL) && (*name != '\0')) {
 		struct _purple_hbuddy hb;
 
-		hb.name = (gchar *)purple_normalize(account, name);
+		hb.name = purple_normalize(account, name);
 		hb.account = account;
 
 		for (node = priv->root; node != NULL; node = node->next) {
@@ -1742,13 +2766,10 @@ purple_blist_get_default_group(void)
 PurpleChat *
 purple_blist_find_chat(PurpleAccount *account, const char *name)
 {
-	char *chat_name;
-	PurpleChat *chat;
 	PurpleProtocol *protocol = NULL;
-	PurpleProtocolChatEntry *pce;
-	PurpleBlistNode *node, *group;
-	GList *parts;
-	char *normname;
+	struct _purple_hchats *hc;
+	PurpleChat *chat;
+	char key[BUF_LEN];
 
 	g_return_val_if_fail(PURPLE_IS_BUDDY_LIST(purplebuddylist), NULL);
 	g_return_val_if_fail((name != NULL) && (*name != '\0'), NULL);
@@ -1761,36 +2782,28 @@ purple_blist_find_chat(PurpleAccount *account, const char *name)
 	if (PURPLE_PROTOCOL_IMPLEMENTS(protocol, CLIENT, find_blist_chat))
 		return purple_protocol_client_iface_find_blist_chat(protocol, account, name);
 
-	normname = g_strdup(purple_normalize(account, name));
-	for (group = purple_blist_get_default_root(); group != NULL;
-	     group = group->next) {
-		for (node = group->child; node != NULL; node = node->next) {
-			if (PURPLE_IS_CHAT(node)) {
-
-				chat = (PurpleChat*)node;
+	/* Not interned, so names that aren't on the list don't fill the
+	 * account's cache. */
+	purple_normalize_to_buffer(account, name, key, sizeof(key));
 
-				if (account != purple_chat_get_account(chat))
-					continue;
+	hc = g_hash_table_lookup(chats_cache, account);
+	if (hc != NULL) {
+		chat = g_hash_table_lookup(hc->chats, key);
 
-				parts = purple_protocol_chat_iface_info(protocol, 
-					purple_account_get_connection(purple_chat_get_account(chat)));
+		/* Renames are announced with purple_blist_update_chats_cache(),
+		 * but a hit is cheap to double check. */
+		if (chat == NULL ||
+				purple_strequal(purple_blist_chats_cache_key(hc, chat), key))
+			return chat;
 
-				pce = parts->data;
-				chat_name = g_hash_table_lookup(purple_chat_get_components(chat),
-												pce->identifier);
-				g_list_free_full(parts, g_free);
-
-				if (purple_chat_get_account(chat) == account && chat_name != NULL &&
-					purple_strequal(purple_normalize(account, chat_name), normname)) {
-					g_free(normname);
-					return chat;
-				}
-			}
-		}
+		g_hash_table_remove(chats_cache, account);
 	}
 
-	g_free(normname);
-	return NULL;
+	hc = purple_blist_chats_cache_build(account, protocol);
+	if (hc == NULL)
+		return NULL;
+
+	return g_hash_table_lookup(hc->chats, key);
 }
 
 void purple_blist_add_account(PurpleAccount *account)
@@ -2212,13 +3225,42 @@ purple_blist_uninit(void)
 		purple_blist_sync();
 	}
 
+	/* Wait for pending writes to finish, and report how they went.  A
+	 * failed compaction queues its changes to the journal, so go around
+	 * again until nothing is left. */
+	while (save_pool != NULL) {
+		GThreadPool *pool = save_pool;
+		PurpleBlistSaveJob *job;
+
+		save_pool = NULL;
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+		while (g_source_remove_by_user_data(save_done))
+			;
+		while ((job = g_async_queue_try_pop(save_done)) != NULL)
+			purple_blist_save_job_done(job, FALSE);
+	}
+	if (save_done != NULL) {
+		g_async_queue_unref(save_done);
+		save_done = NULL;
+	}
+	compaction_pending = FALSE;
+
 	purple_debug(PURPLE_DEBUG_INFO, "buddylist", "Destroying\n");
 
 	g_hash_table_destroy(buddies_cache);
 	g_hash_table_destroy(groups_cache);
+	g_hash_table_destroy(chats_cache);
+	g_hash_table_destroy(dirty_groups);
+	g_hash_table_destroy(dirty_nodes);
+	g_hash_table_destroy(dirty_accounts);
 
 	buddies_cache = NULL;
 	groups_cache = NULL;
+	chats_cache = NULL;
+	dirty_groups = NULL;
+	dirty_nodes = NULL;
+	dirty_accounts = NULL;
 
 	g_clear_object(&purplebuddylist);
 
@@ -2277,6 +3319,6 @@ static void purple_buddy_list_class_init(PurpleBuddyListClass *klass)
 	obj_class->finalize = purple_buddy_list_finalize;
 
 	klass->save_node = purple_blist_real_save_node;
-	klass->remove_node = purple_blist_real_save_node;
+	klass->remove_node = purple_blist_real_remove_node;
 	klass->save_account = purple_blist_real_save_account;
 }
@@ -226,6 +226,19 @@ void purple_blist_set_visible(gboolean show);
  */
 void purple_blist_update_buddies_cache(PurpleBuddy *buddy, const char *new_name);
 
+/**
+ * purple_blist_update_chats_cache:
+ * @chat:     The chat whose components have changed.
+ *
+ * Updates the chats hash table used by purple_blist_find_chat() after the
+ * components of a chat on the buddy list have been changed.
+ *
+ * Anything that edits the table returned by purple_chat_get_components()
+ * of a chat that is on the buddy list must call this afterwards, otherwise
+ * purple_blist_find_chat() may not find the chat under its new name.
+ */
+void purple_blist_update_chats_cache(PurpleChat *chat);
+
 /**
  * purple_blist_update_groups_cache:
  * @group:    The group whose name will be changed.
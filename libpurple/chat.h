@@ -138,7 +138,9 @@ PurpleAccount *purple_chat_get_account(PurpleChat *chat);
  * purple_chat_get_components:
  * @chat:  The chat.
  *
- * Get a hashtable containing information about a chat.
+ * Get a hashtable containing information about a chat.  If you change it
+ * while the chat is on the buddy list, call purple_blist_update_chats_cache()
+ * afterwards.
  *
  * Returns: (transfer none):  The hashtable.
  */
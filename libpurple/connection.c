@@ -26,6 +26,7 @@
 #include "connection.h"
 #include "debug.h"
 #include "enums.h"
+#include "eventloop.h"
 #include "log.h"
 #include "notify.h"
 #include "prefs.h"
@@ -60,12 +61,13 @@ typedef struct
 
 	GSList *active_chats;         /* A list of active chats
 	                                  (#PurpleChatConversation structs). */
+	GHashTable *active_chats_set; /* The same chats, for lookups.      */
 
 	/* TODO Remove this and use protocol-specific subclasses. */
 	void *proto_data;             /* Protocol-specific data.           */
 
 	char *display_name;           /* How you appear to other people.   */
-	GSource *keepalive;           /* Keep-alive.                       */
+	guint keepalive;              /* Keep-alive timer.                 */
 
 	/* Wants to Die state.  This is set when the user chooses to log out, or
 	 * when the protocol is disconnected and should not be automatically
@@ -137,13 +139,13 @@ update_keepalive(PurpleConnection *gc, gboolean on)
 	{
 		int interval = purple_protocol_server_iface_get_keepalive_interval(priv->protocol);
 		purple_debug_info("connection", "Activating keepalive to %d seconds.", interval);
-		priv->keepalive = g_main_context_find_source_by_id(NULL, g_timeout_add_seconds(interval, send_keepalive, gc));
+		priv->keepalive = purple_timer_add_seconds(interval, send_keepalive, gc);
 	}
 	else if (!on && priv->keepalive)
 	{
 		purple_debug_info("connection", "Deactivating keepalive.\n");
-		g_source_destroy(priv->keepalive);
-		priv->keepalive = NULL;
+		purple_timer_remove(priv->keepalive);
+		priv->keepalive = 0;
 	}
 }
 
@@ -396,6 +398,10 @@ _purple_connection_add_active_chat(PurpleConnection *gc, PurpleChatConversation
 	g_return_if_fail(PURPLE_IS_CONNECTION(gc));
 
 	priv = purple_connection_get_instance_private(gc);
+
+	if (!g_hash_table_add(priv->active_chats_set, chat))
+		return;
+
 	priv->active_chats = g_slist_append(priv->active_chats, chat);
 }
 
@@ -407,9 +413,24 @@ _purple_connection_remove_active_chat(PurpleConnection *gc, PurpleChatConversati
 	g_return_if_fail(PURPLE_IS_CONNECTION(gc));
 
 	priv = purple_connection_get_instance_private(gc);
+
+	if (!g_hash_table_remove(priv->active_chats_set, chat))
+		return;
+
 	priv->active_chats = g_slist_remove(priv->active_chats, chat);
 }
 
+gboolean
+_purple_connection_has_active_chat(PurpleConnection *gc, PurpleChatConversation *chat)
+{
+	PurpleConnectionPrivate *priv = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_CONNECTION(gc), FALSE);
+
+	priv = purple_connection_get_instance_private(gc);
+	return g_hash_table_contains(priv->active_chats_set, chat);
+}
+
 gboolean
 _purple_connection_wants_to_die(PurpleConnection *gc)
 {
@@ -646,18 +667,12 @@ void purple_connection_update_last_received(PurpleConnection *gc)
 	 * keepalive mechanism is inactive.
 	 */
 	if (priv->keepalive) {
-		/* The #GTimeoutSource API doesn't expose a function to reset when a
-		 * #GTimeoutSource will dispatch the next time, but because it works to
-		 * directly call g_source_set_ready_time() on a #GTimeoutSource, and since
-		 * it seems unlikely that the implementation will change, we just do that
-		 * for now as a workaround for this API shortcoming.
-		 */
-		gint64 seconds_from_now = purple_protocol_server_iface_get_keepalive_interval(priv->protocol);
-
-		g_source_set_ready_time(
-			priv->keepalive,
-			g_get_monotonic_time() + (seconds_from_now * G_USEC_PER_SEC)
-		);
+		/* Restart the countdown. Both are constant time on the timer
+		 * wheel, so this is cheap enough to do for every packet. */
+		purple_timer_remove(priv->keepalive);
+		priv->keepalive = purple_timer_add_seconds(
+			purple_protocol_server_iface_get_keepalive_interval(priv->protocol),
+			send_keepalive, gc);
 	}
 }
 
@@ -812,6 +827,10 @@ purple_connection_get_property(GObject *obj, guint param_id, GValue *value,
 static void
 purple_connection_init(PurpleConnection *gc)
 {
+	PurpleConnectionPrivate *priv = purple_connection_get_instance_private(gc);
+
+	priv->active_chats_set = g_hash_table_new(g_direct_hash, g_direct_equal);
+
 	purple_connection_set_state(gc, PURPLE_CONNECTION_CONNECTING);
 	connections = g_list_append(connections, gc);
 }
@@ -853,6 +872,7 @@ purple_connection_finalize(GObject *object)
 
 	purple_signal_emit(purple_connections_get_handle(), "signing-off", gc);
 
+	g_hash_table_destroy(priv->active_chats_set);
 	g_slist_free_full(priv->active_chats, (GDestroyNotify)purple_chat_conversation_leave);
 
 	update_keepalive(gc, FALSE);
@@ -51,7 +51,15 @@ struct _PurpleConversationPrivate
 	PurpleConversationUiOps *ui_ops;  /* UI-specific operations.           */
 
 	PurpleConnectionFlags features;   /* The supported features            */
-	GList *message_history; /* Message history, as a GList of PurpleMessages */
+	GQueue message_history; /* Message history, as a GQueue of PurpleMessages,
+	                           newest first and capped in length */
+
+	/* Messages that fell off the end of message_history, appended oldest
+	 * first to a scratch file and mapped when iterating. */
+	FILE *history_spill;
+	gchar *history_spill_path;
+	gsize history_spill_size;
+	GMappedFile *history_spill_map;
 
 	PurpleE2eeState *e2ee_state;      /* End-to-end encryption state.      */
 
@@ -78,6 +86,226 @@ static GParamSpec *properties[PROP_LAST];
 G_DEFINE_ABSTRACT_TYPE_WITH_PRIVATE(PurpleConversation, purple_conversation,
 		G_TYPE_OBJECT);
 
+/* Interned IDs of the hot signals emitted from this file. */
+static gulong sending_im_msg_signal = 0;
+static gulong sent_im_msg_signal = 0;
+static gulong sending_chat_msg_signal = 0;
+static gulong sent_chat_msg_signal = 0;
+static gulong writing_im_msg_signal = 0;
+static gulong wrote_im_msg_signal = 0;
+static gulong writing_chat_msg_signal = 0;
+static gulong wrote_chat_msg_signal = 0;
+static gulong conversation_updated_signal = 0;
+
+static void
+conversation_signals_lookup(void)
+{
+	void *handle;
+
+	if (G_LIKELY(sending_im_msg_signal != 0))
+		return;
+
+	handle = purple_conversations_get_handle();
+
+	sending_im_msg_signal = purple_signal_get_id(handle, "sending-im-msg");
+	sent_im_msg_signal = purple_signal_get_id(handle, "sent-im-msg");
+	sending_chat_msg_signal = purple_signal_get_id(handle, "sending-chat-msg");
+	sent_chat_msg_signal = purple_signal_get_id(handle, "sent-chat-msg");
+	writing_im_msg_signal = purple_signal_get_id(handle, "writing-im-msg");
+	wrote_im_msg_signal = purple_signal_get_id(handle, "wrote-im-msg");
+	writing_chat_msg_signal = purple_signal_get_id(handle, "writing-chat-msg");
+	wrote_chat_msg_signal = purple_signal_get_id(handle, "wrote-chat-msg");
+	conversation_updated_signal =
+		purple_signal_get_id(handle, "conversation-updated");
+}
+
+/*
+ * A spilled history record is a HistoryRecordHeader followed by the author,
+ * author alias, recipient and contents strings (without their terminating
+ * NULs) and a trailing guint32 holding the size of the whole record, so the
+ * file can be walked backwards from the newest record.
+ */
+typedef struct
+{
+	guint64 time;
+	guint32 flags;
+	guint32 lengths[4]; /* strlen() + 1 of each string, 0 for NULL */
+} HistoryRecordHeader;
+
+/* Once a spill file would grow past this it's started over, dropping the
+ * oldest messages with it. */
+#define HISTORY_SPILL_MAX_SIZE (16 * 1024 * 1024)
+
+static gboolean
+history_spill_open(PurpleConversationPrivate *priv)
+{
+	gchar *dir;
+	int fd;
+
+	dir = g_build_filename(purple_cache_dir(), "history", NULL);
+	g_mkdir_with_parents(dir, S_IRUSR | S_IWUSR | S_IXUSR);
+	priv->history_spill_path = g_build_filename(dir, "spill.XXXXXX", NULL);
+	g_free(dir);
+
+	if ((fd = g_mkstemp(priv->history_spill_path)) == -1) {
+		purple_debug_error("conversation",
+				"Failed to create message history spill file: %s\n",
+				g_strerror(errno));
+		g_free(priv->history_spill_path);
+		priv->history_spill_path = NULL;
+		return FALSE;
+	}
+
+	if ((priv->history_spill = fdopen(fd, "w+b")) == NULL) {
+		purple_debug_error("conversation",
+				"Failed to fdopen() message history spill file: %s\n",
+				g_strerror(errno));
+		close(fd);
+		g_unlink(priv->history_spill_path);
+		g_free(priv->history_spill_path);
+		priv->history_spill_path = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+history_spill_close(PurpleConversationPrivate *priv)
+{
+	g_clear_pointer(&priv->history_spill_map, g_mapped_file_unref);
+
+	if (priv->history_spill != NULL) {
+		fclose(priv->history_spill);
+		priv->history_spill = NULL;
+	}
+
+	if (priv->history_spill_path != NULL) {
+		g_unlink(priv->history_spill_path);
+		g_free(priv->history_spill_path);
+		priv->history_spill_path = NULL;
+	}
+
+	priv->history_spill_size = 0;
+}
+
+static void
+history_spill_message(PurpleConversationPrivate *priv, PurpleMessage *msg)
+{
+	HistoryRecordHeader header;
+	const gchar *strings[4];
+	guint32 size;
+	GByteArray *record;
+	int i;
+
+	strings[0] = purple_message_get_author(msg);
+	strings[1] = purple_message_get_author_alias(msg);
+	strings[2] = purple_message_get_recipient(msg);
+	strings[3] = purple_message_get_contents(msg);
+
+	memset(&header, 0, sizeof(header));
+	header.time = purple_message_get_time(msg);
+	header.flags = purple_message_get_flags(msg);
+
+	record = g_byte_array_new();
+	g_byte_array_append(record, (const guint8 *)&header, sizeof(header));
+	for (i = 0; i < 4; i++) {
+		gsize len;
+
+		if (strings[i] == NULL)
+			continue;
+
+		len = strlen(strings[i]);
+		header.lengths[i] = len + 1;
+		g_byte_array_append(record, (const guint8 *)strings[i], len);
+	}
+	memcpy(record->data, &header, sizeof(header));
+
+	size = record->len + sizeof(size);
+	g_byte_array_append(record, (const guint8 *)&size, sizeof(size));
+
+	if (priv->history_spill != NULL &&
+			priv->history_spill_size + record->len > HISTORY_SPILL_MAX_SIZE) {
+		purple_debug_info("conversation",
+				"Message history spill file is full, starting over\n");
+		history_spill_close(priv);
+	}
+
+	if (priv->history_spill == NULL && !history_spill_open(priv)) {
+		g_byte_array_free(record, TRUE);
+		return;
+	}
+
+	if (fwrite(record->data, record->len, 1, priv->history_spill) != 1) {
+		purple_debug_error("conversation",
+				"Failed to spill message history: %s\n",
+				g_strerror(errno));
+		/* Truncate back to the last whole record. */
+		fflush(priv->history_spill);
+		if (ftruncate(fileno(priv->history_spill),
+				priv->history_spill_size) != 0 ||
+				fseek(priv->history_spill,
+				priv->history_spill_size, SEEK_SET) != 0) {
+			history_spill_close(priv);
+		}
+	} else {
+		priv->history_spill_size += record->len;
+		g_clear_pointer(&priv->history_spill_map, g_mapped_file_unref);
+	}
+
+	g_byte_array_free(record, TRUE);
+}
+
+static const gchar *
+history_spill_contents(PurpleConversationPrivate *priv)
+{
+	GError *error = NULL;
+
+	if (priv->history_spill == NULL || priv->history_spill_size == 0)
+		return NULL;
+
+	if (priv->history_spill_map == NULL) {
+		fflush(priv->history_spill);
+		priv->history_spill_map = g_mapped_file_new_from_fd(
+				fileno(priv->history_spill), FALSE, &error);
+		if (priv->history_spill_map == NULL) {
+			purple_debug_error("conversation",
+					"Failed to map message history spill file: %s\n",
+					error->message);
+			g_error_free(error);
+			return NULL;
+		}
+	}
+
+	if (g_mapped_file_get_length(priv->history_spill_map) <
+			priv->history_spill_size)
+		return NULL;
+
+	return g_mapped_file_get_contents(priv->history_spill_map);
+}
+
+static void
+history_trim(PurpleConversationPrivate *priv)
+{
+	int limit;
+	gboolean spill;
+
+	limit = purple_prefs_get_int("/purple/conversations/message_history_size");
+	if (limit <= 0)
+		return;
+
+	spill = purple_prefs_get_bool("/purple/conversations/message_history_spill");
+
+	while (priv->message_history.length > (guint)limit) {
+		PurpleMessage *msg = g_queue_pop_tail(&priv->message_history);
+
+		if (spill)
+			history_spill_message(priv, msg);
+
+		g_object_unref(msg);
+	}
+}
+
 static void
 common_send(PurpleConversation *conv, const char *message, PurpleMessageFlags msgflags)
 {
@@ -116,12 +344,13 @@ common_send(PurpleConversation *conv, const char *message, PurpleMessageFlags ms
 
 	msgflags |= PURPLE_MESSAGE_SEND;
 
+	conversation_signals_lookup();
+
 	if (PURPLE_IS_IM_CONVERSATION(conv)) {
 		msg = purple_message_new_outgoing(
 			purple_conversation_get_name(conv), sent, msgflags);
 
-		purple_signal_emit(purple_conversations_get_handle(), "sending-im-msg",
-			account, msg);
+		purple_signal_emit_by_id(sending_im_msg_signal, account, msg);
 
 		if (!purple_message_is_empty(msg)) {
 
@@ -133,8 +362,7 @@ common_send(PurpleConversation *conv, const char *message, PurpleMessageFlags ms
 				purple_conversation_write_message(conv, msg);
 			}
 
-			purple_signal_emit(purple_conversations_get_handle(),
-				"sent-im-msg", account, msg);
+			purple_signal_emit_by_id(sent_im_msg_signal, account, msg);
 		}
 	}
 	else if (PURPLE_IS_CHAT_CONVERSATION(conv)) {
@@ -142,14 +370,12 @@ common_send(PurpleConversation *conv, const char *message, PurpleMessageFlags ms
 
 		msg = purple_message_new_outgoing(NULL, sent, msgflags);
 
-		purple_signal_emit(purple_conversations_get_handle(),
-			"sending-chat-msg", account, msg, id);
+		purple_signal_emit_by_id(sending_chat_msg_signal, account, msg, id);
 
 		if (!purple_message_is_empty(msg)) {
 			err = purple_serv_chat_send(gc, id, msg);
 
-			purple_signal_emit(purple_conversations_get_handle(),
-				"sent-chat-msg", account, msg, id);
+			purple_signal_emit_by_id(sent_chat_msg_signal, account, msg, id);
 		}
 	}
 
@@ -549,16 +775,19 @@ _purple_conversation_write_common(PurpleConversation *conv, PurpleMessage *pmsg)
 		gc = purple_account_get_connection(account);
 
 	if (PURPLE_IS_CHAT_CONVERSATION(conv) &&
-		(gc != NULL && !g_slist_find(purple_connection_get_active_chats(gc), conv)))
+		(gc != NULL && !_purple_connection_has_active_chat(gc,
+				PURPLE_CHAT_CONVERSATION(conv))))
 		return;
 
 	if (PURPLE_IS_IM_CONVERSATION(conv) &&
-		!g_list_find(purple_conversations_get_all(), conv))
+		!_purple_conversations_contains(conv))
 		return;
 
-	plugin_return = GPOINTER_TO_INT(purple_signal_emit_return_1(
-		purple_conversations_get_handle(),
-		(PURPLE_IS_IM_CONVERSATION(conv) ? "writing-im-msg" : "writing-chat-msg"),
+	conversation_signals_lookup();
+
+	plugin_return = GPOINTER_TO_INT(purple_signal_emit_return_1_by_id(
+		(PURPLE_IS_IM_CONVERSATION(conv) ?
+			writing_im_msg_signal : writing_chat_msg_signal),
 		conv, pmsg));
 
 	if (purple_message_is_empty(pmsg))
@@ -632,11 +861,12 @@ _purple_conversation_write_common(PurpleConversation *conv, PurpleMessage *pmsg)
 			ops->write_conv(conv, pmsg);
 	}
 
-	g_object_ref(pmsg);
-	priv->message_history = g_list_prepend(priv->message_history, pmsg);
+	g_queue_push_head(&priv->message_history, g_object_ref(pmsg));
+	history_trim(priv);
 
-	purple_signal_emit(purple_conversations_get_handle(),
-		(PURPLE_IS_IM_CONVERSATION(conv) ? "wrote-im-msg" : "wrote-chat-msg"),
+	purple_signal_emit_by_id(
+		(PURPLE_IS_IM_CONVERSATION(conv) ?
+			wrote_im_msg_signal : wrote_chat_msg_signal),
 		conv, pmsg);
 }
 
@@ -703,8 +933,9 @@ purple_conversation_update(PurpleConversation *conv, PurpleConversationUpdateTyp
 {
 	g_return_if_fail(PURPLE_IS_CONVERSATION(conv));
 
-	purple_signal_emit(purple_conversations_get_handle(),
-					 "conversation-updated", conv, type);
+	conversation_signals_lookup();
+
+	purple_signal_emit_by_id(conversation_updated_signal, conv, type);
 }
 
 gboolean purple_conversation_present_error(const char *who, PurpleAccount *account, const char *what)
@@ -784,14 +1015,13 @@ purple_conversation_get_extended_menu(PurpleConversation *conv)
 void purple_conversation_clear_message_history(PurpleConversation *conv)
 {
 	PurpleConversationPrivate *priv = NULL;
-	GList *list;
 
 	g_return_if_fail(PURPLE_IS_CONVERSATION(conv));
 
 	priv = purple_conversation_get_instance_private(conv);
-	list = priv->message_history;
-	g_list_free_full(list, g_object_unref);
-	priv->message_history = NULL;
+	g_list_free_full(priv->message_history.head, g_object_unref);
+	g_queue_init(&priv->message_history);
+	history_spill_close(priv);
 
 	purple_signal_emit(purple_conversations_get_handle(),
 			"cleared-message-history", conv);
@@ -804,7 +1034,103 @@ GList *purple_conversation_get_message_history(PurpleConversation *conv)
 	g_return_val_if_fail(PURPLE_IS_CONVERSATION(conv), NULL);
 
 	priv = purple_conversation_get_instance_private(conv);
-	return priv->message_history;
+	return priv->message_history.head;
+}
+
+void
+purple_conversation_history_iter_init(PurpleConversationHistoryIter *iter,
+		PurpleConversation *conv)
+{
+	PurpleConversationPrivate *priv = NULL;
+
+	g_return_if_fail(iter != NULL);
+	g_return_if_fail(PURPLE_IS_CONVERSATION(conv));
+
+	priv = purple_conversation_get_instance_private(conv);
+
+	iter->conv = conv;
+	iter->link = priv->message_history.head;
+	iter->offset = priv->history_spill_size;
+}
+
+gboolean
+purple_conversation_history_iter_next(PurpleConversationHistoryIter *iter,
+		PurpleMessage **msg)
+{
+	PurpleConversationPrivate *priv = NULL;
+	HistoryRecordHeader header;
+	const gchar *contents, *record, *p;
+	gchar *strings[4];
+	guint64 lengths;
+	guint32 size;
+	int i;
+
+	g_return_val_if_fail(iter != NULL, FALSE);
+	g_return_val_if_fail(PURPLE_IS_CONVERSATION(iter->conv), FALSE);
+	g_return_val_if_fail(msg != NULL, FALSE);
+
+	if (iter->link != NULL) {
+		*msg = g_object_ref(iter->link->data);
+		iter->link = iter->link->next;
+		return TRUE;
+	}
+
+	if (iter->offset < sizeof(header) + sizeof(size))
+		return FALSE;
+
+	priv = purple_conversation_get_instance_private(iter->conv);
+	if ((contents = history_spill_contents(priv)) == NULL ||
+			iter->offset > priv->history_spill_size)
+		return FALSE;
+
+	memcpy(&size, contents + iter->offset - sizeof(size), sizeof(size));
+	if (size > iter->offset || size < sizeof(header) + sizeof(size))
+		goto corrupt;
+
+	record = contents + iter->offset - size;
+	memcpy(&header, record, sizeof(header));
+
+	/* The strings have to fill the rest of the record exactly. */
+	lengths = 0;
+	for (i = 0; i < 4; i++) {
+		if (header.lengths[i] > 0)
+			lengths += header.lengths[i] - 1;
+	}
+	if (lengths != size - sizeof(header) - sizeof(size))
+		goto corrupt;
+
+	p = record + sizeof(header);
+	for (i = 0; i < 4; i++) {
+		if (header.lengths[i] == 0) {
+			strings[i] = NULL;
+			continue;
+		}
+
+		strings[i] = g_strndup(p, header.lengths[i] - 1);
+		p += header.lengths[i] - 1;
+	}
+
+	*msg = g_object_new(PURPLE_TYPE_MESSAGE,
+		"author", strings[0],
+		"author-alias", strings[1],
+		"recipient", strings[2],
+		"contents", strings[3],
+		"time", header.time,
+		"flags", header.flags,
+		NULL);
+
+	for (i = 0; i < 4; i++)
+		g_free(strings[i]);
+
+	iter->offset -= size;
+
+	return TRUE;
+
+corrupt:
+	purple_debug_warning("conversation",
+			"Corrupt message history spill record\n");
+	iter->offset = 0;
+	return FALSE;
 }
 
 void purple_conversation_set_ui_data(PurpleConversation *conv, gpointer ui_data)
@@ -972,6 +1298,10 @@ purple_conversation_get_property(GObject *obj, guint param_id, GValue *value,
 static void
 purple_conversation_init(PurpleConversation *conv)
 {
+	PurpleConversationPrivate *priv =
+			purple_conversation_get_instance_private(conv);
+
+	g_queue_init(&priv->message_history);
 }
 
 /* Called when done constructing */
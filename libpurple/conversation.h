@@ -53,6 +53,8 @@ typedef struct _PurpleConversationClass      PurpleConversationClass;
 
 typedef struct _PurpleConversationUiOps      PurpleConversationUiOps;
 
+typedef struct _PurpleConversationHistoryIter PurpleConversationHistoryIter;
+
 /**
  * PurpleConversationUpdateType:
  * @PURPLE_CONVERSATION_UPDATE_ADD:      The buddy associated with the
@@ -199,6 +201,21 @@ struct _PurpleConversationClass {
 	void (*_purple_reserved4)(void);
 };
 
+/**
+ * PurpleConversationHistoryIter:
+ *
+ * An opaque structure used to walk the message history of a conversation,
+ * including messages that have been spilled to disk. It is declared on the
+ * stack and initialized with purple_conversation_history_iter_init().
+ */
+struct _PurpleConversationHistoryIter
+{
+	/*< private >*/
+	PurpleConversation *conv;
+	GList *link;
+	gsize offset;
+};
+
 #include "account.h"
 #include "buddyicon.h"
 #include "e2ee.h"
@@ -561,7 +578,10 @@ void purple_conversation_update(PurpleConversation *conv, PurpleConversationUpda
  * purple_conversation_get_message_history:
  * @conv:   The conversation
  *
- * Retrieve the message history of a conversation.
+ * Retrieve the in-memory message history of a conversation. At most
+ * <literal>/purple/conversations/message_history_size</literal> messages are
+ * kept in memory; use purple_conversation_history_iter_init() to also see
+ * older messages spilled to disk.
  *
  * Returns: (element-type PurpleMessage) (transfer none):
  *          A GList of PurpleMessage's. You must not modify the
@@ -570,6 +590,32 @@ void purple_conversation_update(PurpleConversation *conv, PurpleConversationUpda
  */
 GList *purple_conversation_get_message_history(PurpleConversation *conv);
 
+/**
+ * purple_conversation_history_iter_init:
+ * @iter: An uninitialized #PurpleConversationHistoryIter.
+ * @conv: The conversation.
+ *
+ * Initializes an iterator over the whole message history of a conversation,
+ * newest message first: the in-memory messages, then any that have been
+ * spilled to disk. The iterator is invalidated by writing to or clearing the
+ * conversation.
+ */
+void purple_conversation_history_iter_init(PurpleConversationHistoryIter *iter,
+		PurpleConversation *conv);
+
+/**
+ * purple_conversation_history_iter_next:
+ * @iter: An initialized #PurpleConversationHistoryIter.
+ * @msg:  (out) (transfer full): Return location for the next message.
+ *
+ * Advances @iter. Messages read back from disk are new #PurpleMessage
+ * objects, so the caller always owns a reference to @msg.
+ *
+ * Returns: %FALSE if the end of the history has been reached.
+ */
+gboolean purple_conversation_history_iter_next(PurpleConversationHistoryIter *iter,
+		PurpleMessage **msg);
+
 /**
  * purple_conversation_clear_message_history:
  * @conv:  The conversation
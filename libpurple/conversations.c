@@ -21,6 +21,8 @@
  */
 #include "internal.h"
 #include "conversations.h"
+#include "debug.h"
+#include "util.h"
 
 static GList *conversations = NULL;
 static GList *ims = NULL;
@@ -33,12 +35,32 @@ static PurpleConversationUiOps *default_ops = NULL;
  */
 static GHashTable *conversation_cache = NULL;
 
+/*
+ * The set of live conversations, so the write path can check a conversation
+ * is still around without walking the conversations list.
+ * PurpleConversation* => PurpleConversation*
+ */
+static GHashTable *conversations_set = NULL;
+
+/*
+ * Chats indexed by account and chat id for purple_conversations_find_chat().
+ * The account stands in for the connection since it outlives it; the
+ * connection is checked on lookup.
+ * struct _purple_hchat => PurpleChatConversation*
+ */
+static GHashTable *chat_cache = NULL;
+
 struct _purple_hconv {
 	gboolean im;
 	char *name;
 	PurpleAccount *account;
 };
 
+struct _purple_hchat {
+	PurpleAccount *account;
+	int id;
+};
+
 static guint
 _purple_conversations_hconv_hash(struct _purple_hconv *hc)
 {
@@ -60,6 +82,49 @@ _purple_conversations_hconv_free_key(struct _purple_hconv *hc)
 	g_free(hc);
 }
 
+static guint
+_purple_conversations_hchat_hash(struct _purple_hchat *hc)
+{
+	return g_direct_hash(hc->account) ^ g_int_hash(&hc->id);
+}
+
+static gboolean
+_purple_conversations_hchat_equal(struct _purple_hchat *hc1,
+		struct _purple_hchat *hc2)
+{
+	return (hc1->account == hc2->account && hc1->id == hc2->id);
+}
+
+static void
+_purple_conversations_chat_cache_add(PurpleChatConversation *chat,
+		PurpleAccount *account, int id)
+{
+	struct _purple_hchat *hc;
+
+	hc = g_new(struct _purple_hchat, 1);
+	hc->account = account;
+	hc->id = id;
+
+	/* The most recently (re)numbered chat wins, like the old list scan
+	 * which found the newest chat first. */
+	g_hash_table_replace(chat_cache, hc, chat);
+}
+
+static void
+_purple_conversations_chat_cache_remove(PurpleChatConversation *chat,
+		PurpleAccount *account, int id)
+{
+	struct _purple_hchat hc;
+
+	hc.account = account;
+	hc.id = id;
+
+	/* Only drop the entry if it is ours; a newer chat may have taken over
+	 * the same id. */
+	if (g_hash_table_lookup(chat_cache, &hc) == chat)
+		g_hash_table_remove(chat_cache, &hc);
+}
+
 void
 purple_conversations_add(PurpleConversation *conv)
 {
@@ -68,17 +133,23 @@ purple_conversations_add(PurpleConversation *conv)
 
 	g_return_if_fail(conv != NULL);
 
-	if (g_list_find(conversations, conv) != NULL)
+	if (g_hash_table_contains(conversations_set, conv))
 		return;
 
+	g_hash_table_add(conversations_set, conv);
 	conversations = g_list_prepend(conversations, conv);
 
-	if (PURPLE_IS_IM_CONVERSATION(conv))
+	account = purple_conversation_get_account(conv);
+
+	if (PURPLE_IS_IM_CONVERSATION(conv)) {
 		ims = g_list_prepend(ims, conv);
-	else
-		chats = g_list_prepend(chats, conv);
+	} else {
+		PurpleChatConversation *chat = PURPLE_CHAT_CONVERSATION(conv);
 
-	account = purple_conversation_get_account(conv);
+		chats = g_list_prepend(chats, conv);
+		_purple_conversations_chat_cache_add(chat, account,
+				purple_chat_conversation_get_id(chat));
+	}
 
 	hc = g_new(struct _purple_hconv, 1);
 	hc->name = g_strdup(purple_normalize(account,
@@ -97,14 +168,22 @@ purple_conversations_remove(PurpleConversation *conv)
 
 	g_return_if_fail(conv != NULL);
 
+	if (!g_hash_table_remove(conversations_set, conv))
+		return;
+
 	conversations = g_list_remove(conversations, conv);
 
-	if (PURPLE_IS_IM_CONVERSATION(conv))
+	account = purple_conversation_get_account(conv);
+
+	if (PURPLE_IS_IM_CONVERSATION(conv)) {
 		ims = g_list_remove(ims, conv);
-	else
-		chats = g_list_remove(chats, conv);
+	} else {
+		PurpleChatConversation *chat = PURPLE_CHAT_CONVERSATION(conv);
 
-	account = purple_conversation_get_account(conv);
+		chats = g_list_remove(chats, conv);
+		_purple_conversations_chat_cache_remove(chat, account,
+				purple_chat_conversation_get_id(chat));
+	}
 
 	hc.name = (gchar *)purple_normalize(account,
 				purple_conversation_get_name(conv));
@@ -140,6 +219,40 @@ _purple_conversations_update_cache(PurpleConversation *conv, const char *name,
 		hc->name = g_strdup(purple_normalize(hc->account, name));
 
 	g_hash_table_insert(conversation_cache, hc, conv);
+
+	if (account && PURPLE_IS_CHAT_CONVERSATION(conv) &&
+			g_hash_table_contains(conversations_set, conv)) {
+		PurpleChatConversation *chat = PURPLE_CHAT_CONVERSATION(conv);
+		int id = purple_chat_conversation_get_id(chat);
+
+		_purple_conversations_chat_cache_remove(chat, old_account, id);
+		_purple_conversations_chat_cache_add(chat, account, id);
+	}
+}
+
+void
+_purple_conversations_update_chat_id(PurpleChatConversation *chat,
+		int old_id, int new_id)
+{
+	PurpleAccount *account;
+
+	g_return_if_fail(chat != NULL);
+
+	/* Chats get their id set while being constructed, before they are
+	 * added; purple_conversations_add() indexes them then. */
+	if (!g_hash_table_contains(conversations_set, chat))
+		return;
+
+	account = purple_conversation_get_account(PURPLE_CONVERSATION(chat));
+
+	_purple_conversations_chat_cache_remove(chat, account, old_id);
+	_purple_conversations_chat_cache_add(chat, account, new_id);
+}
+
+gboolean
+_purple_conversations_contains(PurpleConversation *conv)
+{
+	return g_hash_table_contains(conversations_set, conv);
 }
 
 GList *
@@ -221,16 +334,19 @@ purple_conversations_find_chat_with_account(const char *name,
 PurpleChatConversation *
 purple_conversations_find_chat(const PurpleConnection *gc, int id)
 {
-	GList *l;
+	struct _purple_hchat hc;
 	PurpleChatConversation *chat;
 
-	for (l = purple_conversations_get_chats(); l != NULL; l = l->next) {
-		chat = (PurpleChatConversation *)l->data;
+	g_return_val_if_fail(gc != NULL, NULL);
 
-		if (purple_chat_conversation_get_id(chat) == id &&
-				purple_conversation_get_connection(PURPLE_CONVERSATION(chat)) == gc)
-			return chat;
-	}
+	hc.account = purple_connection_get_account((PurpleConnection *)gc);
+	hc.id = id;
+
+	chat = g_hash_table_lookup(chat_cache, &hc);
+
+	if (chat != NULL &&
+			purple_conversation_get_connection(PURPLE_CONVERSATION(chat)) == gc)
+		return chat;
 
 	return NULL;
 }
@@ -255,6 +371,37 @@ purple_conversations_get_handle(void)
 	return &handle;
 }
 
+/* Spill files are removed along with their conversations, so any that are
+ * left were from a run that didn't get to shut down. */
+static void
+purple_conversations_remove_orphaned_spills(void)
+{
+	gchar *dir = g_build_filename(purple_cache_dir(), "history", NULL);
+	GDir *history = g_dir_open(dir, 0, NULL);
+	const gchar *name;
+
+	if (history != NULL) {
+		while ((name = g_dir_read_name(history)) != NULL) {
+			gchar *path;
+
+			if (!g_str_has_prefix(name, "spill."))
+				continue;
+
+			path = g_build_filename(dir, name, NULL);
+			if (g_unlink(path) != 0) {
+				purple_debug_warning("conversations",
+						"Failed to remove %s: %s\n", path,
+						g_strerror(errno));
+			}
+			g_free(path);
+		}
+
+		g_dir_close(history);
+	}
+
+	g_free(dir);
+}
+
 void
 purple_conversations_init(void)
 {
@@ -263,6 +410,10 @@ purple_conversations_init(void)
 	conversation_cache = g_hash_table_new_full((GHashFunc)_purple_conversations_hconv_hash,
 						(GEqualFunc)_purple_conversations_hconv_equal,
 						(GDestroyNotify)_purple_conversations_hconv_free_key, NULL);
+	conversations_set = g_hash_table_new(g_direct_hash, g_direct_equal);
+	chat_cache = g_hash_table_new_full((GHashFunc)_purple_conversations_hchat_hash,
+						(GEqualFunc)_purple_conversations_hchat_equal,
+						g_free, NULL);
 
 	/**********************************************************************
 	 * Register preferences
@@ -270,6 +421,9 @@ purple_conversations_init(void)
 
 	/* Conversations */
 	purple_prefs_add_none("/purple/conversations");
+	purple_prefs_add_int("/purple/conversations/message_history_size", 1000);
+	purple_prefs_add_bool("/purple/conversations/message_history_spill", FALSE);
+	purple_conversations_remove_orphaned_spills();
 
 	/* Conversations -> Chat */
 	purple_prefs_add_none("/purple/conversations/chat");
@@ -390,6 +544,12 @@ purple_conversations_init(void)
 						 G_TYPE_NONE, 4, PURPLE_TYPE_CHAT_CONVERSATION,
 						 G_TYPE_STRING, G_TYPE_UINT, G_TYPE_BOOLEAN);
 
+	purple_signal_register(handle, "chat-users-joined",
+						 purple_marshal_VOID__POINTER_POINTER_UINT,
+						 G_TYPE_NONE, 3, PURPLE_TYPE_CHAT_CONVERSATION,
+						 G_TYPE_POINTER, /* pointer to a GList of PurpleChatUser */
+						 G_TYPE_BOOLEAN);
+
 	purple_signal_register(handle, "chat-user-flags",
 						 purple_marshal_VOID__POINTER_UINT_UINT, G_TYPE_NONE, 3,
 						 PURPLE_TYPE_CHAT_USER, G_TYPE_UINT, G_TYPE_UINT);
@@ -464,5 +624,7 @@ purple_conversations_uninit(void)
 		g_object_unref(G_OBJECT(conversations->data));
 
 	g_hash_table_destroy(conversation_cache);
+	g_hash_table_destroy(conversations_set);
+	g_hash_table_destroy(chat_cache);
 	purple_signals_unregister_by_instance(purple_conversations_get_handle());
 }
@@ -23,6 +23,7 @@
 #include "conversationtypes.h"
 #include "debug.h"
 #include "enums.h"
+#include "eventloop.h"
 
 #define SEND_TYPED_TIMEOUT_SECONDS 5
 
@@ -65,6 +66,7 @@ G_DEFINE_TYPE_WITH_PRIVATE(PurpleIMConversation, purple_im_conversation,
 typedef struct
 {
 	GList *ignored;     /* Ignored users.                            */
+	GHashTable *ignored_keys; /* Match key => entry in ignored.      */
 	char  *who;         /* The person who set the topic.             */
 	char  *topic;       /* The topic.                                */
 	int    id;          /* The chat ID.                              */
@@ -278,7 +280,7 @@ purple_im_conversation_start_typing_timeout(PurpleIMConversation *im, int timeou
 	if (priv->typing_timeout > 0)
 		purple_im_conversation_stop_typing_timeout(im);
 
-	priv->typing_timeout = g_timeout_add_seconds(timeout, reset_typing_cb, im);
+	priv->typing_timeout = purple_timer_add_seconds(timeout, reset_typing_cb, im);
 }
 
 void
@@ -292,7 +294,7 @@ purple_im_conversation_stop_typing_timeout(PurpleIMConversation *im)
 	if (priv->typing_timeout == 0)
 		return;
 
-	g_source_remove(priv->typing_timeout);
+	purple_timer_remove(priv->typing_timeout);
 	priv->typing_timeout = 0;
 }
 
@@ -340,7 +342,7 @@ purple_im_conversation_start_send_typed_timeout(PurpleIMConversation *im)
 	g_return_if_fail(PURPLE_IS_IM_CONVERSATION(im));
 
 	priv = purple_im_conversation_get_instance_private(im);
-	priv->send_typed_timeout = g_timeout_add_seconds(SEND_TYPED_TIMEOUT_SECONDS,
+	priv->send_typed_timeout = purple_timer_add_seconds(SEND_TYPED_TIMEOUT_SECONDS,
 	                                                    send_typed_cb, im);
 }
 
@@ -355,7 +357,7 @@ purple_im_conversation_stop_send_typed_timeout(PurpleIMConversation *im)
 	if (priv->send_typed_timeout == 0)
 		return;
 
-	g_source_remove(priv->send_typed_timeout);
+	purple_timer_remove(priv->send_typed_timeout);
 	priv->send_typed_timeout = 0;
 }
 
@@ -657,6 +659,72 @@ purple_chat_conversation_unignore(PurpleChatConversation *chat, const char *name
 		g_list_delete_link(priv->ignored, item));
 }
 
+/*
+ * The key two names compare equal on with purple_utf8_strcasecmp(), or NULL
+ * if the name isn't valid UTF-8 (and so never matches anything).
+ */
+static gchar *
+chat_conversation_ignore_key(const char *name)
+{
+	gchar *folded, *key;
+
+	if (!g_utf8_validate(name, -1, NULL))
+		return NULL;
+
+	folded = g_utf8_casefold(name, -1);
+	key = g_utf8_collate_key(folded, -1);
+	g_free(folded);
+
+	return key;
+}
+
+static void
+chat_conversation_index_ignored_name(GHashTable *keys, const char *name,
+                                     const char *ign)
+{
+	gchar *key = chat_conversation_ignore_key(name);
+
+	/* The first entry in the list wins, as it would in a scan. */
+	if (key != NULL && !g_hash_table_contains(keys, key))
+		g_hash_table_insert(keys, key, (gpointer)ign);
+	else
+		g_free(key);
+}
+
+/*
+ * Indexes each ignored entry under every name it matches: the entry itself,
+ * and the entry without its "+", "%", "@" or "@+" prefix.
+ */
+static void
+chat_conversation_index_ignored(PurpleChatConversationPrivate *priv)
+{
+	GList *l;
+
+	g_clear_pointer(&priv->ignored_keys, g_hash_table_destroy);
+
+	if (priv->ignored == NULL)
+		return;
+
+	priv->ignored_keys = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+
+	for (l = priv->ignored; l != NULL; l = l->next) {
+		const char *ign = l->data;
+
+		chat_conversation_index_ignored_name(priv->ignored_keys, ign, ign);
+
+		if (*ign == '+' || *ign == '%')
+			chat_conversation_index_ignored_name(priv->ignored_keys,
+					ign + 1, ign);
+		else if (*ign == '@' && ign[1] == '+')
+			chat_conversation_index_ignored_name(priv->ignored_keys,
+					ign + 2, ign + 1);
+		else if (*ign == '@')
+			chat_conversation_index_ignored_name(priv->ignored_keys,
+					ign + 1, ign + 1);
+	}
+}
+
 GList *
 purple_chat_conversation_set_ignored(PurpleChatConversation *chat, GList *ignored)
 {
@@ -666,6 +734,7 @@ purple_chat_conversation_set_ignored(PurpleChatConversation *chat, GList *ignore
 
 	priv = purple_chat_conversation_get_instance_private(chat);
 	priv->ignored = ignored;
+	chat_conversation_index_ignored(priv);
 	return ignored;
 }
 
@@ -683,31 +752,26 @@ purple_chat_conversation_get_ignored(PurpleChatConversation *chat)
 const char *
 purple_chat_conversation_get_ignored_user(PurpleChatConversation *chat, const char *user)
 {
-	GList *ignored;
+	PurpleChatConversationPrivate *priv = NULL;
+	const char *ign;
+	gchar *key;
 
 	g_return_val_if_fail(PURPLE_IS_CHAT_CONVERSATION(chat), NULL);
 	g_return_val_if_fail(user != NULL, NULL);
 
-	for (ignored = purple_chat_conversation_get_ignored(chat);
-		 ignored != NULL;
-		 ignored = ignored->next) {
-
-		const char *ign = (const char *)ignored->data;
+	priv = purple_chat_conversation_get_instance_private(chat);
 
-		if (!purple_utf8_strcasecmp(user, ign) ||
-			((*ign == '+' || *ign == '%') && !purple_utf8_strcasecmp(user, ign + 1)))
-			return ign;
+	if (priv->ignored_keys == NULL)
+		return NULL;
 
-		if (*ign == '@') {
-			ign++;
+	key = chat_conversation_ignore_key(user);
+	if (key == NULL)
+		return NULL;
 
-			if ((*ign == '+' && !purple_utf8_strcasecmp(user, ign + 1)) ||
-				(*ign != '+' && !purple_utf8_strcasecmp(user, ign)))
-				return ign;
-		}
-	}
+	ign = g_hash_table_lookup(priv->ignored_keys, key);
+	g_free(key);
 
-	return NULL;
+	return ign;
 }
 
 gboolean
@@ -778,6 +842,10 @@ purple_chat_conversation_set_id(PurpleChatConversation *chat, int id)
 	g_return_if_fail(PURPLE_IS_CHAT_CONVERSATION(chat));
 
 	priv = purple_chat_conversation_get_instance_private(chat);
+
+	if (priv->id != id)
+		_purple_conversations_update_chat_id(chat, priv->id, id);
+
 	priv->id = id;
 
 	g_object_notify_by_pspec(G_OBJECT(chat), chat_properties[CHAT_PROP_ID]);
@@ -852,6 +920,7 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 	PurpleProtocol *protocol;
 	GList *ul, *fl;
 	GList *cbuddies = NULL;
+	gboolean unique_chatname;
 
 	g_return_if_fail(PURPLE_IS_CHAT_CONVERSATION(chat));
 	g_return_if_fail(users != NULL);
@@ -866,6 +935,8 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 	protocol = purple_connection_get_protocol(gc);
 	g_return_if_fail(PURPLE_IS_PROTOCOL(protocol));
 
+	unique_chatname = (purple_protocol_get_options(protocol) & OPT_PROTO_UNIQUE_CHATNAME);
+
 	ul = users;
 	fl = flags;
 	while ((ul != NULL) && (fl != NULL)) {
@@ -875,7 +946,7 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 		PurpleChatUserFlags flag = GPOINTER_TO_INT(fl->data);
 		const char *extra_msg = (extra_msgs ? extra_msgs->data : NULL);
 
-		if(!(purple_protocol_get_options(protocol) & OPT_PROTO_UNIQUE_CHATNAME)) {
+		if (!unique_chatname) {
 			if (purple_strequal(priv->nick, purple_normalize(account, user))) {
 				const char *alias2 = purple_account_get_private_alias(account);
 				if (alias2 != NULL)
@@ -888,7 +959,7 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 				}
 			} else {
 				PurpleBuddy *buddy;
-				if ((buddy = purple_blist_find_buddy(purple_connection_get_account(gc), user)) != NULL)
+				if ((buddy = purple_blist_find_buddy(account, user)) != NULL)
 					alias = purple_buddy_get_contact_alias(buddy);
 			}
 		}
@@ -937,6 +1008,9 @@ purple_chat_conversation_add_users(PurpleChatConversation *chat, GList *users, G
 	if (ops != NULL && ops->chat_add_users != NULL)
 		ops->chat_add_users(chat, cbuddies, new_arrivals);
 
+	purple_signal_emit(purple_conversations_get_handle(),
+					 "chat-users-joined", chat, cbuddies, new_arrivals);
+
 	g_list_free(cbuddies);
 }
 
@@ -1481,6 +1555,7 @@ purple_chat_conversation_finalize(GObject *object)
 
 	g_list_free_full(priv->ignored, g_free);
 	priv->ignored = NULL;
+	g_clear_pointer(&priv->ignored_keys, g_hash_table_destroy);
 
 	g_free(priv->who);
 	g_free(priv->topic);
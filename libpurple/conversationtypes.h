@@ -506,6 +506,10 @@ void purple_chat_conversation_add_user(PurpleChatConversation *chat, const char
  *
  * Adds a list of users to a chat.
  *
+ * Adding a whole room's worth of users in one call, rather than one
+ * purple_chat_conversation_add_user() each, lets the UI fill its list in a
+ * single pass and emits the "chat-users-joined" signal once.
+ *
  * The data is copied from @users, @extra_msgs, and @flags, so it is up to
  * the caller to free this list after calling this function.
  */
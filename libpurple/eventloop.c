@@ -96,3 +96,313 @@ purple_input_pipe(int pipefd[2])
 	return pipe(pipefd);
 #endif
 }
+
+/**************************************************************************
+ * Timer wheel
+ **************************************************************************/
+/*
+ * All purple_timer_add() timers live in one hierarchical timing wheel
+ * driven by a single GSource, instead of one GSource each. Level 0 has one
+ * slot per tick; each further level has slots TIMER_WHEEL_SIZE times as
+ * wide. Timers are filed by how far away they are and cascade down a level
+ * whenever the level below wraps around, so adding, removing and expiring
+ * a timer are all constant time, and the main loop only ever sees one
+ * source with one ready time.
+ */
+#define TIMER_WHEEL_TICK_MS  100
+#define TIMER_WHEEL_TICK_US  (TIMER_WHEEL_TICK_MS * 1000)
+#define TIMER_WHEEL_BITS     6
+#define TIMER_WHEEL_SIZE     (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK     (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS   4
+#define TIMER_WHEEL_SPAN     ((guint64)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct {
+	guint handle;
+	guint64 expires;            /* The tick to run on.                 */
+	guint interval;             /* In ticks.                           */
+	GSourceFunc function;
+	gpointer data;
+
+	GList link;                 /* Our node in slot.                   */
+	GQueue *slot;               /* NULL while running.                 */
+	gboolean removed;           /* Removed from its own callback.      */
+} PurpleTimer;
+
+typedef struct {
+	GSource source;
+
+	gint64 epoch;               /* Monotonic time of tick 0.           */
+	guint64 now;                /* The last tick that has been run.    */
+	guint64 next;               /* The tick the source will wake on.   */
+
+	GQueue slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+	GHashTable *timers;         /* handle => PurpleTimer               */
+	guint last_handle;
+} PurpleTimerWheel;
+
+static PurpleTimerWheel *timer_wheel = NULL;
+
+static guint64
+timer_wheel_clock(PurpleTimerWheel *wheel, gint64 time)
+{
+	return (time - wheel->epoch) / TIMER_WHEEL_TICK_US;
+}
+
+/* The first tick that starts at or after time. */
+static guint64
+timer_wheel_clock_ceil(PurpleTimerWheel *wheel, gint64 time)
+{
+	return (time - wheel->epoch + TIMER_WHEEL_TICK_US - 1) /
+		TIMER_WHEEL_TICK_US;
+}
+
+static void
+timer_wheel_set_next(PurpleTimerWheel *wheel, guint64 next)
+{
+	wheel->next = next;
+
+	if (next == G_MAXUINT64) {
+		g_source_set_ready_time(&wheel->source, -1);
+	} else {
+		g_source_set_ready_time(&wheel->source,
+			wheel->epoch + next * TIMER_WHEEL_TICK_US);
+	}
+}
+
+static void
+timer_wheel_insert(PurpleTimerWheel *wheel, PurpleTimer *timer)
+{
+	guint64 expires = MAX(timer->expires, wheel->now);
+	guint64 delta = expires - wheel->now;
+	GQueue *slot;
+	int level;
+
+	if (delta >= TIMER_WHEEL_SPAN) {
+		/* Park it in the farthest slot; it gets refiled on cascade. */
+		expires = wheel->now + TIMER_WHEEL_SPAN - 1;
+		delta = TIMER_WHEEL_SPAN - 1;
+	}
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < ((guint64)1 << (TIMER_WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	slot = &wheel->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) &
+	                            TIMER_WHEEL_MASK];
+	g_queue_push_tail_link(slot, &timer->link);
+	timer->slot = slot;
+}
+
+static void
+timer_wheel_cascade(PurpleTimerWheel *wheel, int level)
+{
+	GQueue *slot;
+	GList *link;
+
+	slot = &wheel->slots[level][(wheel->now >> (TIMER_WHEEL_BITS * level)) &
+	                            TIMER_WHEEL_MASK];
+
+	while ((link = g_queue_pop_head_link(slot)) != NULL)
+		timer_wheel_insert(wheel, link->data);
+}
+
+static void
+timer_wheel_run_tick(PurpleTimerWheel *wheel)
+{
+	GQueue *slot;
+	GList *link;
+	int level;
+
+	wheel->now++;
+
+	for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		if ((wheel->now >> (TIMER_WHEEL_BITS * (level - 1))) &
+				TIMER_WHEEL_MASK)
+			break;
+		timer_wheel_cascade(wheel, level);
+	}
+
+	/* Nothing can be added to this slot while it runs: new and re-armed
+	 * timers always expire after the current tick. */
+	slot = &wheel->slots[0][wheel->now & TIMER_WHEEL_MASK];
+	while ((link = g_queue_pop_head_link(slot)) != NULL) {
+		PurpleTimer *timer = link->data;
+		gboolean again;
+
+		timer->slot = NULL;
+
+		if (timer->expires > wheel->now) {
+			/* Parked from beyond the span of the wheel. */
+			timer_wheel_insert(wheel, timer);
+			continue;
+		}
+
+		again = timer->function(timer->data);
+
+		if (again && !timer->removed) {
+			timer->expires = wheel->now + timer->interval;
+			timer_wheel_insert(wheel, timer);
+			continue;
+		}
+
+		if (timer->removed)
+			g_free(timer);
+		else
+			g_hash_table_remove(wheel->timers, GUINT_TO_POINTER(timer->handle));
+	}
+}
+
+/* Wakes on the next tick with anything to run, or where level 0 wraps and
+ * the next cascade might bring something down. */
+static void
+timer_wheel_schedule(PurpleTimerWheel *wheel)
+{
+	guint64 tick, boundary;
+
+	if (g_hash_table_size(wheel->timers) == 0) {
+		timer_wheel_set_next(wheel, G_MAXUINT64);
+		return;
+	}
+
+	boundary = (wheel->now | TIMER_WHEEL_MASK) + 1;
+	for (tick = wheel->now + 1; tick < boundary; tick++) {
+		if (!g_queue_is_empty(&wheel->slots[0][tick & TIMER_WHEEL_MASK]))
+			break;
+	}
+
+	timer_wheel_set_next(wheel, tick);
+}
+
+static gboolean
+timer_wheel_dispatch(GSource *source, GSourceFunc callback, gpointer data)
+{
+	PurpleTimerWheel *wheel = (PurpleTimerWheel *)source;
+	guint64 target = timer_wheel_clock(wheel, g_source_get_time(source));
+
+	while (wheel->now < target)
+		timer_wheel_run_tick(wheel);
+
+	timer_wheel_schedule(wheel);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+timer_wheel_finalize(GSource *source)
+{
+	PurpleTimerWheel *wheel = (PurpleTimerWheel *)source;
+
+	g_hash_table_destroy(wheel->timers);
+}
+
+static GSourceFuncs timer_wheel_funcs = {
+	NULL,
+	NULL,
+	timer_wheel_dispatch,
+	timer_wheel_finalize,
+	NULL,
+	NULL
+};
+
+static PurpleTimerWheel *
+timer_wheel_get(void)
+{
+	GSource *source;
+	int level, i;
+
+	if (timer_wheel != NULL)
+		return timer_wheel;
+
+	source = g_source_new(&timer_wheel_funcs, sizeof(PurpleTimerWheel));
+	g_source_set_name(source, "[purple] timer wheel");
+
+	timer_wheel = (PurpleTimerWheel *)source;
+	timer_wheel->epoch = g_get_monotonic_time();
+	timer_wheel->now = 0;
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for (i = 0; i < TIMER_WHEEL_SIZE; i++)
+			g_queue_init(&timer_wheel->slots[level][i]);
+	}
+	/* The timers are freed by whoever removes them. */
+	timer_wheel->timers = g_hash_table_new_full(g_direct_hash,
+			g_direct_equal, NULL, g_free);
+	timer_wheel_set_next(timer_wheel, G_MAXUINT64);
+
+	g_source_attach(source, NULL);
+	g_source_unref(source);
+
+	return timer_wheel;
+}
+
+guint
+purple_timer_add(guint interval, GSourceFunc function, gpointer data)
+{
+	PurpleTimerWheel *wheel;
+	PurpleTimer *timer;
+	guint64 boundary;
+
+	g_return_val_if_fail(function != NULL, 0);
+
+	wheel = timer_wheel_get();
+
+	timer = g_new0(PurpleTimer, 1);
+	timer->interval = MAX(1,
+		(interval + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS);
+	/* Round the deadline up, not the current time down, so the first call
+	 * is never early. */
+	timer->expires = MAX(wheel->now + 1, timer_wheel_clock_ceil(wheel,
+		g_get_monotonic_time() + (gint64)interval * 1000));
+	timer->function = function;
+	timer->data = data;
+	timer->link.data = timer;
+
+	do {
+		timer->handle = ++wheel->last_handle;
+	} while (timer->handle == 0 || g_hash_table_contains(wheel->timers,
+			GUINT_TO_POINTER(timer->handle)));
+
+	g_hash_table_insert(wheel->timers, GUINT_TO_POINTER(timer->handle), timer);
+	timer_wheel_insert(wheel, timer);
+
+	/* Wake up in time for it, or for the cascade that brings it down. */
+	boundary = (wheel->now | TIMER_WHEEL_MASK) + 1;
+	if (MIN(timer->expires, boundary) < wheel->next)
+		timer_wheel_set_next(wheel, MIN(timer->expires, boundary));
+
+	return timer->handle;
+}
+
+guint
+purple_timer_add_seconds(guint interval, GSourceFunc function, gpointer data)
+{
+	g_return_val_if_fail(interval <= G_MAXUINT / 1000, 0);
+
+	return purple_timer_add(interval * 1000, function, data);
+}
+
+gboolean
+purple_timer_remove(guint handle)
+{
+	PurpleTimer *timer;
+
+	if (timer_wheel == NULL || handle == 0)
+		return FALSE;
+
+	timer = g_hash_table_lookup(timer_wheel->timers, GUINT_TO_POINTER(handle));
+	if (timer == NULL)
+		return FALSE;
+
+	if (timer->slot == NULL) {
+		/* It's running; timer_wheel_run_tick() frees it afterwards. */
+		timer->removed = TRUE;
+		g_hash_table_steal(timer_wheel->timers, GUINT_TO_POINTER(handle));
+		return TRUE;
+	}
+
+	g_queue_unlink(timer->slot, &timer->link);
+	g_hash_table_remove(timer_wheel->timers, GUINT_TO_POINTER(handle));
+
+	return TRUE;
+}
@@ -106,6 +106,55 @@ gboolean purple_input_remove(guint handle);
 int
 purple_input_pipe(int pipefd[2]);
 
+/**
+ * purple_timer_add:
+ * @interval: The time between calls to @function, in milliseconds.
+ * @function: (scope call): The function to call.
+ * @data:     Data to pass to @function.
+ *
+ * Creates a timer that calls @function every @interval milliseconds until
+ * it returns %FALSE or is removed with purple_timer_remove().
+ *
+ * Timers run on 100 millisecond ticks. The first call happens on the first
+ * tick at least @interval milliseconds after the timer is added, so it is
+ * never early but may be up to 100 milliseconds late. Later calls are due
+ * @interval milliseconds, rounded up to a multiple of 100, after the tick
+ * the previous call was due on.
+ *
+ * Unlike g_timeout_add(), all of these timers share a single #GSource, so
+ * large numbers of them can be added and removed cheaply. Use it for
+ * coarse, frequently re-armed timeouts such as keepalives and typing
+ * notifications.
+ *
+ * Returns: A handle for purple_timer_remove() (greater than 0). It is
+ *          not a #GSource ID and must not be passed to g_source_remove().
+ */
+guint purple_timer_add(guint interval, GSourceFunc function, gpointer data);
+
+/**
+ * purple_timer_add_seconds:
+ * @interval: The time between calls to @function, in seconds.
+ * @function: (scope call): The function to call.
+ * @data:     Data to pass to @function.
+ *
+ * The same as purple_timer_add(), but with the interval in seconds.
+ *
+ * Returns: A handle for purple_timer_remove() (greater than 0).
+ */
+guint purple_timer_add_seconds(guint interval, GSourceFunc function,
+                               gpointer data);
+
+/**
+ * purple_timer_remove:
+ * @handle: The handle returned by purple_timer_add() or
+ *          purple_timer_add_seconds().
+ *
+ * Removes a timer. It is safe to call this from the timer's own function.
+ *
+ * Returns: %TRUE if the timer was found and removed.
+ */
+gboolean purple_timer_remove(guint handle);
+
 G_END_DECLS
 
 #endif /* PURPLE_EVENTLOOP_H */
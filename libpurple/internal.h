@@ -270,6 +270,19 @@ void _purple_connection_add_active_chat(PurpleConnection *gc,
 void _purple_connection_remove_active_chat(PurpleConnection *gc,
                                            PurpleChatConversation *chat);
 
+/**
+ * _purple_connection_has_active_chat:
+ * @gc:    The connection
+ * @chat:  The chat conversation to look for
+ *
+ * Checks, in constant time, whether a chat is in the active chats list of a
+ * connection.
+ *
+ * Returns: %TRUE if @chat is active on @gc.
+ */
+gboolean _purple_connection_has_active_chat(PurpleConnection *gc,
+                                            PurpleChatConversation *chat);
+
 /**
  * _purple_conversations_update_cache:
  * @conv:    The conversation.
@@ -286,6 +299,32 @@ void _purple_connection_remove_active_chat(PurpleConnection *gc,
 void _purple_conversations_update_cache(PurpleConversation *conv,
 		const char *name, PurpleAccount *account);
 
+/**
+ * _purple_conversations_update_chat_id:
+ * @chat:   The chat conversation.
+ * @old_id: The chat's previous id.
+ * @new_id: The chat's new id.
+ *
+ * Moves a chat to its new id in the index used by
+ * purple_conversations_find_chat().
+ *
+ * Note: This function should only be called by
+ *       purple_chat_conversation_set_id() in conversationtypes.c.
+ */
+void _purple_conversations_update_chat_id(PurpleChatConversation *chat,
+		int old_id, int new_id);
+
+/**
+ * _purple_conversations_contains:
+ * @conv: The conversation.
+ *
+ * Checks, in constant time, whether a conversation is still in the
+ * conversations list.
+ *
+ * Returns: %TRUE if @conv has been added and not yet removed.
+ */
+gboolean _purple_conversations_contains(PurpleConversation *conv);
+
 /**
  * _purple_statuses_get_primitive_scores:
  *
@@ -320,6 +359,24 @@ _purple_blist_get_localized_default_group_name(void);
 gboolean
 _purple_network_set_common_socket_flags(int fd);
 
+/**
+ * _purple_util_write_file:
+ * @filename_full: The absolute path of the file to write.
+ * @data:          The data to write.
+ * @size:          The length of @data, or -1 if it is nul-terminated.
+ * @error:         Return location for a #GError, or %NULL.
+ *
+ * Replaces a file with @data, like purple_util_write_data_to_file_absolute(),
+ * creating its directory first if needed.  It doesn't log anything, so unlike
+ * the rest of the util file API it may be used from a worker thread; the
+ * caller reports @error from the main thread.
+ *
+ * Returns: %TRUE if the file was written.
+ */
+gboolean
+_purple_util_write_file(const char *filename_full, const char *data,
+                        gssize size, GError **error);
+
 /**
  * A fstat alternative, like g_stat for stat.
  *
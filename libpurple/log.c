@@ -21,6 +21,7 @@
 
 #include "internal.h"
 #include "account.h"
+#include "accounts.h"
 #include "debug.h"
 #include "glibcompat.h" /* for purple_g_stat on win32 */
 #include "image-store.h"
@@ -37,14 +38,126 @@ static PurpleLogLogger *txt_logger;
 static PurpleLogLogger *old_logger;
 
 struct _purple_logsize_user {
-	char *name;
+	/* Normalized.  Owned by stored keys, borrowed by lookup keys. */
+	const char *name;
 	PurpleAccount *account;
+	PurpleLogType type;
 };
+
+/* Persistent index of the built-in loggers' files.  It is keyed by the log
+ * directory (relative to the logs root), saved to logindex.xml and refreshed
+ * by a worker thread, so size and activity queries never hit the disk on the
+ * main thread. */
+#define LOG_INDEX_FILE "logindex.xml"
+
+typedef struct {
+	gchar *dir;
+	gint size;              /* Bytes in html, txt and old format logs. */
+	guint count;            /* Number of html and txt logs. */
+	gint64 last_activity;   /* Start of the newest log. */
+	gdouble score;          /* Activity score as of score_time. */
+	gint64 score_time;
+
+	/* Other loggers can't be called from the worker, so they are asked
+	 * once per session and their share isn't saved. */
+	gint extra_size;
+	gdouble extra_score;
+	gint64 extra_time;
+
+	/* Who the entry was last looked up for, set once it's in the view and
+	 * cleared when that account is removed. */
+	PurpleAccount *account;
+	gchar *name;
+	PurpleLogType type;
+
+	/* Bytes and new files written this session, so scan results can be
+	 * merged with what purple_log_write added while the scan ran. */
+	gint written;
+	guint created;
+
+	gboolean dirty;         /* In log_index_dirty. */
+} PurpleLogIndexEntry;
+
+typedef struct {
+	gchar *dir;
+	gchar *path;            /* Absolute log directory, or index file. */
+	gchar *old_path;        /* Old flat format log, if that logger is used. */
+	gboolean html;
+	gboolean txt;
+
+	/* The entry's written and created counts when the scan was queued. */
+	gint written;
+	guint created;
+
+	gint size;
+	guint count;
+	gint64 last_activity;
+	gdouble score;
+	gint64 score_time;
+
+	GList *entries;         /* Set for save jobs: copies of changed entries. */
+	GError *error;          /* Set by the worker, logged by the main loop. */
+} PurpleLogIndexJob;
+
+static GHashTable *log_index = NULL;
+static GThreadPool *log_index_pool = NULL;
+static gint log_index_cancelled = 0;
+static guint log_index_save_timer = 0;
+
+/* Entries changed since the last save. */
+static GPtrArray *log_index_dirty = NULL;
+
+/* The worker's copy of the index as last saved, so a save only has to hand
+ * it the changed entries.  Filled in by log_index_load before the worker
+ * starts. */
+static GHashTable *log_index_saved = NULL;
+
+/* A view over log_index, for lookups by (name, account, type).  Values are
+ * owned by log_index. */
 static GHashTable *logsize_users = NULL;
-static GHashTable *logsize_users_decayed = NULL;
+
+/* Buffered log writer.  When enabled, the html and txt loggers queue their
+ * formatted records in memory and a worker thread writes them out in
+ * batches, instead of calling fflush() after every message. */
+typedef struct {
+	gint ref;
+	GMutex lock;            /* Protects file, pending and error. */
+	FILE *file;
+	GString *pending;
+	gint error;             /* errno of the last failed write, or 0. */
+	gboolean queued;        /* Protected by writer_lock. */
+} PurpleLogWriteBuffer;
+
+static GMutex writer_lock;
+static GCond writer_cond;
+static GThread *writer_thread = NULL;
+static GQueue writer_queue = G_QUEUE_INIT;
+static gboolean writer_quit = FALSE;
+static gsize writer_pending_bytes = 0;
+static guint writer_flush_interval = 5;
+static gsize writer_flush_threshold = 64 * 1024;
+static gint64 writer_last_flush_latency = 0;
+static gint64 writer_max_flush_latency = 0;
 
 static void log_get_log_sets_common(GHashTable *sets);
 
+static void log_writer_stop(void);
+
+static PurpleLogIndexEntry *log_index_find(PurpleLogType type,
+		const char *name, PurpleAccount *account);
+static PurpleLogIndexEntry *log_index_get(PurpleLogType type,
+		const char *name, PurpleAccount *account);
+static void log_index_queue_scan(PurpleLogIndexEntry *entry);
+static void log_index_schedule_save(PurpleLogIndexEntry *entry);
+static gdouble log_index_decay(gdouble score, gint64 since, gint64 now);
+static void log_index_entry_free(PurpleLogIndexEntry *entry);
+static gboolean log_index_save_cb(gpointer data);
+static gchar *log_index_to_xml(GHashTable *index);
+static void log_index_account_removed_cb(PurpleAccount *account, gpointer data);
+static void log_index_load(void);
+static void log_writer_pref_cb(const char *name, PurplePrefType type,
+                               gconstpointer value, gpointer data);
+
 static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
                                const char *from, GDateTime *time, const char *message);
 static void html_logger_finalize(PurpleLog *log);
@@ -111,42 +224,36 @@ void purple_log_free(PurpleLog *log)
 void purple_log_write(PurpleLog *log, PurpleMessageFlags type,
                       const char *from, GDateTime *time, const char *message)
 {
-	struct _purple_logsize_user *lu;
-	gsize written, total = 0;
-	gpointer ptrsize;
+	PurpleLogIndexEntry *entry;
+	gboolean new_file;
+	gsize written;
 
 	g_return_if_fail(log);
 	g_return_if_fail(log->logger);
 	g_return_if_fail(log->logger->write);
 
-	written = (log->logger->write)(log, type, from, time, message);
-
-	lu = g_new(struct _purple_logsize_user, 1);
-
-	lu->name = g_strdup(purple_normalize(log->account, log->name));
-	lu->account = log->account;
+	/* The common loggers create their file on the first write. */
+	new_file = (log->logger_data == NULL &&
+			(log->logger == html_logger || log->logger == txt_logger));
 
-	if(g_hash_table_lookup_extended(logsize_users, lu, NULL, &ptrsize)) {
-		char *tmp = lu->name;
-
-		total = GPOINTER_TO_INT(ptrsize);
-		total += written;
-		g_hash_table_replace(logsize_users, lu, GINT_TO_POINTER(total));
-
-		/* The hash table takes ownership of lu, so create a new one
-		 * for the logsize_users_decayed check below. */
-		lu = g_new(struct _purple_logsize_user, 1);
-		lu->name = g_strdup(tmp);
-		lu->account = log->account;
-	}
+	written = (log->logger->write)(log, type, from, time, message);
 
-	if(g_hash_table_lookup_extended(logsize_users_decayed, lu, NULL, &ptrsize)) {
-		total = GPOINTER_TO_INT(ptrsize);
-		total += written;
-		g_hash_table_replace(logsize_users_decayed, lu, GINT_TO_POINTER(total));
-	} else {
-		g_free(lu->name);
-		g_free(lu);
+	entry = log_index_find(log->type, log->name, log->account);
+	if (entry != NULL && written > 0) {
+		gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+
+		entry->size += written;
+		entry->written += written;
+		entry->score = log_index_decay(entry->score, entry->score_time,
+				now) + written;
+		entry->score_time = now;
+		if (new_file) {
+			entry->count++;
+			entry->created++;
+			if (log->time != NULL)
+				entry->last_activity = g_date_time_to_unix(log->time);
+		}
+		log_index_schedule_save(entry);
 	}
 }
 
@@ -173,107 +280,57 @@ int purple_log_get_size(PurpleLog *log)
 
 static guint _purple_logsize_user_hash(struct _purple_logsize_user *lu)
 {
-	return g_str_hash(lu->name);
+	return g_str_hash(lu->name) ^ g_direct_hash(lu->account) ^ lu->type;
 }
 
 static guint _purple_logsize_user_equal(struct _purple_logsize_user *lu1,
 		struct _purple_logsize_user *lu2)
 {
-	return (lu1->account == lu2->account && purple_strequal(lu1->name, lu2->name));
+	return (lu1->account == lu2->account &&
+			purple_strequal(lu1->name, lu2->name) && lu1->type == lu2->type);
 }
 
 static void _purple_logsize_user_free_key(struct _purple_logsize_user *lu)
 {
-	g_free(lu->name);
+	g_free((char *)lu->name);
 	g_free(lu);
 }
 
-int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+static struct _purple_logsize_user *
+_purple_logsize_user_dup(const struct _purple_logsize_user *lu)
 {
-	gpointer ptrsize;
-	int size = 0;
-	GSList *n;
-	struct _purple_logsize_user *lu;
+	struct _purple_logsize_user *copy;
 
-	lu = g_new(struct _purple_logsize_user, 1);
-	lu->name = g_strdup(purple_normalize(account, name));
-	lu->account = account;
+	copy = g_memdup(lu, sizeof(struct _purple_logsize_user));
+	copy->name = g_strdup(lu->name);
 
-	if(g_hash_table_lookup_extended(logsize_users, lu, NULL, &ptrsize)) {
-		size = GPOINTER_TO_INT(ptrsize);
-		g_free(lu->name);
-		g_free(lu);
-	} else {
-		for (n = loggers; n; n = n->next) {
-			PurpleLogLogger *logger = n->data;
-
-			if(logger->total_size){
-				size += (logger->total_size)(type, name, account);
-			} else if(logger->list) {
-				GList *logs = (logger->list)(type, name, account);
-				int this_size = 0;
-
-				while (logs) {
-					PurpleLog *log = (PurpleLog*)(logs->data);
-					this_size += purple_log_get_size(log);
-					purple_log_free(log);
-					logs = g_list_delete_link(logs, logs);
-				}
+	return copy;
+}
 
-				size += this_size;
-			}
-		}
+int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	PurpleLogIndexEntry *entry;
 
-		g_hash_table_replace(logsize_users, lu, GINT_TO_POINTER(size));
-	}
-	return size;
+	entry = log_index_get(type, name, account);
+	if (entry == NULL)
+		return 0;
+
+	return entry->size + entry->extra_size;
 }
 
 gint purple_log_get_activity_score(PurpleLogType type, const char *name, PurpleAccount *account)
 {
-	gpointer ptrscore;
-	int score;
-	GSList *n;
-	struct _purple_logsize_user *lu;
+	PurpleLogIndexEntry *entry;
+	gint64 now;
 
-	lu = g_new(struct _purple_logsize_user, 1);
-	lu->name = g_strdup(purple_normalize(account, name));
-	lu->account = account;
+	entry = log_index_get(type, name, account);
+	if (entry == NULL)
+		return 0;
 
-	if(g_hash_table_lookup_extended(logsize_users_decayed, lu, NULL, &ptrscore)) {
-		score = GPOINTER_TO_INT(ptrscore);
-		g_free(lu->name);
-		g_free(lu);
-	} else {
-		GDateTime *now = g_date_time_new_now_utc();
-		double score_double = 0.0;
-		for (n = loggers; n; n = n->next) {
-			PurpleLogLogger *logger = n->data;
-
-			if(logger->list) {
-				GList *logs = (logger->list)(type, name, account);
-
-				while (logs) {
-					PurpleLog *log = (PurpleLog*)(logs->data);
-					if (!log) {
-						g_warn_if_reached();
-						continue;
-					}
-					/* Activity score counts bytes in the log, exponentially
-					   decayed with a half-life of 14 days. */
-					score_double += purple_log_get_size(log) *
-						pow(0.5, g_date_time_difference(now, log->time)/(14LL*G_TIME_SPAN_DAY));
-					purple_log_free(log);
-					logs = g_list_delete_link(logs, logs);
-				}
-			}
-		}
-		g_date_time_unref(now);
+	now = g_get_real_time() / G_USEC_PER_SEC;
 
-		score = (gint) ceil(score_double);
-		g_hash_table_replace(logsize_users_decayed, lu, GINT_TO_POINTER(score));
-	}
-	return score;
+	return (gint)ceil(log_index_decay(entry->score, entry->score_time, now) +
+			log_index_decay(entry->extra_score, entry->extra_time, now));
 }
 
 gboolean purple_log_is_deletable(PurpleLog *log)
@@ -295,8 +352,18 @@ gboolean purple_log_delete(PurpleLog *log)
 	g_return_val_if_fail(log != NULL, FALSE);
 	g_return_val_if_fail(log->logger != NULL, FALSE);
 
-	if (log->logger->remove != NULL)
-		return log->logger->remove(log);
+	if (log->logger->remove != NULL) {
+		PurpleLogIndexEntry *entry;
+
+		if (!log->logger->remove(log))
+			return FALSE;
+
+		entry = log_index_find(log->type, log->name, log->account);
+		if (entry != NULL)
+			log_index_queue_scan(entry);
+
+		return TRUE;
+	}
 
 	return FALSE;
 }
@@ -609,6 +676,10 @@ void purple_log_init(void)
 
 	purple_prefs_add_string("/purple/logging/format", "html");
 
+	purple_prefs_add_bool("/purple/logging/buffered_writes", FALSE);
+	purple_prefs_add_int("/purple/logging/flush_interval", 5);
+	purple_prefs_add_int("/purple/logging/flush_threshold", 64);
+
 	html_logger = purple_log_logger_new("html", _("HTML"), 11,
 									  NULL,
 									  html_logger_write,
@@ -660,18 +731,61 @@ void purple_log_init(void)
 							    logger_pref_cb, NULL);
 	purple_prefs_trigger_callback("/purple/logging/format");
 
+	purple_prefs_connect_callback(handle, "/purple/logging/buffered_writes",
+	                              log_writer_pref_cb, NULL);
+	purple_prefs_connect_callback(handle, "/purple/logging/flush_interval",
+	                              log_writer_pref_cb, NULL);
+	purple_prefs_connect_callback(handle, "/purple/logging/flush_threshold",
+	                              log_writer_pref_cb, NULL);
+	log_writer_pref_cb(NULL, PURPLE_PREF_NONE, NULL, NULL);
+
+	purple_signal_register(handle, "log-index-updated",
+	                       purple_marshal_VOID__POINTER_POINTER_UINT,
+	                       G_TYPE_NONE, 3,
+	                       PURPLE_TYPE_ACCOUNT,
+	                       G_TYPE_STRING,
+	                       G_TYPE_UINT);
+
+	log_index = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+			(GDestroyNotify)log_index_entry_free);
+	log_index_saved = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+			(GDestroyNotify)log_index_entry_free);
+	log_index_dirty = g_ptr_array_new();
 	logsize_users = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
 			(GEqualFunc)_purple_logsize_user_equal,
 			(GDestroyNotify)_purple_logsize_user_free_key, NULL);
-	logsize_users_decayed = g_hash_table_new_full((GHashFunc)_purple_logsize_user_hash,
-				(GEqualFunc)_purple_logsize_user_equal,
-				(GDestroyNotify)_purple_logsize_user_free_key, NULL);
+	log_index_load();
+
+	purple_signal_connect(purple_accounts_get_handle(), "account-removed",
+	                      handle, PURPLE_CALLBACK(log_index_account_removed_cb),
+	                      NULL);
 }
 
 void
 purple_log_uninit(void)
 {
+	purple_signals_disconnect_by_handle(purple_log_get_handle());
 	purple_signals_unregister_by_instance(purple_log_get_handle());
+	purple_prefs_disconnect_by_handle(purple_log_get_handle());
+
+	/* Make sure everything queued has hit the disk. */
+	log_writer_stop();
+
+	if (log_index_save_timer != 0) {
+		g_source_remove(log_index_save_timer);
+		log_index_save_cb(NULL);
+	}
+
+	/* Cancel the scans that haven't run yet, then wait for the index to be
+	 * written out.  The pool isn't freed with immediate set, as that would
+	 * also drop (and leak) that save.  Scan results still queued for the
+	 * main loop are dropped by log_index_scan_done. */
+	if (log_index_pool != NULL) {
+		g_atomic_int_set(&log_index_cancelled, TRUE);
+		g_thread_pool_free(log_index_pool, FALSE, TRUE);
+		log_index_pool = NULL;
+		g_atomic_int_set(&log_index_cancelled, FALSE);
+	}
 
 	purple_log_logger_remove(html_logger);
 	purple_log_logger_free(html_logger);
@@ -686,7 +800,13 @@ purple_log_uninit(void)
 	old_logger = NULL;
 
 	g_hash_table_destroy(logsize_users);
-	g_hash_table_destroy(logsize_users_decayed);
+	logsize_users = NULL;
+	g_hash_table_destroy(log_index);
+	log_index = NULL;
+	g_hash_table_destroy(log_index_saved);
+	log_index_saved = NULL;
+	g_ptr_array_free(log_index_dirty, TRUE);
+	log_index_dirty = NULL;
 }
 
 static PurpleLog *
@@ -1212,6 +1332,825 @@ static char *process_txt_log(char *txt, char *to_free)
 	return txt;
 }
 
+/****************************
+ ** BUFFERED WRITER *********
+ ****************************/
+
+static PurpleLogWriteBuffer *
+log_write_buffer_ref(PurpleLogWriteBuffer *buf)
+{
+	g_atomic_int_inc(&buf->ref);
+
+	return buf;
+}
+
+static void
+log_write_buffer_unref(PurpleLogWriteBuffer *buf)
+{
+	if (!g_atomic_int_dec_and_test(&buf->ref))
+		return;
+
+	g_mutex_clear(&buf->lock);
+	g_string_free(buf->pending, TRUE);
+	g_free(buf);
+}
+
+/* Writes out whatever is pending for a buffer.  Called from the worker
+ * thread, or from the main thread when the log is closed.  Errors are only
+ * recorded here, since the debug API may not be used off the main thread;
+ * log_write_buffer_report() logs them later. */
+static void
+log_write_buffer_flush(PurpleLogWriteBuffer *buf)
+{
+	g_mutex_lock(&buf->lock);
+
+	if (buf->file != NULL && buf->pending->len > 0) {
+		if (fwrite(buf->pending->str, 1, buf->pending->len, buf->file) !=
+				buf->pending->len || fflush(buf->file) != 0)
+		{
+			buf->error = errno;
+		}
+	}
+	g_string_truncate(buf->pending, 0);
+
+	g_mutex_unlock(&buf->lock);
+}
+
+/* Logs any write error recorded by log_write_buffer_flush().  Main thread
+ * only. */
+static void
+log_write_buffer_report(PurpleLogWriteBuffer *buf)
+{
+	gint error;
+
+	g_mutex_lock(&buf->lock);
+	error = buf->error;
+	buf->error = 0;
+	g_mutex_unlock(&buf->lock);
+
+	if (error != 0) {
+		purple_debug_error("log", "Error writing to log file: %s\n",
+				g_strerror(error));
+	}
+}
+
+static gpointer
+log_writer_thread(gpointer unused)
+{
+	g_mutex_lock(&writer_lock);
+
+	for (;;) {
+		GQueue batch;
+		PurpleLogWriteBuffer *buf;
+		gint64 end, start, latency;
+		gboolean quit;
+
+		end = g_get_monotonic_time() +
+			writer_flush_interval * G_TIME_SPAN_SECOND;
+
+		while (!writer_quit &&
+				writer_pending_bytes < writer_flush_threshold)
+		{
+			if (!g_cond_wait_until(&writer_cond, &writer_lock, end))
+				break;
+		}
+
+		/* Take the whole batch so appends can continue while we write. */
+		batch = writer_queue;
+		g_queue_init(&writer_queue);
+		writer_pending_bytes = 0;
+		quit = writer_quit;
+
+		g_mutex_unlock(&writer_lock);
+
+		start = g_get_monotonic_time();
+		while ((buf = g_queue_pop_head(&batch)) != NULL) {
+			g_mutex_lock(&writer_lock);
+			buf->queued = FALSE;
+			g_mutex_unlock(&writer_lock);
+
+			log_write_buffer_flush(buf);
+			log_write_buffer_unref(buf);
+		}
+		latency = g_get_monotonic_time() - start;
+
+		g_mutex_lock(&writer_lock);
+
+		writer_last_flush_latency = latency;
+		if (latency > writer_max_flush_latency)
+			writer_max_flush_latency = latency;
+
+		if (quit && g_queue_is_empty(&writer_queue))
+			break;
+	}
+
+	g_mutex_unlock(&writer_lock);
+
+	return NULL;
+}
+
+static void
+log_writer_start(void)
+{
+	if (writer_thread != NULL)
+		return;
+
+	writer_quit = FALSE;
+	writer_thread = g_thread_new("purple-log-writer", log_writer_thread,
+			NULL);
+}
+
+/* Stops the worker thread, after it has written everything queued. */
+static void
+log_writer_stop(void)
+{
+	if (writer_thread == NULL)
+		return;
+
+	g_mutex_lock(&writer_lock);
+	writer_quit = TRUE;
+	g_cond_signal(&writer_cond);
+	g_mutex_unlock(&writer_lock);
+
+	g_thread_join(writer_thread);
+	writer_thread = NULL;
+}
+
+/* Writes a formatted record to a common logger file, either straight away
+ * or through the worker thread if buffered writing is enabled. */
+static void
+log_writer_append(PurpleLogCommonLoggerData *data, const GString *record)
+{
+	PurpleLogWriteBuffer *buf = data->extra_data;
+
+	if (record->len == 0)
+		return;
+
+	if (buf == NULL) {
+		if (writer_thread == NULL) {
+			fwrite(record->str, 1, record->len, data->file);
+			fflush(data->file);
+			return;
+		}
+
+		buf = g_new0(PurpleLogWriteBuffer, 1);
+		buf->ref = 1;
+		g_mutex_init(&buf->lock);
+		buf->file = data->file;
+		buf->pending = g_string_sized_new(record->len);
+		data->extra_data = buf;
+	}
+
+	/* Report anything that failed since the last append. */
+	log_write_buffer_report(buf);
+
+	g_mutex_lock(&buf->lock);
+	g_string_append_len(buf->pending, record->str, record->len);
+	g_mutex_unlock(&buf->lock);
+
+	if (writer_thread == NULL) {
+		/* Buffering was turned off since this buffer was created. */
+		log_write_buffer_flush(buf);
+		log_write_buffer_report(buf);
+		return;
+	}
+
+	g_mutex_lock(&writer_lock);
+	if (!buf->queued) {
+		buf->queued = TRUE;
+		g_queue_push_tail(&writer_queue, log_write_buffer_ref(buf));
+	}
+	writer_pending_bytes += record->len;
+	if (writer_pending_bytes >= writer_flush_threshold)
+		g_cond_signal(&writer_cond);
+	g_mutex_unlock(&writer_lock);
+}
+
+/* Flushes anything still queued for a log and detaches it from the worker,
+ * so the caller may safely write to and close data->file afterwards. */
+static void
+log_writer_close(PurpleLogCommonLoggerData *data)
+{
+	PurpleLogWriteBuffer *buf = data->extra_data;
+
+	if (buf == NULL)
+		return;
+
+	log_write_buffer_flush(buf);
+	log_write_buffer_report(buf);
+
+	g_mutex_lock(&buf->lock);
+	buf->file = NULL;
+	g_mutex_unlock(&buf->lock);
+
+	log_write_buffer_unref(buf);
+	data->extra_data = NULL;
+}
+
+static void
+log_writer_pref_cb(const char *name, PurplePrefType type,
+                   gconstpointer value, gpointer data)
+{
+	gint interval = purple_prefs_get_int("/purple/logging/flush_interval");
+	gint threshold = purple_prefs_get_int("/purple/logging/flush_threshold");
+
+	g_mutex_lock(&writer_lock);
+	writer_flush_interval = MAX(interval, 1);
+	writer_flush_threshold = (gsize)MAX(threshold, 1) * 1024;
+	g_cond_signal(&writer_cond);
+	g_mutex_unlock(&writer_lock);
+
+	if (purple_prefs_get_bool("/purple/logging/buffered_writes"))
+		log_writer_start();
+	else
+		log_writer_stop();
+}
+
+void
+purple_log_get_writer_stats(guint *queue_depth, gsize *pending_bytes,
+                            gint64 *last_flush_latency,
+                            gint64 *max_flush_latency)
+{
+	g_mutex_lock(&writer_lock);
+
+	if (queue_depth != NULL)
+		*queue_depth = g_queue_get_length(&writer_queue);
+	if (pending_bytes != NULL)
+		*pending_bytes = writer_pending_bytes;
+	if (last_flush_latency != NULL)
+		*last_flush_latency = writer_last_flush_latency;
+	if (max_flush_latency != NULL)
+		*max_flush_latency = writer_max_flush_latency;
+
+	g_mutex_unlock(&writer_lock);
+}
+
+/****************************
+ ** LOG INDEX ***************
+ ****************************/
+
+/* Activity score counts bytes in the log, exponentially decayed with
+ * a half-life of 14 days. */
+static gdouble
+log_index_decay(gdouble score, gint64 since, gint64 now)
+{
+	if (score == 0.0)
+		return 0.0;
+
+	return score * pow(0.5, (gdouble)(now - since) / (14 * 24 * 60 * 60));
+}
+
+static void
+log_index_entry_free(PurpleLogIndexEntry *entry)
+{
+	g_free(entry->dir);
+	g_free(entry->name);
+	g_free(entry);
+}
+
+static void
+log_index_job_free(PurpleLogIndexJob *job)
+{
+	g_free(job->dir);
+	g_free(job->path);
+	g_free(job->old_path);
+	g_list_free_full(job->entries, (GDestroyNotify)log_index_entry_free);
+	g_clear_error(&job->error);
+	g_free(job);
+}
+
+/* Returns the part of a log directory path below the logs root. */
+static const char *
+log_index_key(const char *path)
+{
+	char *root = g_build_filename(purple_data_dir(), "logs", NULL);
+	size_t len = strlen(root);
+	const char *key = path;
+
+	if (strncmp(path, root, len) == 0 && path[len] == G_DIR_SEPARATOR)
+		key = path + len + 1;
+
+	g_free(root);
+
+	return key;
+}
+
+/* Runs in the worker thread, so errors are only recorded in the job.
+ * Mirrors purple_log_common_total_sizer and the activity score of
+ * purple_log_common_lister results, for the html and txt loggers, plus
+ * old_logger_total_size. */
+static void
+log_index_scan(PurpleLogIndexJob *job)
+{
+	GDateTime *now = g_date_time_new_now_utc();
+	const char *filename;
+	GError *error = NULL;
+	GStatBuf st;
+	GDir *dir = NULL;
+
+	job->score_time = g_date_time_to_unix(now);
+
+	if (job->html || job->txt) {
+		dir = g_dir_open(job->path, 0, &error);
+
+		/* No logs yet isn't an error. */
+		if (g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_clear_error(&error);
+		else if (error != NULL)
+			g_propagate_error(&job->error, error);
+	}
+
+	if (dir != NULL) {
+		while (!g_atomic_int_get(&log_index_cancelled) &&
+				(filename = g_dir_read_name(dir))) {
+			GDateTime *stamp;
+			char *tmp;
+
+			if (!(job->html && g_str_has_suffix(filename, ".html") &&
+					strlen(filename) >= 17 + 5) &&
+				!(job->txt && g_str_has_suffix(filename, ".txt") &&
+					strlen(filename) >= 17 + 4))
+			{
+				continue;
+			}
+
+			tmp = g_build_filename(job->path, filename, NULL);
+			if (g_stat(tmp, &st)) {
+				int errsv = errno;
+
+				if (job->error == NULL) {
+					g_set_error(&job->error, G_FILE_ERROR,
+							g_file_error_from_errno(errsv),
+							"Error stating log file %s: %s", tmp,
+							g_strerror(errsv));
+				}
+				g_free(tmp);
+				continue;
+			}
+			g_free(tmp);
+
+			job->size += st.st_size;
+			job->count++;
+
+			/* purple_unescape_filename isn't reentrant. */
+			tmp = g_uri_unescape_string(filename, NULL);
+			stamp = tmp ? purple_str_to_date_time(tmp, FALSE) : NULL;
+			g_free(tmp);
+			if (stamp == NULL)
+				continue;
+
+			job->score += st.st_size * log_index_decay(1.0,
+					g_date_time_to_unix(stamp), job->score_time);
+			job->last_activity = MAX(job->last_activity,
+					g_date_time_to_unix(stamp));
+			g_date_time_unref(stamp);
+		}
+		g_dir_close(dir);
+	}
+
+	if (job->old_path != NULL && g_stat(job->old_path, &st) == 0)
+		job->size += st.st_size;
+
+	g_date_time_unref(now);
+}
+
+/* Merges a scan's results into its entry.  Anything purple_log_write added
+ * since the scan was queued is kept on top of what the scan found.  Bytes
+ * that reached the disk before the scan read it are counted twice until the
+ * entry is scanned again, which is better than losing the rest. */
+static gboolean
+log_index_scan_done(gpointer data)
+{
+	PurpleLogIndexJob *job = data;
+	PurpleLogIndexEntry *entry = NULL;
+	gint size;
+	guint count;
+	gint64 last_activity;
+
+	/* Results that arrive after purple_log_uninit are dropped. */
+	if (log_index != NULL)
+		entry = g_hash_table_lookup(log_index, job->dir);
+
+	if (job->error != NULL && log_index != NULL) {
+		purple_debug_error("log", "Error indexing %s: %s\n", job->path,
+				job->error->message);
+	}
+
+	if (entry == NULL) {
+		log_index_job_free(job);
+		return FALSE;
+	}
+
+	size = job->size + (entry->written - job->written);
+	count = job->count + (entry->created - job->created);
+	last_activity = job->last_activity;
+	if (entry->created != job->created)
+		last_activity = MAX(last_activity, entry->last_activity);
+
+	if (entry->size != size || entry->count != count ||
+			entry->last_activity != last_activity)
+	{
+		gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+
+		entry->size = size;
+		entry->count = count;
+		entry->last_activity = last_activity;
+		entry->score = log_index_decay(job->score, job->score_time, now) +
+				(entry->written - job->written);
+		entry->score_time = now;
+		log_index_schedule_save(entry);
+
+		if (g_list_find(purple_accounts_get_all(), entry->account)) {
+			purple_signal_emit(purple_log_get_handle(),
+					"log-index-updated", entry->account,
+					entry->name, entry->type);
+		}
+	}
+
+	log_index_job_free(job);
+
+	return FALSE;
+}
+
+static gboolean
+log_index_save_done(gpointer data)
+{
+	PurpleLogIndexJob *job = data;
+
+	if (job->error != NULL) {
+		purple_debug_error("log", "Error writing %s: %s\n", job->path,
+				job->error->message);
+	}
+
+	log_index_job_free(job);
+
+	return FALSE;
+}
+
+/* Runs in the worker thread.  It only does file I/O; the results go back
+ * to the main loop to be logged and merged. */
+static void
+log_index_job_run(gpointer data, gpointer user_data)
+{
+	PurpleLogIndexJob *job = data;
+
+	if (job->entries != NULL) {
+		gchar *xml;
+		GList *l;
+
+		for (l = job->entries; l != NULL; l = l->next) {
+			PurpleLogIndexEntry *entry = l->data;
+
+			g_hash_table_replace(log_index_saved, entry->dir, entry);
+		}
+		g_list_free(job->entries);
+		job->entries = NULL;
+
+		xml = log_index_to_xml(log_index_saved);
+		if (_purple_util_write_file(job->path, xml, -1, &job->error))
+			log_index_job_free(job);
+		else
+			g_idle_add(log_index_save_done, job);
+		g_free(xml);
+		return;
+	}
+
+	/* Scans still queued at shutdown are skipped. */
+	if (g_atomic_int_get(&log_index_cancelled)) {
+		log_index_job_free(job);
+		return;
+	}
+
+	log_index_scan(job);
+	g_idle_add(log_index_scan_done, job);
+}
+
+static void
+log_index_push(PurpleLogIndexJob *job)
+{
+	/* A single thread keeps the index writes in order. */
+	if (log_index_pool == NULL) {
+		log_index_pool = g_thread_pool_new(log_index_job_run, NULL,
+				1, FALSE, NULL);
+	}
+
+	g_thread_pool_push(log_index_pool, job, NULL);
+}
+
+static void
+log_index_queue_scan(PurpleLogIndexEntry *entry)
+{
+	PurpleLogIndexJob *job;
+
+	/* Its account was removed. */
+	if (entry->account == NULL)
+		return;
+
+	job = g_new0(PurpleLogIndexJob, 1);
+	job->dir = g_strdup(entry->dir);
+	job->written = entry->written;
+	job->created = entry->created;
+	job->path = purple_log_get_log_dir(entry->type, entry->name,
+			entry->account);
+	job->html = (g_slist_find(loggers, html_logger) != NULL);
+	job->txt = (g_slist_find(loggers, txt_logger) != NULL);
+
+	if (job->path == NULL) {
+		log_index_job_free(job);
+		return;
+	}
+
+	if (g_slist_find(loggers, old_logger) != NULL) {
+		char *logfile = g_strdup_printf("%s.log",
+				purple_normalize(entry->account, entry->name));
+		job->old_path = g_build_filename(purple_data_dir(), "logs",
+				logfile, NULL);
+		g_free(logfile);
+	}
+
+	log_index_push(job);
+}
+
+/* Asks the loggers, which aren't covered by the index, the way
+ * purple_log_get_total_size and purple_log_get_activity_score used to. */
+static void
+log_index_query_other_loggers(PurpleLogIndexEntry *entry)
+{
+	GDateTime *now = g_date_time_new_now_utc();
+	GSList *n;
+
+	entry->extra_size = 0;
+	entry->extra_score = 0.0;
+	entry->extra_time = g_date_time_to_unix(now);
+
+	for (n = loggers; n; n = n->next) {
+		PurpleLogLogger *logger = n->data;
+		GList *logs = NULL;
+
+		if (logger == html_logger || logger == txt_logger ||
+				logger == old_logger)
+			continue;
+
+		if (logger->list)
+			logs = (logger->list)(entry->type, entry->name, entry->account);
+
+		if (logger->total_size) {
+			entry->extra_size += (logger->total_size)(entry->type,
+					entry->name, entry->account);
+		}
+
+		while (logs) {
+			PurpleLog *log = (PurpleLog*)(logs->data);
+			int size = purple_log_get_size(log);
+
+			if (!logger->total_size)
+				entry->extra_size += size;
+			if (log->time != NULL) {
+				entry->extra_score += size * log_index_decay(1.0,
+						g_date_time_to_unix(log->time),
+						entry->extra_time);
+			}
+
+			purple_log_free(log);
+			logs = g_list_delete_link(logs, logs);
+		}
+	}
+
+	g_date_time_unref(now);
+}
+
+static PurpleLogIndexEntry *
+log_index_find(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	struct _purple_logsize_user lu;
+
+	if (account == NULL || logsize_users == NULL)
+		return NULL;
+
+	lu.name = purple_normalize(account, name);
+	lu.account = account;
+	lu.type = type;
+
+	return g_hash_table_lookup(logsize_users, &lu);
+}
+
+/* Returns the index entry for a conversation, creating it if needed.  The
+ * first lookup in a session answers from the saved index and schedules
+ * a refresh in the background. */
+static PurpleLogIndexEntry *
+log_index_get(PurpleLogType type, const char *name, PurpleAccount *account)
+{
+	struct _purple_logsize_user lu;
+	PurpleLogIndexEntry *entry;
+	const char *key;
+	char *path;
+
+	entry = log_index_find(type, name, account);
+	if (entry != NULL || account == NULL)
+		return entry;
+
+	path = purple_log_get_log_dir(type, name, account);
+	if (path == NULL)
+		return NULL;
+
+	key = log_index_key(path);
+	entry = g_hash_table_lookup(log_index, key);
+	if (entry == NULL) {
+		entry = g_new0(PurpleLogIndexEntry, 1);
+		entry->dir = g_strdup(key);
+		g_hash_table_insert(log_index, entry->dir, entry);
+	}
+	g_free(path);
+
+	lu.name = purple_normalize(account, name);
+	lu.account = account;
+	lu.type = type;
+	g_hash_table_insert(logsize_users, _purple_logsize_user_dup(&lu), entry);
+
+	entry->account = account;
+	g_free(entry->name);
+	entry->name = g_strdup(lu.name);
+	entry->type = type;
+
+	log_index_query_other_loggers(entry);
+	log_index_queue_scan(entry);
+
+	return entry;
+}
+
+static gboolean
+log_index_user_is_account(gpointer key, gpointer value, gpointer account)
+{
+	struct _purple_logsize_user *lu = key;
+
+	return lu->account == account;
+}
+
+/* The account may be freed once it's removed, and a new one allocated at
+ * the same address, so forget every lookup made for it. */
+static void
+log_index_account_removed_cb(PurpleAccount *account, gpointer data)
+{
+	GHashTableIter iter;
+	PurpleLogIndexEntry *entry;
+
+	g_hash_table_foreach_remove(logsize_users, log_index_user_is_account,
+			account);
+
+	g_hash_table_iter_init(&iter, log_index);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&entry)) {
+		if (entry->account == account) {
+			entry->account = NULL;
+			g_clear_pointer(&entry->name, g_free);
+		}
+	}
+}
+
+/* Runs in the worker thread, on its own copy of the index. */
+static gchar *
+log_index_to_xml(GHashTable *index)
+{
+	PurpleXmlNode *root;
+	GHashTableIter iter;
+	PurpleLogIndexEntry *entry;
+	gchar *xml;
+
+	root = purple_xmlnode_new("logindex");
+	purple_xmlnode_set_attrib(root, "version", "1.0");
+
+	g_hash_table_iter_init(&iter, index);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&entry)) {
+		PurpleXmlNode *node = purple_xmlnode_new_child(root, "log");
+		char buf[G_ASCII_DTOSTR_BUF_SIZE];
+		char *tmp;
+
+		purple_xmlnode_set_attrib(node, "dir", entry->dir);
+
+		tmp = g_strdup_printf("%d", entry->size);
+		purple_xmlnode_set_attrib(node, "size", tmp);
+		g_free(tmp);
+
+		tmp = g_strdup_printf("%u", entry->count);
+		purple_xmlnode_set_attrib(node, "count", tmp);
+		g_free(tmp);
+
+		tmp = g_strdup_printf("%" G_GINT64_FORMAT, entry->last_activity);
+		purple_xmlnode_set_attrib(node, "last", tmp);
+		g_free(tmp);
+
+		purple_xmlnode_set_attrib(node, "score",
+				g_ascii_dtostr(buf, sizeof(buf), entry->score));
+
+		tmp = g_strdup_printf("%" G_GINT64_FORMAT, entry->score_time);
+		purple_xmlnode_set_attrib(node, "time", tmp);
+		g_free(tmp);
+	}
+
+	xml = purple_xmlnode_to_formatted_str(root, NULL);
+	purple_xmlnode_free(root);
+
+	return xml;
+}
+
+/* A copy of what's saved of an entry, for the worker. */
+static PurpleLogIndexEntry *
+log_index_entry_copy(PurpleLogIndexEntry *entry)
+{
+	PurpleLogIndexEntry *copy = g_new0(PurpleLogIndexEntry, 1);
+
+	copy->dir = g_strdup(entry->dir);
+	copy->size = entry->size;
+	copy->count = entry->count;
+	copy->last_activity = entry->last_activity;
+	copy->score = entry->score;
+	copy->score_time = entry->score_time;
+
+	return copy;
+}
+
+/* Only the entries that changed are copied here; the worker merges them into
+ * its own copy of the index and writes that out. */
+static gboolean
+log_index_save_cb(gpointer data)
+{
+	PurpleLogIndexJob *job;
+	guint i;
+
+	log_index_save_timer = 0;
+
+	if (log_index_dirty->len == 0)
+		return FALSE;
+
+	job = g_new0(PurpleLogIndexJob, 1);
+	job->path = g_build_filename(purple_data_dir(), LOG_INDEX_FILE, NULL);
+
+	for (i = 0; i < log_index_dirty->len; i++) {
+		PurpleLogIndexEntry *entry = g_ptr_array_index(log_index_dirty, i);
+
+		entry->dirty = FALSE;
+		job->entries = g_list_prepend(job->entries,
+				log_index_entry_copy(entry));
+	}
+	g_ptr_array_set_size(log_index_dirty, 0);
+
+	log_index_push(job);
+
+	return FALSE;
+}
+
+static void
+log_index_schedule_save(PurpleLogIndexEntry *entry)
+{
+	if (!entry->dirty) {
+		entry->dirty = TRUE;
+		g_ptr_array_add(log_index_dirty, entry);
+	}
+
+	if (log_index_save_timer == 0)
+		log_index_save_timer = g_timeout_add_seconds(5, log_index_save_cb, NULL);
+}
+
+static void
+log_index_load(void)
+{
+	PurpleXmlNode *root, *node;
+
+	root = purple_util_read_xml_from_data_file(LOG_INDEX_FILE, _("log index"));
+	if (root == NULL)
+		return;
+
+	for (node = purple_xmlnode_get_child(root, "log"); node != NULL;
+			node = purple_xmlnode_get_next_twin(node))
+	{
+		PurpleLogIndexEntry *entry;
+		const char *dir = purple_xmlnode_get_attrib(node, "dir");
+		const char *tmp;
+
+		if (dir == NULL || g_hash_table_contains(log_index, dir))
+			continue;
+
+		entry = g_new0(PurpleLogIndexEntry, 1);
+		entry->dir = g_strdup(dir);
+
+		if ((tmp = purple_xmlnode_get_attrib(node, "size")))
+			entry->size = atoi(tmp);
+		if ((tmp = purple_xmlnode_get_attrib(node, "count")))
+			entry->count = strtoul(tmp, NULL, 10);
+		if ((tmp = purple_xmlnode_get_attrib(node, "last")))
+			entry->last_activity = g_ascii_strtoll(tmp, NULL, 10);
+		if ((tmp = purple_xmlnode_get_attrib(node, "score")))
+			entry->score = g_ascii_strtod(tmp, NULL);
+		if ((tmp = purple_xmlnode_get_attrib(node, "time")))
+			entry->score_time = g_ascii_strtoll(tmp, NULL, 10);
+
+		g_hash_table_insert(log_index, entry->dir, entry);
+		g_hash_table_insert(log_index_saved, entry->dir,
+				log_index_entry_copy(entry));
+	}
+
+	purple_xmlnode_free(root);
+}
+
 /****************************
  ** HTML LOGGER *************
  ****************************/
@@ -1227,7 +2166,10 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 	PurpleProtocol *protocol =
 			purple_protocols_find(purple_account_get_protocol_id(log->account));
 	PurpleLogCommonLoggerData *data = log->logger_data;
-	gsize written = 0;
+	GString *record;
+	gsize written;
+
+	record = g_string_new(NULL);
 
 	if(!data) {
 		const char *proto = purple_protocol_class_list_icon(protocol, log->account, NULL);
@@ -1239,6 +2181,7 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 
 		/* if we can't write to the file, give up before we hurt ourselves */
 		if (!data || !data->file) {
+			g_string_free(record, TRUE);
 			return 0;
 		}
 
@@ -1246,9 +2189,9 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 		date = g_date_time_format(dt, "%c");
 		g_date_time_unref(dt);
 
-		written += fprintf(data->file, "<html><head>");
-		written += fprintf(data->file, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
-		written += fprintf(data->file, "<title>");
+		g_string_append_printf(record, "<html><head>");
+		g_string_append_printf(record, "<meta http-equiv=\"content-type\" content=\"text/html; charset=UTF-8\">");
+		g_string_append_printf(record, "<title>");
 		if (log->type == PURPLE_LOG_SYSTEM)
 			header = g_strdup_printf("System log for account %s (%s) connected at %s",
 					purple_account_get_username(log->account), proto, date);
@@ -1256,16 +2199,18 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 			header = g_strdup_printf("Conversation with %s at %s on %s (%s)",
 					log->name, date, purple_account_get_username(log->account), proto);
 
-		written += fprintf(data->file, "%s", header);
-		written += fprintf(data->file, "</title></head><body>");
-		written += fprintf(data->file, "<h3>%s</h3>\n", header);
+		g_string_append_printf(record, "%s", header);
+		g_string_append_printf(record, "</title></head><body>");
+		g_string_append_printf(record, "<h3>%s</h3>\n", header);
 		g_free(date);
 		g_free(header);
 	}
 
 	/* if we can't write to the file, give up before we hurt ourselves */
-	if(!data->file)
+	if(!data->file) {
+		g_string_free(record, TRUE);
 		return 0;
+	}
 
 	escaped_from = g_markup_escape_text(from != NULL ? from : "<NULL>",
 			-1);
@@ -1281,43 +2226,46 @@ static gsize html_logger_write(PurpleLog *log, PurpleMessageFlags type,
 	date = log_get_timestamp(log, time);
 
 	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----<br/>\n", msg_fixed, date);
+		g_string_append_printf(record, "---- %s @ %s ----<br/>\n", msg_fixed, date);
 	} else {
 		if (type & PURPLE_MESSAGE_SYSTEM)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
+			g_string_append_printf(record, "<font size=\"2\">(%s)</font><b> %s</b><br/>\n", date, msg_fixed);
 		else if (type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
+			g_string_append_printf(record, "<font size=\"2\">(%s)</font> %s<br/>\n", date, msg_fixed);
 		else if (type & PURPLE_MESSAGE_ERROR)
-			written += fprintf(data->file, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
+			g_string_append_printf(record, "<font color=\"#FF0000\"><font size=\"2\">(%s)</font><b> %s</b></font><br/>\n", date, msg_fixed);
 		else if (type & PURPLE_MESSAGE_AUTO_RESP) {
 			if (type & PURPLE_MESSAGE_SEND)
-				written += fprintf(data->file, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
+				g_string_append_printf(record, _("<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
 			else if (type & PURPLE_MESSAGE_RECV)
-				written += fprintf(data->file, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
+				g_string_append_printf(record, _("<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s &lt;AUTO-REPLY&gt;:</b></font> %s<br/>\n"), date, escaped_from, msg_fixed);
 		} else if (type & PURPLE_MESSAGE_RECV) {
 			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+				g_string_append_printf(record, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
 						date, escaped_from, msg_fixed);
 			else
-				written += fprintf(data->file, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+				g_string_append_printf(record, "<font color=\"#A82F2F\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
 						date, escaped_from, msg_fixed);
 		} else if (type & PURPLE_MESSAGE_SEND) {
 			if(purple_message_meify(msg_fixed, -1))
-				written += fprintf(data->file, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
+				g_string_append_printf(record, "<font color=\"#062585\"><font size=\"2\">(%s)</font> <b>***%s</b></font> %s<br/>\n",
 						date, escaped_from, msg_fixed);
 			else
-				written += fprintf(data->file, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
+				g_string_append_printf(record, "<font color=\"#16569E\"><font size=\"2\">(%s)</font> <b>%s:</b></font> %s<br/>\n",
 						date, escaped_from, msg_fixed);
 		} else {
 			purple_debug_error("log", "Unhandled message type.\n");
-			written += fprintf(data->file, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
+			g_string_append_printf(record, "<font size=\"2\">(%s)</font><b> %s:</b></font> %s<br/>\n",
 						date, escaped_from, msg_fixed);
 		}
 	}
 	g_free(date);
 	g_free(msg_fixed);
 	g_free(escaped_from);
-	fflush(data->file);
+
+	log_writer_append(data, record);
+	written = record->len;
+	g_string_free(record, TRUE);
 
 	return written;
 }
@@ -1326,6 +2274,7 @@ static void html_logger_finalize(PurpleLog *log)
 {
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	if (data) {
+		log_writer_close(data);
 		if(data->file) {
 			fprintf(data->file, "</body></html>\n");
 			fclose(data->file);
@@ -1385,8 +2334,8 @@ static gsize txt_logger_write(PurpleLog *log, PurpleMessageFlags type,
 			purple_protocols_find(purple_account_get_protocol_id(log->account));
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	char *stripped = NULL;
-
-	gsize written = 0;
+	GString *record;
+	gsize written;
 
 	if (data == NULL) {
 		/* This log is new.  We could use the loggers 'new' function, but
@@ -1404,58 +2353,69 @@ static gsize txt_logger_write(PurpleLog *log, PurpleMessageFlags type,
 		if(!data || !data->file)
 			return 0;
 
+		record = g_string_new(NULL);
+
 		dt = g_date_time_to_local(log->time);
 		date = g_date_time_format(dt, "%c");
 		if (log->type == PURPLE_LOG_SYSTEM)
-			written += fprintf(data->file, "System log for account %s (%s) connected at %s\n",
+			g_string_append_printf(record, "System log for account %s (%s) connected at %s\n",
 				purple_account_get_username(log->account), proto,
 				date);
 		else
-			written += fprintf(data->file, "Conversation with %s at %s on %s (%s)\n",
+			g_string_append_printf(record, "Conversation with %s at %s on %s (%s)\n",
 				log->name, date,
 				purple_account_get_username(log->account), proto);
 		g_free(date);
 		g_date_time_unref(dt);
-	}
+	} else {
+		/* if we can't write to the file, give up before we hurt ourselves */
+		if(!data->file)
+			return 0;
 
-	/* if we can't write to the file, give up before we hurt ourselves */
-	if(!data->file)
-		return 0;
+		record = g_string_new(NULL);
+	}
 
 	stripped = purple_markup_strip_html(message);
 	date = log_get_timestamp(log, time);
 
 	if(log->type == PURPLE_LOG_SYSTEM){
-		written += fprintf(data->file, "---- %s @ %s ----\n", stripped, date);
+		g_string_append_printf(record, "---- %s @ %s ----\n", stripped, date);
 	} else {
 		if (type & PURPLE_MESSAGE_SEND ||
 			type & PURPLE_MESSAGE_RECV) {
 			if (type & PURPLE_MESSAGE_AUTO_RESP) {
-				written += fprintf(data->file, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
+				g_string_append_printf(record, _("(%s) %s <AUTO-REPLY>: %s\n"), date,
 						from, stripped);
 			} else {
 				if(purple_message_meify(stripped, -1))
-					written += fprintf(data->file, "(%s) ***%s %s\n", date, from,
+					g_string_append_printf(record, "(%s) ***%s %s\n", date, from,
 							stripped);
 				else
-					written += fprintf(data->file, "(%s) %s: %s\n", date, from,
+					g_string_append_printf(record, "(%s) %s: %s\n", date, from,
 							stripped);
 			}
 		} else if (type & PURPLE_MESSAGE_SYSTEM ||
 			type & PURPLE_MESSAGE_ERROR ||
 			type & PURPLE_MESSAGE_RAW)
-			written += fprintf(data->file, "(%s) %s\n", date, stripped);
+			g_string_append_printf(record, "(%s) %s\n", date, stripped);
 		else if (type & PURPLE_MESSAGE_NO_LOG) {
 			/* This shouldn't happen */
+			g_free(date);
 			g_free(stripped);
+			log_writer_append(data, record);
+			written = record->len;
+			g_string_free(record, TRUE);
 			return written;
 		} else
-			written += fprintf(data->file, "(%s) %s%s %s\n", date, from ? from : "",
+			g_string_append_printf(record, "(%s) %s%s %s\n", date, from ? from : "",
 					from ? ":" : "", stripped);
 	}
 	g_free(date);
 	g_free(stripped);
-	fflush(data->file);
+
+	log_writer_append(data, record);
+	written = record->len;
+	g_string_free(record, TRUE);
 
 	return written;
 }
@@ -1464,6 +2424,7 @@ static void txt_logger_finalize(PurpleLog *log)
 {
 	PurpleLogCommonLoggerData *data = log->logger_data;
 	if (data) {
+		log_writer_close(data);
 		if(data->file)
 			fclose(data->file);
 		g_free(data->path);
@@ -317,6 +317,24 @@ GList *purple_log_get_system_logs(PurpleAccount *account);
  */
 int purple_log_get_size(PurpleLog *log);
 
+/**
+ * purple_log_get_writer_stats:
+ * @queue_depth: (out) (optional): The number of logs with records waiting to
+ *               be written.
+ * @pending_bytes: (out) (optional): The number of bytes queued since the
+ *                 last flush.
+ * @last_flush_latency: (out) (optional): How long the last flush took, in
+ *                      microseconds.
+ * @max_flush_latency: (out) (optional): The longest flush so far, in
+ *                     microseconds.
+ *
+ * Returns statistics about the buffered log writer, which is used by the
+ * built-in loggers when the <literal>/purple/logging/buffered_writes</literal>
+ * preference is set.
+ */
+void purple_log_get_writer_stats(guint *queue_depth, gsize *pending_bytes,
+		gint64 *last_flush_latency, gint64 *max_flush_latency);
+
 /**
  * purple_log_get_total_size:
  * @type:                The type of the log
@@ -325,6 +343,11 @@ int purple_log_get_size(PurpleLog *log);
  *
  * Returns the size, in bytes, of all available logs in this conversation
  *
+ * The size of the built-in loggers' files comes from an index, which is kept
+ * up to date in the background. The first call for a conversation in
+ * a session may return a stale value; the "log-index-updated" signal is
+ * emitted once it is refreshed.
+ *
  * Returns:                    The size in bytes
  */
 int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccount *account);
@@ -336,7 +359,8 @@ int purple_log_get_total_size(PurpleLogType type, const char *name, PurpleAccoun
  * @account:             The account
  *
  * Returns the activity score of a log, based on total size in bytes,
- * which is then decayed based on age
+ * which is then decayed based on age. Like purple_log_get_total_size(),
+ * it is answered from the log index.
  *
  * Returns:                    The activity score
  */
@@ -75,8 +75,31 @@ struct purple_pref {
 	struct purple_pref *parent;
 	struct purple_pref *sibling;
 	struct purple_pref *first_child;
+
+	/* Only used on the second level of the tree (e.g. /purple/away),
+	 * which is the unit of saving. */
+	gboolean dirty;
 };
 
+/* A save request for the worker thread.  It carries the first level of
+ * the tree, with an empty <pref name='...'/> placeholder for each second
+ * level subtree, and the subtrees which changed since the previous job.
+ * The worker keeps the others from previous jobs. */
+typedef struct {
+	PurpleXmlNode *skeleton;
+	GHashTable *sections;   /* Full pref name -> PurpleXmlNode. */
+	gchar *path;
+
+	gint64 first_change;
+	gint64 write_time;
+	gboolean written;
+	GError *error;          /* Set by the worker, logged by the main loop. */
+} PurplePrefsSaveJob;
+
+/* Wait for this long after the last change before saving, but not longer
+ * than PREFS_SAVE_MAX_DELAY after the first one. */
+#define PREFS_SAVE_DELAY      1000
+#define PREFS_SAVE_MAX_DELAY  (5 * G_TIME_SPAN_SECOND)
 
 static struct purple_pref prefs = {
 	PURPLE_PREF_NONE,
@@ -85,11 +108,19 @@ static struct purple_pref prefs = {
 	NULL,
 	NULL,
 	NULL,
-	NULL
+	NULL,
+	FALSE
 };
 
 static GHashTable *prefs_hash = NULL;
 static guint       save_timer = 0;
+static gint64      save_first_change = 0;
+static gint64      save_last_write = 0;
+static gint64      save_max_write = 0;
+static gint64      save_last_latency = 0;
+static gint64      save_max_latency = 0;
+static GThreadPool *save_pool = NULL;
+static GHashTable *saved_sections = NULL; /* Owned by the save thread. */
 static gboolean    prefs_loaded = FALSE;
 static GSList     *ui_callbacks = NULL;
 
@@ -141,19 +172,45 @@ purple_pref *find_pref(const char *name)
  *********************************************************************/
 
 /*
- * This function recursively creates the PurpleXmlNode tree from the prefs
- * tree structure.  Yay recursion!
+ * Returns the second level pref (the unit of saving) containing pref, or
+ * NULL if pref is above that level.
  */
+static struct purple_pref *
+pref_get_section(struct purple_pref *pref)
+{
+	for (; pref != NULL && pref->parent != NULL; pref = pref->parent) {
+		if (pref->parent->parent == &prefs)
+			return pref;
+	}
+
+	return NULL;
+}
+
 static void
-pref_to_xmlnode(PurpleXmlNode *parent, struct purple_pref *pref)
+pref_mark_dirty(struct purple_pref *pref)
+{
+	struct purple_pref *section = pref_get_section(pref);
+
+	if (section != NULL)
+		section->dirty = TRUE;
+}
+
+/*
+ * Creates a PurpleXmlNode for a single pref, without its children.  If
+ * parent is NULL, the node is a new tree.
+ */
+static PurpleXmlNode *
+pref_to_xmlnode_shallow(PurpleXmlNode *parent, struct purple_pref *pref)
 {
 	PurpleXmlNode *node, *childnode;
-	struct purple_pref *child;
 	char buf[21];
 	GList *cur;
 
 	/* Create a new node */
-	node = purple_xmlnode_new_child(parent, "pref");
+	if (parent != NULL)
+		node = purple_xmlnode_new_child(parent, "pref");
+	else
+		node = purple_xmlnode_new("pref");
 	purple_xmlnode_set_attrib(node, "name", pref->name);
 
 	/* Set the type of this node (if type == PURPLE_PREF_NONE then do nothing) */
@@ -196,23 +253,20 @@ pref_to_xmlnode(PurpleXmlNode *parent, struct purple_pref *pref)
 		purple_xmlnode_set_attrib(node, "value", buf);
 	}
 
-	/* All My Children */
-	for (child = pref->first_child; child != NULL; child = child->sibling)
-		pref_to_xmlnode(node, child);
+	return node;
 }
 
+/*
+ * This function recursively creates the PurpleXmlNode tree from the prefs
+ * tree structure.  Yay recursion!
+ */
 static PurpleXmlNode *
-prefs_to_xmlnode(void)
+pref_to_xmlnode(PurpleXmlNode *parent, struct purple_pref *pref)
 {
 	PurpleXmlNode *node;
-	struct purple_pref *pref, *child;
-
-	pref = &prefs;
+	struct purple_pref *child;
 
-	/* Create the root preference node */
-	node = purple_xmlnode_new("pref");
-	purple_xmlnode_set_attrib(node, "version", "1");
-	purple_xmlnode_set_attrib(node, "name", "/");
+	node = pref_to_xmlnode_shallow(parent, pref);
 
 	/* All My Children */
 	for (child = pref->first_child; child != NULL; child = child->sibling)
@@ -222,11 +276,201 @@ prefs_to_xmlnode(void)
 }
 
 static void
-sync_prefs(void)
+prefs_xmlnode_unlink(PurpleXmlNode *node)
 {
-	PurpleXmlNode *node;
-	char *data;
+	PurpleXmlNode *parent = node->parent, *prev = NULL, *cur;
+
+	for (cur = parent->child; cur != NULL && cur != node; cur = cur->next)
+		prev = cur;
+
+	g_return_if_fail(cur != NULL);
+
+	if (prev != NULL)
+		prev->next = node->next;
+	else
+		parent->child = node->next;
+
+	if (parent->lastchild == node)
+		parent->lastchild = prev;
+
+	node->parent = NULL;
+	node->next = NULL;
+}
+
+/*
+ * Snapshots the prefs tree for the save thread.  Only the subtrees changed
+ * since the previous snapshot are copied.
+ */
+static PurplePrefsSaveJob *
+prefs_save_job_new(void)
+{
+	PurplePrefsSaveJob *job;
+	struct purple_pref *top, *section;
+
+	job = g_new0(PurplePrefsSaveJob, 1);
+	job->sections = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)purple_xmlnode_free);
+	job->first_change = save_first_change;
+	job->path = g_build_filename(purple_config_dir(), "prefs.xml", NULL);
+
+	/* Create the root preference node */
+	job->skeleton = purple_xmlnode_new("pref");
+	purple_xmlnode_set_attrib(job->skeleton, "version", "1");
+	purple_xmlnode_set_attrib(job->skeleton, "name", "/");
+
+	for (top = prefs.first_child; top != NULL; top = top->sibling) {
+		PurpleXmlNode *topnode = pref_to_xmlnode_shallow(job->skeleton, top);
+
+		for (section = top->first_child; section != NULL;
+				section = section->sibling)
+		{
+			PurpleXmlNode *placeholder;
+
+			placeholder = purple_xmlnode_new_child(topnode, "pref");
+			purple_xmlnode_set_attrib(placeholder, "name", section->name);
+
+			if (!section->dirty)
+				continue;
+
+			g_hash_table_insert(job->sections,
+					g_strdup_printf("/%s/%s", top->name, section->name),
+					pref_to_xmlnode(NULL, section));
+			section->dirty = FALSE;
+		}
+	}
+
+	return job;
+}
+
+static void
+prefs_save_job_free(PurplePrefsSaveJob *job)
+{
+	purple_xmlnode_free(job->skeleton);
+	g_hash_table_destroy(job->sections);
+	g_free(job->path);
+	g_clear_error(&job->error);
+	g_free(job);
+}
+
+static gboolean
+prefs_save_job_done(gpointer data)
+{
+	PurplePrefsSaveJob *job = data;
+
+	if (job->error != NULL) {
+		/* Nothing is lost yet: the worker keeps the whole tree, so the
+		 * next save writes all of it again. */
+		purple_debug_error("prefs", "Error writing prefs.xml: %s\n",
+				job->error->message);
+	} else if (job->written) {
+		save_last_write = job->write_time;
+		save_max_write = MAX(save_max_write, save_last_write);
+		save_last_latency = g_get_monotonic_time() - job->first_change;
+		save_max_latency = MAX(save_max_latency, save_last_latency);
+
+		purple_debug_misc("prefs", "prefs.xml saved: write took "
+				"%" G_GINT64_FORMAT " us, latency %" G_GINT64_FORMAT
+				" us since the first change\n", save_last_write,
+				save_last_latency);
+	}
+
+	prefs_save_job_free(job);
+
+	return FALSE;
+}
+
+/*
+ * Runs in the save thread.  Puts the subtrees into the skeleton, writes the
+ * document out and takes the subtrees back for the next job.  This must not
+ * log or touch the prefs; prefs_save_job_done() reports back on the main
+ * loop.
+ */
+static void
+prefs_save_job_run(gpointer data, gpointer user_data)
+{
+	PurplePrefsSaveJob *job = data;
+	GHashTable *sections;
+	GList *placeholders, *placed = NULL, *l;
+	PurpleXmlNode *topnode, *node;
+	gint64 start = g_get_monotonic_time();
+
+	sections = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			(GDestroyNotify)purple_xmlnode_free);
+
+	for (topnode = purple_xmlnode_get_child(job->skeleton, "pref");
+			topnode != NULL; topnode = purple_xmlnode_get_next_twin(topnode))
+	{
+		const char *top = purple_xmlnode_get_attrib(topnode, "name");
+
+		placeholders = NULL;
+		for (node = purple_xmlnode_get_child(topnode, "pref"); node != NULL;
+				node = purple_xmlnode_get_next_twin(node))
+			placeholders = g_list_prepend(placeholders, node);
+		placeholders = g_list_reverse(placeholders);
+
+		for (l = placeholders; l != NULL; l = l->next) {
+			char *name;
+			PurpleXmlNode *section = NULL;
+			gpointer key;
+
+			node = l->data;
+			name = g_strdup_printf("/%s/%s", top,
+					purple_xmlnode_get_attrib(node, "name"));
+
+			if (g_hash_table_lookup_extended(job->sections, name, &key,
+					(gpointer *)&section))
+			{
+				g_hash_table_steal(job->sections, key);
+				g_free(key);
+			} else if (saved_sections != NULL &&
+					g_hash_table_lookup_extended(saved_sections, name,
+						&key, (gpointer *)&section))
+			{
+				g_hash_table_steal(saved_sections, key);
+				g_free(key);
+			}
+
+			if (section == NULL) {
+				g_warn_if_reached();
+				g_free(name);
+				continue;
+			}
 
+			/* Appending in the placeholders' order keeps the order. */
+			prefs_xmlnode_unlink(node);
+			purple_xmlnode_free(node);
+			purple_xmlnode_insert_child(topnode, section);
+			placed = g_list_prepend(placed, section);
+			g_hash_table_insert(sections, name, section);
+		}
+		g_list_free(placeholders);
+	}
+
+	/* A newer snapshot is already queued, it will write the file. */
+	if (g_thread_pool_unprocessed(save_pool) == 0) {
+		char *str = purple_xmlnode_to_formatted_str(job->skeleton, NULL);
+
+		job->written = _purple_util_write_file(job->path, str, -1,
+				&job->error);
+		g_free(str);
+	}
+
+	for (l = placed; l != NULL; l = l->next)
+		prefs_xmlnode_unlink(l->data);
+	g_list_free(placed);
+
+	/* Whatever is left was removed from the tree. */
+	if (saved_sections != NULL)
+		g_hash_table_destroy(saved_sections);
+	saved_sections = sections;
+
+	job->write_time = g_get_monotonic_time() - start;
+	g_idle_add(prefs_save_job_done, job);
+}
+
+static void
+sync_prefs(void)
+{
 	if (!prefs_loaded)
 	{
 		/*
@@ -240,11 +484,13 @@ sync_prefs(void)
 
 	PURPLE_PREFS_UI_OP_CALL(save);
 
-	node = prefs_to_xmlnode();
-	data = purple_xmlnode_to_formatted_str(node, NULL);
-	purple_util_write_data_to_config_file("prefs.xml", data, -1);
-	g_free(data);
-	purple_xmlnode_free(node);
+	/* A single thread keeps the snapshots in order. */
+	if (save_pool == NULL) {
+		save_pool = g_thread_pool_new(prefs_save_job_run, NULL, 1, FALSE,
+				NULL);
+	}
+
+	g_thread_pool_push(save_pool, prefs_save_job_new(), NULL);
 }
 
 static gboolean
@@ -258,10 +504,37 @@ save_cb(gpointer data)
 static void
 schedule_prefs_save(void)
 {
+	gint64 now;
+
 	PURPLE_PREFS_UI_OP_CALL(schedule_save);
 
-	if (save_timer == 0)
-		save_timer = g_timeout_add_seconds(5, save_cb, NULL);
+	now = g_get_monotonic_time();
+
+	if (save_timer == 0) {
+		save_first_change = now;
+	} else if (now - save_first_change <
+			PREFS_SAVE_MAX_DELAY - PREFS_SAVE_DELAY * 1000) {
+		/* Still within a burst of changes, push the save back. */
+		g_source_remove(save_timer);
+	} else {
+		return;
+	}
+
+	save_timer = g_timeout_add(PREFS_SAVE_DELAY, save_cb, NULL);
+}
+
+void
+purple_prefs_get_save_stats(gint64 *last_write_time, gint64 *max_write_time,
+                            gint64 *last_latency, gint64 *max_latency)
+{
+	if (last_write_time != NULL)
+		*last_write_time = save_last_write;
+	if (max_write_time != NULL)
+		*max_write_time = save_max_write;
+	if (last_latency != NULL)
+		*last_latency = save_last_latency;
+	if (max_latency != NULL)
+		*max_latency = save_max_latency;
 }
 
 
@@ -497,6 +770,10 @@ static void
 prefs_save_cb(const char *name, PurplePrefType type, gconstpointer val,
 			  gpointer user_data)
 {
+	struct purple_pref *pref = find_pref(name);
+
+	if (pref != NULL)
+		pref_mark_dirty(pref);
 
 	if(!prefs_loaded)
 		return;
@@ -626,8 +903,10 @@ add_pref(PurplePrefType type, const char *name)
 	me = g_new0(struct purple_pref, 1);
 	me->type = type;
 	me->name = my_name;
+	me->dirty = TRUE;
 
 	me->parent = parent;
+	pref_mark_dirty(parent);
 	if(parent->first_child) {
 		/* blatant abuse of a for loop */
 		for(sibling = parent->first_child; sibling->sibling;
@@ -811,6 +1090,8 @@ remove_pref(struct purple_pref *pref)
 		return;
 	}
 
+	pref_mark_dirty(pref->parent);
+
 	if (pref->parent->first_child == pref) {
 		pref->parent->first_child = pref->sibling;
 	} else {
@@ -1760,6 +2041,16 @@ purple_prefs_uninit()
 		save_cb(NULL);
 	}
 
+	/* Wait for prefs.xml to be written. */
+	if (save_pool != NULL) {
+		g_thread_pool_free(save_pool, FALSE, TRUE);
+		save_pool = NULL;
+	}
+	if (saved_sections != NULL) {
+		g_hash_table_destroy(saved_sections);
+		saved_sections = NULL;
+	}
+
 	purple_prefs_disconnect_by_handle(purple_prefs_get_handle());
 
 	prefs_loaded = FALSE;
@@ -528,6 +528,23 @@ void purple_prefs_trigger_callback_object(PurplePrefCallbackData *data);
  */
 gboolean purple_prefs_load(void);
 
+/**
+ * purple_prefs_get_save_stats:
+ * @last_write_time: (out) (optional): How long the save thread took to write
+ *                   prefs.xml the last time, in microseconds.
+ * @max_write_time: (out) (optional): The longest write so far, in
+ *                  microseconds.
+ * @last_latency: (out) (optional): How long the last save reached the disk
+ *                after the first change it covers, in microseconds.
+ * @max_latency: (out) (optional): The longest latency so far, in
+ *               microseconds.
+ *
+ * Returns statistics about saving prefs.xml.  All of them are 0 until the
+ * first save has been written.
+ */
+void purple_prefs_get_save_stats(gint64 *last_write_time,
+		gint64 *max_write_time, gint64 *last_latency, gint64 *max_latency);
+
 G_END_DECLS
 
 #endif /* PURPLE_PREFS_H */
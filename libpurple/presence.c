@@ -609,7 +609,7 @@ purple_account_presence_get_account(PurpleAccountPresence *presence)
 	return priv->account;
 }
 
-static int
+int
 purple_buddy_presence_compute_score(PurpleBuddyPresence *buddy_presence)
 {
 	GList *l;
@@ -831,9 +831,17 @@ purple_buddy_presence_update_idle(PurplePresence *presence, gboolean old_idle)
 		}
 	}
 
-	if (old_idle != idle)
-		purple_signal_emit(purple_blist_get_handle(), "buddy-idle-changed", buddy,
+	if (old_idle != idle) {
+		static gulong idle_changed_signal = 0;
+
+		if (G_UNLIKELY(idle_changed_signal == 0)) {
+			idle_changed_signal = purple_signal_get_id(
+				purple_blist_get_handle(), "buddy-idle-changed");
+		}
+
+		purple_signal_emit_by_id(idle_changed_signal, buddy,
 		                 old_idle, idle);
+	}
 
 	purple_contact_invalidate_priority_buddy(purple_buddy_get_contact(buddy));
 
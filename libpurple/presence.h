@@ -327,6 +327,19 @@ PurpleBuddyPresence *purple_buddy_presence_new(PurpleBuddy *buddy);
  */
 PurpleBuddy *purple_buddy_presence_get_buddy(PurpleBuddyPresence *presence);
 
+/**
+ * purple_buddy_presence_compute_score:
+ * @buddy_presence: The presence.
+ *
+ * Adds up the scores of the presence's active statuses, as set by the
+ * /purple/status/scores prefs, along with its account's score and the idle
+ * score if it's idle.  The idle time score isn't included, since it's only
+ * given to the more recently active of two presences.
+ *
+ * Returns: The score; higher is more available.
+ */
+int purple_buddy_presence_compute_score(PurpleBuddyPresence *buddy_presence);
+
 /**
  * purple_buddy_presence_compare:
  * @buddy_presence1: The first presence.
@@ -1048,7 +1048,8 @@ bonjour_bytestreams_connect(PurpleXfer *xfer)
 
 static void
 xep_xfer_init(XepXfer *xfer) {
-
+	/* Bonjour only uses SOCKS5 bytestreams, which carry the file as-is. */
+	purple_xfer_set_raw_stream(PURPLE_XFER(xfer), TRUE);
 }
 
 static void
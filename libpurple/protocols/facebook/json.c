@@ -32,6 +32,7 @@ typedef struct _FbJsonValue FbJsonValue;
 struct _FbJsonValue
 {
 	const gchar *expr;
+	gchar **path;
 	FbJsonType type;
 	gboolean required;
 	GValue value;
@@ -76,6 +77,7 @@ fb_json_values_dispose(GObject *obj)
 			g_value_unset(&value->value);
 		}
 
+		g_strfreev(value->path);
 		g_free(value);
 	}
 
@@ -294,18 +296,100 @@ fb_json_node_new(const gchar *data, gssize size, GError **error)
 	return root;
 }
 
+/*
+ * Splits a plain member path, "$.foo.bar", into its member names. Any
+ * other JsonPath syntax returns NULL, and is left to json_path_query().
+ */
+static gchar **
+fb_json_path_compile(const gchar *expr)
+{
+	const gchar *c;
+
+	if ((expr[0] != '$') || ((expr[1] != '.') && (expr[1] != '\0'))) {
+		return NULL;
+	}
+
+	if (expr[1] == '\0') {
+		return g_new0(gchar *, 1);
+	}
+
+	if (expr[2] == '\0') {
+		return NULL;
+	}
+
+	for (c = expr + 2; *c != '\0'; c++) {
+		if ((*c == '.') && ((c[-1] == '.') || (c[1] == '\0'))) {
+			return NULL;
+		}
+
+		if ((*c != '.') && (*c != '_') && !g_ascii_isalnum(*c)) {
+			return NULL;
+		}
+	}
+
+	return g_strsplit(expr + 2, ".", -1);
+}
+
+/*
+ * Walks a compiled member path. The returned #JsonNode belongs to
+ * @root, nothing is copied.
+ */
+static JsonNode *
+fb_json_path_lookup(JsonNode *root, gchar **path, const gchar *expr,
+                    GError **error)
+{
+	JsonNode *node = root;
+	JsonObject *obj;
+
+	if (*path == NULL) {
+		return root;
+	}
+
+	for (; *path != NULL; path++) {
+		if (!JSON_NODE_HOLDS_OBJECT(node)) {
+			node = NULL;
+			break;
+		}
+
+		obj = json_node_get_object(node);
+		node = json_object_get_member(obj, *path);
+
+		if (node == NULL) {
+			break;
+		}
+	}
+
+	if (node == NULL) {
+		g_set_error(error, FB_JSON_ERROR, FB_JSON_ERROR_NOMATCH,
+		            _("No matches for %s"), expr);
+		return NULL;
+	}
+
+	if (JSON_NODE_HOLDS_NULL(node)) {
+		g_set_error(error, FB_JSON_ERROR, FB_JSON_ERROR_NULL,
+		            _("Null value for %s"), expr);
+		return NULL;
+	}
+
+	return node;
+}
+
 JsonNode *
 fb_json_node_get(JsonNode *root, const gchar *expr, GError **error)
 {
 	GError *err = NULL;
+	gchar **path;
 	guint size;
 	JsonArray *rslt;
 	JsonNode *node;
 	JsonNode *ret;
 
-	/* Special case for json-glib < 0.99.2 */
-	if (purple_strequal(expr, "$")) {
-		return json_node_copy(root);
+	path = fb_json_path_compile(expr);
+
+	if (path != NULL) {
+		node = fb_json_path_lookup(root, path, expr, error);
+		g_strfreev(path);
+		return (node != NULL) ? json_node_copy(node) : NULL;
 	}
 
 	node = json_path_query(expr, root, &err);
@@ -473,6 +557,7 @@ fb_json_values_add(FbJsonValues *values, FbJsonType type, gboolean required,
 
 	value = g_new0(FbJsonValue, 1);
 	value->expr = expr;
+	value->path = fb_json_path_compile(expr);
 	value->type = type;
 	value->required = required;
 
@@ -529,6 +614,7 @@ fb_json_values_update(FbJsonValues *values, GError **error)
 	GType type;
 	JsonNode *root;
 	JsonNode *node;
+	JsonNode *copy;
 
 	g_return_val_if_fail(values != NULL, FALSE);
 	priv = values->priv;
@@ -555,15 +641,20 @@ fb_json_values_update(FbJsonValues *values, GError **error)
 
 	for (l = priv->queue->head; l != NULL; l = l->next) {
 		value = l->data;
-		node = fb_json_node_get(root, value->expr, &err);
+		copy = NULL;
+
+		if (value->path != NULL) {
+			node = fb_json_path_lookup(root, value->path,
+			                           value->expr, &err);
+		} else {
+			node = copy = fb_json_node_get(root, value->expr, &err);
+		}
 
 		if (G_IS_VALUE(&value->value)) {
 			g_value_unset(&value->value);
 		}
 
 		if (err != NULL) {
-			json_node_free(node);
-
 			if (value->required) {
 				g_propagate_error(error, err);
 				return FALSE;
@@ -581,12 +672,12 @@ fb_json_values_update(FbJsonValues *values, GError **error)
 			            g_type_name(value->type),
 			            g_type_name(type),
 				    value->expr);
-			json_node_free(node);
+			json_node_free(copy);
 			return FALSE;
 		}
 
 		json_node_get_value(node, &value->value);
-		json_node_free(node);
+		json_node_free(copy);
 	}
 
 	priv->next = priv->queue->head;
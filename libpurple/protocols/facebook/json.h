@@ -361,7 +361,9 @@ fb_json_values_new(JsonNode *root);
  * @required: #TRUE if the node is required, otherwise #FALSE.
  * @expr: The #JsonPath expression.
  *
- * Adds a new #FbJsonValue to the #FbJsonValues.
+ * Adds a new #FbJsonValue to the #FbJsonValues. Plain member paths,
+ * such as "$.foo.bar", are compiled here and walked directly on each
+ * update. The @expr must outlive the #FbJsonValues.
  */
 void
 fb_json_values_add(FbJsonValues *values, FbJsonType type, gboolean required,
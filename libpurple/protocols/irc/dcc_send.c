@@ -383,6 +383,9 @@ irc_dccsend_init(PurpleXfer *xfer) {
 static void
 irc_xfer_init(IrcXfer *xfer) {
 	xfer->fd = -1;
+
+	/* DCC SEND streams the file as-is. */
+	purple_xfer_set_raw_stream(PURPLE_XFER(xfer), TRUE);
 }
 
 static void
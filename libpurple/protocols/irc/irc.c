@@ -28,7 +28,7 @@
 
 #define PING_TIMEOUT 60
 
-static void irc_ison_buddy_init(char *name, struct irc_buddy *ib, GList **list);
+static void irc_ison_buddy_init(char *name, struct irc_buddy *ib, GQueue *queue);
 
 static const char *irc_blist_icon(PurpleAccount *a, PurpleBuddy *b);
 static GList *irc_status_types(PurpleAccount *account);
@@ -45,6 +45,7 @@ static void irc_read_input_cb(GObject *source, GAsyncResult *res, gpointer data)
 static guint irc_nick_hash(const char *nick);
 static gboolean irc_nick_equal(const char *nick1, const char *nick2);
 static void irc_buddy_free(struct irc_buddy *ib);
+static void irc_batch_free(struct irc_batch *batch);
 
 PurpleProtocol *_irc_protocol = NULL;
 
@@ -289,7 +290,7 @@ gboolean irc_blist_timeout(struct irc_conn *irc)
 	}
 
 	g_hash_table_foreach(irc->buddies, (GHFunc)irc_ison_buddy_init,
-	                     (gpointer *)&irc->buddies_outstanding);
+	                     &irc->buddies_outstanding);
 
 	irc_buddy_query(irc);
 
@@ -298,20 +299,21 @@ gboolean irc_blist_timeout(struct irc_conn *irc)
 
 void irc_buddy_query(struct irc_conn *irc)
 {
-	GList *lp;
 	GString *string;
 	struct irc_buddy *ib;
-	char *buf;
+	char *name, *buf;
 
 	string = g_string_sized_new(512);
 
-	while ((lp = g_list_first(irc->buddies_outstanding))) {
-		ib = (struct irc_buddy *)lp->data;
-		if (string->len + strlen(ib->name) + 1 > 450)
-			break;
-		g_string_append_printf(string, "%s ", ib->name);
-		ib->new_online_status = FALSE;
-		irc->buddies_outstanding = g_list_delete_link(irc->buddies_outstanding, lp);
+	while ((name = g_queue_peek_head(&irc->buddies_outstanding))) {
+		/* The buddy may have been removed since it was queued. */
+		if ((ib = g_hash_table_lookup(irc->buddies, name)) != NULL) {
+			if (string->len + strlen(ib->name) + 1 > 450)
+				break;
+			g_string_append_printf(string, "%s ", ib->name);
+			ib->new_online_status = FALSE;
+		}
+		g_free(g_queue_pop_head(&irc->buddies_outstanding));
 	}
 
 	if (string->len) {
@@ -325,9 +327,9 @@ void irc_buddy_query(struct irc_conn *irc)
 	g_string_free(string, TRUE);
 }
 
-static void irc_ison_buddy_init(char *name, struct irc_buddy *ib, GList **list)
+static void irc_ison_buddy_init(char *name, struct irc_buddy *ib, GQueue *queue)
 {
-	*list = g_list_append(*list, ib);
+	g_queue_push_tail(queue, g_strdup(ib->name));
 }
 
 
@@ -335,8 +337,8 @@ static void irc_ison_one(struct irc_conn *irc, struct irc_buddy *ib)
 {
 	char *buf;
 
-	if (irc->buddies_outstanding != NULL) {
-		irc->buddies_outstanding = g_list_append(irc->buddies_outstanding, ib);
+	if (!g_queue_is_empty(&irc->buddies_outstanding)) {
+		g_queue_push_tail(&irc->buddies_outstanding, g_strdup(ib->name));
 		return;
 	}
 
@@ -347,6 +349,107 @@ static void irc_ison_one(struct irc_conn *irc, struct irc_buddy *ib)
 }
 
 
+/* Registers (or unregisters) names with MONITOR or WATCH, as many per line
+ * as fit. */
+static void irc_presence_send(struct irc_conn *irc, GList *names, gboolean add)
+{
+	gboolean monitor = (irc->presence_mode == IRC_PRESENCE_MONITOR);
+	const char *cmd = monitor ? "MONITOR" : "WATCH";
+	GString *targets = g_string_sized_new(512);
+	char *buf;
+
+	for (; names != NULL; names = names->next) {
+		const char *name = names->data;
+
+		if (targets->len > 0 && targets->len + strlen(name) + 2 > 450) {
+			buf = irc_format(irc, "vn", cmd, targets->str);
+			irc_send(irc, buf);
+			g_free(buf);
+			g_string_truncate(targets, 0);
+		}
+
+		if (monitor) {
+			/* MONITOR + nick1,nick2 */
+			if (targets->len == 0)
+				g_string_append(targets, add ? "+ " : "- ");
+			else
+				g_string_append_c(targets, ',');
+			g_string_append(targets, name);
+		} else {
+			/* WATCH +nick1 +nick2 */
+			if (targets->len > 0)
+				g_string_append_c(targets, ' ');
+			g_string_append_c(targets, add ? '+' : '-');
+			g_string_append(targets, name);
+		}
+	}
+
+	if (targets->len > 0) {
+		buf = irc_format(irc, "vn", cmd, targets->str);
+		irc_send(irc, buf);
+		g_free(buf);
+	}
+
+	g_string_free(targets, TRUE);
+}
+
+static void irc_presence_send_one(struct irc_conn *irc, const char *name, gboolean add)
+{
+	GList names = { (gpointer)name, NULL, NULL };
+
+	irc_presence_send(irc, &names, add);
+}
+
+/* Called once we're connected: hands the whole buddy list to the server if
+ * it can push presence to us, or starts polling it with ISON if not. */
+void irc_presence_start(struct irc_conn *irc)
+{
+	GList *names;
+
+	if (irc->presence_mode != IRC_PRESENCE_ISON && irc->presence_limit > 0 &&
+			g_hash_table_size(irc->buddies) > (guint)irc->presence_limit) {
+		purple_debug_info("irc", "%u buddies won't fit in the server's "
+				"%s list of %d, falling back to ISON\n",
+				g_hash_table_size(irc->buddies),
+				irc->presence_mode == IRC_PRESENCE_MONITOR ? "MONITOR" : "WATCH",
+				irc->presence_limit);
+		irc->presence_mode = IRC_PRESENCE_ISON;
+	}
+
+	if (irc->presence_mode == IRC_PRESENCE_ISON) {
+		irc_blist_timeout(irc);
+		if (!irc->timer)
+			irc->timer = purple_timer_add_seconds(45, (GSourceFunc)irc_blist_timeout, (gpointer)irc);
+		return;
+	}
+
+	names = g_hash_table_get_keys(irc->buddies);
+	irc_presence_send(irc, names, TRUE);
+	g_list_free(names);
+}
+
+/* The server turned down (part of) our MONITOR or WATCH list. Clear it so
+ * we don't get two sources of presence, and poll instead. */
+void irc_presence_fallback(struct irc_conn *irc)
+{
+	char *buf;
+
+	if (irc->presence_mode == IRC_PRESENCE_ISON)
+		return;
+
+	purple_debug_info("irc", "%s list is full, falling back to ISON\n",
+			irc->presence_mode == IRC_PRESENCE_MONITOR ? "MONITOR" : "WATCH");
+
+	buf = irc_format(irc, "vv",
+			irc->presence_mode == IRC_PRESENCE_MONITOR ? "MONITOR" : "WATCH",
+			"C");
+	irc_send(irc, buf);
+	g_free(buf);
+
+	irc->presence_mode = IRC_PRESENCE_ISON;
+	irc_presence_start(irc);
+}
+
 static const char *irc_blist_icon(PurpleAccount *a, PurpleBuddy *b)
 {
 	return "irc";
@@ -452,6 +555,9 @@ static void irc_login(PurpleAccount *account)
 	irc_cmd_table_build(irc);
 	irc->msgs = g_hash_table_new(g_str_hash, g_str_equal);
 	irc_msg_table_build(irc);
+	irc->tags = g_array_new(FALSE, FALSE, sizeof(struct irc_tag));
+	irc->batches = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, (GDestroyNotify)irc_batch_free);
 
 	purple_connection_update_progress(gc, _("Connecting"), 1, 2);
 
@@ -485,13 +591,25 @@ static gboolean do_login(PurpleConnection *gc) {
 	const gboolean use_sasl = purple_account_get_bool(irc->account, "sasl", FALSE);
 #endif
 
-	if (pass && *pass) {
+	/* Registration waits for CAP END if the server supports this at all, so
+	 * irc_msg_cap() requests what we understand from the answer and then
+	 * ends the negotiation. */
+	irc->cap_negotiating = TRUE;
+	buf = irc_format(irc, "vvv", "CAP", "LS", "302");
+	if (irc_send(irc, buf) < 0) {
+		g_free(buf);
+		return FALSE;
+	}
+	g_free(buf);
+
 #ifdef HAVE_CYRUS_SASL
-		if (use_sasl)
-			buf = irc_format(irc, "vv:", "CAP", "REQ", "sasl");
-		else /* intended to fall through */
+	/* The password goes in AUTHENTICATE instead. */
+	if (use_sasl)
+		pass = NULL;
 #endif
-			buf = irc_format(irc, "v:", "PASS", pass);
+
+	if (pass && *pass) {
+		buf = irc_format(irc, "v:", "PASS", pass);
 		if (irc_send(irc, buf) < 0) {
 			g_free(buf);
 			return FALSE;
@@ -602,12 +720,18 @@ static void irc_close(PurpleConnection *gc)
 	g_clear_object(&irc->conn);
 
 	if (irc->timer)
-		g_source_remove(irc->timer);
+		purple_timer_remove(irc->timer);
+	g_queue_foreach(&irc->buddies_outstanding, (GFunc)g_free, NULL);
+	g_queue_clear(&irc->buddies_outstanding);
 	g_hash_table_destroy(irc->cmds);
 	g_hash_table_destroy(irc->msgs);
 	g_hash_table_destroy(irc->buddies);
+	g_array_free(irc->tags, TRUE);
+	g_hash_table_destroy(irc->batches);
 	if (irc->motd)
 		g_string_free(irc->motd, TRUE);
+	if (irc->cap_req)
+		g_string_free(irc->cap_req, TRUE);
 	g_free(irc->server);
 
 	g_free(irc->mode_chars);
@@ -694,6 +818,14 @@ static void irc_add_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGroup
 		ib->name = g_strdup(bname);
 		ib->ref = 1;
 		g_hash_table_replace(irc->buddies, ib->name, ib);
+
+		/* During signon the whole list is registered at once by
+		 * irc_presence_start(). */
+		if (irc->presence_mode != IRC_PRESENCE_ISON &&
+				PURPLE_CONNECTION_IS_CONNECTED(gc)) {
+			irc_presence_send_one(irc, ib->name, TRUE);
+			return;
+		}
 	}
 
 	/* if the timer isn't set, this is during signon, so we don't want to flood
@@ -710,6 +842,9 @@ static void irc_remove_buddy(PurpleConnection *gc, PurpleBuddy *buddy, PurpleGro
 
 	ib = g_hash_table_lookup(irc->buddies, purple_buddy_get_name(buddy));
 	if (ib && --ib->ref == 0) {
+		if (irc->presence_mode != IRC_PRESENCE_ISON &&
+				PURPLE_CONNECTION_IS_CONNECTED(gc))
+			irc_presence_send_one(irc, ib->name, FALSE);
 		g_hash_table_remove(irc->buddies, purple_buddy_get_name(buddy));
 	}
 }
@@ -856,6 +991,14 @@ static void irc_buddy_free(struct irc_buddy *ib)
 	g_free(ib);
 }
 
+static void irc_batch_free(struct irc_batch *batch)
+{
+	g_free(batch->type);
+	g_free(batch->params);
+	g_slist_free_full(batch->quits, g_free);
+	g_free(batch);
+}
+
 static void irc_chat_set_topic(PurpleConnection *gc, int id, const char *topic)
 {
 	char *buf;
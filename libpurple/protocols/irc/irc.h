@@ -51,12 +51,21 @@
 #define IRC_MAX_BUFSIZE 16384
 
 #define IRC_MAX_MSG_SIZE 512
+#define IRC_MAX_MSG_ARGS 15
 
 #define IRC_NAMES_FLAG "irc-namelist"
 
 enum { IRC_USEROPT_SERVER, IRC_USEROPT_PORT, IRC_USEROPT_CHARSET };
 enum irc_state { IRC_STATE_NEW, IRC_STATE_ESTABLISHED };
 
+/* How buddy presence is tracked: polled with ISON, or pushed by the server
+ * once the buddies are registered with IRCv3 MONITOR or WATCH. */
+enum irc_presence_mode {
+	IRC_PRESENCE_ISON,
+	IRC_PRESENCE_MONITOR,
+	IRC_PRESENCE_WATCH
+};
+
 typedef struct
 {
 	PurpleProtocol parent;
@@ -77,8 +86,18 @@ struct irc_conn {
 	guint timer;
 	GHashTable *buddies;
 
+	enum irc_presence_mode presence_mode;
+	int presence_limit;	/* Max MONITOR/WATCH entries, 0 if unknown */
+
 	gboolean ison_outstanding;
-	GList *buddies_outstanding;
+	GQueue buddies_outstanding;	/* Names still to be sent in an ISON */
+
+	GArray *tags;		/* struct irc_tag, of the line being parsed */
+	GHashTable *batches;	/* Open BATCHes, reference -> struct irc_batch */
+	struct irc_batch *batch;	/* The BATCH the current line is part of */
+
+	gboolean cap_negotiating;	/* Registration waits for our CAP END */
+	GString *cap_req;	/* Offered caps we want, from a multi-line LS */
 
 	GDataInputStream *input;
 	PurpleQueuedOutputStream *output;
@@ -118,6 +137,19 @@ struct irc_conn {
 #endif
 };
 
+/* An IRCv3 message tag. Both point into the line being parsed, so they're
+ * only valid while its handler runs. */
+struct irc_tag {
+	const char *key;
+	const char *value;
+};
+
+struct irc_batch {
+	char *type;
+	char *params;
+	GSList *quits;		/* Nicks that quit in a netsplit batch */
+};
+
 struct irc_buddy {
 	char *name;
 	gboolean online;
@@ -135,6 +167,8 @@ int irc_send_len(struct irc_conn *irc, const char *buf, int len);
 gboolean irc_blist_timeout(struct irc_conn *irc);
 gboolean irc_who_channel_timeout(struct irc_conn *irc);
 void irc_buddy_query(struct irc_conn *irc);
+void irc_presence_start(struct irc_conn *irc);
+void irc_presence_fallback(struct irc_conn *irc);
 
 char *irc_escape_privmsg(const char *text, gssize length);
 
@@ -149,6 +183,8 @@ void irc_register_commands(void);
 void irc_unregister_commands(void);
 void irc_msg_table_build(struct irc_conn *irc);
 void irc_parse_msg(struct irc_conn *irc, char *input);
+const char *irc_msg_get_tag(struct irc_conn *irc, const char *key);
+time_t irc_msg_get_time(struct irc_conn *irc);
 char *irc_parse_ctcp(struct irc_conn *irc, const char *from, const char *to, const char *msg, int notice);
 char *irc_format(struct irc_conn *irc, const char *format, ...);
 
@@ -159,12 +195,17 @@ void irc_msg_badnick(struct irc_conn *irc, const char *name, const char *from, c
 void irc_msg_ban(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_banfull(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_banned(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_batch(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_chanmode(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_endwhois(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_features(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_invite(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_inviteonly(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_ison(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_monitor(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_watch(struct irc_conn *irc, const char *name, const char *from, char **args);
+void irc_msg_presencefull(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_join(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_kick(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_list(struct irc_conn *irc, const char *name, const char *from, char **args);
@@ -196,7 +237,6 @@ void irc_msg_wallops(struct irc_conn *irc, const char *name, const char *from, c
 void irc_msg_whois(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_who(struct irc_conn *irc, const char *name, const char *from, char **args);
 #ifdef HAVE_CYRUS_SASL
-void irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_auth(struct irc_conn *irc, char *arg);
 void irc_msg_authenticate(struct irc_conn *irc, const char *name, const char *from, char **args);
 void irc_msg_authok(struct irc_conn *irc, const char *name, const char *from, char **args);
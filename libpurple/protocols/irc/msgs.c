@@ -41,6 +41,7 @@ static char *irc_mask_userhost(const char *mask);
 static void irc_chat_remove_buddy(PurpleChatConversation *chat, char *data[2]);
 static void irc_buddy_status(char *name, struct irc_buddy *ib, struct irc_conn *irc);
 static void irc_connected(struct irc_conn *irc, const char *nick);
+static void irc_cap_end(struct irc_conn *irc);
 
 static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name,
                                    const char *from, const char *to,
@@ -48,6 +49,8 @@ static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name,
 
 #ifdef HAVE_CYRUS_SASL
 static void irc_sasl_finish(struct irc_conn *irc);
+static void irc_msg_cap_sasl(struct irc_conn *irc, const char *name,
+                             const char *from, char **args);
 #endif
 
 static char *irc_mask_nick(const char *mask)
@@ -115,9 +118,7 @@ static void irc_connected(struct irc_conn *irc, const char *nick)
 		g_hash_table_replace(irc->buddies, ib->name, ib);
 	}
 
-	irc_blist_timeout(irc);
-	if (!irc->timer)
-		irc->timer = g_timeout_add_seconds(45, (GSourceFunc)irc_blist_timeout, (gpointer)irc);
+	irc_presence_start(irc);
 }
 
 /* This function is ugly, but it's really an error handler. */
@@ -206,12 +207,224 @@ void irc_msg_features(struct irc_conn *irc, const char *name, const char *from,
 		if (!strncmp(features[i], "PREFIX=", 7)) {
 			if ((val = strchr(features[i] + 7, ')')) != NULL)
 				irc->mode_chars = g_strdup(val + 1);
+		} else if (!strncmp(features[i], "MONITOR", 7) &&
+				(features[i][7] == '\0' || features[i][7] == '=')) {
+			/* MONITOR is preferred over WATCH if both are offered. */
+			irc->presence_mode = IRC_PRESENCE_MONITOR;
+			irc->presence_limit = features[i][7] ? atoi(features[i] + 8) : 0;
+		} else if (!strncmp(features[i], "WATCH", 5) &&
+				(features[i][5] == '\0' || features[i][5] == '=') &&
+				irc->presence_mode != IRC_PRESENCE_MONITOR) {
+			irc->presence_mode = IRC_PRESENCE_WATCH;
+			irc->presence_limit = features[i][5] ? atoi(features[i] + 6) : 0;
 		}
 	}
 
 	g_strfreev(features);
 }
 
+static void irc_batch_netsplit(struct irc_conn *irc, struct irc_batch *batch)
+{
+	PurpleConnection *gc = purple_account_get_connection(irc->account);
+	GSList *chats, *quits;
+	char *reason;
+
+	if (!gc || !batch->quits)
+		return;
+
+	reason = g_strdup_printf("quit: %s", batch->params ? batch->params : "");
+	for (chats = purple_connection_get_active_chats(gc); chats; chats = chats->next) {
+		PurpleChatConversation *chat = chats->data;
+		GList *users = NULL;
+
+		for (quits = batch->quits; quits; quits = quits->next) {
+			if (purple_chat_conversation_has_user(chat, quits->data))
+				users = g_list_prepend(users, quits->data);
+		}
+
+		if (users) {
+			purple_chat_conversation_remove_users(chat, users, reason);
+			g_list_free(users);
+		}
+	}
+	g_free(reason);
+}
+
+void irc_msg_batch(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	struct irc_batch *batch;
+	const char *params;
+
+	if (args[0][0] == '+' && args[0][1] != '\0') {
+		batch = g_new0(struct irc_batch, 1);
+		params = args[1] ? args[1] : "";
+		batch->type = g_strndup(params, strcspn(params, " "));
+		params += strlen(batch->type);
+		if (*params == ' ')
+			batch->params = g_strdup(params + 1);
+		g_hash_table_replace(irc->batches, g_strdup(args[0] + 1), batch);
+	} else if (args[0][0] == '-') {
+		if ((batch = g_hash_table_lookup(irc->batches, args[0] + 1)) == NULL)
+			return;
+
+		if (purple_strequal(batch->type, "netsplit"))
+			irc_batch_netsplit(irc, batch);
+
+		if (irc->batch == batch)
+			irc->batch = NULL;
+		g_hash_table_remove(irc->batches, args[0] + 1);
+	}
+}
+
+/* The capabilities we understand and request whenever they're offered. */
+static const char * const irc_caps[] = { "server-time", "batch", NULL };
+
+/* Whether cap is one of the space separated names in list, ignoring any
+ * "=value" after a name. */
+static gboolean
+irc_cap_listed(const char *list, const char *cap)
+{
+	size_t len = strlen(cap);
+
+	while (*list) {
+		size_t n = strcspn(list, " ");
+
+		if (strcspn(list, " =") == len && !strncmp(list, cap, len))
+			return TRUE;
+
+		list += n;
+		while (*list == ' ')
+			list++;
+	}
+
+	return FALSE;
+}
+
+#ifdef HAVE_CYRUS_SASL
+static gboolean
+irc_cap_wants_sasl(struct irc_conn *irc)
+{
+	PurpleConnection *gc = purple_account_get_connection(irc->account);
+	const char *pass = gc ? purple_connection_get_password(gc) : NULL;
+
+	return purple_account_get_bool(irc->account, "sasl", FALSE) &&
+		pass && *pass;
+}
+#endif
+
+static void
+irc_cap_end(struct irc_conn *irc)
+{
+	char *buf;
+
+	if (!irc->cap_negotiating)
+		return;
+	irc->cap_negotiating = FALSE;
+
+	buf = irc_format(irc, "vv", "CAP", "END");
+	irc_send(irc, buf);
+	g_free(buf);
+}
+
+/* Collects the capabilities we want from a CAP LS reply and requests them
+ * all at once after its last line. */
+static void
+irc_msg_cap_ls(struct irc_conn *irc, char *list)
+{
+	gboolean more = FALSE;
+	char **caps, *req, *buf;
+	int i;
+
+	/* CAP LS 302 ends every line but the last with a "*" parameter. */
+	if (list[0] == '*' && list[1] == ' ') {
+		more = TRUE;
+		list += 2;
+		if (*list == ':')
+			list++;
+	}
+
+	if (irc->cap_req == NULL)
+		irc->cap_req = g_string_new(NULL);
+
+	caps = g_strsplit(list, " ", -1);
+	for (i = 0; caps[i] != NULL; i++) {
+		char *cap = caps[i];
+
+		cap[strcspn(cap, "=")] = '\0';
+		if (*cap == '\0')
+			continue;
+
+		if (!g_strv_contains(irc_caps, cap)
+#ifdef HAVE_CYRUS_SASL
+				&& !(purple_strequal(cap, "sasl") &&
+					irc_cap_wants_sasl(irc))
+#endif
+				)
+			continue;
+
+		if (irc->cap_req->len > 0)
+			g_string_append_c(irc->cap_req, ' ');
+		g_string_append(irc->cap_req, cap);
+	}
+	g_strfreev(caps);
+
+	if (more)
+		return;
+
+	req = g_string_free(irc->cap_req, FALSE);
+	irc->cap_req = NULL;
+
+#ifdef HAVE_CYRUS_SASL
+	if (irc_cap_wants_sasl(irc) && !irc_cap_listed(req, "sasl")) {
+		PurpleConnection *gc = purple_account_get_connection(irc->account);
+
+		purple_connection_take_error(gc, g_error_new_literal(
+			PURPLE_CONNECTION_ERROR,
+			PURPLE_CONNECTION_ERROR_AUTHENTICATION_IMPOSSIBLE,
+			_("SASL authentication failed: Server does not support SASL authentication.")));
+
+		irc_cap_end(irc);
+		g_free(req);
+		return;
+	}
+#endif
+
+	if (*req == '\0') {
+		irc_cap_end(irc);
+		g_free(req);
+		return;
+	}
+
+	buf = irc_format(irc, "vv:", "CAP", "REQ", req);
+	irc_send(irc, buf);
+	g_free(buf);
+	g_free(req);
+}
+
+void irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	if (purple_strequal(args[1], "LS")) {
+		if (irc->cap_negotiating)
+			irc_msg_cap_ls(irc, args[2]);
+		return;
+	}
+
+	/* Anything else, like CAP NEW and CAP DEL, is only informational. */
+	if (!purple_strequal(args[1], "ACK") && !purple_strequal(args[1], "NAK"))
+		return;
+
+#ifdef HAVE_CYRUS_SASL
+	/* SASL ends the negotiation itself once it's done. */
+	if (irc_cap_listed(args[2], "sasl")) {
+		irc_msg_cap_sasl(irc, name, from, args);
+		return;
+	}
+#endif
+
+	/* Our one REQ was answered. */
+	irc_cap_end(irc);
+}
+
 void irc_msg_luser(struct irc_conn *irc, const char *name, const char *from, char **args)
 {
 	if (purple_strequal(name, "251")) {
@@ -899,6 +1112,54 @@ void irc_msg_ison(struct irc_conn *irc, const char *name, const char *from, char
 		g_hash_table_foreach(irc->buddies, (GHFunc)irc_buddy_status, (gpointer)irc);
 }
 
+static void irc_buddy_set_online(struct irc_conn *irc, const char *nick, gboolean online)
+{
+	struct irc_buddy *ib;
+
+	if ((ib = g_hash_table_lookup(irc->buddies, nick)) == NULL)
+		return;
+
+	if (ib->online == online)
+		return;
+
+	ib->online = online;
+	purple_protocol_got_user_status(irc->account, ib->name,
+			online ? "available" : "offline", NULL);
+}
+
+/* RPL_MONONLINE and RPL_MONOFFLINE: a comma separated list of targets, as
+ * nick!user@host for online ones. */
+void irc_msg_monitor(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	gboolean online = purple_strequal(name, "730");
+	char **targets;
+	int i;
+
+	targets = g_strsplit(args[1], ",", -1);
+	for (i = 0; targets[i]; i++) {
+		char *nick = irc_mask_nick(targets[i]);
+		irc_buddy_set_online(irc, nick, online);
+		g_free(nick);
+	}
+	g_strfreev(targets);
+}
+
+/* RPL_LOGON, RPL_LOGOFF, RPL_NOWON and RPL_NOWOFF: one nick each. */
+void irc_msg_watch(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	gboolean online = purple_strequal(name, "600") || purple_strequal(name, "604");
+
+	irc_buddy_set_online(irc, args[1], online);
+}
+
+/* ERR_MONLISTFULL and ERR_TOOMANYWATCH */
+void irc_msg_presencefull(struct irc_conn *irc, const char *name, const char *from, char **args)
+{
+	if ((purple_strequal(name, "734") && irc->presence_mode == IRC_PRESENCE_MONITOR) ||
+			(purple_strequal(name, "512") && irc->presence_mode == IRC_PRESENCE_WATCH))
+		irc_presence_fallback(irc);
+}
+
 static void irc_buddy_status(char *name, struct irc_buddy *ib, struct irc_conn *irc)
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
@@ -1278,6 +1539,8 @@ static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name, const
 {
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
 	PurpleChatConversation *chat;
+	PurpleMessageFlags flags = 0;
+	time_t mtime;
 	char *tmp;
 	char *msg;
 	char *nick;
@@ -1285,6 +1548,11 @@ static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name, const
 	if (!gc)
 		return;
 
+	/* Replayed history, with its original timestamps */
+	if (irc->batch && purple_strequal(irc->batch->type, "chathistory"))
+		flags |= PURPLE_MESSAGE_DELAYED;
+	mtime = irc_msg_get_time(irc);
+
 	nick = irc_mask_nick(from);
 	tmp = irc_parse_ctcp(irc, nick, to, rawmsg, notice);
 	if (!tmp) {
@@ -1305,12 +1573,12 @@ static void irc_msg_handle_privmsg(struct irc_conn *irc, const char *name, const
 	}
 
 	if (!purple_utf8_strcasecmp(to, purple_connection_get_display_name(gc))) {
-		purple_serv_got_im(gc, nick, msg, 0, time(NULL));
+		purple_serv_got_im(gc, nick, msg, flags, mtime);
 	} else {
 		chat = purple_conversations_find_chat_with_account(irc_nick_skip_mode(irc, to), irc->account);
 		if (chat) {
 			purple_serv_got_chat_in(gc, purple_chat_conversation_get_id(chat),
-				nick, PURPLE_MESSAGE_RECV, msg, time(NULL));
+				nick, PURPLE_MESSAGE_RECV | flags, msg, mtime);
 		} else
 			purple_debug_error("irc", "Got a %s on %s, which does not exist\n",
 			                   notice ? "NOTICE" : "PRIVMSG", to);
@@ -1350,9 +1618,15 @@ void irc_msg_quit(struct irc_conn *irc, const char *name, const char *from, char
 
 	data[0] = irc_mask_nick(from);
 	data[1] = args[0];
-	/* XXX this should have an API, I shouldn't grab this directly */
-	g_slist_foreach(purple_connection_get_active_chats(gc),
-			(GFunc)irc_chat_remove_buddy, data);
+	if (irc->batch && purple_strequal(irc->batch->type, "netsplit")) {
+		/* These are taken out of the chats all at once at the end of
+		 * the batch. */
+		irc->batch->quits = g_slist_prepend(irc->batch->quits, g_strdup(data[0]));
+	} else {
+		/* XXX this should have an API, I shouldn't grab this directly */
+		g_slist_foreach(purple_connection_get_active_chats(gc),
+				(GFunc)irc_chat_remove_buddy, data);
+	}
 
 	if ((ib = g_hash_table_lookup(irc->buddies, data[0])) != NULL) {
 		ib->new_online_status = FALSE;
@@ -1547,8 +1821,8 @@ irc_auth_start_cyrus(struct irc_conn *irc)
 }
 
 /* SASL authentication */
-void
-irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **args)
+static void
+irc_msg_cap_sasl(struct irc_conn *irc, const char *name, const char *from, char **args)
 {
 	int ret = 0;
 	int id = 0;
@@ -1557,8 +1831,6 @@ irc_msg_cap(struct irc_conn *irc, const char *name, const char *from, char **arg
 	char *pos;
 	size_t index;
 
-	if (strncmp(g_strstrip(args[2]), "sasl", 5))
-		return;
 	if (strncmp(args[1], "ACK", 4)) {
 		purple_connection_take_error(gc, g_error_new_literal(
 			PURPLE_CONNECTION_ERROR,
@@ -1688,16 +1960,12 @@ irc_msg_authenticate(struct irc_conn *irc, const char *name, const char *from, c
 void
 irc_msg_authok(struct irc_conn *irc, const char *name, const char *from, char **args)
 {
-	char *buf;
-
 	sasl_dispose(&irc->sasl_conn);
 	irc->sasl_conn = NULL;
 	purple_debug_info("irc", "Succesfully authenticated using SASL.\n");
 
 	/* Finish auth session */
-	buf = irc_format(irc, "vv", "CAP", "END");
-	irc_send(irc, buf);
-	g_free(buf);
+	irc_cap_end(irc);
 }
 
 void
@@ -1770,8 +2038,6 @@ irc_msg_authfail(struct irc_conn *irc, const char *name, const char *from, char
 static void
 irc_sasl_finish(struct irc_conn *irc)
 {
-	char *buf;
-
 	sasl_dispose(&irc->sasl_conn);
 	irc->sasl_conn = NULL;
 
@@ -1779,8 +2045,6 @@ irc_sasl_finish(struct irc_conn *irc)
 	irc->sasl_cb = NULL;
 
 	/* Auth failed, abort */
-	buf = irc_format(irc, "vv", "CAP", "END");
-	irc_send(irc, buf);
-	g_free(buf);
+	irc_cap_end(irc);
 }
 #endif
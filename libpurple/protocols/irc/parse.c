@@ -102,16 +102,25 @@ static struct _irc_msg {
 	{ "482", "nc:", 3, irc_msg_notop },		/* Need to be op to do that	*/
 	{ "501", "n:", 2, irc_msg_badmode },		/* Unknown mode flag		*/
 	{ "506", "nc:", 3, irc_msg_nosend },		/* Must identify to send	*/
+	{ "512", "nn:", 2, irc_msg_presencefull },	/* WATCH list is full		*/
 	{ "515", "nc:", 3, irc_msg_regonly },		/* Registration required	*/
+	{ "600", "nnvvv:", 2, irc_msg_watch },		/* WATCH: logged on		*/
+	{ "601", "nnvvv:", 2, irc_msg_watch },		/* WATCH: logged off		*/
+	{ "604", "nnvvv:", 2, irc_msg_watch },		/* WATCH: is online		*/
+	{ "605", "nnvvv:", 2, irc_msg_watch },		/* WATCH: is offline		*/
+	{ "730", "n:", 2, irc_msg_monitor },		/* MONITOR: targets online	*/
+	{ "731", "n:", 2, irc_msg_monitor },		/* MONITOR: targets offline	*/
+	{ "734", "nvv:", 3, irc_msg_presencefull },	/* MONITOR list is full		*/
 #ifdef HAVE_CYRUS_SASL
 	{ "903", "*", 0, irc_msg_authok},		/* SASL auth successful		*/
 	{ "904", "*", 0, irc_msg_authtryagain },	/* SASL auth failed, can recover*/
 	{ "905", "*", 0, irc_msg_authfail },		/* SASL auth failed		*/
 	{ "906", "*", 0, irc_msg_authfail },		/* SASL auth failed		*/
 	{ "907", "*", 0, irc_msg_authfail },		/* SASL auth failed		*/
-	{ "cap", "vv:", 3, irc_msg_cap },		/* SASL capable			*/
 	{ "authenticate", ":", 1, irc_msg_authenticate }, /* SASL authenticate		*/
 #endif
+	{ "batch", "v*", 1, irc_msg_batch },		/* IRCv3 BATCH start or end	*/
+	{ "cap", "vv:", 3, irc_msg_cap },		/* Capability negotiation	*/
 	{ "invite", "n:", 2, irc_msg_invite },		/* Invited			*/
 	{ "join", ":", 1, irc_msg_join },		/* Joined a channel		*/
 	{ "kick", "cn:", 3, irc_msg_kick },		/* KICK				*/
@@ -668,13 +677,147 @@ char *irc_format(struct irc_conn *irc, const char *format, ...)
 	return (g_string_free(string, FALSE));
 }
 
+/* Returns whether text which is valid UTF-8 is taken as it is. */
+static gboolean irc_recv_is_utf8(struct irc_conn *irc)
+{
+	const char *enclist;
+
+	if (purple_account_get_bool(irc->account, "autodetect_utf8", IRC_DEFAULT_AUTODETECT))
+		return TRUE;
+
+	enclist = purple_account_get_string(irc->account, "encoding", IRC_DEFAULT_CHARSET);
+	if (enclist == NULL)
+		return FALSE;
+	while (*enclist == ' ')
+		enclist++;
+
+	return !g_ascii_strncasecmp(enclist, "UTF-8", 5) &&
+		(enclist[5] == '\0' || enclist[5] == ',' || enclist[5] == ' ');
+}
+
+/* Like irc_recv_convert(), but returns string itself rather than a copy when
+ * it needs no conversion. */
+static char *irc_recv_arg(struct irc_conn *irc, char *string, gboolean utf8, gboolean convert)
+{
+	if ((utf8 || !convert) && g_utf8_validate(string, -1, NULL))
+		return string;
+
+	/* Verbatim ('v' and '*') args are of unknown encoding which we do not
+	 * want to transcode, but they may or may not be valid UTF-8, so we'll
+	 * salvage them in case they leak past the IRC protocol.  If a
+	 * nick/channel/target field has inadvertently been marked verbatim,
+	 * this could cause weirdness. */
+	return convert ? irc_recv_convert(irc, string) : purple_utf8_salvage(string);
+}
+
+static void irc_unescape_tag_value(char *value)
+{
+	char *src, *dst;
+
+	for (src = dst = value; *src; src++) {
+		if (*src != '\\') {
+			*dst++ = *src;
+			continue;
+		}
+
+		switch (*++src) {
+		case ':':
+			*dst++ = ';';
+			break;
+		case 's':
+			*dst++ = ' ';
+			break;
+		case 'r':
+			*dst++ = '\r';
+			break;
+		case 'n':
+			*dst++ = '\n';
+			break;
+		case '\0':
+			/* A trailing backslash is dropped */
+			src--;
+			break;
+		default:
+			*dst++ = *src;
+			break;
+		}
+	}
+	*dst = '\0';
+}
+
+/* Splits the @tags at the start of a line into irc->tags, in place, and
+ * returns the rest of the line. */
+static char *irc_parse_tags(struct irc_conn *irc, char *input)
+{
+	struct irc_tag tag;
+	char *cur, *next, *end, *value;
+
+	if ((end = strchr(input, ' ')) == NULL)
+		return NULL;
+	*end++ = '\0';
+	while (*end == ' ')
+		end++;
+
+	for (cur = input + 1; cur; cur = next) {
+		if ((next = strchr(cur, ';')) != NULL)
+			*next++ = '\0';
+		if (*cur == '\0')
+			continue;
+
+		if ((value = strchr(cur, '=')) != NULL) {
+			*value++ = '\0';
+			irc_unescape_tag_value(value);
+		}
+
+		tag.key = cur;
+		tag.value = value ? value : "";
+		g_array_append_val(irc->tags, tag);
+	}
+
+	return end;
+}
+
+const char *irc_msg_get_tag(struct irc_conn *irc, const char *key)
+{
+	guint i;
+
+	for (i = 0; i < irc->tags->len; i++) {
+		struct irc_tag *tag = &g_array_index(irc->tags, struct irc_tag, i);
+		if (purple_strequal(tag->key, key))
+			return tag->value;
+	}
+
+	return NULL;
+}
+
+time_t irc_msg_get_time(struct irc_conn *irc)
+{
+	const char *stamp;
+	time_t t;
+
+	/* server-time: 2011-10-19T16:40:51.620Z */
+	stamp = irc_msg_get_tag(irc, "time");
+	if (stamp && *stamp && (t = purple_str_to_time(stamp, TRUE, NULL, NULL, NULL)) != 0)
+		return t;
+
+	return time(NULL);
+}
+
+/*
+ * Lines are tokenized in place: the prefix, the command and the arguments
+ * are terminated where they stand, and only arguments which need charset
+ * conversion or salvaging are copied.
+ */
 void irc_parse_msg(struct irc_conn *irc, char *input)
 {
 	struct _irc_msg *msgent;
-	char *cur, *end, *tmp, *from, *msgname, *fmt, **args, *msg;
-	guint i;
+	char *cur, *end, *from, *fromend, *fmt, *msg, *tmp, sep;
+	char *args[IRC_MAX_MSG_ARGS + 1];
+	char msgname[16];
+	const char *batch;
+	guint i, copied = 0;
 	PurpleConnection *gc = purple_account_get_connection(irc->account);
-	gboolean fmt_valid;
+	gboolean fmt_valid, utf8;
 	int args_cnt;
 
 	irc->recv_time = time(NULL);
@@ -693,6 +836,19 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 		g_free(clean);
 	}
 
+	g_array_set_size(irc->tags, 0);
+	irc->batch = NULL;
+	if (input[0] == '@') {
+		if ((cur = irc_parse_tags(irc, input)) == NULL) {
+			irc_parse_error_cb(irc, input);
+			return;
+		}
+		input = cur;
+
+		if ((batch = irc_msg_get_tag(irc, "batch")) != NULL)
+			irc->batch = g_hash_table_lookup(irc->batches, batch);
+	}
+
 	if (!strncmp(input, "PING ", 5)) {
 		msg = irc_format(irc, "vv", "PONG", input + 5);
 		irc_send(irc, msg);
@@ -717,90 +873,87 @@ void irc_parse_msg(struct irc_conn *irc, char *input)
 #endif
 	}
 
-	if (input[0] != ':' || (cur = strchr(input, ' ')) == NULL) {
+	if (input[0] != ':' || (fromend = strchr(input, ' ')) == NULL) {
 		irc_parse_error_cb(irc, input);
 		return;
 	}
 
-	from = g_strndup(&input[1], cur - &input[1]);
-	cur++;
+	from = input + 1;
+	cur = fromend + 1;
 	end = strchr(cur, ' ');
 	if (!end)
 		end = cur + strlen(cur);
 
-	tmp = g_strndup(cur, end - cur);
-	msgname = g_ascii_strdown(tmp, -1);
-	g_free(tmp);
+	msgent = NULL;
+	if ((gsize)(end - cur) < sizeof(msgname)) {
+		for (i = 0; cur + i < end; i++)
+			msgname[i] = g_ascii_tolower(cur[i]);
+		msgname[i] = '\0';
+		msgent = g_hash_table_lookup(irc->msgs, msgname);
+	}
 
-	if ((msgent = g_hash_table_lookup(irc->msgs, msgname)) == NULL) {
-		irc_msg_default(irc, "", from, &input);
-		g_free(msgname);
-		g_free(from);
+	if (msgent == NULL) {
+		/* irc_msg_default() wants the whole line, so nothing has been
+		 * cut up yet. */
+		tmp = g_strndup(from, fromend - from);
+		irc_msg_default(irc, "", tmp, &input);
+		g_free(tmp);
 		return;
 	}
-	g_free(msgname);
+	*fromend = '\0';
 
+	utf8 = irc_recv_is_utf8(irc);
+	memset(args, 0, sizeof(args));
 	fmt_valid = TRUE;
-	args = g_new0(char *, strlen(msgent->format));
 	args_cnt = 0;
-	for (cur = end, fmt = msgent->format, i = 0; fmt[i] && *cur++; i++) {
+	sep = *end;
+	for (fmt = msgent->format, i = 0; fmt[i] && sep && i < IRC_MAX_MSG_ARGS; i++) {
+		cur = end + 1;
 		switch (fmt[i]) {
 		case 'v':
-			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
-			/* This is a string of unknown encoding which we do not
-			 * want to transcode, but it may or may not be valid
-			 * UTF-8, so we'll salvage it.  If a nick/channel/target
-			 * field has inadvertently been marked verbatim, this
-			 * could cause weirdness. */
-			tmp = g_strndup(cur, end - cur);
-			args[i] = purple_utf8_salvage(tmp);
-			g_free(tmp);
-			cur += end - cur;
-			break;
 		case 't':
 		case 'n':
 		case 'c':
 			if (!(end = strchr(cur, ' '))) end = cur + strlen(cur);
-			tmp = g_strndup(cur, end - cur);
-			args[i] = irc_recv_convert(irc, tmp);
-			g_free(tmp);
-			cur += end - cur;
+			sep = *end;
+			*end = '\0';
 			break;
 		case ':':
 			if (*cur == ':') cur++;
-			args[i] = irc_recv_convert(irc, cur);
-			cur = cur + strlen(cur);
-			break;
+			/* fall through */
 		case '*':
-			/* Ditto 'v' above; we're going to salvage this in case
-			 * it leaks past the IRC protocol */
-			args[i] = purple_utf8_salvage(cur);
-			cur = cur + strlen(cur);
+			end = cur + strlen(cur);
+			sep = '\0';
 			break;
 		default:
 			purple_debug(PURPLE_DEBUG_ERROR, "irc", "invalid message format character '%c'\n", fmt[i]);
 			fmt_valid = FALSE;
 			break;
 		}
-		if (fmt_valid)
-			args_cnt = i + 1;
+		if (!fmt_valid)
+			break;
+
+		args[i] = irc_recv_arg(irc, cur, utf8, fmt[i] != 'v' && fmt[i] != '*');
+		if (args[i] != cur)
+			copied |= 1 << i;
+		args_cnt = i + 1;
 	}
 	if (G_UNLIKELY(!fmt_valid)) {
 		purple_debug_error("irc", "message format was invalid");
 	} else if (G_LIKELY(args_cnt >= msgent->req_cnt)) {
-		tmp = irc_recv_convert(irc, from);
+		tmp = irc_recv_arg(irc, from, utf8, TRUE);
 		(msgent->cb)(irc, msgent->name, tmp, args);
-		g_free(tmp);
+		if (tmp != from)
+			g_free(tmp);
 	} else {
 		purple_debug_error("irc", "args count (%d) doesn't reach "
 			"expected value of %d for the '%s' command",
 			args_cnt, msgent->req_cnt, msgent->name);
 	}
-	for (i = 0; i < strlen(msgent->format); i++) {
-		g_free(args[i]);
+	for (i = 0; i < IRC_MAX_MSG_ARGS; i++) {
+		if (copied & (1 << i))
+			g_free(args[i]);
 	}
-	g_free(args);
-	g_free(from);
 }
 
 static void irc_parse_error_cb(struct irc_conn *irc, char *input)
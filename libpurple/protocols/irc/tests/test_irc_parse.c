@@ -0,0 +1,110 @@
+#include <glib.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "tests/test_ui.h"
+#include "protocols/irc/irc.h"
+
+#define TEST_IRC_PARSE_BENCHMARK_LINES 200000
+
+extern PurpleProtocol *_irc_protocol;
+
+static const gchar *test_irc_parse_motd_line =
+	"@time=2020-01-01T00:00:00.000Z;msgid=abcdef :irc.example.com 372 nick "
+	":- Welcome to the example network, <please> read the rules";
+
+static struct irc_conn *
+test_irc_parse_conn_new(void) {
+	struct irc_conn *irc = g_new0(struct irc_conn, 1);
+
+	irc->account = purple_account_new("nick@irc.example.com", "prpl-irc");
+	irc->msgs = g_hash_table_new(g_str_hash, g_str_equal);
+	irc_msg_table_build(irc);
+	irc->tags = g_array_new(FALSE, FALSE, sizeof(struct irc_tag));
+	irc->batches = g_hash_table_new_full(g_str_hash, g_str_equal,
+	                                     g_free, NULL);
+	irc->motd = g_string_new("");
+
+	return irc;
+}
+
+static void
+test_irc_parse_conn_free(struct irc_conn *irc) {
+	g_object_unref(irc->account);
+	g_hash_table_destroy(irc->msgs);
+	g_array_free(irc->tags, TRUE);
+	g_hash_table_destroy(irc->batches);
+	g_string_free(irc->motd, TRUE);
+	g_free(irc);
+}
+
+/* irc_parse_msg() cuts the line up in place, so it gets a copy. */
+static void
+test_irc_parse_line(struct irc_conn *irc, const gchar *line) {
+	gchar *input = g_strdup(line);
+
+	irc_parse_msg(irc, input);
+
+	g_free(input);
+}
+
+static void
+test_irc_parse_motd(void) {
+	struct irc_conn *irc = test_irc_parse_conn_new();
+
+	test_irc_parse_line(irc, test_irc_parse_motd_line);
+
+	g_assert_cmpstr(irc->motd->str, ==,
+	                "- Welcome to the example network, &lt;please&gt; read "
+	                "the rules<br>");
+	g_assert_cmpuint(irc->tags->len, ==, 2);
+	g_assert_cmpstr(irc_msg_get_tag(irc, "msgid"), ==, "abcdef");
+
+	test_irc_parse_conn_free(irc);
+}
+
+static void
+test_irc_parse_benchmark(void) {
+	struct irc_conn *irc = test_irc_parse_conn_new();
+	gsize len = strlen(test_irc_parse_motd_line);
+	gdouble elapsed;
+	guint i;
+
+	g_test_timer_start();
+	for(i = 0; i < TEST_IRC_PARSE_BENCHMARK_LINES; i++) {
+		test_irc_parse_line(irc, test_irc_parse_motd_line);
+
+		/* Keep the MOTD from growing without bound. */
+		g_string_truncate(irc->motd, 0);
+	}
+	elapsed = g_test_timer_elapsed();
+
+	g_test_maximized_result(TEST_IRC_PARSE_BENCHMARK_LINES / elapsed,
+	                        "irc_parse_msg: %.0f lines/s",
+	                        TEST_IRC_PARSE_BENCHMARK_LINES / elapsed);
+	g_test_message("irc_parse_msg: %.2f MB/s",
+	               len * TEST_IRC_PARSE_BENCHMARK_LINES / elapsed /
+	               (1024 * 1024));
+
+	test_irc_parse_conn_free(irc);
+}
+
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	/* Nothing is connected to irc-receiving-text, but emitting it still
+	 * wants an instance. */
+	_irc_protocol = (PurpleProtocol *)&_irc_protocol;
+
+	g_test_add_func("/irc/parse/motd", test_irc_parse_motd);
+
+	if(g_test_perf()) {
+		g_test_add_func("/irc/parse/benchmark", test_irc_parse_benchmark);
+	}
+
+	return g_test_run();
+}
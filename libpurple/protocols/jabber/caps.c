@@ -30,8 +30,29 @@
 #include "util.h"
 #include "xdata.h"
 
+/* The old, all-in-one cache; imported into the store and removed. */
 #define JABBER_CAPS_FILENAME "xmpp-caps.xml"
 
+/*
+ * The caps store is an append-only file of records, each of which is:
+ *
+ *   guint32 length (big endian) of the rest of the record
+ *   char    'c' for a client, or 'e' for a v1.3 ext
+ *   client: node NUL ver NUL hash NUL <client/>
+ *   ext:    node NUL identifier NUL feature NUL feature NUL ...
+ *
+ * Only the offset of each client record, keyed by its tuple, is kept in
+ * memory; a client is read in the first time it's looked up.  Later
+ * records replace earlier ones, and once enough of them have been replaced
+ * the store is rewritten with only the live ones when it's next indexed.
+ */
+#define JABBER_CAPS_STORE_FILENAME "xmpp-caps.dat"
+#define JABBER_CAPS_STORE_MAGIC "PURPLECAPS1\n"
+#define JABBER_CAPS_STORE_MAGIC_LEN (sizeof(JABBER_CAPS_STORE_MAGIC) - 1)
+/* Replaced records there must be, and outnumber the live ones, before the
+ * store is compacted. */
+#define JABBER_CAPS_STORE_COMPACT_DEAD 64
+
 typedef struct {
 	gchar *var;
 	GList *values;
@@ -39,7 +60,9 @@ typedef struct {
 
 static GHashTable *capstable = NULL; /* JabberCapsTuple -> JabberCapsClientInfo */
 static GHashTable *nodetable = NULL; /* char *node -> JabberCapsNodeExts */
-static guint       save_timer = 0;
+static GHashTable  *capsindex = NULL; /* JabberCapsTuple -> gsize offset */
+static GMappedFile *capsmap = NULL;
+static gsize        capsstore_size = 0; /* End of the last whole record */
 
 /* Free a GList of allocated char* */
 static void
@@ -94,6 +117,27 @@ static gboolean jabber_caps_compare(gconstpointer v1, gconstpointer v2) {
 	       purple_strequal(name1->hash, name2->hash);
 }
 
+static JabberCapsTuple *
+jabber_caps_tuple_copy(const JabberCapsTuple *tuple)
+{
+	JabberCapsTuple *copy = g_new(JabberCapsTuple, 1);
+
+	copy->node = g_strdup(tuple->node);
+	copy->ver = g_strdup(tuple->ver);
+	copy->hash = g_strdup(tuple->hash);
+
+	return copy;
+}
+
+static void
+jabber_caps_tuple_free(JabberCapsTuple *tuple)
+{
+	g_free((char *)tuple->node);
+	g_free((char *)tuple->ver);
+	g_free((char *)tuple->hash);
+	g_free(tuple);
+}
+
 static void
 jabber_caps_client_info_destroy(JabberCapsClientInfo *info)
 {
@@ -131,27 +175,11 @@ jabber_caps_find_exts_by_node(const char *node)
 	return jabber_caps_node_exts_ref(exts);
 }
 
-static void
-exts_to_xmlnode(gconstpointer key, gconstpointer value, gpointer user_data)
+static PurpleXmlNode *
+jabber_caps_client_to_xmlnode(const JabberCapsClientInfo *props)
 {
-	const char *identifier = key;
-	const GList *features = value, *node;
-	PurpleXmlNode *client = user_data, *ext, *feature;
-
-	ext = purple_xmlnode_new_child(client, "ext");
-	purple_xmlnode_set_attrib(ext, "identifier", identifier);
-
-	for (node = features; node; node = node->next) {
-		feature = purple_xmlnode_new_child(ext, "feature");
-		purple_xmlnode_set_attrib(feature, "var", (const gchar *)node->data);
-	}
-}
-
-static void jabber_caps_store_client(gpointer key, gpointer value, gpointer user_data) {
-	const JabberCapsTuple *tuple = key;
-	const JabberCapsClientInfo *props = value;
-	PurpleXmlNode *root = user_data;
-	PurpleXmlNode *client = purple_xmlnode_new_child(root, "client");
+	const JabberCapsTuple *tuple = &props->tuple;
+	PurpleXmlNode *client = purple_xmlnode_new("client");
 	GList *iter;
 
 	purple_xmlnode_set_attrib(client, "node", tuple->node);
@@ -181,146 +209,525 @@ static void jabber_caps_store_client(gpointer key, gpointer value, gpointer user
 		purple_xmlnode_insert_child(client, purple_xmlnode_copy(xdata));
 	}
 
-	/* TODO: Ideally, only save this once-per-node... */
-	if (props->exts)
-		g_hash_table_foreach(props->exts->exts, (GHFunc)exts_to_xmlnode, client);
+	/* The exts are stored on their own, once per node. */
+
+	return client;
 }
 
-static gboolean
-do_jabber_caps_store(gpointer data)
+static JabberCapsClientInfo *
+jabber_caps_client_from_xmlnode(PurpleXmlNode *client)
 {
-	char *str;
-	int length = 0;
-	PurpleXmlNode *root = purple_xmlnode_new("capabilities");
+	JabberCapsClientInfo *value;
+	JabberCapsTuple *key;
+	PurpleXmlNode *child;
+	JabberCapsNodeExts *exts = NULL;
+	const char *node, *ver;
+
+	node = purple_xmlnode_get_attrib(client, "node");
+	ver = purple_xmlnode_get_attrib(client, "ver");
+	if (!node || !ver)
+		return NULL;
+
+	value = g_new0(JabberCapsClientInfo, 1);
+	key = (JabberCapsTuple*)&value->tuple;
+	key->node = g_strdup(node);
+	key->ver  = g_strdup(ver);
+	key->hash = g_strdup(purple_xmlnode_get_attrib(client,"hash"));
+
+	/* v1.3 capabilities */
+	if (key->hash == NULL)
+		exts = jabber_caps_find_exts_by_node(key->node);
+
+	for (child = client->child; child; child = child->next) {
+		if (child->type != PURPLE_XMLNODE_TYPE_TAG)
+			continue;
+		if (purple_strequal(child->name, "feature")) {
+			const char *var = purple_xmlnode_get_attrib(child, "var");
+			if(!var)
+				continue;
+			value->features = g_list_append(value->features,g_strdup(var));
+		} else if (purple_strequal(child->name, "identity")) {
+			const char *category = purple_xmlnode_get_attrib(child, "category");
+			const char *type = purple_xmlnode_get_attrib(child, "type");
+			const char *name = purple_xmlnode_get_attrib(child, "name");
+			const char *lang = purple_xmlnode_get_attrib(child, "lang");
+			JabberIdentity *id;
+
+			if (!category || !type)
+				continue;
+
+			id = jabber_identity_new(category, type, lang, name);
+			value->identities = g_list_append(value->identities,id);
+		} else if (purple_strequal(child->name, "x")) {
+			/* TODO: See #7814 -- this might cause problems if anyone
+			 * ever actually specifies forms. In fact, for this to
+			 * work properly, that bug needs to be fixed in
+			 * purple_xmlnode_from_str, not the output version... */
+			value->forms = g_list_append(value->forms, purple_xmlnode_copy(child));
+		} else if (purple_strequal(child->name, "ext")) {
+			/* Only found in the old xmpp-caps.xml */
+			if (key->hash != NULL)
+				purple_debug_warning("jabber", "Ignoring exts when reading new-style caps\n");
+			else {
+				/* TODO: Do we care about reading in the identities listed here? */
+				const char *identifier = purple_xmlnode_get_attrib(child, "identifier");
+				PurpleXmlNode *node;
+				GList *features = NULL;
+
+				if (!identifier)
+					continue;
 
-	g_hash_table_foreach(capstable, jabber_caps_store_client, root);
-	str = purple_xmlnode_to_formatted_str(root, &length);
-	purple_xmlnode_free(root);
-	purple_util_write_data_to_cache_file(JABBER_CAPS_FILENAME, str, length);
-	g_free(str);
+				for (node = child->child; node; node = node->next) {
+					if (node->type != PURPLE_XMLNODE_TYPE_TAG)
+						continue;
+					if (purple_strequal(node->name, "feature")) {
+						const char *var = purple_xmlnode_get_attrib(node, "var");
+						if (!var)
+							continue;
+						features = g_list_prepend(features, g_strdup(var));
+					}
+				}
 
-	save_timer = 0;
-	return FALSE;
+				if (features) {
+					g_hash_table_insert(exts->exts, g_strdup(identifier),
+					                    features);
+				} else
+					purple_debug_warning("jabber", "Caps ext %s had no features.\n",
+					                     identifier);
+			}
+		}
+	}
+
+	value->exts = exts;
+	return value;
 }
 
 static void
-schedule_caps_save(void)
+jabber_caps_record_append(GString *data, char type, const GString *payload)
 {
-	if (save_timer == 0)
-		save_timer = g_timeout_add_seconds(5, do_jabber_caps_store, NULL);
+	guint32 len = GUINT32_TO_BE(payload->len + 1);
+
+	g_string_append_len(data, (const gchar *)&len, sizeof(len));
+	g_string_append_c(data, type);
+	g_string_append_len(data, payload->str, payload->len);
 }
 
-static void
-jabber_caps_load(void)
+static GString *
+jabber_caps_client_payload(const JabberCapsClientInfo *info)
 {
-	PurpleXmlNode *capsdata = purple_util_read_xml_from_cache_file(JABBER_CAPS_FILENAME, "XMPP capabilities cache");
+	GString *payload = g_string_new(NULL);
 	PurpleXmlNode *client;
+	char *xml;
+	int len = 0;
+
+	g_string_append_len(payload, info->tuple.node, strlen(info->tuple.node) + 1);
+	g_string_append_len(payload, info->tuple.ver, strlen(info->tuple.ver) + 1);
+	if (info->tuple.hash)
+		g_string_append(payload, info->tuple.hash);
+	g_string_append_c(payload, '\0');
+
+	client = jabber_caps_client_to_xmlnode(info);
+	xml = purple_xmlnode_to_str(client, &len);
+	g_string_append_len(payload, xml, len);
+	g_free(xml);
+	purple_xmlnode_free(client);
+
+	return payload;
+}
 
-	if(!capsdata)
-		return;
+static GString *
+jabber_caps_ext_payload(const char *node, const char *identifier,
+                        const GList *features)
+{
+	GString *payload = g_string_new(NULL);
+
+	g_string_append_len(payload, node, strlen(node) + 1);
+	g_string_append_len(payload, identifier, strlen(identifier) + 1);
+	for (; features; features = features->next)
+		g_string_append_len(payload, features->data, strlen(features->data) + 1);
+
+	return payload;
+}
+
+/* Returns the next NUL terminated string of a record, or NULL if there's
+ * none before end. */
+static const char *
+jabber_caps_record_string(const char **cur, const char *end)
+{
+	const char *str = *cur, *nul;
+
+	if (str >= end || (nul = memchr(str, '\0', end - str)) == NULL)
+		return NULL;
+
+	*cur = nul + 1;
+	return str;
+}
 
-	if (!purple_strequal(capsdata->name, "capabilities")) {
+static const gchar *
+jabber_caps_store_contents(void)
+{
+	GError *error = NULL;
+	gchar *path;
+
+	if (capsmap == NULL) {
+		path = g_build_filename(purple_cache_dir(), JABBER_CAPS_STORE_FILENAME, NULL);
+		capsmap = g_mapped_file_new(path, FALSE, &error);
+		g_free(path);
+		if (capsmap == NULL) {
+			if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+				purple_debug_error("jabber", "Failed to map the caps store: %s\n",
+				                   error->message);
+			g_error_free(error);
+			return NULL;
+		}
+	}
+
+	if (g_mapped_file_get_length(capsmap) < capsstore_size)
+		return NULL;
+
+	return g_mapped_file_get_contents(capsmap);
+}
+
+/* Returns whether the ext replaced one read in before. */
+static gboolean
+jabber_caps_store_add_ext(const char *cur, const char *end)
+{
+	const char *node, *identifier, *var;
+	JabberCapsNodeExts *exts;
+	GList *features = NULL;
+
+	gboolean replaced;
+
+	if (!(node = jabber_caps_record_string(&cur, end)) ||
+			!(identifier = jabber_caps_record_string(&cur, end)))
+		return FALSE;
+
+	while ((var = jabber_caps_record_string(&cur, end)) != NULL)
+		features = g_list_prepend(features, g_strdup(var));
+
+	exts = jabber_caps_find_exts_by_node(node);
+	replaced = !g_hash_table_replace(exts->exts, g_strdup(identifier), features);
+	jabber_caps_node_exts_unref(exts);
+
+	return replaced;
+}
+
+/* Moves the old xmpp-caps.xml, if there is one, into a new store. */
+static void
+jabber_caps_store_import(void)
+{
+	PurpleXmlNode *capsdata, *client;
+	GString *data = g_string_new(JABBER_CAPS_STORE_MAGIC);
+	GHashTableIter iter, extiter;
+	gpointer key, value, identifier, features;
+	gchar *path;
+
+	capsdata = purple_util_read_xml_from_cache_file(JABBER_CAPS_FILENAME, "XMPP capabilities cache");
+	if (capsdata && purple_strequal(capsdata->name, "capabilities")) {
+		for (client = capsdata->child; client; client = client->next) {
+			JabberCapsClientInfo *info;
+			GString *payload;
+
+			if (client->type != PURPLE_XMLNODE_TYPE_TAG ||
+					!purple_strequal(client->name, "client"))
+				continue;
+
+			if ((info = jabber_caps_client_from_xmlnode(client)) == NULL)
+				continue;
+
+			payload = jabber_caps_client_payload(info);
+			jabber_caps_record_append(data, 'c', payload);
+			g_string_free(payload, TRUE);
+			jabber_caps_client_info_destroy(info);
+		}
+
+		g_hash_table_iter_init(&iter, nodetable);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			JabberCapsNodeExts *exts = value;
+
+			g_hash_table_iter_init(&extiter, exts->exts);
+			while (g_hash_table_iter_next(&extiter, &identifier, &features)) {
+				GString *payload = jabber_caps_ext_payload(key, identifier, features);
+				jabber_caps_record_append(data, 'e', payload);
+				g_string_free(payload, TRUE);
+			}
+		}
+	}
+	if (capsdata)
 		purple_xmlnode_free(capsdata);
+
+	if (purple_util_write_data_to_cache_file(JABBER_CAPS_STORE_FILENAME,
+			data->str, data->len)) {
+		path = g_build_filename(purple_cache_dir(), JABBER_CAPS_FILENAME, NULL);
+		g_unlink(path);
+		g_free(path);
+	}
+	g_string_free(data, TRUE);
+}
+
+/* Rewrites the store with only the records the index and the nodetable
+ * still refer to. */
+static void
+jabber_caps_store_compact(const gchar *contents)
+{
+	GString *data = g_string_new(JABBER_CAPS_STORE_MAGIC);
+	GHashTableIter iter, extiter;
+	gpointer key, value, identifier, features;
+	gsize offset;
+	guint32 reclen;
+
+	g_hash_table_iter_init(&iter, capsindex);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		offset = GPOINTER_TO_SIZE(value);
+		memcpy(&reclen, contents + offset, sizeof(reclen));
+		reclen = GUINT32_FROM_BE(reclen);
+		g_string_append_len(data, contents + offset, sizeof(reclen) + reclen);
+	}
+
+	g_hash_table_iter_init(&iter, nodetable);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		JabberCapsNodeExts *exts = value;
+
+		g_hash_table_iter_init(&extiter, exts->exts);
+		while (g_hash_table_iter_next(&extiter, &identifier, &features)) {
+			GString *payload = jabber_caps_ext_payload(key, identifier, features);
+			jabber_caps_record_append(data, 'e', payload);
+			g_string_free(payload, TRUE);
+		}
+	}
+
+	if (!purple_util_write_data_to_cache_file(JABBER_CAPS_STORE_FILENAME,
+			data->str, data->len)) {
+		g_string_free(data, TRUE);
 		return;
 	}
 
-	for (client = capsdata->child; client; client = client->next) {
-		if (client->type != PURPLE_XMLNODE_TYPE_TAG)
-			continue;
-		if (purple_strequal(client->name, "client")) {
-			JabberCapsClientInfo *value = g_new0(JabberCapsClientInfo, 1);
-			JabberCapsTuple *key = (JabberCapsTuple*)&value->tuple;
-			PurpleXmlNode *child;
-			JabberCapsNodeExts *exts = NULL;
-			key->node = g_strdup(purple_xmlnode_get_attrib(client,"node"));
-			key->ver  = g_strdup(purple_xmlnode_get_attrib(client,"ver"));
-			key->hash = g_strdup(purple_xmlnode_get_attrib(client,"hash"));
-
-			/* v1.3 capabilities */
-			if (key->hash == NULL)
-				exts = jabber_caps_find_exts_by_node(key->node);
-
-			for (child = client->child; child; child = child->next) {
-				if (child->type != PURPLE_XMLNODE_TYPE_TAG)
-					continue;
-				if (purple_strequal(child->name, "feature")) {
-					const char *var = purple_xmlnode_get_attrib(child, "var");
-					if(!var)
-						continue;
-					value->features = g_list_append(value->features,g_strdup(var));
-				} else if (purple_strequal(child->name, "identity")) {
-					const char *category = purple_xmlnode_get_attrib(child, "category");
-					const char *type = purple_xmlnode_get_attrib(child, "type");
-					const char *name = purple_xmlnode_get_attrib(child, "name");
-					const char *lang = purple_xmlnode_get_attrib(child, "lang");
-					JabberIdentity *id;
-
-					if (!category || !type)
-						continue;
+	purple_debug_info("jabber", "Compacted the caps store from %" G_GSIZE_FORMAT
+	                  " to %" G_GSIZE_FORMAT " bytes\n", capsstore_size,
+	                  data->len);
+
+	/* The clients went in first, in the order they're walked in again. */
+	offset = JABBER_CAPS_STORE_MAGIC_LEN;
+	g_hash_table_iter_init(&iter, capsindex);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		memcpy(&reclen, contents + GPOINTER_TO_SIZE(value), sizeof(reclen));
+		g_hash_table_iter_replace(&iter, GSIZE_TO_POINTER(offset));
+		offset += sizeof(reclen) + GUINT32_FROM_BE(reclen);
+	}
 
-					id = jabber_identity_new(category, type, lang, name);
-					value->identities = g_list_append(value->identities,id);
-				} else if (purple_strequal(child->name, "x")) {
-					/* TODO: See #7814 -- this might cause problems if anyone
-					 * ever actually specifies forms. In fact, for this to
-					 * work properly, that bug needs to be fixed in
-					 * purple_xmlnode_from_str, not the output version... */
-					value->forms = g_list_append(value->forms, purple_xmlnode_copy(child));
-				} else if (purple_strequal(child->name, "ext")) {
-					if (key->hash != NULL)
-						purple_debug_warning("jabber", "Ignoring exts when reading new-style caps\n");
-					else {
-						/* TODO: Do we care about reading in the identities listed here? */
-						const char *identifier = purple_xmlnode_get_attrib(child, "identifier");
-						PurpleXmlNode *node;
-						GList *features = NULL;
-
-						if (!identifier)
-							continue;
+	capsstore_size = data->len;
+	g_clear_pointer(&capsmap, g_mapped_file_unref);
+	g_string_free(data, TRUE);
+}
 
-						for (node = child->child; node; node = node->next) {
-							if (node->type != PURPLE_XMLNODE_TYPE_TAG)
-								continue;
-							if (purple_strequal(node->name, "feature")) {
-								const char *var = purple_xmlnode_get_attrib(node, "var");
-								if (!var)
-									continue;
-								features = g_list_prepend(features, g_strdup(var));
-							}
-						}
-
-						if (features) {
-							g_hash_table_insert(exts->exts, g_strdup(identifier),
-							                    features);
-						} else
-							purple_debug_warning("jabber", "Caps ext %s had no features.\n",
-							                     identifier);
-					}
-				}
+/* Builds the index of the store the first time it's needed. */
+static void
+jabber_caps_store_index(void)
+{
+	const gchar *contents, *record, *cur, *end;
+	JabberCapsTuple tuple;
+	gsize len, offset;
+	guint records = 0, dead = 0;
+	guint32 reclen;
+	gchar *path;
+
+	if (capsindex != NULL)
+		return;
+
+	capsindex = g_hash_table_new_full(jabber_caps_hash, jabber_caps_compare,
+			(GDestroyNotify)jabber_caps_tuple_free, NULL);
+	capsstore_size = 0;
+
+	path = g_build_filename(purple_cache_dir(), JABBER_CAPS_STORE_FILENAME, NULL);
+	if (!g_file_test(path, G_FILE_TEST_EXISTS))
+		jabber_caps_store_import();
+	g_free(path);
+
+	if ((contents = jabber_caps_store_contents()) == NULL)
+		return;
+
+	len = g_mapped_file_get_length(capsmap);
+	if (len < JABBER_CAPS_STORE_MAGIC_LEN ||
+			memcmp(contents, JABBER_CAPS_STORE_MAGIC, JABBER_CAPS_STORE_MAGIC_LEN) != 0) {
+		purple_debug_warning("jabber", "Discarding unrecognized caps store\n");
+		offset = 0;
+	} else {
+		for (offset = JABBER_CAPS_STORE_MAGIC_LEN; len - offset > sizeof(reclen); offset = end - contents) {
+			record = contents + offset;
+			memcpy(&reclen, record, sizeof(reclen));
+			reclen = GUINT32_FROM_BE(reclen);
+			if (reclen == 0 || reclen > len - offset - sizeof(reclen))
+				break;
+
+			cur = record + sizeof(reclen) + 1;
+			end = cur + reclen - 1;
+
+			if (cur[-1] == 'c') {
+				if (!(tuple.node = jabber_caps_record_string(&cur, end)) ||
+						!(tuple.ver = jabber_caps_record_string(&cur, end)) ||
+						!(tuple.hash = jabber_caps_record_string(&cur, end)))
+					break;
+				if (*tuple.hash == '\0')
+					tuple.hash = NULL;
+
+				records++;
+				if (!g_hash_table_replace(capsindex,
+						jabber_caps_tuple_copy(&tuple),
+						GSIZE_TO_POINTER(offset)))
+					dead++;
+			} else if (cur[-1] == 'e') {
+				records++;
+				if (jabber_caps_store_add_ext(cur, end))
+					dead++;
 			}
+		}
+	}
 
-			value->exts = exts;
-			g_hash_table_replace(capstable, key, value);
+	if (offset > 0 && dead >= JABBER_CAPS_STORE_COMPACT_DEAD &&
+			dead > records - dead) {
+		/* This also cuts off anything half written after the last whole
+		 * record. */
+		capsstore_size = offset;
+		jabber_caps_store_compact(contents);
+		if (capsmap == NULL)
+			return;
+	}
 
+	if (offset < len) {
+		/* Whatever was being appended when we last went away didn't
+		 * make it; cut it off so there's nothing in front of the next
+		 * record. */
+		if (offset == 0) {
+			contents = JABBER_CAPS_STORE_MAGIC;
+			offset = JABBER_CAPS_STORE_MAGIC_LEN;
 		}
+		purple_util_write_data_to_cache_file(JABBER_CAPS_STORE_FILENAME,
+				contents, offset);
+		g_clear_pointer(&capsmap, g_mapped_file_unref);
 	}
-	purple_xmlnode_free(capsdata);
+
+	capsstore_size = offset;
+}
+
+static void
+jabber_caps_store_append(char type, const GString *payload,
+                         const JabberCapsTuple *tuple)
+{
+	GString *record;
+	gchar *path;
+	FILE *file;
+	gboolean ok;
+
+	jabber_caps_store_index();
+
+	path = g_build_filename(purple_cache_dir(), JABBER_CAPS_STORE_FILENAME, NULL);
+	file = g_fopen(path, "ab");
+	g_free(path);
+	if (file == NULL) {
+		purple_debug_error("jabber", "Failed to open the caps store: %s\n",
+		                   g_strerror(errno));
+		return;
+	}
+
+	record = g_string_new(NULL);
+	if (capsstore_size == 0)
+		g_string_append(record, JABBER_CAPS_STORE_MAGIC);
+	jabber_caps_record_append(record, type, payload);
+
+	ok = (fwrite(record->str, record->len, 1, file) == 1);
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok) {
+		purple_debug_error("jabber", "Failed to write to the caps store: %s\n",
+		                   g_strerror(errno));
+		/* Index it again, cutting off whatever was half written. */
+		g_clear_pointer(&capsindex, g_hash_table_destroy);
+	} else {
+		if (capsstore_size == 0)
+			capsstore_size = JABBER_CAPS_STORE_MAGIC_LEN;
+		if (tuple != NULL) {
+			g_hash_table_replace(capsindex, jabber_caps_tuple_copy(tuple),
+					GSIZE_TO_POINTER(capsstore_size));
+		}
+		capsstore_size += sizeof(guint32) + 1 + payload->len;
+	}
+	g_clear_pointer(&capsmap, g_mapped_file_unref);
+
+	g_string_free(record, TRUE);
+}
+
+void
+jabber_caps_store_client(const JabberCapsClientInfo *info)
+{
+	GString *payload = jabber_caps_client_payload(info);
+
+	jabber_caps_store_append('c', payload, &info->tuple);
+	g_string_free(payload, TRUE);
+}
+
+static void
+jabber_caps_store_ext(const char *node, const char *identifier,
+                      const GList *features)
+{
+	GString *payload = jabber_caps_ext_payload(node, identifier, features);
+
+	jabber_caps_store_append('e', payload, NULL);
+	g_string_free(payload, TRUE);
+}
+
+JabberCapsClientInfo *
+jabber_caps_lookup(const JabberCapsTuple *key)
+{
+	JabberCapsClientInfo *info;
+	PurpleXmlNode *client;
+	const gchar *contents, *cur, *end;
+	gsize offset;
+	guint32 reclen;
+
+	if ((info = g_hash_table_lookup(capstable, key)) != NULL)
+		return info;
+
+	jabber_caps_store_index();
+	offset = GPOINTER_TO_SIZE(g_hash_table_lookup(capsindex, key));
+	if (offset == 0 || (contents = jabber_caps_store_contents()) == NULL)
+		return NULL;
+
+	memcpy(&reclen, contents + offset, sizeof(reclen));
+	reclen = GUINT32_FROM_BE(reclen);
+	if (reclen == 0 || offset + sizeof(reclen) + reclen > capsstore_size)
+		return NULL;
+	cur = contents + offset + sizeof(reclen) + 1;
+	end = cur + reclen - 1;
+
+	/* Skip the node, ver and hash; the index already matched them. */
+	if (!jabber_caps_record_string(&cur, end) ||
+			!jabber_caps_record_string(&cur, end) ||
+			!jabber_caps_record_string(&cur, end))
+		return NULL;
+
+	if ((client = purple_xmlnode_from_str(cur, end - cur)) == NULL)
+		return NULL;
+
+	info = jabber_caps_client_from_xmlnode(client);
+	purple_xmlnode_free(client);
+	if (info == NULL)
+		return NULL;
+
+	g_hash_table_insert(capstable, (JabberCapsTuple *)&info->tuple, info);
+	return info;
 }
 
 void jabber_caps_init(void)
 {
 	nodetable = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)jabber_caps_node_exts_unref);
 	capstable = g_hash_table_new_full(jabber_caps_hash, jabber_caps_compare, NULL, (GDestroyNotify)jabber_caps_client_info_destroy);
-	jabber_caps_load();
 }
 
 void jabber_caps_uninit(void)
 {
-	if (save_timer != 0) {
-		g_source_remove(save_timer);
-		save_timer = 0;
-		do_jabber_caps_store(NULL);
-	}
+	g_clear_pointer(&capsmap, g_mapped_file_unref);
+	g_clear_pointer(&capsindex, g_hash_table_destroy);
+	capsstore_size = 0;
 	g_hash_table_destroy(capstable);
 	g_hash_table_destroy(nodetable);
 	capstable = nodetable = NULL;
@@ -480,7 +887,7 @@ jabber_caps_client_iqcb(JabberStream *js, const char *from, JabberIqType type,
 
 	/* Use the copy of this data already in the table if it exists or insert
 	 * a new one if we need to */
-	if ((value = g_hash_table_lookup(capstable, &key))) {
+	if ((value = jabber_caps_lookup(&key))) {
 		jabber_caps_client_info_destroy(info);
 		info = value;
 	} else {
@@ -499,7 +906,7 @@ jabber_caps_client_iqcb(JabberStream *js, const char *from, JabberIqType type,
 
 		/* The capstable gets a reference */
 		g_hash_table_insert(capstable, n_key, info);
-		schedule_caps_save();
+		jabber_caps_store_client(info);
 	}
 
 	userdata->info = info;
@@ -571,7 +978,9 @@ jabber_caps_ext_iqcb(JabberStream *js, const char *from, JabberIqType type,
 	}
 
 	g_hash_table_insert(node_exts->exts, g_strdup(userdata->name), features);
-	schedule_caps_save();
+	jabber_caps_store_ext(userdata->data->info ? userdata->data->info->tuple.node :
+	                                             userdata->data->node,
+	                      userdata->name, features);
 
 	/* Are we done? */
 	if (userdata->data->info && userdata->data->extOutstanding == 0)
@@ -601,7 +1010,7 @@ void jabber_caps_get_info(JabberStream *js, const char *who, const char *node,
 	key.ver = (char *)ver;
 	key.hash = (char *)hash;
 
-	info = g_hash_table_lookup(capstable, &key);
+	info = jabber_caps_lookup(&key);
 	if (info && hash) {
 		/* v1.5 - We already have all the information we care about */
 		if (cb)
@@ -127,4 +127,24 @@ void jabber_caps_broadcast_change(void);
  */
 JabberCapsClientInfo *jabber_caps_parse_client_info(PurpleXmlNode *query);
 
+/**
+ * Appends a client to the caps store.
+ *
+ * Exposed for tests
+ *
+ * @param info The client, with its tuple set.
+ */
+void jabber_caps_store_client(const JabberCapsClientInfo *info);
+
+/**
+ * Looks a client up in the capstable, reading it in from the caps store if
+ * it isn't there yet.
+ *
+ * Exposed for tests
+ *
+ * @param key The node, ver and hash of the client.
+ * @returns The client, owned by the capstable, or NULL if it's unknown.
+ */
+JabberCapsClientInfo *jabber_caps_lookup(const JabberCapsTuple *key);
+
 #endif /* PURPLE_JABBER_CAPS_H */
@@ -63,6 +63,7 @@
 #include "roster.h"
 #include "ping.h"
 #include "si.h"
+#include "sm.h"
 #include "usermood.h"
 #include "xdata.h"
 #include "pep.h"
@@ -83,6 +84,9 @@
  */
 #define DEFAULT_INACTIVITY_TIME 120
 
+#define JABBER_RECV_BUFSIZE_MIN 4096
+#define JABBER_RECV_BUFSIZE_MAX (256 * 1024)
+
 GList *jabber_features = NULL;
 GList *jabber_identities = NULL;
 
@@ -181,6 +185,7 @@ static void jabber_bind_result_cb(JabberStream *js, const char *from,
 		return;
 	}
 
+	jabber_sm_enable(js);
 	jabber_session_init(js);
 }
 
@@ -285,11 +290,17 @@ void jabber_stream_features_parse(JabberStream *js, PurpleXmlNode *packet)
 		return;
 	}
 
+	if (purple_xmlnode_get_child_with_namespace(packet, "sm", NS_STREAM_MANAGEMENT))
+		js->server_caps |= JABBER_CAP_STREAM_MANAGEMENT;
+
 	if(js->registration) {
 		jabber_register_start(js);
 	} else if(purple_xmlnode_get_child(packet, "mechanisms")) {
 		jabber_stream_set_state(js, JABBER_STREAM_AUTHENTICATING);
 		jabber_auth_start(js, packet);
+	} else if (js->sm_state == JABBER_SM_RESUMING) {
+		/* Authenticated again; pick up the old session instead of binding */
+		jabber_sm_resume(js);
 	} else if(purple_xmlnode_get_child(packet, "bind")) {
 		PurpleXmlNode *bind, *resource;
 		char *requested_resource;
@@ -345,6 +356,8 @@ void jabber_process_packet(JabberStream *js, PurpleXmlNode **packet)
 	name = (*packet)->name;
 	xmlns = purple_xmlnode_get_namespace(*packet);
 
+	jabber_sm_inbound(js, *packet);
+
 	if(purple_strequal((*packet)->name, "iq")) {
 		jabber_iq_parse(js, *packet);
 	} else if(purple_strequal((*packet)->name, "presence")) {
@@ -356,6 +369,8 @@ void jabber_process_packet(JabberStream *js, PurpleXmlNode **packet)
 			jabber_stream_features_parse(js, *packet);
 		else if (purple_strequal(name, "error"))
 			jabber_stream_handle_error(js, *packet);
+	} else if (purple_strequal(xmlns, NS_STREAM_MANAGEMENT)) {
+		jabber_sm_process_packet(js, *packet);
 	} else if (purple_strequal(xmlns, NS_XMPP_SASL)) {
 		if (js->state != JABBER_STREAM_AUTHENTICATING)
 			purple_debug_warning("jabber", "Ignoring spurious SASL stanza %s\n", name);
@@ -394,6 +409,18 @@ jabber_push_bytes_cb(GObject *source, GAsyncResult *res, gpointer data)
 	if (!result) {
 		purple_queued_output_stream_clear_queue(stream);
 
+		/* From a connection we've already let go of */
+		if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) ||
+				stream != js->output) {
+			g_error_free(error);
+			return;
+		}
+
+		if (jabber_sm_resume_on_error(js)) {
+			g_error_free(error);
+			return;
+		}
+
 		g_prefix_error(&error, "%s", _("Lost connection with server: "));
 		purple_connection_take_error(js->gc, error);
 	}
@@ -406,6 +433,11 @@ static gboolean do_jabber_send_raw(JabberStream *js, const char *data, int len)
 
 	g_return_val_if_fail(len > 0, FALSE);
 
+	/* Between connections while resuming; stanzas are queued for after
+	 * <resumed/>, and nothing else is worth keeping. */
+	if (js->output == NULL)
+		return TRUE;
+
 	if (js->state == JABBER_STREAM_CONNECTED)
 		jabber_stream_restart_inactivity_timer(js);
 
@@ -534,7 +566,10 @@ int jabber_protocol_send_raw(PurpleConnection *gc, const char *buf, int len)
 	 * to do things during the connection process.
 	 */
 
-	jabber_send_raw(js, buf, len);
+	/* Stanzas from here (like the XMPP console's) count towards stream
+	 * management too, or our acks drift from the server's. */
+	if (jabber_sm_outbound_raw(js, buf, len))
+		jabber_send_raw(js, buf, len);
 	return (len < 0 ? (int)strlen(buf) : len);
 }
 
@@ -561,7 +596,8 @@ void jabber_send_signal_cb(PurpleConnection *pc, PurpleXmlNode **packet,
 				purple_strequal((*packet)->name, "presence"))
 			purple_xmlnode_set_namespace(*packet, NS_XMPP_CLIENT);
 	txt = purple_xmlnode_to_str(*packet, &len);
-	jabber_send_raw(js, txt, len);
+	if (jabber_sm_outbound(js, *packet, txt))
+		jabber_send_raw(js, txt, len);
 	g_free(txt);
 }
 
@@ -573,9 +609,10 @@ void jabber_send(JabberStream *js, PurpleXmlNode *packet)
 static gboolean jabber_keepalive_timeout(PurpleConnection *gc)
 {
 	JabberStream *js = purple_connection_get_protocol_data(gc);
-	purple_connection_error(gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-					_("Ping timed out"));
 	js->keepalive_timeout = 0;
+	if (!jabber_sm_resume_on_error(js))
+		purple_connection_error(gc, PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+						_("Ping timed out"));
 	return FALSE;
 }
 
@@ -585,7 +622,7 @@ void jabber_keepalive(PurpleConnection *gc)
 
 	if (js->keepalive_timeout == 0) {
 		jabber_keepalive_ping(js);
-		js->keepalive_timeout = g_timeout_add_seconds(120,
+		js->keepalive_timeout = purple_timer_add_seconds(120,
 				(GSourceFunc)(jabber_keepalive_timeout), gc);
 	}
 }
@@ -595,61 +632,109 @@ static int jabber_get_keepalive_interval(void)
 	return PING_TIMEOUT;
 }
 
+/* Hands what was read to the parser; returns FALSE if the connection is
+ * being torn down. */
+static gboolean
+jabber_recv_process(JabberStream *js, gchar *buf, gsize len)
+{
+#ifdef HAVE_CYRUS_SASL
+	if (js->sasl_maxbuf > 0) {
+		const char *out;
+		unsigned int olen;
+		int rc;
+
+		rc = sasl_decode(js->sasl, buf, len, &out, &olen);
+		if (rc != SASL_OK) {
+			gchar *error =
+				g_strdup_printf(_("SASL error: %s"),
+					sasl_errdetail(js->sasl));
+			purple_debug_error("jabber",
+				"sasl_decode_error %d: %s\n", rc,
+				sasl_errdetail(js->sasl));
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				error);
+			g_free(error);
+			return FALSE;
+		} else if (olen > 0) {
+			purple_debug_info("jabber", "RecvSASL (%u): %s\n", olen, out);
+			jabber_parser_process(js, out, olen);
+			if (js->reinit)
+				jabber_stream_init(js);
+		}
+		return TRUE;
+	}
+#endif
+	buf[len] = '\0';
+	purple_debug_misc("jabber", "Recv (%" G_GSIZE_FORMAT "): %s", len,
+	                  buf);
+	jabber_parser_process(js, buf, len);
+	if(js->reinit)
+		jabber_stream_init(js);
+
+	return TRUE;
+}
+
 static gboolean
 jabber_recv_cb(GObject *stream, gpointer data)
 {
 	PurpleConnection *gc = data;
 	JabberStream *js = purple_connection_get_protocol_data(gc);
 	gssize len;
-	gchar buf[4096];
+	gsize filled, total = 0;
 	GError *error = NULL;
 
 	PURPLE_ASSERT_CONNECTION_IS_VALID(gc);
 
-	len = g_pollable_input_stream_read_nonblocking(
-	        G_POLLABLE_INPUT_STREAM(stream), buf, sizeof(buf) - 1,
-	        js->cancellable, &error);
-
-	while (len > 0) {
-		purple_connection_update_last_received(gc);
-#ifdef HAVE_CYRUS_SASL
-		if (js->sasl_maxbuf > 0) {
-			const char *out;
-			unsigned int olen;
-			int rc;
+	if (js->recv_buf == NULL) {
+		js->recv_buf_size = JABBER_RECV_BUFSIZE_MIN;
+		js->recv_buf = g_malloc(js->recv_buf_size);
+	}
 
-			rc = sasl_decode(js->sasl, buf, len, &out, &olen);
-			if (rc != SASL_OK) {
-				gchar *error =
-					g_strdup_printf(_("SASL error: %s"),
-						sasl_errdetail(js->sasl));
-				purple_debug_error("jabber",
-					"sasl_decode_error %d: %s\n", rc,
-					sasl_errdetail(js->sasl));
-				purple_connection_error(gc,
-					PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
-					error);
-			} else if (olen > 0) {
-				purple_debug_info("jabber", "RecvSASL (%u): %s\n", olen, out);
-				jabber_parser_process(js, out, olen);
-				if (js->reinit)
-					jabber_stream_init(js);
+	/* Drain everything that's there, handing it to the parser a bufferful
+	 * at a time rather than a read at a time. One byte is kept back for
+	 * the NUL. */
+	do {
+		filled = 0;
+		do {
+			len = g_pollable_input_stream_read_nonblocking(
+			        G_POLLABLE_INPUT_STREAM(stream),
+			        js->recv_buf + filled, js->recv_buf_size - 1 - filled,
+			        js->cancellable, &error);
+			if (len > 0)
+				filled += len;
+		} while (len > 0 && filled < js->recv_buf_size - 1);
+
+		if (filled > 0) {
+			total += filled;
+			if (!jabber_recv_process(js, js->recv_buf, filled)) {
+				g_clear_error(&error);
+				return G_SOURCE_CONTINUE;
 			}
-			return G_SOURCE_CONTINUE;
 		}
-#endif
-		buf[len] = '\0';
-		purple_debug_misc("jabber", "Recv (%" G_GSSIZE_FORMAT "): %s", len,
-		                  buf);
-		jabber_parser_process(js, buf, len);
-		if(js->reinit)
-			jabber_stream_init(js);
-		len = g_pollable_input_stream_read_nonblocking(
-			G_POLLABLE_INPUT_STREAM(stream), buf, sizeof(buf) - 1,
-			js->cancellable, &error);
+
+		/* Filled it up, so there's likely more to come. */
+		if (len > 0 && js->recv_buf_size < JABBER_RECV_BUFSIZE_MAX) {
+			js->recv_buf_size *= 2;
+			g_free(js->recv_buf);
+			js->recv_buf = g_malloc(js->recv_buf_size);
+		}
+	} while (len > 0);
+
+	if (total > 0) {
+		purple_connection_update_last_received(gc);
+		purple_signal_emit(purple_connection_get_protocol(gc),
+				"jabber-receiving-data", gc, (guint)total);
 	}
-	if (error->code != G_IO_ERROR_WOULD_BLOCK &&
-	    error->code != G_IO_ERROR_CANCELLED) {
+
+	if (len == 0) {
+		if (!jabber_sm_resume_on_error(js))
+			purple_connection_error(gc,
+					PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+					_("Server closed the connection"));
+	} else if (error->code != G_IO_ERROR_WOULD_BLOCK &&
+	    error->code != G_IO_ERROR_CANCELLED &&
+	    !jabber_sm_resume_on_error(js)) {
 		g_prefix_error(&error, "%s", _("Lost connection with server: "));
 		purple_connection_g_error(js->gc, error);
 	}
@@ -1071,6 +1156,51 @@ jabber_stream_connect(JabberStream *js)
 	}
 }
 
+void
+jabber_stream_reconnect(JabberStream *js)
+{
+	if (js->inpa) {
+		g_source_remove(js->inpa);
+		js->inpa = 0;
+	}
+	if (js->keepalive_timeout != 0) {
+		purple_timer_remove(js->keepalive_timeout);
+		js->keepalive_timeout = 0;
+	}
+	if (js->inactivity_timer != 0) {
+		g_source_remove(js->inactivity_timer);
+		js->inactivity_timer = 0;
+	}
+
+	/* Anything still in flight belongs to the old connection */
+	g_cancellable_cancel(js->cancellable);
+	g_object_unref(js->cancellable);
+	js->cancellable = g_cancellable_new();
+
+	if (js->stream != NULL)
+		purple_gio_graceful_close(js->stream, js->input,
+		                          G_OUTPUT_STREAM(js->output));
+	g_clear_object(&js->output);
+	js->input = NULL;
+	g_clear_object(&js->stream);
+	g_clear_object(&js->client);
+	g_clear_pointer(&js->certificate_CN, g_free);
+
+	/* The new stream authenticates from scratch */
+	if (js->auth_mech && js->auth_mech->dispose)
+		js->auth_mech->dispose(js);
+	js->auth_mech = NULL;
+#ifdef HAVE_CYRUS_SASL
+	if (js->sasl)
+		sasl_dispose(&js->sasl);
+	js->sasl_maxbuf = 0;
+#endif
+	js->reinit = FALSE;
+	js->server_caps &= ~JABBER_CAP_STREAM_MANAGEMENT;
+
+	jabber_stream_connect(js);
+}
+
 void
 jabber_login(PurpleAccount *account)
 {
@@ -1635,6 +1765,7 @@ void jabber_close(PurpleConnection *gc)
 	}
 
 	g_free(js->stream_id);
+	g_free(js->recv_buf);
 	if(js->user)
 		jabber_id_free(js->user);
 	g_free(js->initial_avatar_hash);
@@ -1671,7 +1802,7 @@ void jabber_close(PurpleConnection *gc)
 		g_source_remove(js->vcard_timer);
 
 	if (js->keepalive_timeout != 0)
-		g_source_remove(js->keepalive_timeout);
+		purple_timer_remove(js->keepalive_timeout);
 	if (js->inactivity_timer != 0)
 		g_source_remove(js->inactivity_timer);
 	if (js->conn_close_timeout != 0)
@@ -1686,6 +1817,8 @@ void jabber_close(PurpleConnection *gc)
 	g_free(js->google_relay_token);
 	g_free(js->google_relay_host);
 
+	jabber_sm_clear(js);
+
 	g_free(js);
 
 	purple_connection_set_protocol_data(gc, NULL);
@@ -1700,6 +1833,15 @@ void jabber_stream_set_state(JabberStream *js, JabberStreamState state)
 	         : 5)
 
 	js->state = state;
+
+	/* A resumed stream never stopped being connected as far as anyone
+	 * else is concerned, so there's no progress to report. */
+	if (js->sm_state == JABBER_SM_RESUMING) {
+		if (state == JABBER_STREAM_INITIALIZING)
+			jabber_stream_init(js);
+		return;
+	}
+
 	switch(state) {
 		case JABBER_STREAM_OFFLINE:
 			break;
@@ -3994,6 +4136,11 @@ static void jabber_init_protocol(PurpleProtocol *protocol)
 			protocol, PURPLE_CALLBACK(jabber_send_signal_cb),
 			NULL, PURPLE_SIGNAL_PRIORITY_HIGHEST);
 
+	purple_signal_register(protocol, "jabber-receiving-data",
+			purple_marshal_VOID__POINTER_UINT, G_TYPE_NONE, 2,
+			PURPLE_TYPE_CONNECTION,
+			G_TYPE_UINT); /* bytes read in one wakeup */
+
 	purple_signal_register(protocol, "jabber-sending-text",
 			     purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
 			     PURPLE_TYPE_CONNECTION,
@@ -49,6 +49,7 @@ typedef enum {
 
 	JABBER_CAP_ITEMS          = 1 << 14,
 	JABBER_CAP_ROSTER_VERSIONING = 1 << 15,
+	JABBER_CAP_STREAM_MANAGEMENT = 1 << 16,
 
 	JABBER_CAP_RETRIEVED      = 1 << 31
 } JabberCapabilities;
@@ -108,6 +109,13 @@ typedef enum {
 	JABBER_STREAM_CONNECTED
 } JabberStreamState;
 
+typedef enum {
+	JABBER_SM_DISABLED,
+	JABBER_SM_ENABLING,
+	JABBER_SM_ENABLED,
+	JABBER_SM_RESUMING
+} JabberSmState;
+
 typedef struct
 {
 	PurpleProtocol parent;
@@ -126,6 +134,7 @@ struct _JabberStream
 
 	xmlParserCtxt *context;
 	PurpleXmlNode *current;
+	PurpleMemoryPool *stanza_pool; /* Backs the stanza being parsed. */
 
 	struct {
 		guint8 major;
@@ -201,6 +210,11 @@ struct _JabberStream
 	GInputStream *input;
 	PurpleQueuedOutputStream *output;
 
+	/* Doubled, up to JABBER_RECV_BUFSIZE_MAX, whenever one wakeup's worth
+	 * of reads fills it. */
+	gchar *recv_buf;
+	gsize recv_buf_size;
+
 	gboolean registration;
 
 	char *initial_avatar_hash;
@@ -276,6 +290,13 @@ struct _JabberStream
 	guint inactivity_timer;
 	guint conn_close_timeout;
 
+	/* XEP-0198 Stream Management; sm_id is only set if we can resume */
+	JabberSmState sm_state;
+	gchar *sm_id;
+	guint32 sm_inbound;
+	guint32 sm_acked;
+	GQueue sm_unacked; /* Text of the stanzas sent but not yet acked */
+
 	PurpleJabberBOSHConnection *bosh;
 
 	SoupSession *http_conns;
@@ -336,6 +357,12 @@ void jabber_send_signal_cb(PurpleConnection *pc, PurpleXmlNode **packet,
 
 void jabber_stream_set_state(JabberStream *js, JabberStreamState state);
 
+/**
+ * Drops the socket and connects again, keeping everything above it
+ * (roster, chats, pending IQs) as it is.  Used to resume a managed stream.
+ */
+void jabber_stream_reconnect(JabberStream *js);
+
 void jabber_register_parse(JabberStream *js, const char *from,
                            JabberIqType type, const char *id, PurpleXmlNode *query);
 void jabber_register_start(JabberStream *js);
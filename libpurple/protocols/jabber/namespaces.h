@@ -70,6 +70,9 @@
 /* XEP-0191 Simple Communications Blocking */
 #define NS_SIMPLE_BLOCKING "urn:xmpp:blocking"
 
+/* XEP-0198 Stream Management */
+#define NS_STREAM_MANAGEMENT "urn:xmpp:sm:3"
+
 /* XEP-0199 Ping */
 #define NS_PING "urn:xmpp:ping"
 
@@ -28,9 +28,18 @@
 #include "debug.h"
 #include "jabber.h"
 #include "parser.h"
+#include "signals.h"
 #include "util.h"
 #include "xmlnode.h"
 
+/*
+ * Incoming stanzas are built from a per-stream memory pool, which is
+ * emptied once the stanza has been handled.  A stanza then costs a block
+ * or two instead of a few allocations per element, attribute and text
+ * chunk.
+ */
+#define JABBER_STANZA_POOL_BLOCK_SIZE 4096
+
 static void
 jabber_parser_element_start_libxml(void *user_data,
 				   const xmlChar *element_name, const xmlChar *prefix, const xmlChar *namespace,
@@ -105,10 +114,17 @@ jabber_parser_element_start_libxml(void *user_data,
 		}
 	} else {
 
-		if(js->current)
+		if(js->current) {
 			node = purple_xmlnode_new_child(js->current, (const char*) element_name);
-		else
-			node = purple_xmlnode_new((const char*) element_name);
+		} else {
+			if (js->stanza_pool == NULL) {
+				js->stanza_pool = purple_memory_pool_new();
+				purple_memory_pool_set_block_size(js->stanza_pool,
+						JABBER_STANZA_POOL_BLOCK_SIZE);
+			}
+			node = purple_xmlnode_new_pooled(js->stanza_pool,
+					(const char*) element_name);
+		}
 		purple_xmlnode_set_namespace(node, (const char*) namespace);
 		purple_xmlnode_set_prefix(node, (const char *)prefix);
 
@@ -127,15 +143,25 @@ jabber_parser_element_start_libxml(void *user_data,
 			const char *name = (const char *)attributes[i];
 			const char *prefix = (const char *)attributes[i+1];
 			const char *attrib_ns = (const char *)attributes[i+2];
-			char *txt;
+			const char *value = (const char *)attributes[i+3];
 			int attrib_len = attributes[i+4] - attributes[i+3];
-			char *attrib = g_strndup((gchar *)attributes[i+3], attrib_len);
+			char *attrib;
+
+			if (memchr(value, '&', attrib_len) == NULL) {
+				/* Nothing to unescape, so skip the temporary copies. */
+				attrib = purple_memory_pool_alloc(js->stanza_pool,
+						attrib_len + 1, 1);
+				memcpy(attrib, value, attrib_len);
+				attrib[attrib_len] = '\0';
+				purple_xmlnode_set_attrib_full(node, name, attrib_ns, prefix, attrib);
+			} else {
+				char *txt = g_strndup(value, attrib_len);
 
-			txt = attrib;
-			attrib = purple_unescape_text(txt);
-			g_free(txt);
-			purple_xmlnode_set_attrib_full(node, name, attrib_ns, prefix, attrib);
-			g_free(attrib);
+				attrib = purple_unescape_text(txt);
+				g_free(txt);
+				purple_xmlnode_set_attrib_full(node, name, attrib_ns, prefix, attrib);
+				g_free(attrib);
+			}
 		}
 
 		js->current = node;
@@ -156,10 +182,31 @@ jabber_parser_element_end_libxml(void *user_data, const xmlChar *element_name,
 			js->current = js->current->parent;
 	} else {
 		PurpleXmlNode *packet = js->current;
+		PurpleMemoryPool *pool = g_object_ref(js->stanza_pool);
+		gulong signal_id;
+
 		js->current = NULL;
+
+		/*
+		 * Signal handlers may keep the packet by setting it to NULL, so
+		 * only give them a copy that doesn't live in the pool.
+		 */
+		signal_id = purple_signal_get_id(
+				purple_connection_get_protocol(js->gc),
+				"jabber-receiving-xmlnode");
+		if (purple_signal_has_handlers_by_id(signal_id)) {
+			PurpleXmlNode *pooled = packet;
+
+			packet = purple_xmlnode_copy(pooled);
+			purple_xmlnode_free(pooled);
+		}
+
 		jabber_process_packet(js, &packet);
 		if (packet != NULL)
 			purple_xmlnode_free(packet);
+
+		purple_memory_pool_cleanup(pool);
+		g_object_unref(pool);
 	}
 }
 
@@ -256,6 +303,18 @@ void jabber_parser_free(JabberStream *js) {
 		xmlFreeParserCtxt(js->context);
 		js->context = NULL;
 	}
+
+	/* Drop any half-parsed stanza along with its pool. */
+	if (js->current) {
+		PurpleXmlNode *root = js->current;
+
+		while (root->parent)
+			root = root->parent;
+		purple_xmlnode_free(root);
+		js->current = NULL;
+	}
+
+	g_clear_object(&js->stanza_pool);
 }
 
 void jabber_parser_process(JabberStream *js, const char *buf, int len)
@@ -25,6 +25,7 @@
 #include "internal.h"
 
 #include "debug.h"
+#include "eventloop.h"
 
 #include "jabber.h"
 #include "ping.h"
@@ -35,7 +36,7 @@ static void jabber_keepalive_pong_cb(JabberStream *js, const char *from,
                                      PurpleXmlNode *packet, gpointer data)
 {
 	if (js->keepalive_timeout != 0) {
-		g_source_remove(js->keepalive_timeout);
+		purple_timer_remove(js->keepalive_timeout);
 		js->keepalive_timeout = 0;
 	}
 }
@@ -157,6 +157,7 @@ jabber_si_bytestreams_connect_cb(gpointer data, gint source, const gchar *error_
 
 	jabber_iq_send(iq);
 
+	purple_xfer_set_raw_stream(xfer, TRUE);
 	purple_xfer_start(xfer, source, NULL, -1);
 }
 
@@ -771,6 +772,7 @@ jabber_si_connect_proxy_cb(JabberStream *js, const char *from,
 			jsx->js->user->domain, jsx->js->user->resource);
 		if (purple_strequal(jid, my_jid)) {
 			purple_debug_info("jabber", "Got local SOCKS5 streamhost-used.\n");
+			purple_xfer_set_raw_stream(xfer, TRUE);
 			purple_xfer_start(xfer, purple_xfer_get_fd(xfer), NULL, -1);
 		} else {
 			/* if available, try to revert to IBB... */
@@ -0,0 +1,319 @@
+/*
+ * purple - Jabber Protocol Plugin
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ *
+ */
+
+/*
+ * XEP-0198 Stream Management.
+ *
+ * Once enabled, every stanza we send is kept until the server acks it, and
+ * every stanza we handle is counted.  If the connection drops, we connect
+ * again, authenticate, and <resume/> instead of binding a new resource; the
+ * server tells us how much of what we sent it got, we send the rest, and the
+ * session carries on without a new roster, presence or caps round.
+ */
+
+#include "internal.h"
+
+#include "debug.h"
+
+#include "jabber.h"
+#include "sm.h"
+
+static gboolean
+jabber_sm_is_stanza(PurpleXmlNode *packet)
+{
+	return purple_strequal(packet->name, "message") ||
+	       purple_strequal(packet->name, "presence") ||
+	       purple_strequal(packet->name, "iq");
+}
+
+static void
+jabber_sm_request_ack(JabberStream *js)
+{
+	jabber_send_raw(js, "<r xmlns='" NS_STREAM_MANAGEMENT "'/>", -1);
+}
+
+static void
+jabber_sm_send_ack(JabberStream *js)
+{
+	char *ack = g_strdup_printf("<a xmlns='" NS_STREAM_MANAGEMENT "' h='%u'/>",
+	                            js->sm_inbound);
+	jabber_send_raw(js, ack, -1);
+	g_free(ack);
+}
+
+static guint32
+jabber_sm_parse_h(PurpleXmlNode *packet, gboolean *valid)
+{
+	const char *h = purple_xmlnode_get_attrib(packet, "h");
+	char *end = NULL;
+	guint64 value;
+
+	value = h ? g_ascii_strtoull(h, &end, 10) : 0;
+	*valid = (h != NULL && end != h && *end == '\0' && value <= G_MAXUINT32);
+
+	return (guint32)value;
+}
+
+void
+jabber_sm_enable(JabberStream *js)
+{
+	if (js->bosh || !(js->server_caps & JABBER_CAP_STREAM_MANAGEMENT))
+		return;
+
+	jabber_sm_clear(js);
+	js->sm_state = JABBER_SM_ENABLING;
+
+	/* We count what we send from here on; the server's count of what we
+	 * get starts with <enabled/>. */
+	jabber_send_raw(js, "<enable xmlns='" NS_STREAM_MANAGEMENT "' resume='true'/>", -1);
+}
+
+void
+jabber_sm_resume(JabberStream *js)
+{
+	PurpleXmlNode *resume;
+	char *h;
+
+	if (!(js->server_caps & JABBER_CAP_STREAM_MANAGEMENT)) {
+		purple_connection_error(js->gc,
+			PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+			_("Unable to resume the session"));
+		return;
+	}
+
+	/* The id is the server's, so it has to be escaped */
+	resume = purple_xmlnode_new("resume");
+	purple_xmlnode_set_namespace(resume, NS_STREAM_MANAGEMENT);
+	h = g_strdup_printf("%u", js->sm_inbound);
+	purple_xmlnode_set_attrib(resume, "h", h);
+	g_free(h);
+	purple_xmlnode_set_attrib(resume, "previd", js->sm_id);
+
+	jabber_send(js, resume);
+	purple_xmlnode_free(resume);
+}
+
+gboolean
+jabber_sm_resume_on_error(JabberStream *js)
+{
+	if (js->sm_state != JABBER_SM_ENABLED || js->sm_id == NULL ||
+			js->state != JABBER_STREAM_CONNECTED || js->bosh)
+		return FALSE;
+
+	purple_debug_info("jabber", "Connection lost; resuming stream %s\n",
+	                  js->sm_id);
+
+	js->sm_state = JABBER_SM_RESUMING;
+	jabber_stream_reconnect(js);
+
+	return TRUE;
+}
+
+void
+jabber_sm_clear(JabberStream *js)
+{
+	js->sm_state = JABBER_SM_DISABLED;
+	g_clear_pointer(&js->sm_id, g_free);
+	js->sm_inbound = 0;
+	js->sm_acked = 0;
+	g_queue_foreach(&js->sm_unacked, (GFunc)g_free, NULL);
+	g_queue_clear(&js->sm_unacked);
+}
+
+void
+jabber_sm_handle_ack(JabberStream *js, guint32 h)
+{
+	/* This wraps at 2^32, like h itself */
+	guint32 acked = h - js->sm_acked;
+
+	if (acked > g_queue_get_length(&js->sm_unacked)) {
+		purple_debug_warning("jabber", "Server acked %u stanzas, but only "
+		                     "%u were sent\n", acked,
+		                     g_queue_get_length(&js->sm_unacked));
+		acked = g_queue_get_length(&js->sm_unacked);
+	}
+
+	/* The server's count is the one that matters from here on, even if we
+	 * lost track of a stanza somewhere. */
+	js->sm_acked = h;
+	while (acked-- > 0)
+		g_free(g_queue_pop_head(&js->sm_unacked));
+}
+
+static void
+jabber_sm_resumed(JabberStream *js, guint32 h)
+{
+	GQueue unacked;
+	char *txt;
+
+	purple_debug_info("jabber", "Resumed stream %s\n", js->sm_id);
+
+	jabber_sm_handle_ack(js, h);
+	js->sm_state = JABBER_SM_ENABLED;
+
+	/* Send what didn't make it, and keep it until it's acked this time. */
+	unacked = js->sm_unacked;
+	g_queue_init(&js->sm_unacked);
+	while ((txt = g_queue_pop_head(&unacked)) != NULL) {
+		jabber_send_raw(js, txt, -1);
+		g_queue_push_tail(&js->sm_unacked, txt);
+	}
+	if (!g_queue_is_empty(&js->sm_unacked))
+		jabber_sm_request_ack(js);
+
+	js->state = JABBER_STREAM_CONNECTED;
+	jabber_stream_restart_inactivity_timer(js);
+}
+
+void
+jabber_sm_process_packet(JabberStream *js, PurpleXmlNode *packet)
+{
+	const char *name = packet->name;
+	gboolean valid;
+	guint32 h;
+
+	if (purple_strequal(name, "r")) {
+		if (js->sm_state == JABBER_SM_ENABLED)
+			jabber_sm_send_ack(js);
+	} else if (purple_strequal(name, "a")) {
+		h = jabber_sm_parse_h(packet, &valid);
+		if (valid && js->sm_state == JABBER_SM_ENABLED)
+			jabber_sm_handle_ack(js, h);
+	} else if (purple_strequal(name, "enabled")) {
+		const char *resume = purple_xmlnode_get_attrib(packet, "resume");
+
+		if (js->sm_state != JABBER_SM_ENABLING)
+			return;
+
+		js->sm_state = JABBER_SM_ENABLED;
+		if (purple_strequal(resume, "true") || purple_strequal(resume, "1")) {
+			g_free(js->sm_id);
+			js->sm_id = g_strdup(purple_xmlnode_get_attrib(packet, "id"));
+		}
+		purple_debug_info("jabber", "Stream management enabled%s\n",
+		                  js->sm_id ? ", resumable" : "");
+	} else if (purple_strequal(name, "resumed")) {
+		h = jabber_sm_parse_h(packet, &valid);
+		if (js->sm_state == JABBER_SM_RESUMING && valid)
+			jabber_sm_resumed(js, h);
+	} else if (purple_strequal(name, "failed")) {
+		if (js->sm_state == JABBER_SM_RESUMING) {
+			purple_debug_info("jabber", "Couldn't resume stream %s\n",
+			                  js->sm_id);
+			jabber_sm_clear(js);
+			purple_connection_error(js->gc,
+				PURPLE_CONNECTION_ERROR_NETWORK_ERROR,
+				_("Unable to resume the session"));
+		} else {
+			purple_debug_info("jabber", "Server refused to enable stream "
+			                  "management\n");
+			jabber_sm_clear(js);
+		}
+	}
+}
+
+void
+jabber_sm_inbound(JabberStream *js, PurpleXmlNode *packet)
+{
+	if (js->sm_state == JABBER_SM_ENABLED && jabber_sm_is_stanza(packet))
+		js->sm_inbound++;
+}
+
+/* Keeps txt until it's acked, and says whether it's time to ask for an ack */
+static gboolean
+jabber_sm_queue(JabberStream *js, const char *txt)
+{
+	g_queue_push_tail(&js->sm_unacked, g_strdup(txt));
+
+	return g_queue_get_length(&js->sm_unacked) % JABBER_SM_ACK_INTERVAL == 0;
+}
+
+/* What to do with txt once its stanzas are queued */
+static gboolean
+jabber_sm_send_queued(JabberStream *js, const char *txt, int len,
+                      gboolean request_ack)
+{
+	/* Held back until <resumed/>, and sent then. */
+	if (js->sm_state == JABBER_SM_RESUMING)
+		return FALSE;
+
+	if (js->sm_state == JABBER_SM_ENABLED && request_ack) {
+		/* Ask once this has gone out */
+		jabber_send_raw(js, txt, len);
+		jabber_sm_request_ack(js);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+gboolean
+jabber_sm_outbound(JabberStream *js, PurpleXmlNode *packet, const char *txt)
+{
+	if (js->sm_state == JABBER_SM_DISABLED || !jabber_sm_is_stanza(packet))
+		return TRUE;
+
+	return jabber_sm_send_queued(js, txt, -1, jabber_sm_queue(js, txt));
+}
+
+gboolean
+jabber_sm_outbound_raw(JabberStream *js, const char *txt, int len)
+{
+	PurpleXmlNode *wrapper, *child;
+	gboolean request_ack = FALSE;
+	char *wrapped;
+
+	if (js->sm_state == JABBER_SM_DISABLED)
+		return TRUE;
+
+	if (len < 0)
+		len = strlen(txt);
+
+	/* Raw text can hold any number of stanzas, or none. The server counts
+	 * every one of them, so we have to as well. */
+	wrapped = g_strdup_printf("<raw xmlns='" NS_XMPP_CLIENT "'>%.*s</raw>",
+	                          len, txt);
+	wrapper = purple_xmlnode_from_str(wrapped, -1);
+	g_free(wrapped);
+
+	if (wrapper == NULL) {
+		purple_debug_warning("jabber", "Sending raw text that isn't XML; "
+		                     "stream management can't count it\n");
+		return TRUE;
+	}
+
+	for (child = wrapper->child; child != NULL; child = child->next) {
+		char *stanza;
+
+		if (child->type != PURPLE_XMLNODE_TYPE_TAG ||
+				!jabber_sm_is_stanza(child))
+			continue;
+
+		stanza = purple_xmlnode_to_str(child, NULL);
+		request_ack |= jabber_sm_queue(js, stanza);
+		g_free(stanza);
+	}
+	purple_xmlnode_free(wrapper);
+
+	return jabber_sm_send_queued(js, txt, len, request_ack);
+}
@@ -0,0 +1,46 @@
+/**
+ * @file sm.h XEP-0198 Stream Management
+ *
+ * purple
+ *
+ * Purple is the legal property of its developers, whose names are too numerous
+ * to list here.  Please refer to the COPYRIGHT file distributed with this
+ * source distribution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+
+#ifndef PURPLE_JABBER_SM_H
+#define PURPLE_JABBER_SM_H
+
+#include "jabber.h"
+#include "xmlnode.h"
+
+/* Ask the server for an ack after this many unacked stanzas */
+#define JABBER_SM_ACK_INTERVAL 5
+
+void jabber_sm_enable(JabberStream *js);
+void jabber_sm_resume(JabberStream *js);
+gboolean jabber_sm_resume_on_error(JabberStream *js);
+void jabber_sm_clear(JabberStream *js);
+
+void jabber_sm_process_packet(JabberStream *js, PurpleXmlNode *packet);
+void jabber_sm_inbound(JabberStream *js, PurpleXmlNode *packet);
+gboolean jabber_sm_outbound(JabberStream *js, PurpleXmlNode *packet,
+                            const char *txt);
+gboolean jabber_sm_outbound_raw(JabberStream *js, const char *txt, int len);
+void jabber_sm_handle_ack(JabberStream *js, guint32 h);
+
+#endif /* PURPLE_JABBER_SM_H */
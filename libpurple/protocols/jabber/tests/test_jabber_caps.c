@@ -1,8 +1,96 @@
 #include <glib.h>
+#include <glib/gstdio.h>
 
+#include <purple.h>
+
+#include "tests/test_ui.h"
 #include "xmlnode.h"
 #include "protocols/jabber/caps.h"
 
+#define TEST_JABBER_CAPS_NODE "https://pidgin.im/"
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static gchar *
+test_jabber_caps_store_path(void) {
+	return g_build_filename(purple_cache_dir(), "xmpp-caps.dat", NULL);
+}
+
+static gsize
+test_jabber_caps_store_length(void) {
+	gchar *path = test_jabber_caps_store_path();
+	gchar *contents = NULL;
+	gsize len = 0;
+
+	g_assert_true(g_file_get_contents(path, &contents, &len, NULL));
+
+	g_free(contents);
+	g_free(path);
+
+	return len;
+}
+
+static void
+test_jabber_caps_store_start(void) {
+	gchar *path = test_jabber_caps_store_path();
+
+	g_mkdir_with_parents(purple_cache_dir(), 0700);
+	g_unlink(path);
+	g_free(path);
+
+	jabber_caps_init();
+}
+
+static void
+test_jabber_caps_store_finish(void) {
+	gchar *path = test_jabber_caps_store_path();
+
+	jabber_caps_uninit();
+	g_unlink(path);
+	g_free(path);
+}
+
+static void
+test_jabber_caps_store_reload(void) {
+	jabber_caps_uninit();
+	jabber_caps_init();
+}
+
+static void
+test_jabber_caps_store(const gchar *ver, const gchar *hash) {
+	JabberCapsClientInfo *info = g_new0(JabberCapsClientInfo, 1);
+	JabberCapsTuple *tuple = (JabberCapsTuple *)&info->tuple;
+
+	tuple->node = TEST_JABBER_CAPS_NODE;
+	tuple->ver = ver;
+	tuple->hash = hash;
+	info->features = g_list_append(info->features, (gpointer)"urn:xmpp:ping");
+	info->features = g_list_append(info->features, (gpointer)ver);
+
+	jabber_caps_store_client(info);
+
+	g_list_free(info->features);
+	g_free(info);
+}
+
+static void
+test_jabber_caps_assert_stored(const gchar *ver, const gchar *hash) {
+	JabberCapsTuple key = { TEST_JABBER_CAPS_NODE, ver, hash };
+	JabberCapsClientInfo *info = jabber_caps_lookup(&key);
+
+	g_assert_nonnull(info);
+	g_assert_cmpstr(info->tuple.ver, ==, ver);
+	g_assert_cmpstr(info->tuple.hash, ==, hash);
+	g_assert_cmpuint(g_list_length(info->features), ==, 2);
+	g_assert_cmpstr(info->features->data, ==, "urn:xmpp:ping");
+	g_assert_cmpstr(info->features->next->data, ==, ver);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+
 static void
 test_jabber_caps_parse_invalid_nodes(void) {
 	PurpleXmlNode *query;
@@ -43,15 +131,111 @@ test_jabber_caps_calculate_from_xmlnode(void) {
 	);
 }
 
+static void
+test_jabber_caps_store_round_trip(void) {
+	JabberCapsTuple unknown = { TEST_JABBER_CAPS_NODE, "unknown", "sha-1" };
+
+	test_jabber_caps_store_start();
+
+	test_jabber_caps_store("ver1", "sha-1");
+	test_jabber_caps_store("ver2", NULL);
+	/* Same node and ver, different hash */
+	test_jabber_caps_store("ver1", "md5");
+
+	test_jabber_caps_store_reload();
+
+	test_jabber_caps_assert_stored("ver1", "sha-1");
+	test_jabber_caps_assert_stored("ver2", NULL);
+	test_jabber_caps_assert_stored("ver1", "md5");
+	g_assert_null(jabber_caps_lookup(&unknown));
+
+	test_jabber_caps_store_finish();
+}
+
+static void
+test_jabber_caps_store_truncated(void) {
+	/* The length says there's more to the record than was written. */
+	static const gchar partial[] = "\0\0\0\x64" "c" TEST_JABBER_CAPS_NODE;
+	gchar *path = test_jabber_caps_store_path();
+	gsize len;
+	FILE *file;
+
+	test_jabber_caps_store_start();
+
+	test_jabber_caps_store("ver1", "sha-1");
+	jabber_caps_uninit();
+
+	len = test_jabber_caps_store_length();
+	file = g_fopen(path, "ab");
+	g_assert_nonnull(file);
+	g_assert_cmpuint(fwrite(partial, sizeof(partial) - 1, 1, file), ==, 1);
+	g_assert_cmpint(fclose(file), ==, 0);
+
+	jabber_caps_init();
+
+	/* The whole record is still there, and the partial one is cut off. */
+	test_jabber_caps_assert_stored("ver1", "sha-1");
+	g_assert_cmpuint(test_jabber_caps_store_length(), ==, len);
+
+	/* So the next record lands where it can be read back. */
+	test_jabber_caps_store("ver2", "sha-1");
+	test_jabber_caps_store_reload();
+	test_jabber_caps_assert_stored("ver1", "sha-1");
+	test_jabber_caps_assert_stored("ver2", "sha-1");
+
+	test_jabber_caps_store_finish();
+	g_free(path);
+}
+
+static void
+test_jabber_caps_store_compact(void) {
+	gsize len;
+	gint i;
+
+	test_jabber_caps_store_start();
+
+	test_jabber_caps_store("ver1", "sha-1");
+	len = test_jabber_caps_store_length();
+
+	for (i = 0; i < 200; i++)
+		test_jabber_caps_store("ver1", "sha-1");
+	g_assert_cmpuint(test_jabber_caps_store_length(), >, len);
+
+	/* Only the latest record is left once it's indexed again. */
+	test_jabber_caps_store_reload();
+	test_jabber_caps_assert_stored("ver1", "sha-1");
+	g_assert_cmpuint(test_jabber_caps_store_length(), ==, len);
+
+	/* And the index still points at the right place afterwards. */
+	test_jabber_caps_store("ver2", "sha-1");
+	test_jabber_caps_store_reload();
+	test_jabber_caps_assert_stored("ver1", "sha-1");
+	test_jabber_caps_assert_stored("ver2", "sha-1");
+
+	test_jabber_caps_store_finish();
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
 gint
 main(gint argc, gchar **argv) {
 	g_test_init(&argc, &argv, NULL);
 
+	test_ui_purple_init();
+
 	g_test_add_func("/jabber/caps/parse invalid nodes",
 	                test_jabber_caps_parse_invalid_nodes);
 
 	g_test_add_func("/jabber/caps/calulate from xmlnode",
 	                test_jabber_caps_calculate_from_xmlnode);
 
+	g_test_add_func("/jabber/caps/store/round trip",
+	                test_jabber_caps_store_round_trip);
+	g_test_add_func("/jabber/caps/store/truncated",
+	                test_jabber_caps_store_truncated);
+	g_test_add_func("/jabber/caps/store/compact",
+	                test_jabber_caps_store_compact);
+
 	return g_test_run();
 }
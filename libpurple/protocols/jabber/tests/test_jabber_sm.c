@@ -0,0 +1,371 @@
+#include <glib.h>
+#include <gio/gio.h>
+#include <string.h>
+
+#include <purple.h>
+
+#include "tests/test_ui.h"
+#include "protocols/jabber/jabber.h"
+#include "protocols/jabber/namespaces.h"
+#include "protocols/jabber/sm.h"
+
+static void
+_test_jabber_sm_queue(JabberStream *js, guint count) {
+	guint i;
+
+	for (i = 0; i < count; i++)
+		g_queue_push_tail(&js->sm_unacked, g_strdup_printf("<iq id='%u'/>", i));
+}
+
+static void
+test_jabber_sm_handle_ack(void) {
+	JabberStream js = { 0 };
+
+	_test_jabber_sm_queue(&js, 5);
+
+	jabber_sm_handle_ack(&js, 0);
+	g_assert_cmpuint(g_queue_get_length(&js.sm_unacked), ==, 5);
+
+	jabber_sm_handle_ack(&js, 3);
+	g_assert_cmpuint(js.sm_acked, ==, 3);
+	g_assert_cmpuint(g_queue_get_length(&js.sm_unacked), ==, 2);
+	g_assert_cmpstr(g_queue_peek_head(&js.sm_unacked), ==, "<iq id='3'/>");
+
+	/* A repeated ack changes nothing */
+	jabber_sm_handle_ack(&js, 3);
+	g_assert_cmpuint(g_queue_get_length(&js.sm_unacked), ==, 2);
+
+	/* Acking more than was sent can't drop more than is queued, but the
+	 * server's count is taken from then on */
+	jabber_sm_handle_ack(&js, 10);
+	g_assert_cmpuint(js.sm_acked, ==, 10);
+	g_assert_true(g_queue_is_empty(&js.sm_unacked));
+
+	jabber_sm_clear(&js);
+}
+
+static void
+test_jabber_sm_handle_ack_wraparound(void) {
+	JabberStream js = { 0 };
+
+	js.sm_acked = G_MAXUINT32 - 1;
+	_test_jabber_sm_queue(&js, 4);
+
+	jabber_sm_handle_ack(&js, 1);
+	g_assert_cmpuint(js.sm_acked, ==, 1);
+	g_assert_cmpuint(g_queue_get_length(&js.sm_unacked), ==, 1);
+	g_assert_cmpstr(g_queue_peek_head(&js.sm_unacked), ==, "<iq id='3'/>");
+
+	jabber_sm_clear(&js);
+}
+
+/******************************************************************************
+ * Resuming against a local server
+ *****************************************************************************/
+#define TEST_JABBER_SM_STREAM \
+	"<?xml version='1.0'?>" \
+	"<stream:stream xmlns='" NS_XMPP_CLIENT "' " \
+	"xmlns:stream='" NS_XMPP_STREAMS "' from='localhost' id='stream' " \
+	"version='1.0'>"
+
+/* Runs the main loop until cond holds, or fails after a few seconds */
+#define test_jabber_sm_run_until(cond) G_STMT_START { \
+	gint64 deadline = g_get_monotonic_time() + 5 * G_USEC_PER_SEC; \
+	while (!(cond) && g_get_monotonic_time() < deadline) \
+		g_main_context_iteration(NULL, TRUE); \
+	g_assert_true(cond); \
+} G_STMT_END
+
+typedef struct {
+	GSocketConnection *conn;
+	GString *received;
+	gchar buf[1024];
+} TestJabberSmPeer;
+
+typedef struct {
+	GSocketService *service;
+	guint16 port;
+	GPtrArray *peers;
+} TestJabberSmServer;
+
+static void
+test_jabber_sm_peer_free(TestJabberSmPeer *peer) {
+	g_object_unref(peer->conn);
+	g_string_free(peer->received, TRUE);
+	g_free(peer);
+}
+
+static void
+test_jabber_sm_peer_read_cb(GObject *source, GAsyncResult *res, gpointer data) {
+	TestJabberSmPeer *peer = data;
+	gssize len = g_input_stream_read_finish(G_INPUT_STREAM(source), res, NULL);
+
+	if (len <= 0)
+		return;
+
+	g_string_append_len(peer->received, peer->buf, len);
+	g_input_stream_read_async(G_INPUT_STREAM(source), peer->buf,
+	                          sizeof(peer->buf), G_PRIORITY_DEFAULT, NULL,
+	                          test_jabber_sm_peer_read_cb, peer);
+}
+
+static gboolean
+test_jabber_sm_incoming_cb(GSocketService *service,
+                           GSocketConnection *conn, GObject *source,
+                           gpointer data) {
+	TestJabberSmServer *server = data;
+	TestJabberSmPeer *peer = g_new0(TestJabberSmPeer, 1);
+
+	peer->conn = g_object_ref(conn);
+	peer->received = g_string_new(NULL);
+	g_ptr_array_add(server->peers, peer);
+
+	g_input_stream_read_async(g_io_stream_get_input_stream(G_IO_STREAM(conn)),
+	                          peer->buf, sizeof(peer->buf),
+	                          G_PRIORITY_DEFAULT, NULL,
+	                          test_jabber_sm_peer_read_cb, peer);
+
+	return TRUE;
+}
+
+static void
+test_jabber_sm_server_start(TestJabberSmServer *server) {
+	GInetAddress *loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+	GSocketAddress *address = g_inet_socket_address_new(loopback, 0);
+	GSocketAddress *effective = NULL;
+	GError *error = NULL;
+
+	server->service = g_socket_service_new();
+	server->peers = g_ptr_array_new_with_free_func(
+		(GDestroyNotify)test_jabber_sm_peer_free);
+
+	g_socket_listener_add_address(G_SOCKET_LISTENER(server->service),
+	                              address, G_SOCKET_TYPE_STREAM,
+	                              G_SOCKET_PROTOCOL_TCP, NULL, &effective,
+	                              &error);
+	g_assert_no_error(error);
+	server->port = g_inet_socket_address_get_port(
+		G_INET_SOCKET_ADDRESS(effective));
+
+	g_signal_connect(server->service, "incoming",
+	                 G_CALLBACK(test_jabber_sm_incoming_cb), server);
+	g_socket_service_start(server->service);
+
+	g_object_unref(effective);
+	g_object_unref(address);
+	g_object_unref(loopback);
+}
+
+static void
+test_jabber_sm_server_stop(TestJabberSmServer *server) {
+	g_socket_service_stop(server->service);
+	g_socket_listener_close(G_SOCKET_LISTENER(server->service));
+	g_object_unref(server->service);
+	g_ptr_array_free(server->peers, TRUE);
+}
+
+static TestJabberSmPeer *
+test_jabber_sm_server_peer(TestJabberSmServer *server, guint index) {
+	test_jabber_sm_run_until(server->peers->len > index);
+
+	return g_ptr_array_index(server->peers, index);
+}
+
+static void
+test_jabber_sm_peer_expect(TestJabberSmPeer *peer, const gchar *text) {
+	test_jabber_sm_run_until(strstr(peer->received->str, text) != NULL);
+}
+
+static void
+test_jabber_sm_peer_send(TestJabberSmPeer *peer, const gchar *text) {
+	GError *error = NULL;
+
+	g_output_stream_write_all(
+		g_io_stream_get_output_stream(G_IO_STREAM(peer->conn)),
+		text, strlen(text), NULL, NULL, &error);
+	g_assert_no_error(error);
+}
+
+/* Stands in for the XMPP protocol, which is only registered by the plugin */
+typedef struct {
+	PurpleProtocol parent;
+} TestJabberSmProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestJabberSmProtocolClass;
+
+static GType test_jabber_sm_protocol_get_type(void);
+
+G_DEFINE_TYPE(TestJabberSmProtocol, test_jabber_sm_protocol,
+              PURPLE_TYPE_PROTOCOL);
+
+static void
+test_jabber_sm_protocol_init(TestJabberSmProtocol *protocol) {
+	PURPLE_PROTOCOL(protocol)->id = "prpl-jabber-sm";
+}
+
+static void
+test_jabber_sm_protocol_class_init(TestJabberSmProtocolClass *klass) {
+	PurpleProtocolClass *protocol_class = PURPLE_PROTOCOL_CLASS(klass);
+
+	protocol_class->login = jabber_login;
+	protocol_class->close = jabber_close;
+}
+
+static PurpleProtocol *
+test_jabber_sm_protocol_new(void) {
+	PurpleProtocol *protocol =
+		g_object_new(test_jabber_sm_protocol_get_type(), NULL);
+
+	/* The ones the plugin registers that this stream emits */
+	purple_signal_register(protocol, "jabber-receiving-xmlnode",
+			purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
+			PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+	purple_signal_register(protocol, "jabber-sending-xmlnode",
+			purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
+			PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+	purple_signal_connect_priority(protocol, "jabber-sending-xmlnode",
+			protocol, PURPLE_CALLBACK(jabber_send_signal_cb),
+			NULL, PURPLE_SIGNAL_PRIORITY_HIGHEST);
+	purple_signal_register(protocol, "jabber-receiving-data",
+			purple_marshal_VOID__POINTER_UINT, G_TYPE_NONE, 2,
+			PURPLE_TYPE_CONNECTION, G_TYPE_UINT);
+	purple_signal_register(protocol, "jabber-sending-text",
+			purple_marshal_VOID__POINTER_POINTER, G_TYPE_NONE, 2,
+			PURPLE_TYPE_CONNECTION, G_TYPE_POINTER);
+
+	return protocol;
+}
+
+static void
+test_jabber_sm_send_message(JabberStream *js, const gchar *id) {
+	PurpleXmlNode *message = purple_xmlnode_new("message");
+
+	purple_xmlnode_set_attrib(message, "id", id);
+	purple_xmlnode_set_attrib(message, "to", "buddy@localhost");
+	jabber_send(js, message);
+	purple_xmlnode_free(message);
+}
+
+static gboolean
+test_jabber_sm_tick_cb(gpointer data) {
+	/* Keeps g_main_context_iteration() from blocking for good */
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+test_jabber_sm_resume(void) {
+	TestJabberSmServer server;
+	TestJabberSmPeer *first, *second;
+	PurpleProtocol *protocol;
+	PurpleAccount *account;
+	PurpleConnection *gc;
+	PurpleXmlNode *resume;
+	JabberStream *js;
+	const gchar *start, *end;
+	gchar *text;
+	guint tick;
+
+	test_jabber_sm_server_start(&server);
+	tick = g_timeout_add(10, test_jabber_sm_tick_cb, NULL);
+
+	protocol = test_jabber_sm_protocol_new();
+	account = purple_account_new("test@localhost/sm", "prpl-jabber-sm");
+	purple_account_set_string(account, "connect_server", "127.0.0.1");
+	purple_account_set_int(account, "port", server.port);
+	purple_account_set_string(account, "connection_security",
+	                          "opportunistic_tls");
+	gc = g_object_new(PURPLE_TYPE_CONNECTION, "protocol", protocol,
+	                  "account", account, NULL);
+
+	jabber_login(account);
+	js = purple_connection_get_protocol_data(gc);
+	g_assert_nonnull(js);
+
+	/* Skip straight to an established session and enable SM on it */
+	first = test_jabber_sm_server_peer(&server, 0);
+	test_jabber_sm_peer_expect(first, "<stream:stream");
+	test_jabber_sm_peer_send(first, TEST_JABBER_SM_STREAM);
+
+	js->state = JABBER_STREAM_CONNECTED;
+	js->server_caps |= JABBER_CAP_STREAM_MANAGEMENT;
+	jabber_sm_enable(js);
+	test_jabber_sm_peer_expect(first, "<enable ");
+
+	/* An id that needs escaping on the way back */
+	test_jabber_sm_peer_send(first, "<enabled xmlns='" NS_STREAM_MANAGEMENT
+	                         "' id='s&apos;m' resume='true'/>");
+	test_jabber_sm_run_until(js->sm_state == JABBER_SM_ENABLED);
+	g_assert_cmpstr(js->sm_id, ==, "s'm");
+
+	test_jabber_sm_send_message(js, "sm-1");
+	test_jabber_sm_send_message(js, "sm-2");
+	test_jabber_sm_peer_expect(first, "sm-2");
+
+	test_jabber_sm_peer_send(first, "<a xmlns='" NS_STREAM_MANAGEMENT
+	                         "' h='1'/>");
+	test_jabber_sm_run_until(js->sm_acked == 1);
+	g_assert_cmpuint(g_queue_get_length(&js->sm_unacked), ==, 1);
+
+	/* Drop the connection mid-stream */
+	g_socket_shutdown(g_socket_connection_get_socket(first->conn), TRUE, TRUE,
+	                  NULL);
+	test_jabber_sm_run_until(js->sm_state == JABBER_SM_RESUMING);
+
+	/* Sent while reconnecting, so held back for the new stream */
+	test_jabber_sm_send_message(js, "sm-3");
+
+	second = test_jabber_sm_server_peer(&server, 1);
+	test_jabber_sm_peer_expect(second, "<stream:stream");
+	test_jabber_sm_peer_send(second, TEST_JABBER_SM_STREAM
+	                         "<stream:features><sm xmlns='"
+	                         NS_STREAM_MANAGEMENT "'/></stream:features>");
+
+	test_jabber_sm_peer_expect(second, "<resume ");
+	start = strstr(second->received->str, "<resume ");
+	end = strstr(start, "/>");
+	g_assert_nonnull(end);
+	text = g_strndup(start, end + 2 - start);
+	resume = purple_xmlnode_from_str(text, -1);
+	g_assert_nonnull(resume);
+	g_assert_cmpstr(purple_xmlnode_get_namespace(resume), ==,
+	                NS_STREAM_MANAGEMENT);
+	g_assert_cmpstr(purple_xmlnode_get_attrib(resume, "previd"), ==, "s'm");
+	g_assert_cmpstr(purple_xmlnode_get_attrib(resume, "h"), ==, "0");
+	purple_xmlnode_free(resume);
+	g_free(text);
+
+	/* Nothing goes out on the new stream before it's resumed */
+	g_assert_null(strstr(second->received->str, "sm-3"));
+
+	test_jabber_sm_peer_send(second, "<resumed xmlns='" NS_STREAM_MANAGEMENT
+	                         "' h='1' previd='s&apos;m'/>");
+	test_jabber_sm_peer_expect(second, "sm-3");
+	g_assert_nonnull(strstr(second->received->str, "sm-2"));
+	g_assert_null(strstr(second->received->str, "sm-1"));
+	g_assert_cmpint(js->sm_state, ==, JABBER_SM_ENABLED);
+	g_assert_cmpint(js->state, ==, JABBER_STREAM_CONNECTED);
+
+	g_source_remove(tick);
+	g_object_unref(gc);
+	test_jabber_sm_server_stop(&server);
+}
+
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	g_test_add_func("/jabber/sm/handle ack",
+	                test_jabber_sm_handle_ack);
+
+	g_test_add_func("/jabber/sm/handle ack wraparound",
+	                test_jabber_sm_handle_ack_wraparound);
+
+	g_test_add_func("/jabber/sm/resume",
+	                test_jabber_sm_resume);
+
+	return g_test_run();
+}
@@ -36,6 +36,11 @@
  *
  * To queue data, use #purple_queued_output_stream_push_bytes_async().
  *
+ * Everything queued while a write is in progress is sent with the next
+ * write, as a single vectored write, so a burst of small pushes doesn't
+ * turn into a burst of small syscalls or TLS records. Each push is still
+ * completed on its own, once all of its bytes are written.
+ *
  * If there's a fatal stream error, it's suggested to clear the remaining
  * bytes queued with #purple_queued_output_stream_clear_queue() to avoid
  * excessive errors returned in
@@ -46,10 +51,25 @@ struct _PurpleQueuedOutputStream
 	GFilterOutputStream parent;
 };
 
+/* Limits of a single write. The first queued push is always written, even
+ * if it's larger. */
+#define PURPLE_QUEUED_OUTPUT_STREAM_MAX_VECTORS 64
+#define PURPLE_QUEUED_OUTPUT_STREAM_MAX_WRITE (64 * 1024)
+
 typedef struct
 {
 	GAsyncQueue *queue;
 	gboolean pending_queued;
+
+	/* Tasks being written, in order. */
+	GQueue batch;
+#if GLIB_CHECK_VERSION(2, 60, 0)
+	GOutputVector vectors[PURPLE_QUEUED_OUTPUT_STREAM_MAX_VECTORS];
+#endif
+
+	guint64 writes;
+	guint64 bytes_written;
+	gsize max_write;
 } PurpleQueuedOutputStreamPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE(PurpleQueuedOutputStream,
@@ -59,39 +79,105 @@ G_DEFINE_TYPE_WITH_PRIVATE(PurpleQueuedOutputStream,
  * Helpers
  *****************************************************************************/
 
-static void purple_queued_output_stream_start_push_bytes_async(GTask *task);
+static void purple_queued_output_stream_start_write(
+		PurpleQueuedOutputStream *stream);
+
+/* Moves queued tasks to the batch, within the limits of a single write.
+ * Only the tasks sharing the priority and cancellable of the first one are
+ * written together. */
+static void
+purple_queued_output_stream_fill_batch(PurpleQueuedOutputStream *stream)
+{
+	PurpleQueuedOutputStreamPrivate *priv = purple_queued_output_stream_get_instance_private(stream);
+	GTask *first, *task;
+	gsize size = 0;
+	GList *l;
+
+	for (l = priv->batch.head; l != NULL; l = l->next)
+		size += g_bytes_get_size(g_task_get_task_data(l->data));
+
+	while (priv->batch.length < PURPLE_QUEUED_OUTPUT_STREAM_MAX_VECTORS &&
+			(priv->batch.length == 0 ||
+			 size < PURPLE_QUEUED_OUTPUT_STREAM_MAX_WRITE) &&
+			(task = g_async_queue_try_pop(priv->queue)) != NULL)
+	{
+		first = g_queue_peek_head(&priv->batch);
+		if (first != NULL && (g_task_get_priority(task) !=
+				g_task_get_priority(first) ||
+				g_task_get_cancellable(task) !=
+				g_task_get_cancellable(first)))
+		{
+			g_async_queue_push_front(priv->queue, task);
+			break;
+		}
+
+		size += g_bytes_get_size(g_task_get_task_data(task));
+		g_queue_push_tail(&priv->batch, task);
+	}
+}
 
 static void
-purple_queued_output_stream_push_bytes_async_cb(GObject *source,
+purple_queued_output_stream_write_cb(GObject *source,
 		GAsyncResult *res, gpointer user_data)
 {
-	GTask *task = G_TASK(user_data);
-	PurpleQueuedOutputStream *stream = g_task_get_source_object(task);
+	PurpleQueuedOutputStream *stream = PURPLE_QUEUED_OUTPUT_STREAM(user_data);
 	PurpleQueuedOutputStreamPrivate *priv = purple_queued_output_stream_get_instance_private(stream);
-	gssize written;
-	GBytes *bytes;
-	gsize size;
+	GQueue done = G_QUEUE_INIT;
+	GTask *task;
+	gsize written = 0;
+	gboolean success;
 	GError *error = NULL;
 
-	written = g_output_stream_write_bytes_finish(G_OUTPUT_STREAM(source),
-			res, &error);
-
-	bytes = g_task_get_task_data(task);
-	size = g_bytes_get_size(bytes);
-
-	if (written < 0) {
-		/* Error occurred, return error */
-		g_task_return_error(task, error);
-		g_clear_object(&task);
-	} else if (size > written) {
-		/* Partial write, prepare to send remaining data */
-		bytes = g_bytes_new_from_bytes(bytes, written, size - written);
-		g_task_set_task_data(task, bytes,
-				(GDestroyNotify)g_bytes_unref);
+#if GLIB_CHECK_VERSION(2, 60, 0)
+	success = g_output_stream_writev_finish(G_OUTPUT_STREAM(source),
+			res, &written, &error);
+#else
+	{
+		gssize ret = g_output_stream_write_bytes_finish(
+				G_OUTPUT_STREAM(source), res, &error);
+
+		success = (ret >= 0);
+		if (success)
+			written = ret;
+	}
+#endif
+
+	if (!success) {
+		/* Error occurred, return it for everything in this write */
+		while ((task = g_queue_pop_head(&priv->batch)) != NULL) {
+			g_task_return_error(task, g_error_copy(error));
+			g_object_unref(task);
+		}
+		g_clear_error(&error);
 	} else {
-		/* Full write, this task is finished */
-		g_task_return_boolean(task, TRUE);
-		g_clear_object(&task);
+		priv->writes++;
+		priv->bytes_written += written;
+		priv->max_write = MAX(priv->max_write, written);
+
+		/* Finish the tasks written in full... */
+		while ((task = g_queue_peek_head(&priv->batch)) != NULL) {
+			GBytes *bytes = g_task_get_task_data(task);
+			gsize size = g_bytes_get_size(bytes);
+
+			if (written < size) {
+				/* ...and prepare to send the rest of a partial one */
+				if (written > 0) {
+					bytes = g_bytes_new_from_bytes(bytes, written,
+							size - written);
+					g_task_set_task_data(task, bytes,
+							(GDestroyNotify)g_bytes_unref);
+				}
+				break;
+			}
+
+			written -= size;
+			g_queue_push_tail(&done, g_queue_pop_head(&priv->batch));
+		}
+
+		while ((task = g_queue_pop_head(&done)) != NULL) {
+			g_task_return_boolean(task, TRUE);
+			g_object_unref(task);
+		}
 	}
 
 	/* If g_task_return_* was called in this function, the callback
@@ -99,36 +185,77 @@ purple_queued_output_stream_push_bytes_async_cb(GObject *source,
 	 * tasks to process here.
 	 */
 
-	if (task == NULL) {
-		/* Any queued data left? */
-		task = g_async_queue_try_pop(priv->queue);
-	}
+	/* Any queued data left? */
+	purple_queued_output_stream_fill_batch(stream);
 
-	if (task != NULL) {
+	if (priv->batch.length > 0) {
 		/* More to process */
-		purple_queued_output_stream_start_push_bytes_async(task);
+		purple_queued_output_stream_start_write(stream);
 	} else {
 		/* All done */
 		priv->pending_queued = FALSE;
 		g_output_stream_clear_pending(G_OUTPUT_STREAM(stream));
 	}
+
+	g_object_unref(stream);
 }
 
+/* Writes out the whole batch with one call. */
 static void
-purple_queued_output_stream_start_push_bytes_async(GTask *task)
+purple_queued_output_stream_start_write(PurpleQueuedOutputStream *stream)
 {
-	PurpleQueuedOutputStream *stream = g_task_get_source_object(task);
+	PurpleQueuedOutputStreamPrivate *priv = purple_queued_output_stream_get_instance_private(stream);
+	GTask *first = g_queue_peek_head(&priv->batch);
 	GOutputStream *base_stream;
+#if GLIB_CHECK_VERSION(2, 60, 0)
+	GList *l;
+	gsize n = 0;
+#else
+	GBytes *bytes;
+#endif
 
 	base_stream = g_filter_output_stream_get_base_stream(
 			G_FILTER_OUTPUT_STREAM(stream));
 
-	g_output_stream_write_bytes_async(base_stream,
-			g_task_get_task_data(task),
-			g_task_get_priority(task),
-			g_task_get_cancellable(task),
-			purple_queued_output_stream_push_bytes_async_cb,
-			task);
+#if GLIB_CHECK_VERSION(2, 60, 0)
+	for (l = priv->batch.head; l != NULL; l = l->next, n++) {
+		GBytes *bytes = g_task_get_task_data(l->data);
+
+		priv->vectors[n].buffer = g_bytes_get_data(bytes,
+				&priv->vectors[n].size);
+	}
+
+	g_output_stream_writev_async(base_stream, priv->vectors, n,
+			g_task_get_priority(first),
+			g_task_get_cancellable(first),
+			purple_queued_output_stream_write_cb,
+			g_object_ref(stream));
+#else
+	if (priv->batch.length == 1) {
+		bytes = g_bytes_ref(g_task_get_task_data(first));
+	} else {
+		/* Without writev, gather the data into one buffer. */
+		GByteArray *buf = g_byte_array_new();
+		GList *l;
+
+		for (l = priv->batch.head; l != NULL; l = l->next) {
+			gsize size;
+			gconstpointer data = g_bytes_get_data(
+					g_task_get_task_data(l->data), &size);
+
+			g_byte_array_append(buf, data, size);
+		}
+
+		bytes = g_byte_array_free_to_bytes(buf);
+	}
+
+	g_output_stream_write_bytes_async(base_stream, bytes,
+			g_task_get_priority(first),
+			g_task_get_cancellable(first),
+			purple_queued_output_stream_write_cb,
+			g_object_ref(stream));
+	g_bytes_unref(bytes);
+#endif
 }
 
 /******************************************************************************
@@ -160,6 +287,7 @@ purple_queued_output_stream_init(PurpleQueuedOutputStream *stream)
 	PurpleQueuedOutputStreamPrivate *priv = purple_queued_output_stream_get_instance_private(stream);
 	priv->queue = g_async_queue_new_full((GDestroyNotify)g_bytes_unref);
 	priv->pending_queued = FALSE;
+	g_queue_init(&priv->batch);
 }
 
 /******************************************************************************
@@ -220,7 +348,8 @@ purple_queued_output_stream_push_bytes_async(PurpleQueuedOutputStream *stream,
 
 	if (set_pending) {
 		/* Start processing if there were no pending operations */
-		purple_queued_output_stream_start_push_bytes_async(task);
+		g_queue_push_tail(&priv->batch, task);
+		purple_queued_output_stream_start_write(stream);
 	} else {
 		/* Otherwise queue the data */
 		g_async_queue_push(priv->queue, task);
@@ -255,3 +384,21 @@ purple_queued_output_stream_clear_queue(PurpleQueuedOutputStream *stream)
 		g_object_unref(task);
 	}
 }
+
+void
+purple_queued_output_stream_get_stats(PurpleQueuedOutputStream *stream,
+		guint64 *writes, guint64 *bytes_written, gsize *max_write)
+{
+	PurpleQueuedOutputStreamPrivate *priv = NULL;
+
+	g_return_if_fail(PURPLE_IS_QUEUED_OUTPUT_STREAM(stream));
+
+	priv = purple_queued_output_stream_get_instance_private(stream);
+
+	if (writes != NULL)
+		*writes = priv->writes;
+	if (bytes_written != NULL)
+		*bytes_written = priv->bytes_written;
+	if (max_write != NULL)
+		*max_write = priv->max_write;
+}
@@ -104,6 +104,23 @@ gboolean purple_queued_output_stream_push_bytes_finish(
  */
 void purple_queued_output_stream_clear_queue(PurpleQueuedOutputStream *stream);
 
+/*
+ * purple_queued_output_stream_get_stats
+ * @stream: #PurpleQueuedOutputStream to query
+ * @writes: (out) (optional): Return location for the number of writes to
+ *          the base stream
+ * @bytes_written: (out) (optional): Return location for the number of
+ *                 bytes written to the base stream
+ * @max_write: (out) (optional): Return location for the largest number of
+ *             bytes written at once
+ *
+ * Returns statistics about the writes to the base stream. Since queued data
+ * is coalesced, @bytes_written divided by @writes is the average number of
+ * bytes per write.
+ */
+void purple_queued_output_stream_get_stats(PurpleQueuedOutputStream *stream,
+		guint64 *writes, guint64 *bytes_written, gsize *max_write);
+
 G_END_DECLS
 
 #endif /* PURPLE_QUEUED_OUTPUT_STREAM_H */
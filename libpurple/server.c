@@ -27,6 +27,7 @@
 #include "buddylist.h"
 #include "conversation.h"
 #include "debug.h"
+#include "eventloop.h"
 #include "log.h"
 #include "notify.h"
 #include "prefs.h"
@@ -40,6 +41,37 @@
 #define SECS_BEFORE_RESENDING_AUTORESPONSE 600
 #define SEX_BEFORE_RESENDING_AUTORESPONSE "Only after you're married"
 
+/* Interned IDs of the hot signals emitted from this file. */
+static gulong receiving_im_msg_signal = 0;
+static gulong received_im_msg_signal = 0;
+static gulong receiving_chat_msg_signal = 0;
+static gulong received_chat_msg_signal = 0;
+static gulong buddy_typing_signal = 0;
+static gulong buddy_typed_signal = 0;
+static gulong buddy_typing_stopped_signal = 0;
+
+static void
+server_signals_lookup(void)
+{
+	void *handle;
+
+	if (G_LIKELY(receiving_im_msg_signal != 0))
+		return;
+
+	handle = purple_conversations_get_handle();
+
+	receiving_im_msg_signal = purple_signal_get_id(handle, "receiving-im-msg");
+	received_im_msg_signal = purple_signal_get_id(handle, "received-im-msg");
+	receiving_chat_msg_signal =
+		purple_signal_get_id(handle, "receiving-chat-msg");
+	received_chat_msg_signal =
+		purple_signal_get_id(handle, "received-chat-msg");
+	buddy_typing_signal = purple_signal_get_id(handle, "buddy-typing");
+	buddy_typed_signal = purple_signal_get_id(handle, "buddy-typed");
+	buddy_typing_stopped_signal =
+		purple_signal_get_id(handle, "buddy-typing-stopped");
+}
+
 unsigned int
 purple_serv_send_typing(PurpleConnection *gc, const char *name, PurpleIMTypingState state)
 {
@@ -53,31 +85,43 @@ purple_serv_send_typing(PurpleConnection *gc, const char *name, PurpleIMTypingSt
 	return 0;
 }
 
-static GSList *last_auto_responses = NULL;
+/* struct last_auto_response => itself, keyed by connection and name. */
+static GHashTable *last_auto_responses = NULL;
 struct last_auto_response {
 	PurpleConnection *gc;
 	char name[80];
 	time_t sent;
+	guint expire_timer;
 };
 
+static guint
+last_auto_response_hash(const struct last_auto_response *lar)
+{
+	return g_str_hash(lar->name) ^ g_direct_hash(lar->gc);
+}
+
 static gboolean
-expire_last_auto_responses(gpointer data)
+last_auto_response_equal(const struct last_auto_response *lar1,
+		const struct last_auto_response *lar2)
 {
-	GSList *tmp, *cur;
-	struct last_auto_response *lar;
+	return (lar1->gc == lar2->gc && g_str_equal(lar1->name, lar2->name));
+}
 
-	tmp = last_auto_responses;
+static void
+last_auto_response_free(struct last_auto_response *lar)
+{
+	if (lar->expire_timer != 0)
+		purple_timer_remove(lar->expire_timer);
+	g_free(lar);
+}
 
-	while (tmp) {
-		cur = tmp;
-		tmp = tmp->next;
-		lar = (struct last_auto_response *)cur->data;
+static gboolean
+expire_last_auto_response(gpointer data)
+{
+	struct last_auto_response *lar = data;
 
-		if ((time(NULL) - lar->sent) > SECS_BEFORE_RESENDING_AUTORESPONSE) {
-			last_auto_responses = g_slist_delete_link(last_auto_responses, cur);
-			g_free(lar);
-		}
-	}
+	lar->expire_timer = 0;
+	g_hash_table_remove(last_auto_responses, lar);
 
 	return FALSE; /* do not run again */
 }
@@ -85,29 +129,34 @@ expire_last_auto_responses(gpointer data)
 static struct last_auto_response *
 get_last_auto_response(PurpleConnection *gc, const char *name)
 {
-	GSList *tmp;
-	struct last_auto_response *lar;
-
-	/* because we're modifying or creating a lar, schedule the
-	 * function to expire them as the pref dictates */
-	g_timeout_add_seconds((SECS_BEFORE_RESENDING_AUTORESPONSE + 1), expire_last_auto_responses, NULL);
+	struct last_auto_response key, *lar;
 
-	tmp = last_auto_responses;
-
-	while (tmp) {
-		lar = (struct last_auto_response *)tmp->data;
+	if (last_auto_responses == NULL) {
+		last_auto_responses = g_hash_table_new_full(
+				(GHashFunc)last_auto_response_hash,
+				(GEqualFunc)last_auto_response_equal,
+				(GDestroyNotify)last_auto_response_free, NULL);
+	}
 
-		if (gc == lar->gc && !strncmp(name, lar->name, sizeof(lar->name)))
-			return lar;
+	key.gc = gc;
+	g_snprintf(key.name, sizeof(key.name), "%s", name);
 
-		tmp = tmp->next;
+	lar = g_hash_table_lookup(last_auto_responses, &key);
+	if (lar == NULL) {
+		lar = g_new0(struct last_auto_response, 1);
+		g_snprintf(lar->name, sizeof(lar->name), "%s", name);
+		lar->gc = gc;
+		lar->sent = 0;
+		g_hash_table_add(last_auto_responses, lar);
+	} else {
+		purple_timer_remove(lar->expire_timer);
 	}
 
-	lar = g_new0(struct last_auto_response, 1);
-	g_snprintf(lar->name, sizeof(lar->name), "%s", name);
-	lar->gc = gc;
-	lar->sent = 0;
-	last_auto_responses = g_slist_prepend(last_auto_responses, lar);
+	/* because we're modifying or creating a lar, (re)schedule its
+	 * expiry as the pref dictates */
+	lar->expire_timer = purple_timer_add_seconds(
+			SECS_BEFORE_RESENDING_AUTORESPONSE + 1,
+			expire_last_auto_response, lar);
 
 	return lar;
 }
@@ -518,9 +567,11 @@ void purple_serv_got_im(PurpleConnection *gc, const char *who, const char *msg,
 	buffy = g_strdup(msg);
 	angel = g_strdup(who);
 
+	server_signals_lookup();
+
 	plugin_return = GPOINTER_TO_INT(
-		purple_signal_emit_return_1(purple_conversations_get_handle(),
-								  "receiving-im-msg", purple_connection_get_account(gc),
+		purple_signal_emit_return_1_by_id(receiving_im_msg_signal,
+								  purple_connection_get_account(gc),
 								  &angel, &buffy, im, &flags));
 
 	if (!buffy || !angel || plugin_return) {
@@ -532,7 +583,7 @@ void purple_serv_got_im(PurpleConnection *gc, const char *who, const char *msg,
 	name = angel;
 	message = buffy;
 
-	purple_signal_emit(purple_conversations_get_handle(), "received-im-msg", purple_connection_get_account(gc),
+	purple_signal_emit_by_id(received_im_msg_signal, purple_connection_get_account(gc),
 					 name, message, im, flags);
 
 	/* search for conversation again in case it was created by received-im-msg handler */
@@ -633,19 +684,21 @@ void purple_serv_got_typing(PurpleConnection *gc, const char *name, int timeout,
 	if (im != NULL) {
 		purple_im_conversation_set_typing_state(im, state);
 	} else {
+		server_signals_lookup();
+
 		switch (state)
 		{
 			case PURPLE_IM_TYPING:
-				purple_signal_emit(purple_conversations_get_handle(),
-								   "buddy-typing", purple_connection_get_account(gc), name);
+				purple_signal_emit_by_id(buddy_typing_signal,
+								   purple_connection_get_account(gc), name);
 				break;
 			case PURPLE_IM_TYPED:
-				purple_signal_emit(purple_conversations_get_handle(),
-								   "buddy-typed", purple_connection_get_account(gc), name);
+				purple_signal_emit_by_id(buddy_typed_signal,
+								   purple_connection_get_account(gc), name);
 				break;
 			case PURPLE_IM_NOT_TYPING:
-				purple_signal_emit(purple_conversations_get_handle(),
-								   "buddy-typing-stopped", purple_connection_get_account(gc), name);
+				purple_signal_emit_by_id(buddy_typing_stopped_signal,
+								   purple_connection_get_account(gc), name);
 				break;
 		}
 	}
@@ -669,8 +722,10 @@ void purple_serv_got_typing_stopped(PurpleConnection *gc, const char *name) {
 	}
 	else
 	{
-		purple_signal_emit(purple_conversations_get_handle(),
-						 "buddy-typing-stopped", purple_connection_get_account(gc), name);
+		server_signals_lookup();
+
+		purple_signal_emit_by_id(buddy_typing_stopped_signal,
+						 purple_connection_get_account(gc), name);
 	}
 }
 
@@ -772,8 +827,7 @@ PurpleChatConversation *purple_serv_got_joined_chat(PurpleConnection *gc,
 	chat = purple_chat_conversation_new(account, name);
 	g_return_val_if_fail(chat != NULL, NULL);
 
-	if (!g_slist_find(purple_connection_get_active_chats(gc), chat))
-		_purple_connection_add_active_chat(gc, chat);
+	_purple_connection_add_active_chat(gc, chat);
 
 	purple_chat_conversation_set_id(chat, id);
 
@@ -784,18 +838,11 @@ PurpleChatConversation *purple_serv_got_joined_chat(PurpleConnection *gc,
 
 void purple_serv_got_chat_left(PurpleConnection *g, int id)
 {
-	GSList *bcs;
-	PurpleChatConversation *chat = NULL;
+	PurpleChatConversation *chat;
 
-	for (bcs = purple_connection_get_active_chats(g); bcs != NULL; bcs = bcs->next) {
-		if (purple_chat_conversation_get_id(
-				PURPLE_CHAT_CONVERSATION(bcs->data)) == id) {
-			chat = (PurpleChatConversation *)bcs->data;
-			break;
-		}
-	}
+	chat = purple_conversations_find_chat(g, id);
 
-	if (!chat)
+	if (!chat || !_purple_connection_has_active_chat(g, chat))
 		return;
 
 	purple_debug(PURPLE_DEBUG_INFO, "server", "Leaving room: %s\n",
@@ -817,8 +864,7 @@ void purple_serv_got_join_chat_failed(PurpleConnection *gc, GHashTable *data)
 void purple_serv_got_chat_in(PurpleConnection *g, int id, const char *who,
 					  PurpleMessageFlags flags, const char *message, time_t mtime)
 {
-	GSList *bcs;
-	PurpleChatConversation *chat = NULL;
+	PurpleChatConversation *chat;
 	char *buffy, *angel;
 	int plugin_return;
 	PurpleMessage *pmsg;
@@ -834,15 +880,9 @@ void purple_serv_got_chat_in(PurpleConnection *g, int id, const char *who,
 		mtime = time(NULL);
 	}
 
-	for (bcs = purple_connection_get_active_chats(g); bcs != NULL; bcs = bcs->next) {
-		if (purple_chat_conversation_get_id(
-				PURPLE_CHAT_CONVERSATION(bcs->data)) == id) {
-			chat = (PurpleChatConversation *)bcs->data;
-			break;
-		}
-	}
+	chat = purple_conversations_find_chat(g, id);
 
-	if (!chat)
+	if (!chat || !_purple_connection_has_active_chat(g, chat))
 		return;
 
 	/* Did I send the message? */
@@ -862,9 +902,11 @@ void purple_serv_got_chat_in(PurpleConnection *g, int id, const char *who,
 	buffy = g_strdup(message);
 	angel = g_strdup(who);
 
+	server_signals_lookup();
+
 	plugin_return = GPOINTER_TO_INT(
-		purple_signal_emit_return_1(purple_conversations_get_handle(),
-								  "receiving-chat-msg", purple_connection_get_account(g),
+		purple_signal_emit_return_1_by_id(receiving_chat_msg_signal,
+								  purple_connection_get_account(g),
 								  &angel, &buffy, chat, &flags));
 
 	if (!buffy || !angel || plugin_return) {
@@ -876,7 +918,7 @@ void purple_serv_got_chat_in(PurpleConnection *g, int id, const char *who,
 	who = angel;
 	message = buffy;
 
-	purple_signal_emit(purple_conversations_get_handle(), "received-chat-msg", purple_connection_get_account(g),
+	purple_signal_emit_by_id(received_chat_msg_signal, purple_connection_get_account(g),
 					 who, message, chat, flags);
 
 	if (flags & PURPLE_MESSAGE_RECV)
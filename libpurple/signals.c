@@ -33,8 +33,6 @@ typedef struct
 	GHashTable *signals;
 	size_t signal_count;
 
-	gulong next_signal_id;
-
 } PurpleInstanceData;
 
 typedef struct
@@ -64,8 +62,77 @@ typedef struct
 
 } PurpleSignalHandlerData;
 
+typedef struct
+{
+	void *instance;
+	char *signal;
+
+} PurpleSignalKey;
+
 static GHashTable *instance_table = NULL;
 
+/*
+ * Signal IDs are interned per (instance, signal name) pair and, like
+ * GQuarks, are never released.  This lets emitters cache an ID across
+ * the signal being unregistered and registered again.  signal_table maps
+ * an ID to the currently registered PurpleSignalData, or NULL.
+ */
+static GHashTable *signal_ids = NULL;
+static GPtrArray *signal_table = NULL;
+
+static guint
+signal_key_hash(const PurpleSignalKey *key)
+{
+	return g_direct_hash(key->instance) ^ g_str_hash(key->signal);
+}
+
+static gboolean
+signal_key_equal(const PurpleSignalKey *a, const PurpleSignalKey *b)
+{
+	return a->instance == b->instance && g_str_equal(a->signal, b->signal);
+}
+
+static void
+signal_key_free(PurpleSignalKey *key)
+{
+	g_free(key->signal);
+	g_free(key);
+}
+
+static gulong
+intern_signal_id(void *instance, const char *signal)
+{
+	PurpleSignalKey lookup, *key;
+	gulong id;
+
+	lookup.instance = instance;
+	lookup.signal = (char *)signal;
+
+	id = GPOINTER_TO_SIZE(g_hash_table_lookup(signal_ids, &lookup));
+	if (id != 0)
+		return id;
+
+	/* Slot 0 is reserved so that 0 can mean "no signal". */
+	id = signal_table->len;
+	g_ptr_array_add(signal_table, NULL);
+
+	key = g_new0(PurpleSignalKey, 1);
+	key->instance = instance;
+	key->signal = g_strdup(signal);
+	g_hash_table_insert(signal_ids, key, GSIZE_TO_POINTER(id));
+
+	return id;
+}
+
+static PurpleSignalData *
+signal_data_from_id(gulong id)
+{
+	if (id == 0 || id >= signal_table->len)
+		return NULL;
+
+	return g_ptr_array_index(signal_table, id);
+}
+
 static void
 destroy_instance_data(PurpleInstanceData *instance_data)
 {
@@ -77,6 +144,10 @@ destroy_instance_data(PurpleInstanceData *instance_data)
 static void
 destroy_signal_data(PurpleSignalData *signal_data)
 {
+	/* The slot may already belong to a re-registered signal. */
+	if (signal_data_from_id(signal_data->id) == signal_data)
+		g_ptr_array_index(signal_table, signal_data->id) = NULL;
+
 	g_list_free_full(signal_data->handlers, g_free);
 	g_free(signal_data->value_types);
 	g_free(signal_data);
@@ -103,7 +174,6 @@ purple_signal_register(void *instance, const char *signal,
 		instance_data = g_new0(PurpleInstanceData, 1);
 
 		instance_data->instance = instance;
-		instance_data->next_signal_id = 1;
 
 		instance_data->signals =
 			g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
@@ -113,7 +183,7 @@ purple_signal_register(void *instance, const char *signal,
 	}
 
 	signal_data = g_new0(PurpleSignalData, 1);
-	signal_data->id              = instance_data->next_signal_id;
+	signal_data->id              = intern_signal_id(instance, signal);
 	signal_data->marshal         = marshal;
 	signal_data->next_handler_id = 1;
 	signal_data->ret_type        = ret_type;
@@ -133,10 +203,11 @@ purple_signal_register(void *instance, const char *signal,
 		va_end(args);
 	}
 
+	g_ptr_array_index(signal_table, signal_data->id) = signal_data;
+
 	g_hash_table_insert(instance_data->signals,
 						g_strdup(signal), signal_data);
 
-	instance_data->next_signal_id++;
 	instance_data->signal_count++;
 
 	return signal_data->id;
@@ -400,35 +471,38 @@ purple_signals_disconnect_by_handle(void *handle)
 						 (GHFunc)disconnect_handle_from_instance, handle);
 }
 
-void
-purple_signal_emit(void *instance, const char *signal, ...)
+gulong
+purple_signal_get_id(void *instance, const char *signal)
 {
-	va_list args;
+	g_return_val_if_fail(instance != NULL, 0);
+	g_return_val_if_fail(signal   != NULL, 0);
+	g_return_val_if_fail(signal_ids != NULL, 0);
 
-	g_return_if_fail(instance != NULL);
-	g_return_if_fail(signal   != NULL);
+	return intern_signal_id(instance, signal);
+}
 
-	va_start(args, signal);
-	purple_signal_emit_vargs(instance, signal, args);
-	va_end(args);
+gboolean
+purple_signal_has_handlers_by_id(gulong signal_id)
+{
+	PurpleSignalData *signal_data;
+
+	g_return_val_if_fail(signal_table != NULL, FALSE);
+
+	signal_data = signal_data_from_id(signal_id);
+
+	return (signal_data != NULL && signal_data->handlers != NULL);
 }
 
-void
-purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
+static PurpleSignalData *
+find_signal_data(void *instance, const char *signal)
 {
 	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
-	GList *l, *l_next;
-	va_list tmp;
-
-	g_return_if_fail(instance != NULL);
-	g_return_if_fail(signal   != NULL);
 
 	instance_data =
 		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
 
-	g_return_if_fail(instance_data != NULL);
+	g_return_val_if_fail(instance_data != NULL, NULL);
 
 	signal_data =
 		(PurpleSignalData *)g_hash_table_lookup(instance_data->signals, signal);
@@ -437,9 +511,18 @@ purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
 	{
 		purple_debug(PURPLE_DEBUG_ERROR, "signals",
 				   "Signal data for %s not found!\n", signal);
-		return;
 	}
 
+	return signal_data;
+}
+
+static void
+signal_emit_common(PurpleSignalData *signal_data, va_list args)
+{
+	PurpleSignalHandlerData *handler_data;
+	GList *l, *l_next;
+	va_list tmp;
+
 	for (l = signal_data->handlers; l != NULL; l = l_next)
 	{
 		l_next = l->next;
@@ -465,6 +548,104 @@ purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
 	}
 }
 
+static void *
+signal_emit_return_1_common(PurpleSignalData *signal_data, va_list args)
+{
+	PurpleSignalHandlerData *handler_data;
+	GList *l, *l_next;
+	va_list tmp;
+
+	for (l = signal_data->handlers; l != NULL; l = l_next)
+	{
+		void *ret_val = NULL;
+
+		l_next = l->next;
+
+		handler_data = (PurpleSignalHandlerData *)l->data;
+
+		G_VA_COPY(tmp, args);
+		if (handler_data->use_vargs)
+		{
+			ret_val = ((void *(*)(va_list, void *))handler_data->cb)(
+				tmp, handler_data->data);
+		}
+		else
+		{
+			signal_data->marshal(handler_data->cb, tmp,
+								 handler_data->data, &ret_val);
+		}
+		va_end(tmp);
+
+		if (ret_val != NULL)
+			return ret_val;
+	}
+
+	return NULL;
+}
+
+void
+purple_signal_emit(void *instance, const char *signal, ...)
+{
+	va_list args;
+
+	g_return_if_fail(instance != NULL);
+	g_return_if_fail(signal   != NULL);
+
+	va_start(args, signal);
+	purple_signal_emit_vargs(instance, signal, args);
+	va_end(args);
+}
+
+void
+purple_signal_emit_vargs(void *instance, const char *signal, va_list args)
+{
+	PurpleSignalData *signal_data;
+
+	g_return_if_fail(instance != NULL);
+	g_return_if_fail(signal   != NULL);
+
+	signal_data = find_signal_data(instance, signal);
+
+	if (signal_data == NULL || signal_data->handlers == NULL)
+		return;
+
+	signal_emit_common(signal_data, args);
+}
+
+void
+purple_signal_emit_by_id(gulong signal_id, ...)
+{
+	PurpleSignalData *signal_data;
+	va_list args;
+
+	g_return_if_fail(signal_table != NULL);
+
+	signal_data = signal_data_from_id(signal_id);
+
+	/* Fast path: nothing to do when nobody is listening. */
+	if (signal_data == NULL || signal_data->handlers == NULL)
+		return;
+
+	va_start(args, signal_id);
+	signal_emit_common(signal_data, args);
+	va_end(args);
+}
+
+void
+purple_signal_emit_vargs_by_id(gulong signal_id, va_list args)
+{
+	PurpleSignalData *signal_data;
+
+	g_return_if_fail(signal_table != NULL);
+
+	signal_data = signal_data_from_id(signal_id);
+
+	if (signal_data == NULL || signal_data->handlers == NULL)
+		return;
+
+	signal_emit_common(signal_data, args);
+}
+
 void *
 purple_signal_emit_return_1(void *instance, const char *signal, ...)
 {
@@ -485,56 +666,53 @@ void *
 purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 								va_list args)
 {
-	PurpleInstanceData *instance_data;
 	PurpleSignalData *signal_data;
-	PurpleSignalHandlerData *handler_data;
-	GList *l, *l_next;
-	va_list tmp;
 
 	g_return_val_if_fail(instance != NULL, NULL);
 	g_return_val_if_fail(signal   != NULL, NULL);
 
-	instance_data =
-		(PurpleInstanceData *)g_hash_table_lookup(instance_table, instance);
+	signal_data = find_signal_data(instance, signal);
 
-	g_return_val_if_fail(instance_data != NULL, NULL);
+	if (signal_data == NULL || signal_data->handlers == NULL)
+		return NULL;
 
-	signal_data =
-		(PurpleSignalData *)g_hash_table_lookup(instance_data->signals, signal);
+	return signal_emit_return_1_common(signal_data, args);
+}
 
-	if (signal_data == NULL)
-	{
-		purple_debug(PURPLE_DEBUG_ERROR, "signals",
-				   "Signal data for %s not found!\n", signal);
-		return 0;
-	}
+void *
+purple_signal_emit_return_1_by_id(gulong signal_id, ...)
+{
+	PurpleSignalData *signal_data;
+	void *ret_val;
+	va_list args;
 
-	for (l = signal_data->handlers; l != NULL; l = l_next)
-	{
-		void *ret_val = NULL;
+	g_return_val_if_fail(signal_table != NULL, NULL);
 
-		l_next = l->next;
+	signal_data = signal_data_from_id(signal_id);
 
-		handler_data = (PurpleSignalHandlerData *)l->data;
+	if (signal_data == NULL || signal_data->handlers == NULL)
+		return NULL;
 
-		G_VA_COPY(tmp, args);
-		if (handler_data->use_vargs)
-		{
-			ret_val = ((void *(*)(va_list, void *))handler_data->cb)(
-				tmp, handler_data->data);
-		}
-		else
-		{
-			signal_data->marshal(handler_data->cb, tmp,
-								 handler_data->data, &ret_val);
-		}
-		va_end(tmp);
+	va_start(args, signal_id);
+	ret_val = signal_emit_return_1_common(signal_data, args);
+	va_end(args);
 
-		if (ret_val != NULL)
-			return ret_val;
-	}
+	return ret_val;
+}
 
-	return NULL;
+void *
+purple_signal_emit_vargs_return_1_by_id(gulong signal_id, va_list args)
+{
+	PurpleSignalData *signal_data;
+
+	g_return_val_if_fail(signal_table != NULL, NULL);
+
+	signal_data = signal_data_from_id(signal_id);
+
+	if (signal_data == NULL || signal_data->handlers == NULL)
+		return NULL;
+
+	return signal_emit_return_1_common(signal_data, args);
 }
 
 void
@@ -545,6 +723,19 @@ purple_signals_init()
 	instance_table =
 		g_hash_table_new_full(g_direct_hash, g_direct_equal,
 							  NULL, (GDestroyNotify)destroy_instance_data);
+
+	/* The interned IDs outlive a purple_signals_uninit() on purpose, so
+	 * that IDs cached by emitters stay valid if the core is restarted. */
+	if (signal_ids == NULL)
+	{
+		signal_ids =
+			g_hash_table_new_full((GHashFunc)signal_key_hash,
+								  (GEqualFunc)signal_key_equal,
+								  (GDestroyNotify)signal_key_free, NULL);
+
+		signal_table = g_ptr_array_new();
+		g_ptr_array_add(signal_table, NULL);
+	}
 }
 
 void
@@ -86,8 +86,8 @@ G_BEGIN_DECLS
  *
  * Registers a signal in an instance.
  *
- * Returns: The signal ID local to that instance, or 0 if the signal
- *          couldn't be registered.
+ * Returns: The signal ID, as returned by purple_signal_get_id(), or 0 if
+ *          the signal couldn't be registered.
  */
 gulong purple_signal_register(void *instance, const char *signal,
 							PurpleSignalMarshalFunc marshal,
@@ -125,6 +125,36 @@ void purple_signal_get_types(void *instance, const char *signal,
 							GType *ret_type, int *num_values,
 							GType **param_types);
 
+/**
+ * purple_signal_get_id:
+ * @instance: The instance the signal is registered to.
+ * @signal:   The signal name.
+ *
+ * Returns the interned ID of a signal, for use with
+ * purple_signal_emit_by_id() and friends.
+ *
+ * The ID is unique across all instances and stays the same for the
+ * lifetime of the process, even if the signal is unregistered and later
+ * registered again, so it is safe to look it up once and cache it.  The
+ * signal does not need to be registered yet; emitting an ID with no
+ * registered signal behind it does nothing.
+ *
+ * Returns: The signal ID, or 0 on error.
+ */
+gulong purple_signal_get_id(void *instance, const char *signal);
+
+/**
+ * purple_signal_has_handlers_by_id:
+ * @signal_id: The signal ID, as returned by purple_signal_get_id().
+ *
+ * Checks whether any handlers are connected to a signal.  Emitters can use
+ * this to skip building expensive arguments for a signal nobody listens
+ * to.
+ *
+ * Returns: %TRUE if the signal is registered and has at least one handler.
+ */
+gboolean purple_signal_has_handlers_by_id(gulong signal_id);
+
 /**
  * purple_signal_connect_priority:
  * @instance: The instance to connect to.
@@ -267,6 +297,29 @@ void purple_signal_emit(void *instance, const char *signal, ...);
  */
 void purple_signal_emit_vargs(void *instance, const char *signal, va_list args);
 
+/**
+ * purple_signal_emit_by_id:
+ * @signal_id: The signal ID, as returned by purple_signal_get_id().
+ * @...:       The arguments to pass to the callbacks.
+ *
+ * Emits a signal by its interned ID.  This avoids the name lookups done by
+ * purple_signal_emit() and returns immediately if nothing is connected.
+ *
+ * See purple_signal_emit()
+ */
+void purple_signal_emit_by_id(gulong signal_id, ...);
+
+/**
+ * purple_signal_emit_vargs_by_id:
+ * @signal_id: The signal ID, as returned by purple_signal_get_id().
+ * @args:      The arguments list.
+ *
+ * Emits a signal by its interned ID, using a va_list of arguments.
+ *
+ * See purple_signal_emit_by_id()
+ */
+void purple_signal_emit_vargs_by_id(gulong signal_id, va_list args);
+
 /**
  * purple_signal_emit_return_1:
  * @instance: The instance emitting the signal.
@@ -298,6 +351,34 @@ void *purple_signal_emit_return_1(void *instance, const char *signal, ...);
 void *purple_signal_emit_vargs_return_1(void *instance, const char *signal,
 									  va_list args);
 
+/**
+ * purple_signal_emit_return_1_by_id:
+ * @signal_id: The signal ID, as returned by purple_signal_get_id().
+ * @...:       The arguments to pass to the callbacks.
+ *
+ * Emits a signal by its interned ID and returns the first non-NULL return
+ * value.
+ *
+ * See purple_signal_emit_return_1()
+ *
+ * Returns: The first non-NULL return value
+ */
+void *purple_signal_emit_return_1_by_id(gulong signal_id, ...);
+
+/**
+ * purple_signal_emit_vargs_return_1_by_id:
+ * @signal_id: The signal ID, as returned by purple_signal_get_id().
+ * @args:      The arguments list.
+ *
+ * Emits a signal by its interned ID, using a va_list of arguments, and
+ * returns the first non-NULL return value.
+ *
+ * See purple_signal_emit_return_1()
+ *
+ * Returns: The first non-NULL return value
+ */
+void *purple_signal_emit_vargs_return_1_by_id(gulong signal_id, va_list args);
+
 /**
  * purple_signals_init:
  *
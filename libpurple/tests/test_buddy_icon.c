@@ -0,0 +1,206 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+/* Enough of a PNG for the icon to get a .png filename */
+static const gchar test_buddy_icon_data[] = "\x89PNG\r\n\x1a\n" "buddy icon";
+
+static PurpleAccount *test_buddy_icon_account = NULL;
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+typedef struct {
+	GMainLoop *loop;
+	PurpleBuddyIcon *icon;
+	GError *error;
+} TestBuddyIconFind;
+
+static void
+test_buddy_icon_find_cb(GObject *source, GAsyncResult *res, gpointer data) {
+	TestBuddyIconFind *find = data;
+
+	find->icon = purple_buddy_icons_find_finish(res, &find->error);
+	g_main_loop_quit(find->loop);
+}
+
+static void
+test_buddy_icon_find(TestBuddyIconFind *find, const gchar *name,
+                     const gchar *change_to) {
+	PurpleBuddy *buddy = purple_blist_find_buddy(test_buddy_icon_account,
+	                                             name);
+
+	find->loop = g_main_loop_new(NULL, FALSE);
+	find->icon = NULL;
+	find->error = NULL;
+
+	purple_buddy_icons_find_async(test_buddy_icon_account, name, NULL,
+	                              test_buddy_icon_find_cb, find);
+
+	/* Set a new icon while the old one is still being read. */
+	if(change_to != NULL) {
+		purple_blist_node_set_string(PURPLE_BLIST_NODE(buddy), "buddy_icon",
+		                             change_to);
+	}
+
+	g_main_loop_run(find->loop);
+	g_main_loop_unref(find->loop);
+}
+
+static PurpleBuddy *
+test_buddy_icon_buddy_new(const gchar *name, const gchar *filename) {
+	PurpleBuddy *buddy = purple_buddy_new(test_buddy_icon_account, name,
+	                                      NULL);
+
+	purple_blist_add_buddy(buddy, NULL, NULL, NULL);
+	purple_blist_node_set_string(PURPLE_BLIST_NODE(buddy), "buddy_icon",
+	                             filename);
+
+	return buddy;
+}
+
+static gchar *
+test_buddy_icon_write(const gchar *filename) {
+	const gchar *dir = purple_buddy_icons_get_cache_dir();
+	gchar *path = g_build_filename(dir, filename, NULL);
+	GError *error = NULL;
+
+	g_mkdir_with_parents(dir, 0700);
+	g_file_set_contents(path, test_buddy_icon_data,
+	                    sizeof(test_buddy_icon_data) - 1, &error);
+	g_assert_no_error(error);
+
+	return path;
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_buddy_icon_find_async(void) {
+	TestBuddyIconFind find;
+	PurpleBuddy *buddy;
+	gconstpointer data;
+	gchar *path;
+	size_t len;
+
+	path = test_buddy_icon_write("test-buddy-icon-found.png");
+	buddy = test_buddy_icon_buddy_new("found", "test-buddy-icon-found.png");
+
+	test_buddy_icon_find(&find, "found", NULL);
+
+	g_assert_no_error(find.error);
+	g_assert_nonnull(find.icon);
+	data = purple_buddy_icon_get_data(find.icon, &len);
+	g_assert_cmpmem(data, len, test_buddy_icon_data,
+	                sizeof(test_buddy_icon_data) - 1);
+
+	/* It's the buddy's icon now, and found again without reading it. */
+	g_assert_true(purple_buddy_get_icon(buddy) == find.icon);
+	purple_buddy_icon_unref(find.icon);
+
+	test_buddy_icon_find(&find, "found", NULL);
+	g_assert_no_error(find.error);
+	g_assert_true(find.icon == purple_buddy_get_icon(buddy));
+	purple_buddy_icon_unref(find.icon);
+
+	purple_blist_remove_buddy(buddy);
+	g_unlink(path);
+	g_free(path);
+}
+
+static void
+test_buddy_icon_find_async_missing(void) {
+	TestBuddyIconFind find;
+	PurpleBuddy *buddy;
+
+	buddy = test_buddy_icon_buddy_new("missing",
+	                                  "test-buddy-icon-missing.png");
+
+	test_buddy_icon_find(&find, "missing", NULL);
+
+	g_assert_error(find.error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+	g_assert_null(find.icon);
+	g_clear_error(&find.error);
+
+	/* The setting pointed nowhere, so it's gone. */
+	g_assert_null(purple_blist_node_get_string(PURPLE_BLIST_NODE(buddy),
+	                                           "buddy_icon"));
+
+	purple_blist_remove_buddy(buddy);
+}
+
+static void
+test_buddy_icon_find_async_stale(void) {
+	TestBuddyIconFind find;
+	PurpleBuddy *buddy;
+	gchar *path;
+
+	path = test_buddy_icon_write("test-buddy-icon-stale.png");
+	buddy = test_buddy_icon_buddy_new("stale", "test-buddy-icon-stale.png");
+
+	test_buddy_icon_find(&find, "stale", "test-buddy-icon-newer.png");
+
+	g_assert_no_error(find.error);
+	g_assert_null(find.icon);
+	g_assert_null(purple_buddy_get_icon(buddy));
+
+	/* The newer icon is left alone. */
+	g_assert_cmpstr(purple_blist_node_get_string(PURPLE_BLIST_NODE(buddy),
+	                                             "buddy_icon"),
+	                ==, "test-buddy-icon-newer.png");
+
+	purple_blist_remove_buddy(buddy);
+	g_unlink(path);
+	g_free(path);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+	purple_blist_boot();
+
+	test_buddy_icon_account = purple_account_new("test-buddy-icon",
+	                                             "prpl-buddy-icon");
+	purple_accounts_add(test_buddy_icon_account);
+
+	g_test_add_func("/buddy-icon/find-async",
+	                test_buddy_icon_find_async);
+	g_test_add_func("/buddy-icon/find-async/missing",
+	                test_buddy_icon_find_async_missing);
+	g_test_add_func("/buddy-icon/find-async/stale",
+	                test_buddy_icon_find_async_stale);
+
+	return g_test_run();
+}
@@ -0,0 +1,229 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <purple.h>
+
+#include "test_ui.h"
+
+#define HISTORY_SIZE 3
+#define HISTORY_WRITTEN 8
+
+/******************************************************************************
+ * Protocol
+ *****************************************************************************/
+/* The connection the conversations need can't be freed without one. */
+static GType test_conversation_history_protocol_get_type(void);
+
+typedef struct {
+	PurpleProtocol parent;
+} TestConversationHistoryProtocol;
+
+typedef struct {
+	PurpleProtocolClass parent;
+} TestConversationHistoryProtocolClass;
+
+G_DEFINE_TYPE(TestConversationHistoryProtocol,
+              test_conversation_history_protocol, PURPLE_TYPE_PROTOCOL);
+
+static void
+test_conversation_history_protocol_init(TestConversationHistoryProtocol *prpl) {
+	PURPLE_PROTOCOL(prpl)->id = "prpl-history";
+}
+
+static void
+test_conversation_history_protocol_class_init(TestConversationHistoryProtocolClass *klass) {
+}
+
+static PurpleProtocol *test_conversation_history_protocol = NULL;
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static guint
+test_conversation_history_spill_files(void) {
+	gchar *path = g_build_filename(purple_cache_dir(), "history", NULL);
+	GDir *dir = g_dir_open(path, 0, NULL);
+	guint count = 0;
+
+	g_free(path);
+
+	if(dir == NULL) {
+		return 0;
+	}
+
+	while(g_dir_read_name(dir) != NULL) {
+		count++;
+	}
+
+	g_dir_close(dir);
+
+	return count;
+}
+
+static PurpleConversation *
+test_conversation_history_new(const gchar *username) {
+	PurpleAccount *account = purple_account_new(username, "prpl-history");
+
+	/* purple_im_conversation_new() needs the account to be connected. */
+	g_object_new(PURPLE_TYPE_CONNECTION,
+	             "account", account,
+	             "protocol", test_conversation_history_protocol,
+	             NULL);
+
+	return PURPLE_CONVERSATION(purple_im_conversation_new(account, "buddy"));
+}
+
+static void
+test_conversation_history_free(PurpleConversation *conv) {
+	PurpleAccount *account = purple_conversation_get_account(conv);
+	PurpleConnection *gc = purple_account_get_connection(account);
+
+	g_object_unref(conv);
+	g_object_unref(gc);
+	g_object_unref(account);
+}
+
+static void
+test_conversation_history_write(PurpleConversation *conv) {
+	gint i;
+
+	for(i = 0; i < HISTORY_WRITTEN; i++) {
+		gchar *contents = g_strdup_printf("message %d", i);
+
+		purple_conversation_write_system_message(conv, contents, 0);
+
+		g_free(contents);
+	}
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_conversation_history_capped(void) {
+	PurpleConversation *conv = NULL;
+	PurpleConversationHistoryIter iter;
+	PurpleMessage *msg = NULL;
+	guint files = test_conversation_history_spill_files();
+	gint count = 0;
+
+	purple_prefs_set_bool("/purple/conversations/message_history_spill", FALSE);
+
+	conv = test_conversation_history_new("history-capped");
+	test_conversation_history_write(conv);
+
+	g_assert_cmpuint(
+		g_list_length(purple_conversation_get_message_history(conv)),
+		==,
+		HISTORY_SIZE
+	);
+	g_assert_cmpuint(test_conversation_history_spill_files(), ==, files);
+
+	/* Without spilling only the newest messages are left. */
+	purple_conversation_history_iter_init(&iter, conv);
+	while(purple_conversation_history_iter_next(&iter, &msg)) {
+		gchar *expected = g_strdup_printf("message %d",
+		                                  HISTORY_WRITTEN - 1 - count);
+
+		g_assert_cmpstr(purple_message_get_contents(msg), ==, expected);
+
+		g_free(expected);
+		g_object_unref(msg);
+		count++;
+	}
+	g_assert_cmpint(count, ==, HISTORY_SIZE);
+
+	test_conversation_history_free(conv);
+}
+
+static void
+test_conversation_history_spilled(void) {
+	PurpleConversation *conv = NULL;
+	PurpleConversationHistoryIter iter;
+	PurpleMessage *msg = NULL;
+	guint files = test_conversation_history_spill_files();
+	gint count = 0;
+
+	purple_prefs_set_bool("/purple/conversations/message_history_spill", TRUE);
+
+	conv = test_conversation_history_new("history-spilled");
+	test_conversation_history_write(conv);
+
+	g_assert_cmpuint(
+		g_list_length(purple_conversation_get_message_history(conv)),
+		==,
+		HISTORY_SIZE
+	);
+	g_assert_cmpuint(test_conversation_history_spill_files(), ==, files + 1);
+
+	/* The spilled messages follow the in-memory ones, still newest first. */
+	purple_conversation_history_iter_init(&iter, conv);
+	while(purple_conversation_history_iter_next(&iter, &msg)) {
+		gchar *expected = g_strdup_printf("message %d",
+		                                  HISTORY_WRITTEN - 1 - count);
+
+		g_assert_cmpstr(purple_message_get_contents(msg), ==, expected);
+		g_assert_true(purple_message_get_flags(msg) & PURPLE_MESSAGE_SYSTEM);
+
+		g_free(expected);
+		g_object_unref(msg);
+		count++;
+	}
+	g_assert_cmpint(count, ==, HISTORY_WRITTEN);
+
+	/* Freeing the conversation removes its spill file. */
+	test_conversation_history_free(conv);
+	g_assert_cmpuint(test_conversation_history_spill_files(), ==, files);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	gint ret;
+
+	g_test_init(&argc, &argv, NULL);
+
+	test_ui_purple_init();
+
+	test_conversation_history_protocol =
+		g_object_new(test_conversation_history_protocol_get_type(), NULL);
+
+	purple_prefs_set_bool("/purple/logging/log_ims", FALSE);
+	purple_prefs_set_int("/purple/conversations/message_history_size",
+	                     HISTORY_SIZE);
+
+	g_test_add_func("/conversation/history/capped",
+	                test_conversation_history_capped);
+	g_test_add_func("/conversation/history/spilled",
+	                test_conversation_history_spilled);
+
+	ret = g_test_run();
+
+	g_object_unref(test_conversation_history_protocol);
+
+	return ret;
+}
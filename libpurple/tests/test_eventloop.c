@@ -0,0 +1,227 @@
+/*
+ * Purple
+ *
+ * Purple is the legal property of its developers, whose names are too
+ * numerous to list here. Please refer to the COPYRIGHT file distributed
+ * with this source distribution
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02111-1301 USA
+ */
+
+#include <glib.h>
+
+#include <eventloop.h>
+
+/******************************************************************************
+ * Helpers
+ *****************************************************************************/
+static GString *test_eventloop_fired = NULL;
+
+static gboolean
+test_eventloop_record_cb(gpointer data) {
+	g_string_append(test_eventloop_fired, data);
+
+	return FALSE;
+}
+
+static gboolean
+test_eventloop_quit_cb(gpointer data) {
+	g_main_loop_quit(data);
+
+	return FALSE;
+}
+
+static void
+test_eventloop_run(guint timeout) {
+	GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+
+	purple_timer_add(timeout, test_eventloop_quit_cb, loop);
+	g_main_loop_run(loop);
+	g_main_loop_unref(loop);
+}
+
+/******************************************************************************
+ * Tests
+ *****************************************************************************/
+static void
+test_eventloop_timeout_order(void) {
+	test_eventloop_fired = g_string_new(NULL);
+
+	purple_timer_add(300, test_eventloop_record_cb, "c");
+	purple_timer_add(100, test_eventloop_record_cb, "a");
+	purple_timer_add(200, test_eventloop_record_cb, "b");
+
+	test_eventloop_run(400);
+
+	g_assert_cmpstr(test_eventloop_fired->str, ==, "abc");
+
+	g_string_free(test_eventloop_fired, TRUE);
+}
+
+static void
+test_eventloop_timeout_remove(void) {
+	guint handle;
+
+	test_eventloop_fired = g_string_new(NULL);
+
+	handle = purple_timer_add(100, test_eventloop_record_cb, "a");
+	purple_timer_add(200, test_eventloop_record_cb, "b");
+	g_assert_true(purple_timer_remove(handle));
+	g_assert_false(purple_timer_remove(handle));
+
+	test_eventloop_run(300);
+
+	g_assert_cmpstr(test_eventloop_fired->str, ==, "b");
+
+	g_string_free(test_eventloop_fired, TRUE);
+}
+
+static guint test_eventloop_repeat_handle = 0;
+static gint test_eventloop_repeat_count = 0;
+
+static gboolean
+test_eventloop_repeat_cb(gpointer data) {
+	if (++test_eventloop_repeat_count == 3) {
+		/* Removing a timer from its own callback must be safe. */
+		g_assert_true(purple_timer_remove(test_eventloop_repeat_handle));
+	}
+
+	return TRUE;
+}
+
+static void
+test_eventloop_timeout_repeat(void) {
+	test_eventloop_repeat_count = 0;
+	test_eventloop_repeat_handle = purple_timer_add(100,
+			test_eventloop_repeat_cb, NULL);
+
+	test_eventloop_run(600);
+
+	g_assert_cmpint(test_eventloop_repeat_count, ==, 3);
+}
+
+typedef struct {
+	guint interval;
+	gint64 added;
+} TestEventloopDeadline;
+
+static gint test_eventloop_deadline_count = 0;
+
+static gboolean
+test_eventloop_deadline_cb(gpointer data) {
+	TestEventloopDeadline *deadline = data;
+	gint64 elapsed = g_get_monotonic_time() - deadline->added;
+
+	g_assert_cmpint(elapsed, >=, (gint64)deadline->interval * 1000);
+	test_eventloop_deadline_count++;
+
+	return FALSE;
+}
+
+/* Timers added part way through a tick must still wait their whole
+ * interval. */
+static void
+test_eventloop_timeout_not_early(void) {
+	TestEventloopDeadline deadlines[10];
+	guint i;
+
+	test_eventloop_deadline_count = 0;
+
+	for (i = 0; i < G_N_ELEMENTS(deadlines); i++) {
+		deadlines[i].interval = (i % 2) ? 150 : 100;
+		deadlines[i].added = g_get_monotonic_time();
+		purple_timer_add(deadlines[i].interval, test_eventloop_deadline_cb,
+				&deadlines[i]);
+
+		g_usleep(23 * 1000);
+	}
+
+	test_eventloop_run(300);
+
+	g_assert_cmpint(test_eventloop_deadline_count, ==, G_N_ELEMENTS(deadlines));
+}
+
+/* Many far-off timeouts, like the per-buddy and per-conversation ones a busy
+ * client accumulates, and the cost of a main loop iteration with them
+ * registered as separate GSources vs on the timer wheel. */
+#define TEST_EVENTLOOP_BENCHMARK_TIMERS 10000
+#define TEST_EVENTLOOP_BENCHMARK_ITERATIONS 1000
+
+static gboolean
+test_eventloop_benchmark_cb(gpointer data) {
+	return FALSE;
+}
+
+static gdouble
+test_eventloop_benchmark_iterate(void) {
+	gint i;
+
+	g_test_timer_start();
+	for (i = 0; i < TEST_EVENTLOOP_BENCHMARK_ITERATIONS; i++)
+		g_main_context_iteration(NULL, FALSE);
+
+	return g_test_timer_elapsed() / TEST_EVENTLOOP_BENCHMARK_ITERATIONS;
+}
+
+static void
+test_eventloop_benchmark(void) {
+	guint handles[TEST_EVENTLOOP_BENCHMARK_TIMERS];
+	gdouble elapsed;
+	gint i;
+
+	for (i = 0; i < TEST_EVENTLOOP_BENCHMARK_TIMERS; i++) {
+		handles[i] = g_timeout_add_seconds(3600 + i,
+				test_eventloop_benchmark_cb, NULL);
+	}
+	elapsed = test_eventloop_benchmark_iterate();
+	g_test_message("%d GSources: %.1f us per iteration",
+		TEST_EVENTLOOP_BENCHMARK_TIMERS, elapsed * G_USEC_PER_SEC);
+	for (i = 0; i < TEST_EVENTLOOP_BENCHMARK_TIMERS; i++)
+		g_source_remove(handles[i]);
+
+	for (i = 0; i < TEST_EVENTLOOP_BENCHMARK_TIMERS; i++) {
+		handles[i] = purple_timer_add_seconds(3600 + i,
+				test_eventloop_benchmark_cb, NULL);
+	}
+	elapsed = test_eventloop_benchmark_iterate();
+	g_test_minimized_result(elapsed, "%d wheel timers: %.1f us per iteration",
+		TEST_EVENTLOOP_BENCHMARK_TIMERS, elapsed * G_USEC_PER_SEC);
+	for (i = 0; i < TEST_EVENTLOOP_BENCHMARK_TIMERS; i++)
+		purple_timer_remove(handles[i]);
+}
+
+/******************************************************************************
+ * Main
+ *****************************************************************************/
+gint
+main(gint argc, gchar **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/eventloop/timeout/order",
+			test_eventloop_timeout_order);
+	g_test_add_func("/eventloop/timeout/remove",
+			test_eventloop_timeout_remove);
+	g_test_add_func("/eventloop/timeout/repeat",
+			test_eventloop_timeout_repeat);
+	g_test_add_func("/eventloop/timeout/not-early",
+			test_eventloop_timeout_not_early);
+
+	if (g_test_perf()) {
+		g_test_add_func("/eventloop/benchmark",
+				test_eventloop_benchmark);
+	}
+
+	return g_test_run();
+}
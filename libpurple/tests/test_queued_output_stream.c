@@ -126,6 +126,8 @@ test_queued_output_stream_push_bytes_async_multiple(void) {
 	PurpleQueuedOutputStream *queued;
 	GBytes *bytes;
 	gchar *all_test_bytes_data;
+	guint64 writes, bytes_written;
+	gsize max_write;
 	GError *err = NULL;
 	int done = 3;
 
@@ -169,6 +171,14 @@ test_queued_output_stream_push_bytes_async_multiple(void) {
 			g_memory_output_stream_get_data_size(output),
 			all_test_bytes_data, strlen(all_test_bytes_data));
 
+	/* The first push is written alone, the two queued behind it together */
+	purple_queued_output_stream_get_stats(queued, &writes, &bytes_written,
+			&max_write);
+	g_assert_cmpuint(writes, ==, 2);
+	g_assert_cmpuint(bytes_written, ==, strlen(all_test_bytes_data));
+	g_assert_cmpuint(max_write, ==,
+			test_bytes_data_len2 + test_bytes_data_len3);
+
 	g_free(all_test_bytes_data);
 
 	g_assert_true(g_output_stream_close(
@@ -21,6 +21,7 @@
  */
 
 #include <glib.h>
+#include <string.h>
 
 #include "../trie.h"
 
@@ -339,6 +340,159 @@ test_trie_multi_find(void) {
 	g_slist_free_full(tries, g_object_unref);
 }
 
+/* A smiley theme and a chat log, on which it's used. The log is made of
+ * a few typical lines repeated many times, so it's mostly plain text with
+ * occasional matches, which exercises skipping over unmatched text. */
+static const gchar *test_trie_log_smileys[] = {
+	":)", ":-)", ":(", ":-(", ";)", ";-)", ":D", ":-D", ":P", ":-P",
+	":p", ":-p", ":O", ":-O", ":*", ":-*", ":'(", ":|", ":-|", ":/",
+	":-/", ":$", ":-$", ":S", ":-S", "8)", "8-)", "B)", "B-)", "<3",
+	"</3", "(y)", "(n)", ">:(", ">:-(", "O:)", "O:-)", ":-@", "^_^",
+	"o_O", NULL
+};
+
+static const gchar *test_trie_log_lines[] = {
+	"(12:01:33) alice: hey, are you around? I have a question about "
+		"the release :)\n",
+	"(12:01:58) bob: sure, what's up?\n",
+	"(12:02:14) alice: the build broke on the 32-bit machines again, "
+		"do you know who changed the configure checks last week?\n",
+	"(12:03:40) bob: no idea, let me check the history... give me a "
+		"minute\n",
+	"(12:05:02) bob: found it, it was the patch for the new libxml2 "
+		"detection, I'll revert it for now ;)\n",
+	"(12:05:19) alice: thanks a lot <3\n",
+	"(12:06:45) carol has joined the room\n",
+	"(12:07:01) carol: hi all, did anybody see my message on the "
+		"mailing list about the translations?\n",
+	NULL
+};
+
+#define TEST_TRIE_LOG_SIZE (64 * 1024)
+#define TEST_TRIE_BENCHMARK_ITERATIONS 200
+
+/* A reference for the match count: a number of positions, at which any of
+ * the words ends. That's what purple_trie_find returns without a callback
+ * and with reset-on-match disabled. */
+static gulong
+test_trie_log_naive_find(const gchar *text)
+{
+	gulong found = 0;
+	gsize i, len = strlen(text);
+
+	for (i = 1; i <= len; i++) {
+		gint w;
+
+		for (w = 0; test_trie_log_smileys[w] != NULL; w++) {
+			const gchar *word = test_trie_log_smileys[w];
+			gsize word_len = strlen(word);
+
+			if (word_len <= i &&
+				memcmp(text + i - word_len, word, word_len) == 0)
+			{
+				found++;
+				break;
+			}
+		}
+	}
+
+	return found;
+}
+
+static PurpleTrie *
+test_trie_log_trie_new(void)
+{
+	PurpleTrie *trie;
+	gint i;
+
+	trie = purple_trie_new();
+	purple_trie_set_reset_on_match(trie, FALSE);
+	for (i = 0; test_trie_log_smileys[i] != NULL; i++) {
+		purple_trie_add(trie, test_trie_log_smileys[i],
+			GINT_TO_POINTER(i + 1));
+	}
+
+	return trie;
+}
+
+static GString *
+test_trie_log_new(void)
+{
+	GString *log;
+	gsize line = 0;
+
+	log = g_string_sized_new(TEST_TRIE_LOG_SIZE);
+	while (log->len < TEST_TRIE_LOG_SIZE) {
+		if (test_trie_log_lines[line] == NULL)
+			line = 0;
+		g_string_append(log, test_trie_log_lines[line++]);
+	}
+
+	return log;
+}
+
+static void
+test_trie_find_log(void) {
+	PurpleTrie *trie = test_trie_log_trie_new();
+	GString *log = test_trie_log_new();
+
+	g_assert_cmpuint(test_trie_log_naive_find(log->str), ==,
+		purple_trie_find(trie, log->str, NULL, NULL));
+
+	g_string_free(log, TRUE);
+	g_object_unref(trie);
+}
+
+static gboolean
+test_trie_benchmark_replace_cb(GString *out, const gchar *word,
+	gpointer word_data, gpointer user_data)
+{
+	g_string_append_printf(out, "<img id=\"%d\">",
+		GPOINTER_TO_INT(word_data));
+
+	return TRUE;
+}
+
+static void
+test_trie_benchmark(void) {
+	PurpleTrie *trie = test_trie_log_trie_new();
+	GString *log = test_trie_log_new();
+	gdouble mb = (gdouble)log->len * TEST_TRIE_BENCHMARK_ITERATIONS /
+		(1024 * 1024);
+	gdouble elapsed;
+	gulong found = 0;
+	gint i;
+
+	g_test_timer_start();
+	for (i = 0; i < TEST_TRIE_BENCHMARK_ITERATIONS; i++)
+		found += test_trie_log_naive_find(log->str);
+	elapsed = g_test_timer_elapsed();
+	g_test_message("naive find: %.1f MB/s", mb / elapsed);
+
+	/* Compiles the trie, which isn't what's being measured. */
+	g_assert_cmpuint(purple_trie_find(trie, log->str, NULL, NULL) *
+		TEST_TRIE_BENCHMARK_ITERATIONS, ==, found);
+
+	g_test_timer_start();
+	for (i = 0; i < TEST_TRIE_BENCHMARK_ITERATIONS; i++)
+		purple_trie_find(trie, log->str, NULL, NULL);
+	elapsed = g_test_timer_elapsed();
+	g_test_maximized_result(mb / elapsed, "trie find: %.1f MB/s",
+		mb / elapsed);
+
+	g_test_timer_start();
+	for (i = 0; i < TEST_TRIE_BENCHMARK_ITERATIONS; i++) {
+		g_free(purple_trie_replace(trie, log->str,
+			test_trie_benchmark_replace_cb, NULL));
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_maximized_result(mb / elapsed, "trie replace: %.1f MB/s",
+		mb / elapsed);
+
+	g_string_free(log, TRUE);
+	g_object_unref(trie);
+}
+
 gint
 main(gint argc, gchar **argv) {
 	g_test_init(&argc, &argv, NULL);
@@ -364,9 +518,16 @@ main(gint argc, gchar **argv) {
 	                test_trie_find_reset);
 	g_test_add_func("/trie/find/noreset",
 	                test_trie_find_noreset);
+	g_test_add_func("/trie/find/log",
+	                test_trie_find_log);
 
 	g_test_add_func("/trie/multi_find",
 	                test_trie_multi_find);
 
+	if (g_test_perf()) {
+		g_test_add_func("/trie/benchmark",
+		                test_trie_benchmark);
+	}
+
 	return g_test_run();
 }
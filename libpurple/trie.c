@@ -23,6 +23,9 @@
 #include "trie.h"
 
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "debug.h"
 #include "memorypool.h"
@@ -39,9 +42,17 @@
 #define PURPLE_TRIE_STATES_SMALL_POOL_BLOCK_SIZE 10880
 #define PURPLE_TRIE_STATES_LARGE_POOL_BLOCK_SIZE 102400
 
+/* The initial state of a compiled automaton. */
+#define PURPLE_TRIE_ROOT 0
+
+/* Up to that many distinct leading bytes are looked for with vector
+ * compares, tries with more of them fall back to a lookup table. */
+#define PURPLE_TRIE_SIMD_MAX_FIRST_BYTES 16
+
 typedef struct _PurpleTrieRecord PurpleTrieRecord;
 typedef struct _PurpleTrieState PurpleTrieState;
 typedef struct _PurpleTrieRecordList PurpleTrieRecordList;
+typedef struct _PurpleTrieDfa PurpleTrieDfa;
 
 /**
  * PurpleTrie:
@@ -64,7 +75,7 @@ typedef struct
 	gsize records_total_size;
 
 	PurpleMemoryPool *states_mempool;
-	PurpleTrieState *root_state;
+	PurpleTrieDfa *dfa;
 } PurpleTriePrivate;
 
 struct _PurpleTrieRecord
@@ -91,13 +102,40 @@ struct _PurpleTrieState
 	PurpleTrieState *longest_suffix;
 
 	PurpleTrieRecord *found_word;
+
+	guint32 id;
+};
+
+/* The compiled form of a trie, which is used for searching.
+ *
+ * States are numbered in the breadth-first order and every transition
+ * (including these, which followed longest_suffix links) is resolved
+ * during the compilation, so advancing is a single table lookup. Bytes,
+ * that doesn't occur in any word, share the class 0, which keeps the
+ * transitions table narrow.
+ */
+struct _PurpleTrieDfa
+{
+	guint32 states_count;
+	guint classes_count;
+	guint8 byte_class[256];
+
+	/* guint32 transitions[states_count][classes_count] */
+	guint32 *transitions;
+	PurpleTrieRecord **found_words;
+
+	/* Bytes, that may start a word - everything else is skipped while
+	 * the automaton stays in its initial state. */
+	gboolean first_byte[256];
+	guint first_bytes_count;
+	guchar first_bytes[PURPLE_TRIE_SIMD_MAX_FIRST_BYTES];
 };
 
 typedef struct
 {
-	PurpleTrieState *state;
+	const PurpleTrieDfa *dfa;
+	guint32 state;
 
-	PurpleTrieState *root_state;
 	gboolean reset_on_match;
 
 	PurpleTrieReplaceCb replace_cb;
@@ -202,13 +240,22 @@ purple_record_list_remove(PurpleTrieRecordList *head,
  * States management
  ******************************************************************************/
 
+static void
+purple_trie_dfa_free(PurpleTrieDfa *dfa)
+{
+	if (dfa == NULL)
+		return;
+
+	g_free(dfa->transitions);
+	g_free(dfa->found_words);
+	g_free(dfa);
+}
+
 static void
 purple_trie_states_cleanup(PurpleTriePrivate *priv)
 {
-	if (priv->root_state != NULL) {
-		purple_memory_pool_cleanup(priv->states_mempool);
-		priv->root_state = NULL;
-	}
+	purple_trie_dfa_free(priv->dfa);
+	priv->dfa = NULL;
 }
 
 /* Allocates a state and binds it to the parent. */
@@ -245,6 +292,100 @@ purple_trie_state_new(PurpleTriePrivate *priv, PurpleTrieState *parent,
 	return state;
 }
 
+/* Turns the trie into a PurpleTrieDfa in a single breadth-first pass. */
+static PurpleTrieDfa *
+purple_trie_dfa_compile(PurpleTriePrivate *priv, PurpleTrieState *root)
+{
+	PurpleTrieDfa *dfa;
+	PurpleTrieRecordList *it;
+	GPtrArray *queue;
+	guchar class_byte[256];
+	guint32 i;
+	guint c;
+
+	dfa = g_new0(PurpleTrieDfa, 1);
+
+	/* Every byte used within any word gets its own class. */
+	dfa->classes_count = 1;
+	for (it = priv->records; it != NULL; it = it->next) {
+		const guchar *word = (const guchar *)it->rec->word;
+
+		dfa->first_byte[word[0]] = TRUE;
+		for (; *word != '\0'; word++) {
+			if (dfa->byte_class[*word] != 0)
+				continue;
+			class_byte[dfa->classes_count] = *word;
+			dfa->byte_class[*word] = dfa->classes_count++;
+		}
+	}
+	class_byte[0] = '\0';
+
+	for (c = 0; c < 256; c++) {
+		if (!dfa->first_byte[c])
+			continue;
+		if (dfa->first_bytes_count < PURPLE_TRIE_SIMD_MAX_FIRST_BYTES)
+			dfa->first_bytes[dfa->first_bytes_count] = c;
+		dfa->first_bytes_count++;
+	}
+
+	/* Number the states. Longest suffix of a state is always closer to
+	 * the root, than the state itself, so its row is filled in before. */
+	queue = g_ptr_array_new();
+	root->id = PURPLE_TRIE_ROOT;
+	g_ptr_array_add(queue, root);
+	for (i = 0; i < queue->len; i++) {
+		PurpleTrieState *state = g_ptr_array_index(queue, i);
+
+		if (state->children == NULL)
+			continue;
+		for (c = 1; c < dfa->classes_count; c++) {
+			PurpleTrieState *child = state->children[class_byte[c]];
+
+			if (child == NULL)
+				continue;
+			child->id = queue->len;
+			g_ptr_array_add(queue, child);
+		}
+	}
+
+	dfa->states_count = queue->len;
+	dfa->transitions = g_new(guint32,
+		(gsize)dfa->states_count * dfa->classes_count);
+	dfa->found_words = g_new(PurpleTrieRecord *, dfa->states_count);
+
+	for (i = 0; i < dfa->states_count; i++) {
+		PurpleTrieState *state = g_ptr_array_index(queue, i);
+		guint32 *row = dfa->transitions + (gsize)i * dfa->classes_count;
+		const guint32 *suffix_row = NULL;
+
+		if (i != PURPLE_TRIE_ROOT) {
+			suffix_row = dfa->transitions + (gsize)state->
+				longest_suffix->id * dfa->classes_count;
+		}
+
+		row[0] = suffix_row ? suffix_row[0] : PURPLE_TRIE_ROOT;
+		for (c = 1; c < dfa->classes_count; c++) {
+			PurpleTrieState *child = NULL;
+
+			if (state->children)
+				child = state->children[class_byte[c]];
+
+			if (child)
+				row[c] = child->id;
+			else if (suffix_row)
+				row[c] = suffix_row[c];
+			else
+				row[c] = PURPLE_TRIE_ROOT;
+		}
+
+		dfa->found_words[i] = state->found_word;
+	}
+
+	g_ptr_array_free(queue, TRUE);
+
+	return dfa;
+}
+
 static gboolean
 purple_trie_states_build(PurpleTriePrivate *priv)
 {
@@ -253,7 +394,7 @@ purple_trie_states_build(PurpleTriePrivate *priv)
 	PurpleTrieRecordList *reclist, *it;
 	gulong cur_len;
 
-	if (priv->root_state != NULL)
+	if (priv->dfa != NULL)
 		return TRUE;
 
 	if (priv->records_total_size < PURPLE_TRIE_LARGE_THRESHOLD) {
@@ -264,7 +405,7 @@ purple_trie_states_build(PurpleTriePrivate *priv)
 			PURPLE_TRIE_STATES_LARGE_POOL_BLOCK_SIZE);
 	}
 
-	priv->root_state = root = purple_trie_state_new(priv, NULL, '\0');
+	root = purple_trie_state_new(priv, NULL, '\0');
 	g_return_val_if_fail(root != NULL, FALSE);
 	g_assert(root->longest_suffix == NULL);
 
@@ -302,6 +443,8 @@ purple_trie_states_build(PurpleTriePrivate *priv)
 				if (!prefix) {
 					g_warn_if_reached();
 					g_object_unref(reclist_mpool);
+					purple_memory_pool_cleanup(
+						priv->states_mempool);
 					return FALSE;
 				}
 			}
@@ -351,6 +494,11 @@ purple_trie_states_build(PurpleTriePrivate *priv)
 
 	g_object_unref(reclist_mpool);
 
+	/* The pointer-based trie is needed only to compute longest suffixes,
+	 * searching is done on its compiled form. */
+	priv->dfa = purple_trie_dfa_compile(priv, root);
+	purple_memory_pool_cleanup(priv->states_mempool);
+
 	return TRUE;
 }
 
@@ -358,44 +506,82 @@ purple_trie_states_build(PurpleTriePrivate *priv)
  * Searching
  ******************************************************************************/
 
-static void
+static inline void
 purple_trie_advance(PurpleTrieMachine *m, const guchar character)
 {
-	/* change state after processing a character */
-	while (TRUE) {
-		/* Perfect fit - next character is the same, as the child of the
-		 * prefix we reached so far. */
-		if (m->state->children && m->state->children[character]) {
-			m->state = m->state->children[character];
-			break;
-		}
+	const PurpleTrieDfa *dfa = m->dfa;
 
-		/* We reached root, that's a pity. */
-		if (m->state == m->root_state)
-			break;
+	m->state = dfa->transitions[(gsize)m->state * dfa->classes_count +
+		dfa->byte_class[character]];
+}
+
+/* Returns the position of the first byte at or after pos, that is set in
+ * the first_byte table, or len if there is no such byte. */
+static inline gsize
+purple_trie_skip_table(const gboolean *first_byte, const guchar *src,
+	gsize pos, gsize len)
+{
+	while (pos < len && !first_byte[src[pos]])
+		pos++;
 
-		/* Let's try a bit shorter suffix. */
-		m->state = m->state->longest_suffix;
+	return pos;
+}
+
+/* Skips the part of src, where no word could start. */
+static gsize
+purple_trie_skip(const PurpleTrieDfa *dfa, const guchar *src, gsize pos,
+	gsize len)
+{
+#ifdef __SSE2__
+	if (dfa->first_bytes_count <= PURPLE_TRIE_SIMD_MAX_FIRST_BYTES) {
+		__m128i needles[PURPLE_TRIE_SIMD_MAX_FIRST_BYTES];
+		guint i;
+
+		if (dfa->first_bytes_count == 0)
+			return len;
+
+		for (i = 0; i < dfa->first_bytes_count; i++)
+			needles[i] = _mm_set1_epi8((gchar)dfa->first_bytes[i]);
+
+		for (; pos + 16 <= len; pos += 16) {
+			__m128i block, hits;
+			gint mask;
+
+			block = _mm_loadu_si128((const __m128i *)(src + pos));
+			hits = _mm_cmpeq_epi8(block, needles[0]);
+			for (i = 1; i < dfa->first_bytes_count; i++) {
+				hits = _mm_or_si128(hits,
+					_mm_cmpeq_epi8(block, needles[i]));
+			}
+
+			mask = _mm_movemask_epi8(hits);
+			if (mask != 0)
+				return pos + g_bit_nth_lsf(mask, -1);
+		}
 	}
+#endif
+
+	return purple_trie_skip_table(dfa->first_byte, src, pos, len);
 }
 
 static gboolean
 purple_trie_replace_do_replacement(PurpleTrieMachine *m, GString *out)
 {
+	PurpleTrieRecord *found_word = m->dfa->found_words[m->state];
 	gboolean was_replaced = FALSE;
 	gsize str_old_len;
 
 	/* if we reached a "found" state, let's process it */
-	if (!m->state->found_word)
+	if (!found_word)
 		return FALSE;
 
 	/* let's get back to the beginning of the word */
-	g_assert(out->len >= m->state->found_word->word_len - 1);
+	g_assert(out->len >= found_word->word_len - 1);
 	str_old_len = out->len;
-	out->len -= m->state->found_word->word_len - 1;
+	out->len -= found_word->word_len - 1;
 
-	was_replaced = m->replace_cb(out, m->state->found_word->word,
-		m->state->found_word->data, m->user_data);
+	was_replaced = m->replace_cb(out, found_word->word,
+		found_word->data, m->user_data);
 
 	/* output was untouched, revert to the previous position */
 	if (!was_replaced)
@@ -403,7 +589,7 @@ purple_trie_replace_do_replacement(PurpleTrieMachine *m, GString *out)
 
 	/* XXX */
 	if (was_replaced || m->reset_on_match)
-		m->state = m->root_state;
+		m->state = PURPLE_TRIE_ROOT;
 
 	return was_replaced;
 }
@@ -411,25 +597,53 @@ purple_trie_replace_do_replacement(PurpleTrieMachine *m, GString *out)
 static gboolean
 purple_trie_find_do_discovery(PurpleTrieMachine *m)
 {
+	PurpleTrieRecord *found_word = m->dfa->found_words[m->state];
 	gboolean was_accepted;
 
 	/* if we reached a "found" state, let's process it */
-	if (!m->state->found_word)
+	if (!found_word)
 		return FALSE;
 
 	if (m->find_cb) {
-		was_accepted = m->find_cb(m->state->found_word->word,
-			m->state->found_word->data, m->user_data);
+		was_accepted = m->find_cb(found_word->word,
+			found_word->data, m->user_data);
 	} else {
 		was_accepted = TRUE;
 	}
 
 	if (was_accepted && m->reset_on_match)
-		m->state = m->root_state;
+		m->state = PURPLE_TRIE_ROOT;
 
 	return was_accepted;
 }
 
+/* Merges first_byte tables of all machines. */
+static void
+purple_trie_multi_first_bytes(const PurpleTrieMachine *machines, guint count,
+	gboolean *first_byte)
+{
+	guint m_idx, c;
+
+	memset(first_byte, 0, 256 * sizeof(gboolean));
+	for (m_idx = 0; m_idx < count; m_idx++) {
+		for (c = 0; c < 256; c++)
+			first_byte[c] |= machines[m_idx].dfa->first_byte[c];
+	}
+}
+
+static inline gboolean
+purple_trie_machines_at_root(const PurpleTrieMachine *machines, guint count)
+{
+	guint m_idx;
+
+	for (m_idx = 0; m_idx < count; m_idx++) {
+		if (machines[m_idx].state != PURPLE_TRIE_ROOT)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 gchar *
 purple_trie_replace(PurpleTrie *trie, const gchar *src,
 	PurpleTrieReplaceCb replace_cb, gpointer user_data)
@@ -437,7 +651,7 @@ purple_trie_replace(PurpleTrie *trie, const gchar *src,
 	PurpleTriePrivate *priv = NULL;
 	PurpleTrieMachine machine;
 	GString *out;
-	gsize i;
+	gsize i, len;
 
 	if (src == NULL)
 		return NULL;
@@ -447,20 +661,36 @@ purple_trie_replace(PurpleTrie *trie, const gchar *src,
 
 	priv = purple_trie_get_instance_private(trie);
 
-	purple_trie_states_build(priv);
+	if (!purple_trie_states_build(priv))
+		return g_strdup(src);
 
-	machine.state = priv->root_state;
-	machine.root_state = priv->root_state;
+	machine.dfa = priv->dfa;
+	machine.state = PURPLE_TRIE_ROOT;
 	machine.reset_on_match = priv->reset_on_match;
 	machine.replace_cb = replace_cb;
 	machine.user_data = user_data;
 
-	out = g_string_new(NULL);
+	len = strlen(src);
+	out = g_string_sized_new(len);
 	i = 0;
-	while (src[i] != '\0') {
-		guchar character = src[i++];
+	while (i < len) {
+		guchar character;
 		gboolean was_replaced;
 
+		/* Nothing is matched so far - copy everything up to the next
+		 * byte, that may start a word, at once. */
+		if (machine.state == PURPLE_TRIE_ROOT) {
+			gsize next = purple_trie_skip(machine.dfa,
+				(const guchar *)src, i, len);
+
+			g_string_append_len(out, src + i, next - i);
+			i = next;
+			if (i == len)
+				break;
+		}
+
+		character = src[i++];
+
 		purple_trie_advance(&machine, character);
 		was_replaced = purple_trie_replace_do_replacement(&machine, out);
 
@@ -479,8 +709,9 @@ purple_trie_multi_replace(const GSList *tries, const gchar *src,
 {
 	guint tries_count, m_idx;
 	PurpleTrieMachine *machines;
+	gboolean first_byte[256];
 	GString *out;
-	gsize i;
+	gsize i, len;
 
 	if (src == NULL)
 		return NULL;
@@ -505,21 +736,39 @@ purple_trie_multi_replace(const GSList *tries, const gchar *src,
 
 		priv = purple_trie_get_instance_private(trie);
 
-		purple_trie_states_build(priv);
+		if (!purple_trie_states_build(priv)) {
+			g_free(machines);
+			return g_strdup(src);
+		}
 
-		machines[i].state = priv->root_state;
-		machines[i].root_state = priv->root_state;
+		machines[i].dfa = priv->dfa;
+		machines[i].state = PURPLE_TRIE_ROOT;
 		machines[i].reset_on_match = priv->reset_on_match;
 		machines[i].replace_cb = replace_cb;
 		machines[i].user_data = user_data;
 	}
 
-	out = g_string_new(NULL);
+	purple_trie_multi_first_bytes(machines, tries_count, first_byte);
+
+	len = strlen(src);
+	out = g_string_sized_new(len);
 	i = 0;
-	while (src[i] != '\0') {
-		guchar character = src[i++];
+	while (i < len) {
+		guchar character;
 		gboolean was_replaced = FALSE;
 
+		if (purple_trie_machines_at_root(machines, tries_count)) {
+			gsize next = purple_trie_skip_table(first_byte,
+				(const guchar *)src, i, len);
+
+			g_string_append_len(out, src + i, next - i);
+			i = next;
+			if (i == len)
+				break;
+		}
+
+		character = src[i++];
+
 		/* Advance every machine and possibly perform a replacement. */
 		for (m_idx = 0; m_idx < tries_count; m_idx++) {
 			purple_trie_advance(&machines[m_idx], character);
@@ -536,10 +785,8 @@ purple_trie_multi_replace(const GSList *tries, const gchar *src,
 
 		/* If we replaced a word, reset _all_ machines */
 		if (was_replaced) {
-			for (m_idx = 0; m_idx < tries_count; m_idx++) {
-				machines[m_idx].state =
-					machines[m_idx].root_state;
-			}
+			for (m_idx = 0; m_idx < tries_count; m_idx++)
+				machines[m_idx].state = PURPLE_TRIE_ROOT;
 		}
 	}
 
@@ -554,7 +801,7 @@ purple_trie_find(PurpleTrie *trie, const gchar *src,
 	PurpleTriePrivate *priv = NULL;
 	PurpleTrieMachine machine;
 	gulong found_count = 0;
-	gsize i;
+	gsize i, len;
 
 	if (src == NULL)
 		return 0;
@@ -563,19 +810,30 @@ purple_trie_find(PurpleTrie *trie, const gchar *src,
 
 	priv = purple_trie_get_instance_private(trie);
 
-	purple_trie_states_build(priv);
+	if (!purple_trie_states_build(priv))
+		return 0;
 
-	machine.state = priv->root_state;
-	machine.root_state = priv->root_state;
+	machine.dfa = priv->dfa;
+	machine.state = PURPLE_TRIE_ROOT;
 	machine.reset_on_match = priv->reset_on_match;
 	machine.find_cb = find_cb;
 	machine.user_data = user_data;
 
+	len = strlen(src);
 	i = 0;
-	while (src[i] != '\0') {
-		guchar character = src[i++];
+	while (i < len) {
+		guchar character;
 		gboolean was_found;
 
+		if (machine.state == PURPLE_TRIE_ROOT) {
+			i = purple_trie_skip(machine.dfa,
+				(const guchar *)src, i, len);
+			if (i == len)
+				break;
+		}
+
+		character = src[i++];
+
 		purple_trie_advance(&machine, character);
 
 		was_found = purple_trie_find_do_discovery(&machine);
@@ -593,8 +851,9 @@ purple_trie_multi_find(const GSList *tries, const gchar *src,
 {
 	guint tries_count, m_idx;
 	PurpleTrieMachine *machines;
+	gboolean first_byte[256];
 	gulong found_count = 0;
-	gsize i;
+	gsize i, len;
 
 	if (src == NULL)
 		return 0;
@@ -617,20 +876,35 @@ purple_trie_multi_find(const GSList *tries, const gchar *src,
 
 		priv = purple_trie_get_instance_private(trie);
 
-		purple_trie_states_build(priv);
+		if (!purple_trie_states_build(priv)) {
+			g_free(machines);
+			return 0;
+		}
 
-		machines[i].state = priv->root_state;
-		machines[i].root_state = priv->root_state;
+		machines[i].dfa = priv->dfa;
+		machines[i].state = PURPLE_TRIE_ROOT;
 		machines[i].reset_on_match = priv->reset_on_match;
 		machines[i].find_cb = find_cb;
 		machines[i].user_data = user_data;
 	}
 
+	purple_trie_multi_first_bytes(machines, tries_count, first_byte);
+
+	len = strlen(src);
 	i = 0;
-	while (src[i] != '\0') {
-		guchar character = src[i++];
+	while (i < len) {
+		guchar character;
 		gboolean was_found = FALSE;
 
+		if (purple_trie_machines_at_root(machines, tries_count)) {
+			i = purple_trie_skip_table(first_byte,
+				(const guchar *)src, i, len);
+			if (i == len)
+				break;
+		}
+
+		character = src[i++];
+
 		/* Advance every machine and possibly perform a replacement. */
 		for (m_idx = 0; m_idx < tries_count; m_idx++) {
 			purple_trie_advance(&machines[m_idx], character);
@@ -647,8 +921,7 @@ purple_trie_multi_find(const GSList *tries, const gchar *src,
 			for (m_idx = 0; m_idx < tries_count; m_idx++) {
 				if (!machines[m_idx].reset_on_match)
 					continue;
-				machines[m_idx].state =
-					machines[m_idx].root_state;
+				machines[m_idx].state = PURPLE_TRIE_ROOT;
 			}
 		}
 	}
@@ -796,6 +1069,7 @@ purple_trie_finalize(GObject *obj)
 	PurpleTriePrivate *priv =
 			purple_trie_get_instance_private(PURPLE_TRIE(obj));
 
+	purple_trie_states_cleanup(priv);
 	g_hash_table_destroy(priv->records_map);
 	g_object_unref(priv->records_obj_mempool);
 	g_object_unref(priv->records_str_mempool);
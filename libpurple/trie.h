@@ -41,9 +41,11 @@
  * a trie and is always <literal>O(n)</literal>, where <literal>n</literal> is
  * the size of a text.
  *
- * Its main drawback is a significant memory usage - every internal trie node
- * needs about 1kB of memory on 32-bit machine and 2kB on 64-bit. Fortunately,
- * the trie grows slower when more words (with common prefixes) are added.
+ * Before the first search after a modification, the trie is compiled into
+ * a dense transition table, indexed by state and by a class of the input
+ * byte (all bytes, that don't occur in any phrase, share a single class).
+ * While no phrase is partially matched, parts of the text, that can't start
+ * any phrase, are skipped at once (using SSE2, if available).
  * We could avoid invalidating the whole tree when altering it, but it would
  * require figuring out, how to update <literal>longest_suffix</literal> fields
  * in satisfying time.
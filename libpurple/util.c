@@ -58,6 +58,9 @@ purple_util_uninit(void)
 
 	g_free(data_dir);
 	data_dir = NULL;
+
+	normalize_cache_free(normalize_cache_no_account);
+	normalize_cache_no_account = NULL;
 }
 
 /**************************************************************************
@@ -2323,6 +2326,41 @@ purple_util_write_data_to_file_absolute(const char *filename_full, const char *d
 	return TRUE;
 }
 
+gboolean
+_purple_util_write_file(const char *filename_full, const char *data,
+                        gssize size, GError **error)
+{
+	GFile *file;
+	gchar *dir;
+	gboolean ret;
+
+	g_return_val_if_fail(filename_full != NULL, FALSE);
+	g_return_val_if_fail(size >= -1, FALSE);
+
+	if (size == -1) {
+		size = strlen(data);
+	}
+
+	dir = g_path_get_dirname(filename_full);
+	if (g_mkdir_with_parents(dir, S_IRUSR | S_IWUSR | S_IXUSR) == -1) {
+		int errsv = errno;
+
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+				"Error creating directory %s: %s", dir,
+				g_strerror(errsv));
+		g_free(dir);
+		return FALSE;
+	}
+	g_free(dir);
+
+	file = g_file_new_for_path(filename_full);
+	ret = g_file_replace_contents(file, data, size, NULL, FALSE,
+			G_FILE_CREATE_PRIVATE, NULL, NULL, error);
+	g_object_unref(file);
+
+	return ret;
+}
+
 PurpleXmlNode *
 purple_util_read_xml_from_file(const char *filename, const char *description)
 {
@@ -2578,14 +2616,75 @@ purple_socket_speaks_ipv4(int fd)
 /**************************************************************************
  * String Functions
  **************************************************************************/
-const char *
-purple_normalize(PurpleAccount *account, const char *str)
+
+/*
+ * Protocol normalizers return static buffers, so every normalization goes
+ * through this lock.  It is recursive in case a normalizer calls back into
+ * purple_normalize().
+ */
+static GRecMutex normalize_lock;
+
+/*
+ * Interned normalized names for one account.  Both the names as passed in
+ * and their normalized forms live in the string chunk, and are only freed
+ * with the account.  If the account's protocol changes, the old cache is
+ * kept in stale so pointers handed out earlier stay valid.
+ */
+typedef struct _PurpleNormalizeCache PurpleNormalizeCache;
+struct _PurpleNormalizeCache {
+	char *protocol_id;
+	GStringChunk *chunk;
+	GHashTable *names;              /* name => interned normalized name */
+	PurpleNormalizeCache *stale;
+};
+
+static PurpleNormalizeCache *normalize_cache_no_account = NULL;
+
+static GQuark
+normalize_cache_quark(void)
+{
+	return g_quark_from_static_string("purple-normalize-cache");
+}
+
+static PurpleNormalizeCache *
+normalize_cache_new(const char *protocol_id)
+{
+	PurpleNormalizeCache *cache = g_new0(PurpleNormalizeCache, 1);
+
+	cache->protocol_id = g_strdup(protocol_id);
+	cache->chunk = g_string_chunk_new(1024);
+	cache->names = g_hash_table_new(g_str_hash, g_str_equal);
+
+	return cache;
+}
+
+static void
+normalize_cache_free(PurpleNormalizeCache *cache)
+{
+	while (cache != NULL) {
+		PurpleNormalizeCache *stale = cache->stale;
+
+		g_free(cache->protocol_id);
+		g_hash_table_destroy(cache->names);
+		g_string_chunk_free(cache->chunk);
+		g_free(cache);
+
+		cache = stale;
+	}
+}
+
+gsize
+purple_normalize_to_buffer(PurpleAccount *account, const char *str,
+		char *buf, gsize size)
 {
 	const char *ret = NULL;
-	static char buf[BUF_LEN];
+	const char *p;
+	gsize len;
 
-	/* This should prevent a crash if purple_normalize gets called with NULL str, see #10115 */
-	g_return_val_if_fail(str != NULL, "");
+	g_return_val_if_fail(str != NULL, 0);
+	g_return_val_if_fail(buf != NULL, 0);
+
+	g_rec_mutex_lock(&normalize_lock);
 
 	if (account != NULL)
 	{
@@ -2596,17 +2695,97 @@ purple_normalize(PurpleAccount *account, const char *str)
 			ret = purple_protocol_client_iface_normalize(protocol, account, str);
 	}
 
-	if (ret == NULL)
-	{
-		char *tmp;
+	if (ret != NULL) {
+		len = g_strlcpy(buf, ret, size);
+		g_rec_mutex_unlock(&normalize_lock);
+		return len;
+	}
 
-		tmp = g_utf8_normalize(str, -1, G_NORMALIZE_DEFAULT);
-		g_snprintf(buf, sizeof(buf), "%s", tmp);
+	g_rec_mutex_unlock(&normalize_lock);
+
+	/* Plain ASCII is already in normal form. */
+	for (p = str; *p != '\0' && !(*p & 0x80); p++)
+		;
+
+	if (*p == '\0') {
+		len = g_strlcpy(buf, str, size);
+	} else {
+		char *tmp = g_utf8_normalize(str, -1, G_NORMALIZE_DEFAULT);
+
+		len = g_strlcpy(buf, tmp ? tmp : "", size);
 		g_free(tmp);
+	}
+
+	return len;
+}
 
-		ret = buf;
+const char *
+purple_normalize(PurpleAccount *account, const char *str)
+{
+	static char buf[BUF_LEN];
+
+	/* This should prevent a crash if purple_normalize gets called with NULL str, see #10115 */
+	g_return_val_if_fail(str != NULL, "");
+
+	purple_normalize_to_buffer(account, str, buf, sizeof(buf));
+
+	return buf;
+}
+
+const char *
+purple_normalize_intern(PurpleAccount *account, const char *str)
+{
+	PurpleNormalizeCache *cache;
+	const char *protocol_id = NULL;
+	const char *ret;
+
+	g_return_val_if_fail(str != NULL, NULL);
+
+	g_rec_mutex_lock(&normalize_lock);
+
+	if (account != NULL) {
+		protocol_id = purple_account_get_protocol_id(account);
+		cache = g_object_get_qdata(G_OBJECT(account), normalize_cache_quark());
+
+		if (cache == NULL || !purple_strequal(cache->protocol_id, protocol_id)) {
+			/* Replacing the qdata would free the old cache, so steal it. */
+			PurpleNormalizeCache *stale = g_object_steal_qdata(
+					G_OBJECT(account), normalize_cache_quark());
+
+			cache = normalize_cache_new(protocol_id);
+			cache->stale = stale;
+			g_object_set_qdata_full(G_OBJECT(account),
+					normalize_cache_quark(), cache,
+					(GDestroyNotify)normalize_cache_free);
+		}
+	} else {
+		if (normalize_cache_no_account == NULL)
+			normalize_cache_no_account = normalize_cache_new(NULL);
+		cache = normalize_cache_no_account;
 	}
 
+	ret = g_hash_table_lookup(cache->names, str);
+	if (ret == NULL) {
+		char buf[BUF_LEN];
+		char *normalized = buf;
+		gsize len;
+
+		len = purple_normalize_to_buffer(account, str, buf, sizeof(buf));
+		if (len >= sizeof(buf)) {
+			normalized = g_malloc(len + 1);
+			purple_normalize_to_buffer(account, str, normalized, len + 1);
+		}
+
+		ret = g_string_chunk_insert_const(cache->chunk, normalized);
+		g_hash_table_insert(cache->names,
+				g_string_chunk_insert_const(cache->chunk, str), (gpointer)ret);
+
+		if (normalized != buf)
+			g_free(normalized);
+	}
+
+	g_rec_mutex_unlock(&normalize_lock);
+
 	return ret;
 }
 
@@ -918,9 +918,54 @@ purple_strequal(const gchar *left, const gchar *right)
  * will lead to problems.
  *
  * Returns: A pointer to the normalized version stored in a static buffer.
+ *
+ * See also: purple_normalize_to_buffer(), purple_normalize_intern()
  */
 const char *purple_normalize(PurpleAccount *account, const char *str);
 
+/**
+ * purple_normalize_to_buffer:
+ * @account:  The account the string belongs to, or NULL if you do
+ *            not know the account.
+ * @str:      The string to normalize.
+ * @buf:      The buffer to write the normalized string to.
+ * @size:     The size of @buf.
+ *
+ * Normalizes a string like purple_normalize(), but writes the result to a
+ * caller-provided buffer.  The result is always nul-terminated, and is
+ * truncated if @buf is too small.  Unlike purple_normalize(), two calls may
+ * be nested, but protocol normalize functions often use static buffers, so
+ * this should still only be called from the main thread.
+ *
+ * Returns: The length of the normalized string.  If this is @size or more,
+ *          the result was truncated.
+ *
+ * Since: 3.0.0
+ */
+gsize purple_normalize_to_buffer(PurpleAccount *account, const char *str,
+		char *buf, gsize size);
+
+/**
+ * purple_normalize_intern:
+ * @account:  The account the string belongs to, or NULL if you do
+ *            not know the account.
+ * @str:      The string to normalize.
+ *
+ * Normalizes a string and returns an interned copy from a per-account
+ * cache, so repeated calls with the same string don't normalize it again.
+ *
+ * The cache is never trimmed, so only intern names that are kept anyway,
+ * such as those of buddy list members, and use purple_normalize() for
+ * one-off lookups.  Compare the results as strings: if the account's
+ * protocol changes, later calls intern into a new cache.
+ *
+ * Returns: The interned normalized string, which is owned by @account and
+ *          valid for as long as @account exists.
+ *
+ * Since: 3.0.0
+ */
+const char *purple_normalize_intern(PurpleAccount *account, const char *str);
+
 /**
  * purple_normalize_nocase:
  * @account:  The account the string belongs to.
@@ -33,14 +33,25 @@
 #include "util.h"
 #include "debug.h"
 
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 #define FT_INITIAL_BUFFER_SIZE 4096
 #define FT_MAX_BUFFER_SIZE     65535
 
+/* Default and lower bound of /purple/filetransfer/max_window, in KiB. */
+#define FT_DEFAULT_MAX_WINDOW  4096
+#define FT_MIN_MAX_WINDOW      64
+
 typedef struct _PurpleXferPrivate  PurpleXferPrivate;
 
 static PurpleXferUiOps *xfer_ui_ops = NULL;
 static GList *xfers;
 
+/* Largest chunk used by raw stream transfers, in bytes. */
+static gsize max_window_size = FT_DEFAULT_MAX_WINDOW * 1024;
+
 /* Private data for a file transfer */
 struct _PurpleXferPrivate {
 	PurpleXferType type;         /* The type of transfer.               */
@@ -75,6 +86,16 @@ struct _PurpleXferPrivate {
 
 	gboolean visible;            /* Hint the UI that the transfer should
 	                                be visible or not. */
+
+	gboolean raw_stream;         /* The fd carries the file contents
+	                                verbatim, so the window may grow up
+	                                to max_window_size and the data can
+	                                bypass the read/write vfuncs.       */
+	gboolean no_sendfile;        /* sendfile() failed for this transfer;
+	                                don't try it again.                 */
+	guchar *read_buffer;         /* Receive buffer reused across chunks
+	                                of a raw stream.                    */
+	gsize read_buffer_size;
 	PurpleXferUiOps *ui_ops;     /* UI-specific operations.             */
 
 	/*
@@ -118,6 +139,7 @@ enum
 	PROP_STATUS,
 	PROP_PROGRESS,
 	PROP_VISIBLE,
+	PROP_RAW_STREAM,
 	PROP_LAST
 };
 
@@ -199,6 +221,28 @@ purple_xfer_set_visible(PurpleXfer *xfer, gboolean visible)
 	g_object_notify_by_pspec(G_OBJECT(xfer), properties[PROP_VISIBLE]);
 }
 
+void
+purple_xfer_set_raw_stream(PurpleXfer *xfer, gboolean raw_stream)
+{
+	PurpleXferPrivate *priv = NULL;
+
+	g_return_if_fail(PURPLE_IS_XFER(xfer));
+
+	priv = purple_xfer_get_instance_private(xfer);
+
+	if (priv->raw_stream == raw_stream)
+		return;
+
+	priv->raw_stream = raw_stream;
+
+	if (!raw_stream) {
+		priv->current_buffer_size = MIN(priv->current_buffer_size,
+				FT_MAX_BUFFER_SIZE);
+	}
+
+	g_object_notify_by_pspec(G_OBJECT(xfer), properties[PROP_RAW_STREAM]);
+}
+
 static void
 purple_xfer_conversation_write_internal(PurpleXfer *xfer,
 	const char *message, gboolean is_error, gboolean print_thumbnail)
@@ -770,6 +814,17 @@ purple_xfer_get_visible(PurpleXfer *xfer)
 	return priv->visible;
 }
 
+gboolean
+purple_xfer_get_raw_stream(PurpleXfer *xfer)
+{
+	PurpleXferPrivate *priv = NULL;
+
+	g_return_val_if_fail(PURPLE_IS_XFER(xfer), FALSE);
+
+	priv = purple_xfer_get_instance_private(xfer);
+	return priv->raw_stream;
+}
+
 gboolean
 purple_xfer_is_cancelled(PurpleXfer *xfer)
 {
@@ -1111,9 +1166,103 @@ purple_xfer_increase_buffer_size(PurpleXfer *xfer)
 	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
 
 	priv->current_buffer_size = MIN(priv->current_buffer_size * 1.5,
-			FT_MAX_BUFFER_SIZE);
+			priv->raw_stream ? max_window_size : FT_MAX_BUFFER_SIZE);
 }
 
+/*
+ * Reads the next chunk of a raw stream into the transfer's own buffer,
+ * which is kept around for the next chunk instead of being allocated and
+ * freed every time.  The returned buffer belongs to the transfer.
+ */
+static gssize
+do_read_raw(PurpleXfer *xfer, guchar **buffer)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+	gsize s;
+	gssize r;
+
+	if (purple_xfer_get_size(xfer) == 0) {
+		s = priv->current_buffer_size;
+	} else {
+		s = MIN((gsize)purple_xfer_get_bytes_remaining(xfer),
+				priv->current_buffer_size);
+	}
+
+	if (priv->read_buffer_size < priv->current_buffer_size) {
+		g_free(priv->read_buffer);
+		priv->read_buffer_size = priv->current_buffer_size;
+		priv->read_buffer = g_malloc(priv->read_buffer_size);
+	}
+
+	*buffer = priv->read_buffer;
+
+	r = read(priv->fd, priv->read_buffer, s);
+	if (r < 0 && errno == EAGAIN) {
+		r = 0;
+	} else if (r <= 0) {
+		r = -1;
+	}
+
+	if (r >= 0 && (gsize)r == priv->current_buffer_size) {
+		purple_xfer_increase_buffer_size(xfer);
+	}
+
+	return r;
+}
+
+#ifdef HAVE_SENDFILE
+/*
+ * Sends up to @size bytes of the local file straight to the socket with
+ * sendfile(), without copying them through userspace.  Only used for raw
+ * streams that read the file through the default PurpleXfer::read-local
+ * handler.
+ *
+ * Returns the number of bytes sent, 0 if the socket would block, -1 on
+ * error, or -2 if sendfile() is not usable and the caller should fall back
+ * to reading the file itself.
+ */
+static gssize
+do_sendfile(PurpleXfer *xfer, gsize size)
+{
+	PurpleXferPrivate *priv = purple_xfer_get_instance_private(xfer);
+	off_t offset;
+	gssize r;
+
+	offset = ftello(priv->dest_fp);
+	if (offset < 0) {
+		priv->no_sendfile = TRUE;
+		return -2;
+	}
+
+	r = sendfile(priv->fd, fileno(priv->dest_fp), &offset, size);
+	if (r < 0) {
+		if (errno == EAGAIN)
+			return 0;
+
+		if (errno == EINVAL || errno == ENOSYS) {
+			purple_debug_info("xfer",
+				"sendfile() unavailable, falling back to copying\n");
+			priv->no_sendfile = TRUE;
+			return -2;
+		}
+
+		return -1;
+	}
+
+	/* Keep the stdio position in sync in case we fall back later. */
+	if (fseeko(priv->dest_fp, offset, SEEK_SET) != 0) {
+		priv->no_sendfile = TRUE;
+	}
+
+	if (r > 0) {
+		purple_xfer_set_bytes_sent(xfer,
+			purple_xfer_get_bytes_sent(xfer) + r);
+	}
+
+	return r;
+}
+#endif /* HAVE_SENDFILE */
+
 static gssize
 do_read(PurpleXfer *xfer, guchar **buffer, gsize size)
 {
@@ -1337,17 +1486,29 @@ do_transfer(PurpleXfer *xfer)
 	gssize r = 0;
 
 	if (priv->type == PURPLE_XFER_TYPE_RECEIVE) {
-		r = purple_xfer_read(xfer, &buffer);
-		if (r > 0) {
-			if (!purple_xfer_write_file(xfer, buffer, r)) {
-				g_free(buffer);
+		if (priv->raw_stream && priv->fd >= 0) {
+			/* buffer is priv->read_buffer and must not be freed. */
+			r = do_read_raw(xfer, &buffer);
+			if (r > 0) {
+				if (!purple_xfer_write_file(xfer, buffer, r))
+					return;
+			} else if (r < 0) {
+				purple_xfer_cancel_remote(xfer);
 				return;
 			}
+		} else {
+			r = purple_xfer_read(xfer, &buffer);
+			if (r > 0) {
+				if (!purple_xfer_write_file(xfer, buffer, r)) {
+					g_free(buffer);
+					return;
+				}
 
-		} else if(r < 0) {
-			purple_xfer_cancel_remote(xfer);
-			g_free(buffer);
-			return;
+			} else if(r < 0) {
+				purple_xfer_cancel_remote(xfer);
+				g_free(buffer);
+				return;
+			}
 		}
 	} else if (priv->type == PURPLE_XFER_TYPE_SEND) {
 		gssize result = 0;
@@ -1368,6 +1529,30 @@ do_transfer(PurpleXfer *xfer)
 			return;
 		}
 
+#ifdef HAVE_SENDFILE
+		if (priv->raw_stream && !priv->no_sendfile && priv->buffer == NULL &&
+				priv->dest_fp != NULL && priv->fd >= 0 &&
+				!g_signal_has_handler_pending(xfer,
+					signals[SIG_READ_LOCAL], 0, TRUE)) {
+			r = do_sendfile(xfer, s);
+			if (r == -1) {
+				purple_debug_error("xfer", "sendfile failed! %s\n",
+						g_strerror(errno));
+				purple_xfer_cancel_remote(xfer);
+				return;
+			}
+
+			if (r >= 0) {
+				if ((gsize)r == s)
+					purple_xfer_increase_buffer_size(xfer);
+				goto sent;
+			}
+
+			/* -2: fall through to the copying path below. */
+			r = 0;
+		}
+#endif /* HAVE_SENDFILE */
+
 		if (priv->buffer) {
 			existing_buffer = TRUE;
 			if (priv->buffer->len < s) {
@@ -1448,6 +1633,9 @@ do_transfer(PurpleXfer *xfer)
 		}
 	}
 
+#ifdef HAVE_SENDFILE
+sent:
+#endif
 	if (r > 0) {
 		PurpleXferClass *klass = PURPLE_XFER_GET_CLASS(xfer);
 
@@ -1455,7 +1643,8 @@ do_transfer(PurpleXfer *xfer)
 			klass->ack(xfer, buffer, r);
 	}
 
-	g_free(buffer);
+	if (buffer != priv->read_buffer)
+		g_free(buffer);
 
 	if (purple_xfer_get_bytes_sent(xfer) >= purple_xfer_get_size(xfer) &&
 			!purple_xfer_is_completed(xfer)) {
@@ -1999,6 +2188,9 @@ purple_xfer_set_property(GObject *obj, guint param_id, const GValue *value,
 		case PROP_VISIBLE:
 			purple_xfer_set_visible(xfer, g_value_get_boolean(value));
 			break;
+		case PROP_RAW_STREAM:
+			purple_xfer_set_raw_stream(xfer, g_value_get_boolean(value));
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
 			break;
@@ -2066,6 +2258,9 @@ purple_xfer_get_property(GObject *obj, guint param_id, GValue *value,
 		case PROP_VISIBLE:
 			g_value_set_boolean(value, purple_xfer_get_visible(xfer));
 			break;
+		case PROP_RAW_STREAM:
+			g_value_set_boolean(value, purple_xfer_get_raw_stream(xfer));
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
 			break;
@@ -2124,6 +2319,8 @@ purple_xfer_finalize(GObject *object)
 		g_byte_array_free(priv->buffer, TRUE);
 	}
 
+	g_free(priv->read_buffer);
+
 	g_free(priv->thumbnail_data);
 	g_free(priv->thumbnail_mimetype);
 
@@ -2243,6 +2440,11 @@ purple_xfer_class_init(PurpleXferClass *klass)
 	        "Hint for UIs whether this transfer should be visible.", FALSE,
 	        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+	properties[PROP_RAW_STREAM] = g_param_spec_boolean(
+	        "raw-stream", "Raw stream",
+	        "Whether the file descriptor carries the file contents verbatim.",
+	        FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
 	g_object_class_install_properties(obj_class, PROP_LAST, properties);
 
 	/* Signals */
@@ -2426,10 +2628,28 @@ purple_xfers_get_handle(void) {
 	return &handle;
 }
 
+static void
+max_window_pref_cb(const char *name, PurplePrefType type, gconstpointer value,
+                   gpointer data)
+{
+	max_window_size = MAX(GPOINTER_TO_INT(value), FT_MIN_MAX_WINDOW) * 1024;
+}
+
 void
 purple_xfers_init(void) {
 	void *handle = purple_xfers_get_handle();
 
+	purple_prefs_add_none("/purple/filetransfer");
+	purple_prefs_add_int("/purple/filetransfer/max_window",
+	                     FT_DEFAULT_MAX_WINDOW);
+
+	max_window_pref_cb(NULL, PURPLE_PREF_INT,
+	                   GINT_TO_POINTER(purple_prefs_get_int(
+	                           "/purple/filetransfer/max_window")),
+	                   NULL);
+	purple_prefs_connect_callback(handle, "/purple/filetransfer/max_window",
+	                              max_window_pref_cb, NULL);
+
 	/* register signals */
 	purple_signal_register(handle, "file-recv-request",
 	                     purple_marshal_VOID__POINTER, G_TYPE_NONE, 1,
@@ -2441,6 +2661,7 @@ purple_xfers_uninit(void)
 {
 	void *handle = purple_xfers_get_handle();
 
+	purple_prefs_disconnect_by_handle(handle);
 	purple_signals_disconnect_by_handle(handle);
 	purple_signals_unregister_by_instance(handle);
 }
@@ -113,7 +113,8 @@ struct _PurpleXferUiOps
  * @cancel_recv: Handler for cancelling a receiving file transfer.
  * @read: Called when reading data from the file transfer.
  * @write: Called when writing data to the file transfer.
- * @ack: Called when a file transfer is acknowledged.
+ * @ack: Called when a file transfer is acknowledged. For raw stream sends
+ *       (see purple_xfer_set_raw_stream()) the buffer may be %NULL.
  * @open_local: The vfunc for PurpleXfer::open-local. Since: 3.0.0
  * @query_local: The vfunc for PurpleXfer::query-local. Since: 3.0.0
  * @read_local: The vfunc for PurpleXfer::read-local. Since: 3.0.0
@@ -277,6 +278,19 @@ PurpleXferStatus purple_xfer_get_status(PurpleXfer *xfer);
  */
 gboolean purple_xfer_get_visible(PurpleXfer *xfer);
 
+/**
+ * purple_xfer_get_raw_stream:
+ * @xfer: The file transfer.
+ *
+ * Returns whether the transfer's file descriptor carries the file contents
+ * verbatim.  See purple_xfer_set_raw_stream().
+ *
+ * Returns: %TRUE if the transfer is a raw stream.
+ *
+ * Since: 3.0.0
+ */
+gboolean purple_xfer_get_raw_stream(PurpleXfer *xfer);
+
 /**
  * purple_xfer_is_cancelled:
  * @xfer: The file transfer.
@@ -458,6 +472,22 @@ void purple_xfer_set_status(PurpleXfer *xfer, PurpleXferStatus status);
  */
 void purple_xfer_set_visible(PurpleXfer *xfer, gboolean visible);
 
+/**
+ * purple_xfer_set_raw_stream:
+ * @xfer: The file transfer.
+ * @raw_stream: Whether the file descriptor carries the file verbatim.
+ *
+ * Marks the transfer's file descriptor as carrying the file contents
+ * verbatim, with no protocol framing.  Raw stream transfers may grow their
+ * window up to the /purple/filetransfer/max_window preference, receive
+ * into a buffer reused across chunks and, where available, send the file
+ * with sendfile().  The PurpleXferClass->read and PurpleXferClass->write
+ * vfuncs are bypassed for such transfers.
+ *
+ * Since: 3.0.0
+ */
+void purple_xfer_set_raw_stream(PurpleXfer *xfer, gboolean raw_stream);
+
 /**
  * purple_xfer_set_message:
  * @xfer:     The file transfer.
@@ -40,12 +40,32 @@
 # define NEWLINE_S "\n"
 #endif
 
+/*
+ * Nodes created with purple_xmlnode_new_pooled() and their descendants
+ * allocate the node and all of its strings from node->pool, and never free
+ * them individually; the pool owner releases them all at once.
+ */
+static gchar *
+node_strdup(PurpleMemoryPool *pool, const char *str)
+{
+	return pool ? purple_memory_pool_strdup(pool, str) : g_strdup(str);
+}
+
 static PurpleXmlNode*
-new_node(const char *name, PurpleXmlNodeType type)
+new_node(PurpleMemoryPool *pool, const char *name, PurpleXmlNodeType type)
 {
-	PurpleXmlNode *node = g_new0(PurpleXmlNode, 1);
+	PurpleXmlNode *node;
 
-	node->name = g_strdup(name);
+	if (pool != NULL) {
+		node = purple_memory_pool_alloc(pool, sizeof(PurpleXmlNode),
+				sizeof(gpointer));
+		memset(node, 0, sizeof(PurpleXmlNode));
+		node->pool = pool;
+	} else {
+		node = g_new0(PurpleXmlNode, 1);
+	}
+
+	node->name = node_strdup(pool, name);
 	node->type = type;
 
 	return node;
@@ -56,7 +76,16 @@ purple_xmlnode_new(const char *name)
 {
 	g_return_val_if_fail(name != NULL && *name != '\0', NULL);
 
-	return new_node(name, PURPLE_XMLNODE_TYPE_TAG);
+	return new_node(NULL, name, PURPLE_XMLNODE_TYPE_TAG);
+}
+
+PurpleXmlNode *
+purple_xmlnode_new_pooled(PurpleMemoryPool *pool, const char *name)
+{
+	g_return_val_if_fail(PURPLE_IS_MEMORY_POOL(pool), NULL);
+	g_return_val_if_fail(name != NULL && *name != '\0', NULL);
+
+	return new_node(pool, name, PURPLE_XMLNODE_TYPE_TAG);
 }
 
 PurpleXmlNode *
@@ -67,7 +96,7 @@ purple_xmlnode_new_child(PurpleXmlNode *parent, const char *name)
 	g_return_val_if_fail(parent != NULL, NULL);
 	g_return_val_if_fail(name != NULL && *name != '\0', NULL);
 
-	node = new_node(name, PURPLE_XMLNODE_TYPE_TAG);
+	node = new_node(parent->pool, name, PURPLE_XMLNODE_TYPE_TAG);
 
 	purple_xmlnode_insert_child(parent, node);
 
@@ -103,9 +132,14 @@ purple_xmlnode_insert_data(PurpleXmlNode *node, const char *data, gssize size)
 
 	real_size = size == -1 ? strlen(data) : (gsize)size;
 
-	child = new_node(NULL, PURPLE_XMLNODE_TYPE_DATA);
+	child = new_node(node->pool, NULL, PURPLE_XMLNODE_TYPE_DATA);
 
-	child->data = g_memdup(data, real_size);
+	if (node->pool != NULL) {
+		child->data = purple_memory_pool_alloc(node->pool, real_size, 1);
+		memcpy(child->data, data, real_size);
+	} else {
+		child->data = g_memdup(data, real_size);
+	}
 	child->data_sz = real_size;
 
 	purple_xmlnode_insert_child(node, child);
@@ -192,11 +226,11 @@ purple_xmlnode_set_attrib_full(PurpleXmlNode *node, const char *attr, const char
 	g_return_if_fail(value != NULL);
 
 	purple_xmlnode_remove_attrib_with_namespace(node, attr, xmlns);
-	attrib_node = new_node(attr, PURPLE_XMLNODE_TYPE_ATTRIB);
+	attrib_node = new_node(node->pool, attr, PURPLE_XMLNODE_TYPE_ATTRIB);
 
-	attrib_node->data = g_strdup(value);
-	attrib_node->xmlns = g_strdup(xmlns);
-	attrib_node->prefix = g_strdup(prefix);
+	attrib_node->data = node_strdup(node->pool, value);
+	attrib_node->xmlns = node_strdup(node->pool, xmlns);
+	attrib_node->prefix = node_strdup(node->pool, prefix);
 
 	purple_xmlnode_insert_child(node, attrib_node);
 }
@@ -245,14 +279,15 @@ void purple_xmlnode_set_namespace(PurpleXmlNode *node, const char *xmlns)
 	g_return_if_fail(node != NULL);
 
 	tmp = node->xmlns;
-	node->xmlns = g_strdup(xmlns);
+	node->xmlns = node_strdup(node->pool, xmlns);
 
 	if (node->namespace_map) {
 		g_hash_table_insert(node->namespace_map,
 			g_strdup(""), g_strdup(xmlns));
 	}
 
-	g_free(tmp);
+	if (node->pool == NULL)
+		g_free(tmp);
 }
 
 const char *purple_xmlnode_get_namespace(const PurpleXmlNode *node)
@@ -292,8 +327,9 @@ void purple_xmlnode_set_prefix(PurpleXmlNode *node, const char *prefix)
 {
 	g_return_if_fail(node != NULL);
 
-	g_free(node->prefix);
-	node->prefix = g_strdup(prefix);
+	if (node->pool == NULL)
+		g_free(node->prefix);
+	node->prefix = node_strdup(node->pool, prefix);
 }
 
 const char *purple_xmlnode_get_prefix(const PurpleXmlNode *node)
@@ -389,15 +425,19 @@ purple_xmlnode_free(PurpleXmlNode *node)
 		x = y;
 	}
 
+	if(node->namespace_map)
+		g_hash_table_destroy(node->namespace_map);
+
+	/* Pooled nodes are released along with their pool. */
+	if (node->pool != NULL)
+		return;
+
 	/* now dispose of ourselves */
 	g_free(node->name);
 	g_free(node->data);
 	g_free(node->xmlns);
 	g_free(node->prefix);
 
-	if(node->namespace_map)
-		g_hash_table_destroy(node->namespace_map);
-
 	g_free(node);
 }
 
@@ -892,7 +932,7 @@ purple_xmlnode_copy(const PurpleXmlNode *src)
 
 	g_return_val_if_fail(src != NULL, NULL);
 
-	ret = new_node(src->name, src->type);
+	ret = new_node(NULL, src->name, src->type);
 	ret->xmlns = g_strdup(src->xmlns);
 	if (src->data) {
 		if (src->data_sz) {
@@ -31,6 +31,8 @@
 #include <glib.h>
 #include <glib-object.h>
 
+#include "memorypool.h"
+
 #define PURPLE_TYPE_XMLNODE  (purple_xmlnode_get_type())
 
 /**
@@ -62,6 +64,8 @@ typedef enum
  * @next:          The next node or %NULL.
  * @prefix:        The namespace prefix if any.
  * @namespace_map: The namespace map.
+ * @pool:          The pool the node was allocated from, or %NULL. See
+ *                 purple_xmlnode_new_pooled(). Since: 3.0.0
  *
  * An PurpleXmlNode.
  */
@@ -79,6 +83,7 @@ struct _PurpleXmlNode
 	PurpleXmlNode *next;
 	char *prefix;
 	GHashTable *namespace_map;
+	PurpleMemoryPool *pool;
 };
 
 G_BEGIN_DECLS
@@ -100,6 +105,27 @@ GType purple_xmlnode_get_type(void);
  */
 PurpleXmlNode *purple_xmlnode_new(const char *name);
 
+/**
+ * purple_xmlnode_new_pooled:
+ * @pool: The memory pool to allocate from.
+ * @name: The name of the node.
+ *
+ * Creates a new PurpleXmlNode whose memory comes from @pool.  Children,
+ * attributes and data added to it later are allocated from @pool as well,
+ * and purple_xmlnode_free() only unlinks them; everything is released at
+ * once by purple_memory_pool_cleanup().
+ *
+ * This is meant for short-lived trees such as incoming stanzas.  The tree
+ * must be freed, and no node of it may be kept or moved into another tree,
+ * before @pool is cleaned up.  Use purple_xmlnode_copy() to get a regular
+ * copy that outlives the pool.
+ *
+ * Returns: The new node.
+ *
+ * Since: 3.0.0
+ */
+PurpleXmlNode *purple_xmlnode_new_pooled(PurpleMemoryPool *pool, const char *name);
+
 /**
  * purple_xmlnode_new_child:
  * @parent: The parent node.
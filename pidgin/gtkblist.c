@@ -153,6 +153,9 @@ static void sort_method_none(PurpleBlistNode *node, PurpleBuddyList *blist, GtkT
 static void sort_method_alphabetical(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter);
 static void sort_method_status(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter);
 static void sort_method_log_activity(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter);
+static void sort_index_remove(PurpleBlistNode *node);
+static void sort_index_flush(PurpleBlistNode *group);
+static void sort_index_flush_all(void);
 static guint sort_merge_id;
 static GtkActionGroup *sort_action_group = NULL;
 
@@ -188,8 +191,22 @@ typedef struct {
 		PurpleConversation *conv;
 		PidginBlistNodeFlags flags;
 	} conv;
+	GSequence *sort_index;      /* Groups: children in sorted order */
+	GSequenceIter *sort_entry;  /* Contacts and chats: their place in it */
 } PidginBlistNode;
 
+typedef struct {
+	PurpleBlistNode *node;
+	gchar *name_key;  /* Collation key of the case-folded alias */
+	int activity;     /* Log activity score, when sorting by it */
+	struct {          /* The priority buddy's presence, when sorting by it */
+		gboolean known;
+		gboolean online;
+		int score;
+		time_t idle_time;
+	} status;
+} PidginBlistSortEntry;
+
 /***************************************************
  *              Callbacks                          *
  ***************************************************/
@@ -631,6 +648,8 @@ chat_components_edit_ok(PurpleChat *chat, PurpleRequestFields *allfields)
 			}
 		}
 	}
+
+	purple_blist_update_chats_cache(chat);
 }
 
 static void chat_components_edit(GtkWidget *w, PurpleBlistNode *node)
@@ -2644,6 +2663,218 @@ do_alphashift(GdkPixbuf *pixbuf, int shift)
 	}
 }
 
+/*
+ * Decoded, greyed and scaled buddy icons, keyed by the icon's cache filename
+ * (a checksum of its data, worked out once when it was cached) and
+ * everything else that went into them, so contacts sharing an icon and the
+ * refresh timer's pass over the whole list don't decode it again. The
+ * least recently used are dropped past ICON_CACHE_BUDGET bytes of pixels.
+ */
+#define ICON_CACHE_BUDGET (8 * 1024 * 1024)
+
+typedef struct {
+	gchar *key;
+	GdkPixbuf *pixbuf;
+	gsize size;
+	GList *link;  /* In icon_cache_lru, most recently used first */
+} PidginBlistIconCacheEntry;
+
+static GHashTable *icon_cache = NULL;
+static GQueue icon_cache_lru = G_QUEUE_INIT;
+static gsize icon_cache_size = 0;
+static guint icon_cache_hits = 0, icon_cache_misses = 0;
+
+static void
+icon_cache_entry_free(PidginBlistIconCacheEntry *entry)
+{
+	icon_cache_size -= entry->size;
+	g_queue_delete_link(&icon_cache_lru, entry->link);
+	g_object_unref(entry->pixbuf);
+	g_free(entry->key);
+	g_free(entry);
+}
+
+static GdkPixbuf *
+icon_cache_lookup(const gchar *key)
+{
+	PidginBlistIconCacheEntry *entry;
+
+	entry = icon_cache ? g_hash_table_lookup(icon_cache, key) : NULL;
+	if (entry == NULL) {
+		icon_cache_misses++;
+		return NULL;
+	}
+
+	icon_cache_hits++;
+	g_queue_unlink(&icon_cache_lru, entry->link);
+	g_queue_push_head_link(&icon_cache_lru, entry->link);
+
+	return g_object_ref(entry->pixbuf);
+}
+
+static void
+icon_cache_insert(const gchar *key, GdkPixbuf *pixbuf)
+{
+	PidginBlistIconCacheEntry *entry;
+
+	if (icon_cache == NULL)
+		icon_cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+				(GDestroyNotify)icon_cache_entry_free);
+
+	entry = g_new0(PidginBlistIconCacheEntry, 1);
+	entry->key = g_strdup(key);
+	entry->pixbuf = g_object_ref(pixbuf);
+	entry->size = gdk_pixbuf_get_byte_length(pixbuf);
+	g_queue_push_head(&icon_cache_lru, entry);
+	entry->link = icon_cache_lru.head;
+	icon_cache_size += entry->size;
+
+	g_hash_table_replace(icon_cache, entry->key, entry);
+
+	while (icon_cache_size > ICON_CACHE_BUDGET &&
+			icon_cache_lru.tail != icon_cache_lru.head) {
+		PidginBlistIconCacheEntry *old = icon_cache_lru.tail->data;
+		g_hash_table_remove(icon_cache, old->key);
+	}
+}
+
+void
+pidgin_blist_get_icon_cache_stats(guint *hits, guint *misses, guint *icons,
+		gsize *size)
+{
+	if (hits != NULL)
+		*hits = icon_cache_hits;
+	if (misses != NULL)
+		*misses = icon_cache_misses;
+	if (icons != NULL)
+		*icons = icon_cache ? g_hash_table_size(icon_cache) : 0;
+	if (size != NULL)
+		*size = icon_cache_size;
+}
+
+static void
+icon_cache_destroy(void)
+{
+	if (icon_cache == NULL)
+		return;
+
+	purple_debug_info("gtkblist", "Buddy icon cache: %u hits, %u misses, "
+			"%u icons in %" G_GSIZE_FORMAT " bytes\n", icon_cache_hits,
+			icon_cache_misses, g_hash_table_size(icon_cache),
+			icon_cache_size);
+
+	g_hash_table_destroy(icon_cache);
+	icon_cache = NULL;
+}
+
+/*
+ * Buddy icons that aren't loaded yet are read from the cache in the
+ * background, and the buddy's row redrawn once they are. Lookups in flight
+ * are keyed like the pixbuf cache, by account and buddy name, so redraws in
+ * the meantime don't start another.
+ */
+typedef struct {
+	PurpleAccount *account;
+	gchar *name;
+	gchar *key;
+} PidginBlistIconLookup;
+
+static GHashTable *icon_lookups = NULL;
+static GCancellable *icon_lookup_cancellable = NULL;
+
+static void
+icon_lookup_free(PidginBlistIconLookup *lookup)
+{
+	g_object_unref(lookup->account);
+	g_free(lookup->name);
+	g_free(lookup->key);
+	g_free(lookup);
+}
+
+static void
+icon_lookup_done_cb(GObject *source, GAsyncResult *res, gpointer data)
+{
+	PidginBlistIconLookup *lookup = data;
+	PurpleBuddyIcon *icon;
+	GSList *buddies, *l;
+	GError *error = NULL;
+
+	icon = purple_buddy_icons_find_finish(res, &error);
+
+	/* The buddy list is gone, and icon_lookups with it. */
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_error_free(error);
+		icon_lookup_free(lookup);
+		return;
+	}
+
+	/* Already logged, and the buddy's icon setting cleared. */
+	g_clear_error(&error);
+
+	g_hash_table_remove(icon_lookups, lookup->key);
+
+	if (icon != NULL) {
+		buddies = purple_blist_find_buddies(lookup->account, lookup->name);
+		for (l = buddies; l != NULL; l = l->next) {
+			/* Only redraw rows that will find it this time. */
+			if (purple_buddy_get_icon(l->data) != NULL)
+				pidgin_blist_update(purple_blist_get_default(),
+						PURPLE_BLIST_NODE(l->data));
+		}
+		g_slist_free(buddies);
+
+		purple_buddy_icon_unref(icon);
+	}
+
+	icon_lookup_free(lookup);
+}
+
+static void
+icon_lookup_start(PurpleBuddy *buddy)
+{
+	PidginBlistIconLookup *lookup;
+	PurpleAccount *account = purple_buddy_get_account(buddy);
+	const gchar *name = purple_buddy_get_name(buddy);
+	gchar *key;
+
+	/* Nothing on disk to read. */
+	if (purple_blist_node_get_string(PURPLE_BLIST_NODE(buddy),
+			"buddy_icon") == NULL)
+		return;
+
+	key = g_strdup_printf("%p/%s", (gpointer)account, name);
+
+	if (icon_lookups == NULL) {
+		icon_lookups = g_hash_table_new_full(g_str_hash, g_str_equal,
+				g_free, NULL);
+		icon_lookup_cancellable = g_cancellable_new();
+	} else if (g_hash_table_contains(icon_lookups, key)) {
+		g_free(key);
+		return;
+	}
+
+	g_hash_table_add(icon_lookups, g_strdup(key));
+
+	lookup = g_new0(PidginBlistIconLookup, 1);
+	lookup->account = g_object_ref(account);
+	lookup->name = g_strdup(name);
+	lookup->key = key;
+
+	purple_buddy_icons_find_async(account, name, icon_lookup_cancellable,
+			icon_lookup_done_cb, lookup);
+}
+
+static void
+icon_lookups_cancel(void)
+{
+	if (icon_lookups == NULL)
+		return;
+
+	g_cancellable_cancel(icon_lookup_cancellable);
+	g_clear_object(&icon_lookup_cancellable);
+	g_hash_table_destroy(icon_lookups);
+	icon_lookups = NULL;
+}
 
 static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
                                               gboolean scaled, gboolean greyed)
@@ -2660,6 +2891,9 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	PurpleProtocol *protocol = NULL;
 	PurpleBuddyIconSpec *icon_spec = NULL;
 	gint orig_width, orig_height, scale_width, scale_height;
+	gboolean offline = FALSE, idle = FALSE;
+	const gchar *filename;
+	gchar *checksum = NULL, *key;
 
 	if (PURPLE_IS_CONTACT(node)) {
 		buddy = purple_contact_get_priority_buddy((PurpleContact*)node);
@@ -2706,9 +2940,13 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 
 	if (data == NULL) {
 		if (buddy) {
-			/* Not sure I like this...*/
-			if (!(icon = purple_buddy_icons_find(purple_buddy_get_account(buddy), purple_buddy_get_name(buddy))))
+			/* Without blocking on the disk; the row is redrawn once
+			 * the icon has been read. */
+			if (!(icon = purple_buddy_get_icon(buddy))) {
+				icon_lookup_start(buddy);
 				return NULL;
+			}
+			purple_buddy_icon_ref(icon);
 			data = purple_buddy_icon_get_data(icon, &len);
 		}
 
@@ -2716,6 +2954,47 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 			return NULL;
 	}
 
+	if (greyed) {
+		if (buddy) {
+			PurplePresence *presence = purple_buddy_get_presence(buddy);
+			if (!PURPLE_BUDDY_IS_ONLINE(buddy))
+				offline = TRUE;
+			if (purple_presence_is_idle(presence))
+				idle = TRUE;
+		} else if (group) {
+			if (purple_counting_node_get_online_count(PURPLE_COUNTING_NODE(group)) == 0)
+				offline = TRUE;
+		}
+	}
+
+	if (protocol)
+		icon_spec = purple_protocol_get_icon_spec(protocol);
+	if (icon_spec && !(icon_spec->scale_rules & PURPLE_ICON_SCALE_DISPLAY))
+		icon_spec = NULL;
+
+	/* Both filenames are checksums of the data, so neither has to be
+	 * worked out again here. */
+	if (icon == NULL) {
+		filename = purple_image_generate_filename(custom_img);
+	} else {
+		filename = purple_blist_node_get_string(PURPLE_BLIST_NODE(buddy),
+				"buddy_icon");
+		/* Not cached to disk, so there's nothing to go by but the data */
+		if (filename == NULL)
+			filename = checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1, data, len);
+	}
+	key = g_strdup_printf("%s/%d/%d/%d/%p", filename, scaled, offline, idle,
+			(gpointer)icon_spec);
+	g_free(checksum);
+
+	if ((ret = icon_cache_lookup(key)) != NULL) {
+		purple_buddy_icon_unref(icon);
+		if (custom_img)
+			g_object_unref(custom_img);
+		g_free(key);
+		return ret;
+	}
+
 	buf = pidgin_pixbuf_from_data(data, len);
 	purple_buddy_icon_unref(icon);
 	if (!buf) {
@@ -2727,42 +3006,25 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 			custom_img ? purple_image_get_data_size(custom_img) : 0);
 		if (custom_img)
 			g_object_unref(custom_img);
+		g_free(key);
 		return NULL;
 	}
 	if (custom_img)
 		g_object_unref(custom_img);
 
-	if (greyed) {
-		gboolean offline = FALSE, idle = FALSE;
-
-		if (buddy) {
-			PurplePresence *presence = purple_buddy_get_presence(buddy);
-			if (!PURPLE_BUDDY_IS_ONLINE(buddy))
-				offline = TRUE;
-			if (purple_presence_is_idle(presence))
-				idle = TRUE;
-		} else if (group) {
-			if (purple_counting_node_get_online_count(PURPLE_COUNTING_NODE(group)) == 0)
-				offline = TRUE;
-		}
-
-		if (offline)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.0, FALSE);
+	if (offline)
+		gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.0, FALSE);
 
-		if (idle)
-			gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.25, FALSE);
-	}
+	if (idle)
+		gdk_pixbuf_saturate_and_pixelate(buf, buf, 0.25, FALSE);
 
 	/* I'd use the pidgin_buddy_icon_get_scale_size() thing, but it won't
 	 * tell me the original size, which I need for scaling purposes. */
 	scale_width = orig_width = gdk_pixbuf_get_width(buf);
 	scale_height = orig_height = gdk_pixbuf_get_height(buf);
 
-	if (protocol)
-		icon_spec = purple_protocol_get_icon_spec(protocol);
-
-	if (icon_spec && icon_spec->scale_rules & PURPLE_ICON_SCALE_DISPLAY)
-		purple_buddy_icon_spec_get_scaled_size(purple_protocol_get_icon_spec(protocol), &scale_width, &scale_height);
+	if (icon_spec)
+		purple_buddy_icon_spec_get_scaled_size(icon_spec, &scale_width, &scale_height);
 
 	if (scaled || scale_height > 200 || scale_width > 200) {
 		GdkPixbuf *tmpbuf;
@@ -2790,6 +3052,10 @@ static GdkPixbuf *pidgin_blist_get_buddy_icon(PurpleBlistNode *node,
 	}
 	g_object_unref(G_OBJECT(buf));
 
+	/* Callers get a shared reference; copy before changing it. */
+	icon_cache_insert(key, ret);
+	g_free(key);
+
 	return ret;
 }
 
@@ -4520,6 +4786,10 @@ static void pidgin_blist_hide_node(PurpleBuddyList *list, PurpleBlistNode *node,
 	PidginBlistNode *gtknode = purple_blist_node_get_ui_data(node);
 	GtkTreeIter iter;
 
+	sort_index_remove(node);
+	if (PURPLE_IS_GROUP(node))
+		sort_index_flush(node);
+
 	if (!gtknode || !gtknode->row || !gtkblist)
 		return;
 
@@ -4815,6 +5085,29 @@ conversation_created_cb(PurpleConversation *conv, PidginBuddyList *gtkblist)
 	}
 }
 
+/* Log sizes are filled in by a background scan, so a contact sorted by log
+ * activity may have been placed with a stale score.  Re-sort it once the
+ * real numbers are in. */
+static void
+log_index_updated_cb(PurpleAccount *account, const char *name,
+		PurpleLogType type, PurpleBuddyList *list)
+{
+	GSList *buddies;
+
+	if (type != PURPLE_LOG_IM || current_sort_method == NULL ||
+			current_sort_method->func != sort_method_log_activity)
+		return;
+
+	buddies = purple_blist_find_buddies(account, name);
+	while (buddies) {
+		PurpleBlistNode *buddy = buddies->data;
+		buddies = g_slist_delete_link(buddies, buddies);
+
+		if (purple_blist_node_get_ui_data(buddy->parent) != NULL)
+			pidgin_blist_update_contact(list, buddy);
+	}
+}
+
 /**********************************************************************************
  * Public API Functions                                                           *
  **********************************************************************************/
@@ -4903,6 +5196,18 @@ static void _prefs_change_sort_method(const char *pref_name, PurplePrefType type
 		pidgin_blist_sort_method_set(val);
 }
 
+/* The status order's indexes were ranked with the old scores */
+static void _prefs_change_status_scores(const char *pref_name, PurplePrefType type,
+									   gconstpointer val, gpointer data)
+{
+	if (current_sort_method == NULL ||
+			current_sort_method->func != sort_method_status)
+		return;
+
+	sort_index_flush_all();
+	redo_buddy_list(purple_blist_get_default(), FALSE, FALSE);
+}
+
 static gboolean pidgin_blist_select_notebook_page_cb(gpointer user_data)
 {
 	PidginBuddyList *gtkblist = (PidginBuddyList *)user_data;
@@ -6028,6 +6333,8 @@ static void pidgin_blist_show(PurpleBuddyList *list)
 	/* sorting */
 	purple_prefs_connect_callback(handle, PIDGIN_PREFS_ROOT "/blist/sort_type",
 			_prefs_change_sort_method, NULL);
+	purple_prefs_connect_callback(handle, "/purple/status/scores",
+			_prefs_change_status_scores, NULL);
 
 	/* menus */
 	purple_prefs_connect_callback(handle, PIDGIN_PREFS_ROOT "/sound/mute",
@@ -6083,6 +6390,10 @@ static void pidgin_blist_show(PurpleBuddyList *list)
 	                      PURPLE_CALLBACK(conversation_created_cb),
 	                      gtkblist);
 
+	handle = purple_log_get_handle();
+	purple_signal_connect(handle, "log-index-updated", gtkblist,
+	                      PURPLE_CALLBACK(log_index_updated_cb), list);
+
 	gtk_widget_hide(gtkblist->headline);
 
 	show_initial_account_errors(gtkblist);
@@ -6252,18 +6563,19 @@ static gboolean insert_node(PurpleBuddyList *list, PurpleBlistNode *node, GtkTre
 	if(get_iter_from_node(node, &cur))
 		curptr = &cur;
 
+	/* The sort methods keep their index in here */
+	if(gtknode == NULL) {
+		pidgin_blist_new_node(list, node);
+		gtknode = purple_blist_node_get_ui_data(node);
+	}
+
 	if(PURPLE_IS_CONTACT(node) || PURPLE_IS_CHAT(node)) {
 		current_sort_method->func(node, list, parent_iter, curptr, iter);
 	} else {
 		sort_method_none(node, list, parent_iter, curptr, iter);
 	}
 
-	if(gtknode != NULL) {
-		gtk_tree_row_reference_free(gtknode->row);
-	} else {
-		pidgin_blist_new_node(list, node);
-		gtknode = purple_blist_node_get_ui_data(node);
-	}
+	gtk_tree_row_reference_free(gtknode->row);
 
 	newpath = gtk_tree_model_get_path(GTK_TREE_MODEL(gtkblist->treemodel),
 			iter);
@@ -6495,6 +6807,10 @@ static void buddy_node(PurpleBuddy *buddy, GtkTreeIter *iter, PurpleBlistNode *n
 		g_object_ref(G_OBJECT(gtkblist->empty_avatar));
 		avatar = gtkblist->empty_avatar;
 	} else if ((!PURPLE_BUDDY_IS_ONLINE(buddy) || purple_presence_is_idle(presence))) {
+		/* The icon is shared with the icon cache */
+		GdkPixbuf *faded = gdk_pixbuf_copy(avatar);
+		g_object_unref(avatar);
+		avatar = faded;
 		do_alphashift(avatar, 77);
 	}
 
@@ -7492,6 +7808,8 @@ void pidgin_blist_init(void)
 void
 pidgin_blist_uninit(void) {
 	g_hash_table_destroy(cached_emblems);
+	icon_lookups_cancel();
+	icon_cache_destroy();
 
 	purple_signals_unregister_by_instance(pidgin_blist_get_handle());
 	purple_signals_disconnect_by_handle(pidgin_blist_get_handle());
@@ -7628,6 +7946,9 @@ void pidgin_blist_sort_method_set(const char *id){
 		pidgin_blist_sort_method_set("none");
 		return;
 	}
+
+	/* The indexes are ordered for the old method */
+	sort_index_flush_all();
 	if (purple_strequal(id, "none")) {
 		redo_buddy_list(purple_blist_get_default(), TRUE, FALSE);
 	} else {
@@ -7658,233 +7979,282 @@ static void sort_method_none(PurpleBlistNode *node, PurpleBuddyList *blist, GtkT
 			sibling ? &sibling_iter : NULL);
 }
 
-static void sort_method_alphabetical(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+/*
+ * The sorted methods keep each group's contacts and chats in a GSequence,
+ * ordered the same as the group's rows, so a node's place is found with a
+ * binary search instead of by comparing it to every sibling. The keys are
+ * worked out once per insert, not once per comparison.
+ */
+static void
+sort_entry_free(PidginBlistSortEntry *entry)
 {
-	GtkTreeIter more_z;
+	g_free(entry->name_key);
+	g_free(entry);
+}
 
-	const char *my_name;
+static gchar *
+sort_name_key(PurpleBlistNode *node)
+{
+	const char *name;
+	gchar *folded, *key;
 
-	if(PURPLE_IS_CONTACT(node)) {
-		my_name = purple_contact_get_alias((PurpleContact*)node);
-	} else if(PURPLE_IS_CHAT(node)) {
-		my_name = purple_chat_get_name((PurpleChat*)node);
-	} else {
-		sort_method_none(node, blist, groupiter, cur, iter);
-		return;
-	}
+	if (PURPLE_IS_CONTACT(node))
+		name = purple_contact_get_alias((PurpleContact*)node);
+	else
+		name = purple_chat_get_name((PurpleChat*)node);
 
-	if (!gtk_tree_model_iter_children(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, &groupiter)) {
-		gtk_tree_store_insert(gtkblist->treemodel, iter, &groupiter, 0);
-		return;
-	}
+	if (name == NULL || !g_utf8_validate(name, -1, NULL))
+		return g_strdup("");
 
-	do {
-		PurpleBlistNode *n;
-		const char *this_name;
-		int cmp;
+	folded = g_utf8_casefold(name, -1);
+	key = g_utf8_collate_key(folded, -1);
+	g_free(folded);
 
-		gtk_tree_model_get(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, NODE_COLUMN, &n, -1);
+	return key;
+}
 
-		if(PURPLE_IS_CONTACT(n)) {
-			this_name = purple_contact_get_alias((PurpleContact*)n);
-		} else if(PURPLE_IS_CHAT(n)) {
-			this_name = purple_chat_get_name((PurpleChat*)n);
-		} else {
-			this_name = NULL;
-		}
+static int
+sort_log_activity(PurpleBlistNode *node)
+{
+	PurpleBlistNode *n;
+	int score = 0;
 
-		cmp = purple_utf8_strcasecmp(my_name, this_name);
+	for (n = node->child; n; n = n->next) {
+		PurpleBuddy *buddy = (PurpleBuddy*)n;
+		score += purple_log_get_activity_score(PURPLE_LOG_IM, purple_buddy_get_name(buddy), purple_buddy_get_account(buddy));
+	}
 
-		if(this_name && (cmp < 0 || (cmp == 0 && node < n))) {
-			if(cur) {
-				gtk_tree_store_move_before(gtkblist->treemodel, cur, &more_z);
-				*iter = *cur;
-				return;
-			} else {
-				gtk_tree_store_insert_before(gtkblist->treemodel, iter,
-						&groupiter, &more_z);
-				return;
-			}
-		}
-	} while (gtk_tree_model_iter_next (GTK_TREE_MODEL(gtkblist->treemodel), &more_z));
+	return score;
+}
 
-	if(cur) {
-		gtk_tree_store_move_before(gtkblist->treemodel, cur, NULL);
-		*iter = *cur;
-		return;
-	} else {
-		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
+static void
+sort_index_remove(PurpleBlistNode *node)
+{
+	PidginBlistNode *gtknode = purple_blist_node_get_ui_data(node);
+
+	if (gtknode == NULL || gtknode->sort_entry == NULL)
 		return;
-	}
+
+	g_sequence_remove(gtknode->sort_entry);
+	gtknode->sort_entry = NULL;
 }
 
-static void sort_method_status(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+static void
+sort_index_flush(PurpleBlistNode *group)
 {
-	GtkTreeIter more_z;
+	PidginBlistNode *gtkgroup = purple_blist_node_get_ui_data(group);
+	GSequenceIter *si;
 
-	PurpleBuddy *my_buddy, *this_buddy;
+	if (gtkgroup == NULL || gtkgroup->sort_index == NULL)
+		return;
 
-	if(PURPLE_IS_CONTACT(node)) {
-		my_buddy = purple_contact_get_priority_buddy((PurpleContact*)node);
-	} else if(PURPLE_IS_CHAT(node)) {
-		if (cur != NULL) {
-			*iter = *cur;
-			return;
-		}
+	for (si = g_sequence_get_begin_iter(gtkgroup->sort_index);
+			!g_sequence_iter_is_end(si); si = g_sequence_iter_next(si)) {
+		PidginBlistSortEntry *entry = g_sequence_get(si);
+		PidginBlistNode *gtknode = purple_blist_node_get_ui_data(entry->node);
 
-		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
-		return;
-	} else {
-		sort_method_alphabetical(node, blist, groupiter, cur, iter);
-		return;
+		if (gtknode != NULL)
+			gtknode->sort_entry = NULL;
 	}
 
+	g_sequence_free(gtkgroup->sort_index);
+	gtkgroup->sort_index = NULL;
+}
 
-	if (!gtk_tree_model_iter_children(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, &groupiter)) {
-		gtk_tree_store_insert(gtkblist->treemodel, iter, &groupiter, 0);
-		return;
+static void
+sort_index_flush_all(void)
+{
+	PurpleBlistNode *gnode;
+
+	for (gnode = purple_blist_get_root(purple_blist_get_default());
+			gnode != NULL; gnode = gnode->next) {
+		if (PURPLE_IS_GROUP(gnode))
+			sort_index_flush(gnode);
 	}
+}
 
-	do {
-		PurpleBlistNode *n;
-		gint name_cmp;
-		gint presence_cmp;
+/* Chats sort after contacts in the status and log activity orders */
+static int
+sort_compare_chats_last(PurpleBlistNode *a, PurpleBlistNode *b)
+{
+	if (PURPLE_IS_CHAT(a) && !PURPLE_IS_CHAT(b))
+		return 1;
+	if (!PURPLE_IS_CHAT(a) && PURPLE_IS_CHAT(b))
+		return -1;
 
-		gtk_tree_model_get(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, NODE_COLUMN, &n, -1);
+	return 0;
+}
 
-		if(PURPLE_IS_CONTACT(n)) {
-			this_buddy = purple_contact_get_priority_buddy((PurpleContact*)n);
-		} else {
-			this_buddy = NULL;
-		}
+static gint
+sort_compare_alphabetical(gconstpointer a, gconstpointer b, gpointer data)
+{
+	const PidginBlistSortEntry *entry_a = a, *entry_b = b;
+	int cmp;
 
-		name_cmp = purple_utf8_strcasecmp(
-			purple_contact_get_alias(purple_buddy_get_contact(my_buddy)),
-			(this_buddy
-			 ? purple_contact_get_alias(purple_buddy_get_contact(this_buddy))
-			 : NULL));
+	cmp = strcmp(entry_a->name_key, entry_b->name_key);
+	if (cmp != 0)
+		return cmp;
 
-		presence_cmp = purple_buddy_presence_compare(
-			PURPLE_BUDDY_PRESENCE(purple_buddy_get_presence(my_buddy)),
-			this_buddy ? PURPLE_BUDDY_PRESENCE(purple_buddy_get_presence(this_buddy)) : NULL);
+	return (entry_a->node < entry_b->node) ? -1 : (entry_a->node > entry_b->node);
+}
 
-		if (this_buddy == NULL ||
-			(presence_cmp < 0 ||
-			 (presence_cmp == 0 &&
-			  (name_cmp < 0 || (name_cmp == 0 && node < n)))))
-		{
-			if (cur != NULL)
-			{
-				gtk_tree_store_move_before(gtkblist->treemodel, cur, &more_z);
-				*iter = *cur;
-				return;
-			}
-			else
-			{
-				gtk_tree_store_insert_before(gtkblist->treemodel, iter,
-											 &groupiter, &more_z);
-				return;
-			}
-		}
-	}
-	while (gtk_tree_model_iter_next(GTK_TREE_MODEL(gtkblist->treemodel),
-									&more_z));
+/* Statuses change while their contacts are in the index, so the index has
+ * to be ordered by what they were when each contact went in.  The order is
+ * that of purple_buddy_presence_compare(). */
+static void
+sort_status_rank(PurpleBlistNode *node, PidginBlistSortEntry *entry)
+{
+	PurpleBuddy *buddy = purple_contact_get_priority_buddy((PurpleContact*)node);
+	PurpleBuddyPresence *presence;
 
-	if (cur) {
-		gtk_tree_store_move_before(gtkblist->treemodel, cur, NULL);
-		*iter = *cur;
+	if (buddy == NULL)
 		return;
-	} else {
-		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
-		return;
-	}
+
+	presence = PURPLE_BUDDY_PRESENCE(purple_buddy_get_presence(buddy));
+	entry->status.known = TRUE;
+	entry->status.online = purple_presence_is_online(PURPLE_PRESENCE(presence));
+	entry->status.score = purple_buddy_presence_compute_score(presence);
+	entry->status.idle_time = purple_presence_get_idle_time(PURPLE_PRESENCE(presence));
 }
 
-static void sort_method_log_activity(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+static gint
+sort_compare_status(gconstpointer a, gconstpointer b, gpointer data)
 {
-	GtkTreeIter more_z;
+	const PidginBlistSortEntry *entry_a = a, *entry_b = b;
+	int idle_time_score = GPOINTER_TO_INT(data);
+	int cmp, score_a, score_b;
 
-	int activity_score = 0, this_log_activity_score = 0;
-	const char *buddy_name, *this_buddy_name;
+	cmp = sort_compare_chats_last(entry_a->node, entry_b->node);
+	if (cmp != 0)
+		return cmp;
 
-	if(cur && (gtk_tree_model_iter_n_children(GTK_TREE_MODEL(gtkblist->treemodel), &groupiter) == 1)) {
-		*iter = *cur;
-		return;
-	}
+	if (PURPLE_IS_CONTACT(entry_a->node) &&
+			(entry_a->status.known || entry_b->status.known)) {
+		if (!entry_a->status.known)
+			return 1;
+		if (!entry_b->status.known)
+			return -1;
 
-	if(PURPLE_IS_CONTACT(node)) {
-		PurpleBlistNode *n;
-		PurpleBuddy *buddy;
-		for (n = node->child; n; n = n->next) {
-			buddy = (PurpleBuddy*)n;
-			activity_score += purple_log_get_activity_score(PURPLE_LOG_IM, purple_buddy_get_name(buddy), purple_buddy_get_account(buddy));
-		}
-		buddy_name = purple_contact_get_alias((PurpleContact*)node);
-	} else if(PURPLE_IS_CHAT(node)) {
-		/* we don't have a reliable way of getting the log filename
-		 * from the chat info in the blist, yet */
-		if (cur != NULL) {
-			*iter = *cur;
-			return;
-		}
+		if (entry_a->status.online != entry_b->status.online)
+			return entry_a->status.online ? -1 : 1;
 
-		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
-		return;
-	} else {
-		sort_method_none(node, blist, groupiter, cur, iter);
-		return;
+		/* The one that went idle later, if either, gets the idle time
+		 * score */
+		score_a = entry_a->status.score;
+		score_b = entry_b->status.score;
+		if (entry_a->status.idle_time < entry_b->status.idle_time)
+			score_a += idle_time_score;
+		else if (entry_a->status.idle_time > entry_b->status.idle_time)
+			score_b += idle_time_score;
+
+		if (score_a != score_b)
+			return (score_a > score_b) ? -1 : 1;
 	}
 
+	return sort_compare_alphabetical(a, b, data);
+}
 
-	if (!gtk_tree_model_iter_children(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, &groupiter)) {
-		gtk_tree_store_insert(gtkblist->treemodel, iter, &groupiter, 0);
-		return;
-	}
+static gint
+sort_compare_log_activity(gconstpointer a, gconstpointer b, gpointer data)
+{
+	const PidginBlistSortEntry *entry_a = a, *entry_b = b;
+	int cmp;
 
-	do {
-		PurpleBlistNode *n;
-		PurpleBlistNode *n2;
-		PurpleBuddy *buddy;
-		int cmp;
+	cmp = sort_compare_chats_last(entry_a->node, entry_b->node);
+	if (cmp != 0)
+		return cmp;
 
-		gtk_tree_model_get(GTK_TREE_MODEL(gtkblist->treemodel), &more_z, NODE_COLUMN, &n, -1);
-		this_log_activity_score = 0;
+	if (entry_a->activity != entry_b->activity)
+		return (entry_a->activity > entry_b->activity) ? -1 : 1;
 
-		if(PURPLE_IS_CONTACT(n)) {
-			for (n2 = n->child; n2; n2 = n2->next) {
-				buddy = (PurpleBuddy*)n2;
-				this_log_activity_score += purple_log_get_activity_score(PURPLE_LOG_IM, purple_buddy_get_name(buddy), purple_buddy_get_account(buddy));
-			}
-			this_buddy_name = purple_contact_get_alias((PurpleContact*)n);
-		} else {
-			this_buddy_name = NULL;
-		}
+	return sort_compare_alphabetical(a, b, data);
+}
+
+static void
+sort_index_insert(PurpleBlistNode *node, GtkTreeIter groupiter,
+		GtkTreeIter *cur, GtkTreeIter *iter, GCompareDataFunc compare)
+{
+	PidginBlistNode *gtkgroup = purple_blist_node_get_ui_data(node->parent);
+	PidginBlistNode *gtknode = purple_blist_node_get_ui_data(node);
+	PidginBlistSortEntry *entry;
+	GSequenceIter *si;
+	GtkTreeIter next_iter;
+	gpointer compare_data = NULL;
+	gboolean found = FALSE;
+
+	sort_index_remove(node);
+
+	if (gtkgroup->sort_index == NULL)
+		gtkgroup->sort_index = g_sequence_new((GDestroyNotify)sort_entry_free);
+
+	entry = g_new0(PidginBlistSortEntry, 1);
+	entry->node = node;
+	entry->name_key = sort_name_key(node);
+	if (compare == sort_compare_log_activity && PURPLE_IS_CONTACT(node)) {
+		entry->activity = sort_log_activity(node);
+	} else if (compare == sort_compare_status) {
+		if (PURPLE_IS_CONTACT(node))
+			sort_status_rank(node, entry);
+		compare_data = GINT_TO_POINTER(purple_prefs_get_int("/purple/status/scores/idle_time"));
+	}
 
-		cmp = purple_utf8_strcasecmp(buddy_name, this_buddy_name);
+	gtknode->sort_entry = g_sequence_insert_sorted(gtkgroup->sort_index,
+			entry, compare, compare_data);
 
-		if (!PURPLE_IS_CONTACT(n) || activity_score > this_log_activity_score ||
-				((activity_score == this_log_activity_score) &&
-				 (cmp < 0 || (cmp == 0 && node < n)))) {
-			if (cur != NULL) {
-				gtk_tree_store_move_before(gtkblist->treemodel, cur, &more_z);
-				*iter = *cur;
-				return;
-			} else {
-				gtk_tree_store_insert_before(gtkblist->treemodel, iter,
-						&groupiter, &more_z);
-				return;
-			}
+	/* Go in front of the next sibling in the index that has a row */
+	for (si = g_sequence_iter_next(gtknode->sort_entry);
+			!g_sequence_iter_is_end(si); si = g_sequence_iter_next(si)) {
+		PidginBlistSortEntry *next = g_sequence_get(si);
+
+		if (get_iter_from_node(next->node, &next_iter)) {
+			found = TRUE;
+			break;
 		}
-	} while (gtk_tree_model_iter_next (GTK_TREE_MODEL(gtkblist->treemodel), &more_z));
+	}
 
 	if (cur != NULL) {
-		gtk_tree_store_move_before(gtkblist->treemodel, cur, NULL);
+		gtk_tree_store_move_before(gtkblist->treemodel, cur,
+				found ? &next_iter : NULL);
 		*iter = *cur;
-		return;
+	} else if (found) {
+		gtk_tree_store_insert_before(gtkblist->treemodel, iter,
+				&groupiter, &next_iter);
 	} else {
 		gtk_tree_store_append(gtkblist->treemodel, iter, &groupiter);
+	}
+}
+
+static void sort_method_alphabetical(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+{
+	if(!PURPLE_IS_CONTACT(node) && !PURPLE_IS_CHAT(node)) {
+		sort_method_none(node, blist, groupiter, cur, iter);
+		return;
+	}
+
+	sort_index_insert(node, groupiter, cur, iter,
+			sort_compare_alphabetical);
+}
+
+static void sort_method_status(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+{
+	if(!PURPLE_IS_CONTACT(node) && !PURPLE_IS_CHAT(node)) {
+		sort_method_none(node, blist, groupiter, cur, iter);
 		return;
 	}
+
+	sort_index_insert(node, groupiter, cur, iter,
+			sort_compare_status);
+}
+
+static void sort_method_log_activity(PurpleBlistNode *node, PurpleBuddyList *blist, GtkTreeIter groupiter, GtkTreeIter *cur, GtkTreeIter *iter)
+{
+	if(!PURPLE_IS_CONTACT(node) && !PURPLE_IS_CHAT(node)) {
+		sort_method_none(node, blist, groupiter, cur, iter);
+		return;
+	}
+
+	sort_index_insert(node, groupiter, cur, iter,
+			sort_compare_log_activity);
 }
 
 static void
@@ -234,6 +234,21 @@ void pidgin_blist_update_refresh_timeout(void);
 GdkPixbuf *
 pidgin_blist_get_emblem(PurpleBlistNode *node);
 
+/**
+ * pidgin_blist_get_icon_cache_stats:
+ * @hits:   (out) (optional): Return location for the number of buddy icons
+ *          found already decoded and scaled.
+ * @misses: (out) (optional): Return location for the number that had to be
+ *          decoded.
+ * @icons:  (out) (optional): Return location for the number of icons cached.
+ * @size:   (out) (optional): Return location for the bytes of pixels they
+ *          take up.
+ *
+ * Gets how well the buddy list's cache of decoded buddy icons is doing.
+ */
+void pidgin_blist_get_icon_cache_stats(guint *hits, guint *misses,
+		guint *icons, gsize *size);
+
 /**
  * pidgin_blist_get_status_icon:
  *
@@ -108,6 +108,9 @@ struct _PidginChatPane
 
 #define CLOSE_CONV_TIMEOUT_SECS  (10 * 60)
 
+/* Add batches of chat users at least this big with the list detached */
+#define CHAT_USERS_DETACH_THRESHOLD 100
+
 #define AUTO_RESPONSE "&lt;AUTO-REPLY&gt; : "
 
 typedef enum
@@ -3682,15 +3685,14 @@ deleting_chat_user_cb(PurpleChatUser *cb)
 }
 
 static void
-add_chat_user_common(PurpleChatConversation *chat, PurpleChatUser *cb, const char *old_name)
+add_chat_user_to_store(PurpleChatConversation *chat, PurpleChatUser *cb,
+                       const char *old_name, GtkListStore *ls)
 {
 	PidginConversation *gtkconv;
 	PurpleConversation *conv;
-	PidginChatPane *gtkchat;
 	PurpleConnection *gc;
 	PurpleProtocol *protocol;
 	GtkTreeModel *tm;
-	GtkListStore *ls;
 	GtkTreePath *newpath;
 	const char *stock;
 	GtkTreeIter iter;
@@ -3707,14 +3709,12 @@ add_chat_user_common(PurpleChatConversation *chat, PurpleChatUser *cb, const cha
 
 	conv    = PURPLE_CONVERSATION(chat);
 	gtkconv = PIDGIN_CONVERSATION(conv);
-	gtkchat = gtkconv->u.chat;
 	gc      = purple_conversation_get_connection(conv);
 
 	if (!gc || !(protocol = purple_connection_get_protocol(gc)))
 		return;
 
-	tm = gtk_tree_view_get_model(GTK_TREE_VIEW(gtkchat->list));
-	ls = GTK_LIST_STORE(tm);
+	tm = GTK_TREE_MODEL(ls);
 
 	stock = get_chat_user_status_icon(chat, name, flags);
 
@@ -3778,6 +3778,16 @@ add_chat_user_common(PurpleChatConversation *chat, PurpleChatUser *cb, const cha
 	g_free(alias_key);
 }
 
+static void
+add_chat_user_common(PurpleChatConversation *chat, PurpleChatUser *cb, const char *old_name)
+{
+	PidginConversation *gtkconv = PIDGIN_CONVERSATION(PURPLE_CONVERSATION(chat));
+	GtkTreeModel *tm;
+
+	tm = gtk_tree_view_get_model(GTK_TREE_VIEW(gtkconv->u.chat->list));
+	add_chat_user_to_store(chat, cb, old_name, GTK_LIST_STORE(tm));
+}
+
 static void topic_callback(GtkWidget *w, PidginConversation *gtkconv)
 {
 	PurpleProtocol *protocol = NULL;
@@ -4983,6 +4993,7 @@ pidgin_conv_chat_add_users(PurpleChatConversation *chat, GList *cbuddies, gboole
 	PidginChatPane *gtkchat;
 	GtkListStore *ls;
 	GList *l;
+	gboolean detach;
 
 	char tmp[BUF_LONG];
 	int num_users;
@@ -5001,12 +5012,21 @@ pidgin_conv_chat_add_users(PurpleChatConversation *chat, GList *cbuddies, gboole
 
 	ls = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(gtkchat->list)));
 
+	/* For a big batch, like the names list of a busy room, fill the store
+	 * while it's detached so the view doesn't do its work once per row.
+	 * Detaching loses the scroll position, so small batches don't. */
+	detach = (g_list_nth(cbuddies, CHAT_USERS_DETACH_THRESHOLD) != NULL);
+	if (detach) {
+		g_object_ref(ls);
+		gtk_tree_view_set_model(GTK_TREE_VIEW(gtkchat->list), NULL);
+	}
+
 	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(ls),  GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID,
 										 GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID);
 
 	l = cbuddies;
 	while (l != NULL) {
-		add_chat_user_common(chat, (PurpleChatUser *)l->data, NULL);
+		add_chat_user_to_store(chat, (PurpleChatUser *)l->data, NULL, ls);
 		l = l->next;
 	}
 
@@ -5015,6 +5035,11 @@ pidgin_conv_chat_add_users(PurpleChatConversation *chat, GList *cbuddies, gboole
 	 */
 	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(ls),  CHAT_USERS_ALIAS_KEY_COLUMN,
 										 GTK_SORT_ASCENDING);
+
+	if (detach) {
+		gtk_tree_view_set_model(GTK_TREE_VIEW(gtkchat->list), GTK_TREE_MODEL(ls));
+		g_object_unref(ls);
+	}
 }
 
 static void